@@ -0,0 +1,462 @@
+#include "AdapterSelection.hpp"
+#include "GpuMemory.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct Preference
+{
+	const char* name;
+	WGPUPowerPreference power;
+	bool fallback;
+};
+
+constexpr Preference kPreferences[] = {
+	{"high-performance", WGPUPowerPreference_HighPerformance, false},
+	{"low-power", WGPUPowerPreference_LowPower, false},
+	{"fallback", WGPUPowerPreference_Undefined, true},
+};
+
+constexpr const char* kOverrideVariable = "WEBGPU_ADAPTER";
+
+WgpuAdapterPtr RequestAdapter(GpuEvents& events, WGPUSurface compatibleSurface, const Preference& preference)
+{
+	WGPURequestAdapterOptions options{};
+	options.powerPreference = preference.power;
+	options.forceFallbackAdapter = preference.fallback;
+	options.compatibleSurface = compatibleSurface;
+
+	GpuRequest<WGPUAdapter> request = events.RequestAdapter(&options);
+	events.Wait(request);
+	return WgpuAdapterPtr(request.Result(), wgpuAdapterRelease);
+}
+
+#if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
+
+struct Candidate
+{
+	WgpuAdapterPtr adapter{nullptr, wgpuAdapterRelease};
+	std::vector<const char*> preferences;  // Names of the preferences that returned it
+	std::string name;
+	std::string identity;                  // Stable across runs: backend, vendor, device and name
+	double capability = 0;
+	double fillRate = 0;         // Gigapixels per second, zero if the benchmark failed
+	double uploadBandwidth = 0;  // GiB per second
+	double score = 0;
+};
+
+// Relative weights of the measurements, each normalized to the best candidate's
+constexpr double kFillRateWeight = 0.6;
+constexpr double kUploadWeight = 0.3;
+constexpr double kCapabilityWeight = 0.1;
+
+// Benchmark sizes, enough to run for a few milliseconds on a discrete GPU
+constexpr uint32_t kFillSize = 2048;
+constexpr uint32_t kFillLayers = 16;  // Full screen triangles per pass
+constexpr uint64_t kUploadSize = 16 << 20;
+constexpr uint32_t kUploadWrites = 8;
+constexpr uint32_t kRuns = 3;  // Timed runs after a warm up one, the fastest counts
+
+const char* kFillShader = R"(
+@vertex
+fn vs_main(@builtin(vertex_index) index: u32) -> @builtin(position) vec4f {
+	let uv = vec2f(f32((index << 1u) & 2u), f32(index & 2u));
+	return vec4f(uv * 2.0 - 1.0, 0.0, 1.0);
+}
+
+@fragment
+fn fs_main() -> @location(0) vec4f {
+	return vec4f(0.5, 0.25, 0.125, 0.5);
+}
+)";
+
+std::string ToString(WGPUStringView view)
+{
+	return view.data ? std::string(view.data, view.length == WGPU_STRLEN ? std::char_traits<char>::length(view.data) : view.length) : std::string();
+}
+
+std::string ToLower(std::string str)
+{
+	std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return str;
+}
+
+// Larger limits and more features, on a log scale so no single limit dominates
+double CapabilityScore(WGPUAdapter adapter)
+{
+	WGPULimits limits{};
+	wgpuAdapterGetLimits(adapter, &limits);
+	WGPUSupportedFeatures features{};
+	wgpuAdapterGetFeatures(adapter, &features);
+
+	auto log2 = [](double value) { return std::log2(std::max(value, 1.0)); };
+	const double score = log2(limits.maxBufferSize) + log2(limits.maxStorageBufferBindingSize)
+		+ log2(limits.maxTextureDimension2D) + log2(limits.maxComputeWorkgroupStorageSize)
+		+ static_cast<double>(features.featureCount);
+	wgpuSupportedFeaturesFreeMembers(features);
+	return score;
+}
+
+std::vector<Candidate> FindCandidates(GpuEvents& events, WGPUSurface compatibleSurface)
+{
+	std::vector<Candidate> candidates;
+	for (const Preference &preference : kPreferences)
+	{
+		WgpuAdapterPtr adapter = RequestAdapter(events, compatibleSurface, preference);
+		if (!adapter)
+			continue;
+
+		WGPUAdapterInfo info{};
+		wgpuAdapterGetInfo(adapter.get(), &info);
+		std::string name = ToString(info.device);
+		if (name.empty())
+			name = ToString(info.description);
+		std::ostringstream identity;
+		identity << info.backendType << ':' << std::hex << info.vendorID << ':' << info.deviceID << ':' << name;
+		wgpuAdapterInfoFreeMembers(info);
+
+		// The preferences often lead to the same adapter
+		auto same = std::find_if(candidates.begin(), candidates.end(),
+			[&identity](const Candidate& candidate) { return candidate.identity == identity.str(); });
+		if (same != candidates.end())
+		{
+			same->preferences.push_back(preference.name);
+			continue;
+		}
+
+		Candidate candidate;
+		candidate.capability = CapabilityScore(adapter.get());
+		candidate.adapter = std::move(adapter);
+		candidate.preferences.push_back(preference.name);
+		candidate.name = std::move(name);
+		candidate.identity = identity.str();
+		candidates.push_back(std::move(candidate));
+	}
+	return candidates;
+}
+
+Candidate* FindOverride(std::vector<Candidate>& candidates, const std::string& override)
+{
+	for (Candidate &candidate : candidates)
+		for (const char *preference : candidate.preferences)
+			if (override == preference)
+				return &candidate;
+
+	if (std::all_of(override.begin(), override.end(), [](unsigned char c) { return std::isdigit(c); }))
+	{
+		const size_t index = std::strtoul(override.c_str(), nullptr, 10);
+		return index < candidates.size() ? &candidates[index] : nullptr;
+	}
+
+	const std::string lowerOverride = ToLower(override);
+	for (Candidate &candidate : candidates)
+		if (ToLower(candidate.name).find(lowerOverride) != std::string::npos)
+			return &candidate;
+	return nullptr;
+}
+
+// Seconds of the fastest timed run of submit and waiting for the GPU, zero if a wait failed
+double TimeRuns(GpuEvents& events, WGPUQueue queue, const std::function<void()>& submit)
+{
+	using Clock = std::chrono::steady_clock;
+
+	double fastest = std::numeric_limits<double>::max();
+	for (uint32_t run = 0; run <= kRuns; ++run)
+	{
+		const Clock::time_point start = Clock::now();
+		submit();
+		if (!events.Wait(events.OnSubmittedWorkDone(queue)))
+			return 0;
+		if (run > 0)
+			fastest = std::min(fastest, std::chrono::duration<double>(Clock::now() - start).count());
+	}
+	return fastest;
+}
+
+double MeasureUpload(GpuEvents& events, WGPUDevice device, WGPUQueue queue)
+{
+	WGPUBufferDescriptor bufferDesc{};
+	bufferDesc.size = kUploadSize;
+	bufferDesc.usage = WGPUBufferUsage_CopyDst;
+	WgpuBufferPtr buffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+	if (!buffer)
+		return 0;
+
+	const std::vector<uint8_t> data(kUploadSize, 0x5a);
+	const double seconds = TimeRuns(events, queue, [&]() {
+		for (uint32_t i = 0; i < kUploadWrites; ++i)
+			wgpuQueueWriteBuffer(queue, buffer.get(), 0, data.data(), data.size());
+	});
+	return seconds > 0 ? kUploadWrites * kUploadSize / seconds / (1 << 30) : 0;
+}
+
+double MeasureFillRate(GpuEvents& events, WGPUDevice device, WGPUQueue queue)
+{
+	WGPUTextureDescriptor textureDesc{};
+	textureDesc.dimension = WGPUTextureDimension_2D;
+	textureDesc.size = {kFillSize, kFillSize, 1};
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
+	textureDesc.usage = WGPUTextureUsage_RenderAttachment;
+	WgpuTexturePtr texture = GpuMemory::Global().CreateTexture(device, textureDesc);
+	if (!texture)
+		return 0;
+	WgpuTextureViewPtr view(wgpuTextureCreateView(texture.get(), nullptr), wgpuTextureViewRelease);
+
+	WgpuShaderModulePtr shaderModule(wgpuUtils::createShaderModule(device, kFillShader), wgpuShaderModuleRelease);
+
+	// Blending keeps the driver from skipping overdrawn layers
+	WGPUBlendState blend{};
+	blend.color = {WGPUBlendOperation_Add, WGPUBlendFactor_SrcAlpha, WGPUBlendFactor_OneMinusSrcAlpha};
+	blend.alpha = {WGPUBlendOperation_Add, WGPUBlendFactor_Zero, WGPUBlendFactor_One};
+
+	WGPUColorTargetState colorTarget{};
+	colorTarget.format = textureDesc.format;
+	colorTarget.blend = &blend;
+	colorTarget.writeMask = WGPUColorWriteMask_All;
+
+	WGPUFragmentState fragment{};
+	fragment.module = shaderModule.get();
+	fragment.entryPoint = WGPUStringView{"fs_main", WGPU_STRLEN};
+	fragment.targetCount = 1;
+	fragment.targets = &colorTarget;
+
+	WGPURenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.vertex.module = shaderModule.get();
+	pipelineDesc.vertex.entryPoint = WGPUStringView{"vs_main", WGPU_STRLEN};
+	pipelineDesc.primitive.topology = WGPUPrimitiveTopology_TriangleList;
+	pipelineDesc.primitive.cullMode = WGPUCullMode_None;
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.fragment = &fragment;
+	WgpuRenderPipelinePtr pipeline(wgpuDeviceCreateRenderPipeline(device, &pipelineDesc), wgpuRenderPipelineRelease);
+	if (!pipeline)
+		return 0;
+
+	const double seconds = TimeRuns(events, queue, [&]() {
+		WgpuCommandEncoderPtr encoder(wgpuDeviceCreateCommandEncoder(device, nullptr), wgpuCommandEncoderRelease);
+
+		WGPURenderPassColorAttachment colorAttachment{};
+		colorAttachment.view = view.get();
+		colorAttachment.loadOp = WGPULoadOp_Clear;
+		colorAttachment.storeOp = WGPUStoreOp_Store;
+		colorAttachment.clearValue = WGPUColor{0, 0, 0, 1};
+#if !defined(WEBGPU_BACKEND_WGPU)
+		colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif
+		WGPURenderPassDescriptor passDesc{};
+		passDesc.colorAttachmentCount = 1;
+		passDesc.colorAttachments = &colorAttachment;
+
+		WgpuRenderPassEncoderPtr pass(wgpuCommandEncoderBeginRenderPass(encoder.get(), &passDesc), wgpuRenderPassEncoderRelease);
+		wgpuRenderPassEncoderSetPipeline(pass.get(), pipeline.get());
+		wgpuRenderPassEncoderDraw(pass.get(), 3, kFillLayers, 0, 0);
+		wgpuRenderPassEncoderEnd(pass.get());
+
+		WgpuCommandBufferPtr commands(wgpuCommandEncoderFinish(encoder.get(), nullptr), wgpuCommandBufferRelease);
+		WGPUCommandBuffer buffer = commands.get();
+		wgpuQueueSubmit(queue, 1, &buffer);
+	});
+	return seconds > 0 ? double{kFillLayers} * kFillSize * kFillSize / seconds / 1e9 : 0;
+}
+
+// Runs on a device of its own with the default limits, which every adapter supports
+void Benchmark(const GpuEvents& instanceEvents, Candidate& candidate)
+{
+	TRACE_SCOPE("BenchmarkAdapter");
+
+	GpuEvents events = instanceEvents;
+	WGPUDeviceDescriptor deviceDesc{};
+	GpuRequest<WGPUDevice> request = events.RequestDevice(candidate.adapter.get(), &deviceDesc);
+	events.Wait(request);
+	WgpuDevicePtr device(request.Result(), wgpuDeviceRelease);
+	if (!device)
+		return;
+	events.SetDevice(device.get());
+	WgpuQueuePtr queue(wgpuDeviceGetQueue(device.get()), wgpuQueueRelease);
+
+	candidate.uploadBandwidth = MeasureUpload(events, device.get(), queue.get());
+	candidate.fillRate = MeasureFillRate(events, device.get(), queue.get());
+}
+
+void Score(std::vector<Candidate>& candidates)
+{
+	double bestFillRate = 0, bestUpload = 0, bestCapability = 0;
+	for (const Candidate &candidate : candidates)
+	{
+		bestFillRate = std::max(bestFillRate, candidate.fillRate);
+		bestUpload = std::max(bestUpload, candidate.uploadBandwidth);
+		bestCapability = std::max(bestCapability, candidate.capability);
+	}
+
+	auto relative = [](double value, double best) { return best > 0 ? value / best : 0; };
+	for (Candidate &candidate : candidates)
+		candidate.score = kFillRateWeight * relative(candidate.fillRate, bestFillRate)
+			+ kUploadWeight * relative(candidate.uploadBandwidth, bestUpload)
+			+ kCapabilityWeight * relative(candidate.capability, bestCapability);
+}
+
+std::filesystem::path CachePath()
+{
+	const char *cacheHome = std::getenv("XDG_CACHE_HOME");
+	if (cacheHome && *cacheHome)
+		return std::filesystem::path(cacheHome) / "webgpu-example" / "adapters";
+#if defined(_WIN32)
+	if (const char *localAppData = std::getenv("LOCALAPPDATA"))
+		return std::filesystem::path(localAppData) / "webgpu-example" / "adapters";
+#endif
+	if (const char *home = std::getenv("HOME"))
+		return std::filesystem::path(home) / ".cache" / "webgpu-example" / "adapters";
+	return {};
+}
+
+// FNV-1a of the sorted candidate identities, so the key stays the same across builds
+std::string CacheKey(const std::vector<Candidate>& candidates, bool surface)
+{
+	std::vector<std::string> identities;
+	for (const Candidate &candidate : candidates)
+		identities.push_back(candidate.identity);
+	std::sort(identities.begin(), identities.end());
+
+	uint64_t hash = 0xcbf29ce484222325ull;
+	auto add = [&hash](const std::string& str) {
+		for (unsigned char c : str)
+			hash = (hash ^ c) * 0x100000001b3ull;
+		hash = (hash ^ '\n') * 0x100000001b3ull;
+	};
+	add(surface ? "surface" : "headless");
+	for (const std::string &identity : identities)
+		add(identity);
+
+	std::ostringstream key;
+	key << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return key.str();
+}
+
+// One line per set of candidates: the key, a tab and the chosen identity
+std::string ReadCache(const std::filesystem::path& path, const std::string& key)
+{
+	std::ifstream file(path);
+	std::string line;
+	while (std::getline(file, line))
+		if (line.size() > key.size() && line.compare(0, key.size(), key) == 0 && line[key.size()] == '\t')
+			return line.substr(key.size() + 1);
+	return {};
+}
+
+void WriteCache(const std::filesystem::path& path, const std::string& key, const std::string& identity)
+{
+	if (path.empty())
+		return;
+
+	std::vector<std::string> lines;
+	{
+		std::ifstream file(path);
+		std::string line;
+		while (std::getline(file, line))
+			if (line.compare(0, key.size() + 1, key + '\t') != 0)
+				lines.push_back(line);
+	}
+	lines.push_back(key + '\t' + identity);
+
+	std::error_code error;
+	std::filesystem::create_directories(path.parent_path(), error);
+	std::ofstream file(path, std::ios::trunc);
+	for (const std::string &line : lines)
+		file << line << '\n';
+	if (!file)
+		std::cerr << "Could not write the adapter cache " << path << std::endl;
+}
+
+void PrintCandidates(const std::vector<Candidate>& candidates, std::ostream& out)
+{
+	out << "Adapter candidates:" << std::endl;
+	out << std::fixed << std::setprecision(2);
+	for (size_t i = 0; i < candidates.size(); ++i)
+	{
+		const Candidate &candidate = candidates[i];
+		out << "  " << i << ": " << candidate.name << " (";
+		for (size_t p = 0; p < candidate.preferences.size(); ++p)
+			out << (p ? ", " : "") << candidate.preferences[p];
+		out << ")";
+		if (candidate.score > 0)
+			out << ", " << candidate.fillRate << " Gpixel/s fill, " << candidate.uploadBandwidth << " GiB/s upload, score " << candidate.score;
+		out << std::endl;
+	}
+	out.unsetf(std::ios::floatfield);
+}
+
+#endif  // WEBGPU_BACKEND_EMSCRIPTEN
+
+} // anonymous namespace
+
+WgpuAdapterPtr SelectAdapter(GpuEvents& events, WGPUSurface compatibleSurface, const std::string& override)
+{
+	TRACE_SCOPE("SelectAdapter");
+
+	std::string choice = override;
+	if (choice.empty())
+		if (const char *variable = std::getenv(kOverrideVariable))
+			choice = variable;
+
+#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	const Preference *preference = &kPreferences[0];
+	for (const Preference &candidate : kPreferences)
+		if (choice == candidate.name)
+			preference = &candidate;
+	return RequestAdapter(events, compatibleSurface, *preference);
+#else
+	std::vector<Candidate> candidates = FindCandidates(events, compatibleSurface);
+	if (candidates.empty())
+		return WgpuAdapterPtr(nullptr, wgpuAdapterRelease);
+
+	auto select = [](Candidate& candidate, const char* reason) {
+		std::cout << "Selected adapter " << candidate.name << " (" << reason << ")" << std::endl;
+		return std::move(candidate.adapter);
+	};
+
+	if (!choice.empty())
+	{
+		if (Candidate *candidate = FindOverride(candidates, choice))
+			return select(*candidate, "override");
+		std::cerr << "No adapter matches \"" << choice << "\", selecting automatically" << std::endl;
+		PrintCandidates(candidates, std::cerr);
+	}
+
+	if (candidates.size() == 1)
+		return select(candidates[0], "only candidate");
+
+	const std::filesystem::path cachePath = CachePath();
+	const std::string key = CacheKey(candidates, compatibleSurface != nullptr);
+	const std::string cached = ReadCache(cachePath, key);
+	for (Candidate &candidate : candidates)
+		if (!cached.empty() && candidate.identity == cached)
+			return select(candidate, "cached");
+
+	for (Candidate &candidate : candidates)
+		Benchmark(events, candidate);
+	Score(candidates);
+	PrintCandidates(candidates, std::cout);
+
+	Candidate &best = *std::max_element(candidates.begin(), candidates.end(),
+		[](const Candidate& a, const Candidate& b) { return a.score < b.score; });
+	WriteCache(cachePath, key, best.identity);
+	return select(best, "benchmarked");
+#endif
+}
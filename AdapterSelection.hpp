@@ -0,0 +1,25 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "GpuEvents.hpp"
+
+#include <string>
+
+/**
+ * Picks the adapter to run on, for machines with more than one.
+ *
+ * Candidates are the adapters returned for the high performance, low power and fallback
+ * preferences, without duplicates. When there are several, each gets a device of its own for a
+ * short benchmark of fill rate (blended full screen triangles) and upload bandwidth (queue buffer
+ * writes), and the best score wins, with the adapter's limits and features as a smaller part. The
+ * winner is cached per machine, keyed by the set of candidates, so the benchmark only runs again
+ * once the hardware or drivers change.
+ *
+ * override skips scoring. It is one of high-performance, low-power or fallback, the index of a
+ * candidate, or a case insensitive part of an adapter's name. When empty, the WEBGPU_ADAPTER
+ * environment variable is used instead.
+ *
+ * On the web the browser only exposes one adapter per preference, so only the override applies.
+ */
+WgpuAdapterPtr SelectAdapter(GpuEvents& events, WGPUSurface compatibleSurface, const std::string& override = {});
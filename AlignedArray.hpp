@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+
+/**
+ * Growable array of trivially copyable elements whose storage starts on a cache line.
+ *
+ * Used for the structure of arrays pools, so SIMD loops can use aligned loads and two pools are
+ * never split across a cache line that threads writing neighbouring ranges would fight over.
+ * New elements are zero initialized.
+ */
+template <class T, size_t Alignment = 64>
+class AlignedArray
+{
+	static_assert(std::is_trivially_copyable<T>::value, "AlignedArray relocates elements with memcpy");
+	static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0);
+
+public:
+	AlignedArray() = default;
+
+	explicit AlignedArray(size_t size)
+	{
+		Resize(size);
+	}
+
+	~AlignedArray()
+	{
+		Free();
+	}
+
+	AlignedArray(const AlignedArray&) = delete;
+	AlignedArray& operator=(const AlignedArray&) = delete;
+
+	AlignedArray(AlignedArray&& other) noexcept :
+		m_data(other.m_data), m_size(other.m_size), m_capacity(other.m_capacity)
+	{
+		other.m_data = nullptr;
+		other.m_size = other.m_capacity = 0;
+	}
+
+	AlignedArray& operator=(AlignedArray&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Free();
+			m_data = other.m_data;
+			m_size = other.m_size;
+			m_capacity = other.m_capacity;
+			other.m_data = nullptr;
+			other.m_size = other.m_capacity = 0;
+		}
+		return *this;
+	}
+
+	void Reserve(size_t capacity)
+	{
+		if (capacity <= m_capacity)
+			return;
+
+		T* data = static_cast<T*>(::operator new(capacity * sizeof(T), std::align_val_t(Alignment)));
+		if (m_size)
+			std::memcpy(static_cast<void*>(data), m_data, m_size * sizeof(T));
+		Free();
+		m_data = data;
+		m_capacity = capacity;
+	}
+
+	void Resize(size_t size)
+	{
+		if (size > m_capacity)
+			Reserve(std::max(size, m_capacity * 2));
+		if (size > m_size)
+			std::memset(static_cast<void*>(m_data + m_size), 0, (size - m_size) * sizeof(T));
+		m_size = size;
+	}
+
+	void PushBack(const T& value)
+	{
+		if (m_size == m_capacity)
+			Reserve(std::max<size_t>(16, m_capacity * 2));
+		m_data[m_size++] = value;
+	}
+
+	void Clear() { m_size = 0; }
+
+	T& operator[](size_t i) { assert(i < m_size); return m_data[i]; }
+	const T& operator[](size_t i) const { assert(i < m_size); return m_data[i]; }
+
+	T* Data() { return m_data; }
+	const T* Data() const { return m_data; }
+	size_t Size() const { return m_size; }
+	bool Empty() const { return m_size == 0; }
+
+private:
+	void Free()
+	{
+		if (m_data)
+			::operator delete(m_data, std::align_val_t(Alignment));
+		m_data = nullptr;
+	}
+
+	T* m_data = nullptr;
+	size_t m_size = 0;
+	size_t m_capacity = 0;
+};
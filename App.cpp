@@ -8,25 +8,59 @@
 #include <GLFW/glfw3.h>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cmath>
 #include <numeric>
 
+#include "AdapterSelection.hpp"
 #include "glfw3webgpu.hpp"
+#include "Image.hpp"
+#include "Startup.hpp"
+#include "Trace.hpp"
 #include "webgpu-utils.hpp"
 
 App::App() :
+	App(Options{})
+{}
+
+App::App(const Options& options) :
+	m_options(options),
 	m_terminated(false),
 	m_window(nullptr, glfwDestroyWindow),
 	m_windowDim{1280, 720},
+	m_surfaceDirty(false),
+	m_launchTime(std::chrono::steady_clock::now()),
+	m_firstFramePresented(false),
+	m_submitsThisFrame(0),
+	m_instanceBuffer(nullptr, wgpuBufferRelease),
+	m_instanceCapacity(0),
 	m_uniformsBuffer(nullptr, [](WGPUBuffer){}),
 	m_bindGroupLayout(nullptr, wgpuBindGroupLayoutRelease),
 	m_pipelineLayout(nullptr, wgpuPipelineLayoutRelease),
-	m_bindGroup(nullptr, wgpuBindGroupRelease)
+	m_bindGroup(nullptr, wgpuBindGroupRelease),
+	m_renderGraph(m_releaseQueue),
+	m_gpuFramesMeasured(0)
 {
-	m_uniforms.ratio = static_cast<float>(m_windowDim.width) / m_windowDim.height;
+	m_uniforms.transform = math::Scale({1.0f, static_cast<float>(m_windowDim.width) / m_windowDim.height, 1.0f});
 	m_uniforms.color = {};
 
+	if (!m_options.tracePath.empty())
+	{
+		trace::Enable(true);
+		TRACE_THREAD_NAME("Main");
+	}
+
+	GpuMemory::Global().SetBudget(m_options.gpuBudget);
+
+	if (!m_options.metricsFile.empty())
+		m_metricsExporter.StartFileDump(m_options.metricsFile, m_options.metricsInterval);
+	if (!m_options.metricsSocket.empty())
+		m_metricsExporter.StartSocketServer(m_options.metricsSocket);
+
 	m_initialized = Initialize();
+	m_lastTickTime = std::chrono::steady_clock::now();
 }
 
 App::~App()
@@ -37,24 +71,82 @@ App::~App()
 
 void App::Terminate()
 {
+	// Nothing else will be submitted, so anything parked can go now
+	m_releaseQueue.Flush();
+
 	m_indicies.m_wgpuBuffer.reset();
 	m_verticies.m_wgpuBuffer.reset();
 	m_uniformsBuffer.reset();
+	m_instanceBuffer.reset();
 	m_bindGroupLayout.reset();
 	m_pipelineLayout.reset();
 	m_bindGroup.reset();
-	m_texture.~WgpuTexture();
+	m_sprites.Reset();
+	m_texturePool.Reset();
+	m_renderGraph.Reset();
+	m_colorGrading.Reset();
+	m_dynamicResolution.Reset();
+	m_gpuTimer.Reset();
+	m_occlusion.Reset();
 
-	// Call dtor so that objects are destroyed in correct order
-	m_wgpuCtx.~WgpuContext();
+	m_wgpuCtx.Reset();
 
 	m_window.reset();
 	glfwTerminate();
 
+	if (m_metrics.droppedFrames.Value())
+		std::cerr << "Dropped " << m_metrics.droppedFrames.Value() << " frame(s) due to unavailable surface textures" << std::endl;
+
+	m_metricsExporter.Stop();
+
+	if (trace::IsEnabled())
+	{
+		trace::WriteJson(m_options.tracePath);
+		trace::Enable(false);
+	}
+
 	m_initialized = false;
 	m_terminated = true;
 }
 
+App::AppMetrics::AppMetrics() :
+	frameTime(MetricsRegistry::Global().GetHistogram("app_frame_time_seconds", "Time between the start of consecutive frames", 1e-6)),
+	droppedFrames(MetricsRegistry::Global().GetCounter("app_dropped_frames_total", "Frames skipped because no surface texture could be acquired")),
+	submits(MetricsRegistry::Global().GetCounter("webgpu_queue_submits_total", "Command buffer submissions")),
+	submitsPerFrame(MetricsRegistry::Global().GetGauge("webgpu_queue_submits_per_frame", "Command buffer submissions during the last frame")),
+	bytesUploaded(UploadBytesCounter()),
+	deviceErrors(MetricsRegistry::Global().GetCounter("webgpu_device_errors_total", "Uncaptured device errors")),
+	culledObjects(MetricsRegistry::Global().GetGauge("app_culled_objects", "Scene objects outside the view frustum during the last frame")),
+	occludedObjects(MetricsRegistry::Global().GetGauge("app_occluded_objects", "Scene objects inside the view frustum skipped as occluded during the last frame")),
+	visibleObjects(MetricsRegistry::Global().GetGauge("app_visible_objects", "Scene objects inside the view frustum and not occluded during the last frame")),
+	occlusionQueries(MetricsRegistry::Global().GetGauge("app_occlusion_queries", "Occlusion queries issued during the last frame")),
+	drawnTriangles(MetricsRegistry::Global().GetGauge("app_drawn_triangles", "Mesh triangles drawn during the last frame, at their selected levels of detail")),
+	spriteQuads(MetricsRegistry::Global().GetGauge("app_sprite_quads", "Sprite quads drawn during the last frame")),
+	spriteBatches(MetricsRegistry::Global().GetGauge("app_sprite_batches", "Draws the sprite quads took during the last frame")),
+	renderScale(MetricsRegistry::Global().GetGauge("app_render_scale_percent", "Percent of the window's width and height the scene renders at")),
+	gpuFrameTime(MetricsRegistry::Global().GetGauge("app_gpu_frame_time_microseconds", "GPU time of the latest frame measured with timestamp queries")),
+	startupTime(MetricsRegistry::Global().GetGauge("app_startup_milliseconds", "Time spent creating the window, device and initial resources")),
+	timeToFirstFrame(MetricsRegistry::Global().GetGauge("app_time_to_first_frame_milliseconds", "Time from launch until the first frame was presented"))
+{}
+
+void App::WgpuContext::Reset()
+{
+	pipelines.clear();
+	queue.reset();
+	surface.reset();
+	device.reset();
+	adapter.reset();
+	instance.reset();
+	events = GpuEvents();
+	initialized = false;
+}
+
+void App::WgpuTexture::Reset()
+{
+	textureView.reset();
+	texture.reset();
+}
+
 void App::AddDeviceError(WGPUErrorType error, std::string_view message)
 {
 	std::stringstream ss;
@@ -64,6 +156,10 @@ void App::AddDeviceError(WGPUErrorType error, std::string_view message)
 	ss << std::endl;
 
 	m_wgpuErrors.push( {error, ss.str()} );
+	m_metrics.deviceErrors.Add();
+
+	if (error == WGPUErrorType_OutOfMemory)
+		GpuMemory::Global().PrintReport(std::cerr);
 }
 
 bool App::LogDeviceErrors()
@@ -86,41 +182,85 @@ bool App::IsInitialized() const { return m_initialized; }
 
 bool App::Initialize()
 {
-	// Init Glfw
-	m_window = GlfwInitialize();
-	if (m_window == nullptr)
-	{
-		std::cerr << "Could not initialize glfw. Aborting initialization." << std::endl;
-		return false;
-	}
+	TRACE_SCOPE("Initialize");
 
-	// Init Wgpu
-	m_wgpuCtx = WgpuInitialize();
-	if (m_wgpuCtx.initialized == false)
-	{
-		std::cerr << "Could not initialize WebGPU. Aborting initialization." << std::endl;
-		return false;
-	}
+	// The window and everything touching the device stay on the main thread, the rest overlaps
+	// the adapter and device requests
+	using Affinity = StartupGraph::Affinity;
+	StartupGraph startup;
 
-	glfwSetWindowUserPointer(m_window.get(), static_cast<void*>(this));
-	glfwSetFramebufferSizeCallback(m_window.get(), [](GLFWwindow* pWindow, int width, int height){
-			App &app = *static_cast<App*>(glfwGetWindowUserPointer(pWindow));
-			app.m_windowDim = WindowDimensions{width, height};
-			app.m_uniforms.ratio = static_cast<float>(width) / height;
+	const auto window = startup.Add("Window", Affinity::MainThread, {}, [this]() { return WindowInitialize(); });
+	const auto device = startup.Add("Device", Affinity::MainThread, {window}, [this]() {
+		m_wgpuCtx = WgpuInitialize();
+		return m_wgpuCtx.initialized;
+	});
+	const auto meshData = startup.Add("MeshData", Affinity::AnyThread, {}, [this]() {
+		MeshDataInitialize();
+		return true;
+	});
+	const auto textureData = startup.Add("TextureData", Affinity::AnyThread, {}, [this]() {
+		TextureDataInitialize();
+		return true;
+	});
+
+	// Only informational, but it queries the adapter and device, which stay on the main thread
+	startup.Add("AdapterReport", Affinity::MainThread, {device}, [this]() {
+		std::cout << AdapterReport() << std::flush;
+		return true;
 	});
 
-	BuffersInitialize();
-	WgpuTextureInitialize();
+	const auto buffers = startup.Add("Buffers", Affinity::MainThread, {device, meshData}, [this]() {
+		BuffersInitialize();
+		return true;
+	});
+	// After the mesh data, which creates the objects the textures' materials are assigned to
+	const auto texture = startup.Add("Texture", Affinity::MainThread, {device, meshData, textureData}, [this]() {
+		return WgpuTextureInitialize();
+	});
+	startup.Add("Sprites", Affinity::MainThread, {texture}, [this]() {
+		return m_sprites.Initialize(m_wgpuCtx.device.get(), m_wgpuCtx.queue.get(), m_wgpuCtx.limits, m_texturePool,
+			SceneFormat(), kDepthFormat, SceneEncodesSrgb());
+	});
+	startup.Add("ColorGrading", Affinity::MainThread, {device}, [this]() {
+		return !m_options.hdr || m_colorGrading.Initialize(m_wgpuCtx.device.get(), m_wgpuCtx.queue.get(), m_wgpuCtx.renderFormat, {});
+	});
+	startup.Add("DynamicResolution", Affinity::MainThread, {device}, [this]() {
+		if (!m_options.dynamicResolution)
+			return true;
+		// Without timestamp queries the controller runs on the CPU time alone
+		m_gpuTimer.Initialize(m_wgpuCtx.device.get(), m_wgpuCtx.events);
+		if (!m_dynamicResolution.Initialize(m_wgpuCtx.device.get(), m_wgpuCtx.renderFormat, m_options.resolution))
+			return false;
+		m_metrics.renderScale.Set(std::lround(m_dynamicResolution.Scale() * 100.0f));
+		return true;
+	});
+	startup.Add("OcclusionCulling", Affinity::MainThread, {device}, [this]() {
+		return !m_options.occlusionCulling || m_occlusion.Initialize(m_wgpuCtx.device.get(), m_wgpuCtx.queue.get(), m_wgpuCtx.events,
+			SceneFormat(), kDepthFormat);
+	});
+	// The vertex layout comes from the vertex buffer's attributes
+	const auto pipelines = startup.Add("Pipelines", Affinity::MainThread, {device, buffers}, [this]() {
+		WgpuPipelineLayoutInitialize();
+		if (!GetPipeline(m_options.sampleCount, false) || !GetPipeline(m_options.sampleCount, true))
+		{
+			std::cerr << "Could not initialize WebGPU pipeline." << std::endl;
+			return false;
+		}
+		return true;
+	});
+	startup.Add("BindGroups", Affinity::MainThread, {buffers, texture, pipelines}, [this]() {
+		WgpuBindGroupsInitialize();
+		return true;
+	});
 
-	// Init Wgpu Pipeline
-	m_wgpuCtx.pipeline = WgpuRenderPipelineInitialize();
-	if (!m_wgpuCtx.pipeline)
+	const bool started = startup.Run(m_jobs);
+	startup.PrintReport(std::cout);
+	if (!started)
 	{
-		std::cerr << "Could not initialize WebGPU pipeline. Aborting initialization." << std::endl;
+		std::cerr << "Startup failed. Aborting initialization." << std::endl;
 		return false;
 	}
-
-	WgpuBindGroupsInitialize();
+	m_metrics.startupTime.Set(std::chrono::duration_cast<std::chrono::milliseconds>(startup.Total()).count());
 
 	// On Emscripten the errors might not be captured yet because the callback is asynchronous.
 	if (LogDeviceErrors())
@@ -132,8 +272,34 @@ bool App::Initialize()
 	return true;
 }
 
+bool App::WindowInitialize()
+{
+	m_window = GlfwInitialize();
+	if (m_window == nullptr)
+	{
+		std::cerr << "Could not initialize glfw." << std::endl;
+		return false;
+	}
+
+	// The framebuffer can be larger than the window on high DPI displays
+	glfwGetFramebufferSize(m_window.get(), &m_windowDim.width, &m_windowDim.height);
+	m_uniforms.transform = math::Scale({1.0f, static_cast<float>(m_windowDim.width) / m_windowDim.height, 1.0f});
+
+	glfwSetWindowUserPointer(m_window.get(), static_cast<void*>(this));
+	glfwSetFramebufferSizeCallback(m_window.get(), [](GLFWwindow* pWindow, int width, int height){
+			// Several events can arrive during a single poll, only reconfigure once per frame
+			App &app = *static_cast<App*>(glfwGetWindowUserPointer(pWindow));
+			app.m_windowDim = WindowDimensions{width, height};
+			app.m_surfaceDirty = true;
+	});
+
+	return true;
+}
+
 App::GlfwWindowPtr App::GlfwInitialize()
 {
+	TRACE_SCOPE("GlfwInitialize");
+
 	// Setup GLFW
 	if (!glfwInit())
 	{
@@ -153,43 +319,10 @@ App::GlfwWindowPtr App::GlfwInitialize()
 	return GlfwWindowPtr(pWindow, glfwDestroyWindow);
 }
 
-#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-WGPURequiredLimits App::GetRequiredLimits(WGPUAdapter adapter) const
-{
-	WGPUSupportedLimits supLimits{};
-	wgpuAdapterGetLimits(adapter, &supLimits);
-	const WGPULimits &supportedLimits = supLimits.limits;
-#else
-WGPULimits App::GetRequiredLimits(WGPUAdapter adapter) const
-{
-	WGPULimits supportedLimits{};
-	wgpuAdapterGetLimits(adapter, &supportedLimits);
-#endif
-
-	// Good practice to set these limits as low as possible to support the largest amount of devices
-	WGPULimits limits = supportedLimits;
-	limits.maxVertexAttributes =         3;
-	limits.maxVertexBuffers =            1;
-	limits.maxBufferSize =               4 * 256 * 256;
-	limits.maxVertexBufferArrayStride =  7 * sizeof(float);
-	limits.maxBindGroups =               1;
-	limits.maxUniformBufferBindingSize = 16 * sizeof(float);
-	limits.maxSampledTexturesPerShaderStage = 1;
-#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	limits.maxInterStageShaderComponents = WGPU_LIMIT_U32_UNDEFINED;  // This is removed in latest webgpu but firefox complains about this
-#endif
-
-#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPURequiredLimits reqLimits{};
-	reqLimits.limits = limits;
-	return reqLimits;
-#else
-	return limits;
-#endif
-}
-
 App::WgpuContext App::WgpuInitialize()
 {
+	TRACE_SCOPE("WgpuInitialize");
+
 	WgpuContext ctx;
 	ctx.initialized = false;
 
@@ -205,8 +338,7 @@ App::WgpuContext App::WgpuInitialize()
 #endif
 
 #if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
-	WGPUInstanceDescriptor desc = {};
-	desc.nextInChain = nullptr;
+	const WGPUInstanceDescriptor desc = GpuEvents::InstanceDescriptor();
 #endif
 
 	ctx.instance = WgpuInstancePtr
@@ -225,6 +357,7 @@ App::WgpuContext App::WgpuInitialize()
 		return ctx;
 	}
 	std::cout << "WebGPU initialized successfully: " << ctx.instance.get() << std::endl;
+	ctx.events = GpuEvents(ctx.instance.get());
 
 	// Retrieving the surface is platform dependant, so use a helper function
 	ctx.surface = WgpuSurfacePtr
@@ -241,24 +374,14 @@ App::WgpuContext App::WgpuInitialize()
 		return ctx;
 	}
 
-	// Retrieve the WebGPU adapter
-	WGPURequestAdapterOptions adapterOptions{};
-	adapterOptions.compatibleSurface = ctx.surface.get();
-
-	ctx.adapter = WgpuAdapterPtr
-	(
-		wgpuUtils::requestAdapter(ctx.instance.get(), &adapterOptions),
-		wgpuAdapterRelease
-	);
+	// Retrieve the WebGPU adapter, the fastest one on machines with several
+	ctx.adapter = SelectAdapter(ctx.events, ctx.surface.get(), m_options.adapter);
 	if (!ctx.adapter)
 	{
 		std::cerr << "Could not retrieve adapter" << std::endl;
 		return ctx;
 	}
 	std::cout << "Got adapter: " << ctx.adapter.get() << std::endl;
-	wgpuUtils::printAdapterFeatures(ctx.adapter.get());
-	wgpuUtils::printAdapterProperties(ctx.adapter.get());
-	wgpuUtils::printAdapterLimits(ctx.adapter.get());
 
 	auto onDeviceError = [](
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
@@ -294,15 +417,23 @@ App::WgpuContext App::WgpuInitialize()
 #endif  // EMSCRIPTEN_WEBGPU_DEPRECATED
 			std::cerr << " (" << message << ")";
 		std::cout << std::endl;
+
+		// Most unexpected losses are out of memory, show what was holding it
+		GpuMemory::Global().PrintReport(std::cerr);
 	};
 	// Use adapter and device description to retrieve a device
 	WGPUDeviceDescriptor deviceDesc{};
 	deviceDesc.nextInChain = nullptr;
-	deviceDesc.requiredFeatureCount = 0;
+	// Timestamp queries measure the GPU time dynamic resolution is driven by, when there are any
+	const WGPUFeatureName timestampQuery = WGPUFeatureName_TimestampQuery;
+	const bool timestamps = m_options.dynamicResolution && wgpuAdapterHasFeature(ctx.adapter.get(), timestampQuery);
+	deviceDesc.requiredFeatureCount = timestamps ? 1 : 0;
+	deviceDesc.requiredFeatures = timestamps ? &timestampQuery : nullptr;
 	deviceDesc.defaultQueue.nextInChain = nullptr;
+	ctx.limits = DeviceLimits::Negotiate(ctx.adapter.get());
+	const auto requiredLimits = ctx.limits.RequiredLimits();
+	deviceDesc.requiredLimits = &requiredLimits;
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPULimits limits = GetRequiredLimits(ctx.adapter.get());
-	deviceDesc.requiredLimits = &limits;
 	deviceDesc.label = {"My Device", WGPU_STRLEN};
 	deviceDesc.defaultQueue.label = {"Default Queue", WGPU_STRLEN};
 	deviceDesc.deviceLostCallbackInfo.nextInChain = nullptr;
@@ -312,32 +443,29 @@ App::WgpuContext App::WgpuInitialize()
 	deviceDesc.uncapturedErrorCallbackInfo.userdata1 = this;
 	deviceDesc.uncapturedErrorCallbackInfo.callback = onDeviceError;
 #else
-	WGPURequiredLimits limits = GetRequiredLimits(ctx.adapter.get());
-	deviceDesc.requiredLimits = &limits;
 	deviceDesc.label = "My Device";
 	deviceDesc.defaultQueue.label = "Default Queue";
 	deviceDesc.deviceLostCallback = onDeviceLost;
 #endif
-	deviceDesc.requiredLimits = &limits;
 
-	ctx.device = WgpuDevicePtr
-	(
-		wgpuUtils::requestDevice(ctx.instance.get(), ctx.adapter.get(), &deviceDesc),
-		wgpuDeviceRelease
-	);
+	{
+		TRACE_SCOPE("RequestDevice");
+		GpuRequest<WGPUDevice> request = ctx.events.RequestDevice(ctx.adapter.get(), &deviceDesc);
+		ctx.events.Wait(request);
+		ctx.device = WgpuDevicePtr(request.Result(), wgpuDeviceRelease);
+	}
 	if (!ctx.device)
 	{
 		std::cerr << "Could not retrieve device" << std::endl;
 		return ctx;
 	}
-	std::cout << "Device retrieved" << std::endl;
+	std::cout << "Device retrieved with the " << DeviceLimits::TierName(ctx.limits.GetTier()) << " limits tier" << std::endl;
+	ctx.events.SetDevice(ctx.device.get());
 
 #if defined (EMSCRIPTEN_WEBGPU_DEPRECATED)
 	wgpuDeviceSetUncapturedErrorCallback(ctx.device.get(), onDeviceError, this);
 #endif
 
-	wgpuUtils::printDeviceLimits(ctx.device.get());
-
 	// Get the queue on the device
 	ctx.queue = WgpuQueuePtr
 	(
@@ -345,94 +473,138 @@ App::WgpuContext App::WgpuInitialize()
 		wgpuQueueRelease
 	);
 
-	// Callback only invoked when all work submitted up to this point in complete.
-	// No work has been submitted to the queue yet...
-	auto onQueueWorkDone = [](
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-			WGPUQueueWorkDoneStatus status, [[maybe_unused]]void* pUserData1, [[maybe_unused]]void* pUserData2)
-#else
-			WGPUQueueWorkDoneStatus status, [[maybe_unused]]void* pUserData1)
-#endif
-	{
-		std::cout << "Queued work completed with status: " << status << std::endl;
-	};
-
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPUQueueWorkDoneCallbackInfo queueWorkDoneInfo{};
-	queueWorkDoneInfo.mode = WGPUCallbackMode_AllowProcessEvents;
-	queueWorkDoneInfo.callback = onQueueWorkDone;
-	[[maybe_unused]]WGPUFuture queueFuture = wgpuQueueOnSubmittedWorkDone(ctx.queue.get(), queueWorkDoneInfo);
-
-	#if !defined(WEBGPU_FUTURE_UNIMPLEMENTED)
-		WGPUFutureWaitInfo queueFutureWait{queueFuture, false};
-		while (wgpuInstanceWaitAny(ctx.instance.get(), 1, &queueFutureWait, 0) != WGPUWaitStatus_Success);
-	#endif
-#else
-	wgpuQueueOnSubmittedWorkDone(ctx.queue.get(), onQueueWorkDone, nullptr);
-#endif  // EMSCRIPTEN_WEBGPU_DEPRECATED
+	// Completes once all work submitted up to this point is done. Nothing has been submitted
+	// yet, so nothing waits on it, it reports from the first pump.
+	ctx.events.OnSubmittedWorkDone(ctx.queue.get()).Then([](bool succeeded) {
+		std::cout << "Queued work completed " << (succeeded ? "successfully" : "with an error") << std::endl;
+	});
 
-	wgpuUtils::configureSurface(ctx.surface.get(), ctx.device.get(), ctx.adapter.get(), m_windowDim.width, m_windowDim.height);
+	{
+		TRACE_SCOPE("ConfigureSurface");
+		wgpuUtils::configureSurface(ctx.surface.get(), ctx.device.get(), ctx.adapter.get(), m_windowDim.width, m_windowDim.height);
+	}
 
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPUTextureFormat textureFormat = wgpuUtils::getPreferredFormat(ctx.adapter.get(), ctx.surface.get());
+	ctx.surfaceFormat = wgpuUtils::getPreferredFormat(ctx.adapter.get(), ctx.surface.get());
 #else
-	WGPUTextureFormat textureFormat = wgpuSurfaceGetPreferredFormat(m_wgpuCtx.surface.get(), m_wgpuCtx.adapter.get());
+	ctx.surfaceFormat = wgpuSurfaceGetPreferredFormat(ctx.surface.get(), ctx.adapter.get());
 #endif
 
-	std::cout << "Preferred Format: 0x" << std::hex << textureFormat << std::endl;
+	ctx.renderFormat = wgpuUtils::srgbFormat(ctx.surfaceFormat);
+
+	std::cout << "Preferred Format: 0x" << std::hex << ctx.surfaceFormat << ", rendering through 0x" << ctx.renderFormat << std::dec
+		<< (wgpuUtils::isSrgbFormat(ctx.renderFormat) ? "" : ", encoding sRGB in the shaders") << std::endl;
 
 	ctx.initialized = true;
 	return ctx;
 }
 
-void App::BuffersInitialize()
+std::string App::AdapterReport() const
+{
+	TRACE_SCOPE("AdapterReport");
+
+	std::ostringstream report;
+	wgpuUtils::printAdapterFeatures(m_wgpuCtx.adapter.get(), report);
+	wgpuUtils::printAdapterProperties(m_wgpuCtx.adapter.get(), report);
+	wgpuUtils::printAdapterLimits(m_wgpuCtx.adapter.get(), report);
+	wgpuUtils::printDeviceLimits(m_wgpuCtx.device.get(), report);
+	return report.str();
+}
+
+void App::MeshDataInitialize()
 {
-	const std::vector<float> verticies = {
-		// x,    y,   r,   g,   b,   u,   v
-		-0.5, -0.5, 1.0, 0.0, 0.0, 0.0, 1.0,
-		 0.5,  0.5, 0.0, 1.0, 0.0, 1.0, 0.0,
-		-0.5,  0.5, 0.0, 0.0, 1.0, 0.0, 0.0,
-		 0.5, -0.5, 0.0, 0.4, 0.6, 1.0, 1.0,
+	TRACE_SCOPE("MeshDataInitialize");
+
+	m_startupData.verticies = {
+		// x,    y,    z,   r,   g,   b,   u,   v
+		-0.5, -0.5, 0.50, 1.0, 0.0, 0.0, 0.0, 1.0,
+		 0.5,  0.5, 0.50, 0.0, 1.0, 0.0, 1.0, 0.0,
+		-0.5,  0.5, 0.50, 0.0, 0.0, 1.0, 0.0, 0.0,
+		 0.5, -0.5, 0.50, 0.0, 0.4, 0.6, 1.0, 1.0,
 
 		// Rotated/skewed for anti-aliasing
-		-0.9, -0.4, 1.0, 1.0, 0.0, 0.0, 1.0,
-		-0.6,  0.0, 1.0, 0.0, 1.0, 1.0, 1.0,
-		-0.7,  0.5, 0.0, 1.0, 1.0, 0.5, 0.0,
+		-0.9, -0.4, 0.25, 1.0, 1.0, 0.0, 0.0, 1.0,
+		-0.6,  0.0, 0.25, 1.0, 0.0, 1.0, 1.0, 1.0,
+		-0.7,  0.5, 0.25, 0.0, 1.0, 1.0, 0.5, 0.0,
 	};
 
-	const std::vector<uint32_t> indicies = {
+	m_startupData.indicies = {
 		0, 1, 2,
 		0, 3, 1,
 		4, 5, 6,
 	};
 
+	// Depth is the z of the vertices, which is constant across each mesh
+	m_meshes = {
+		{0, 6, 0.50f, false, Scene::kInvalidHandle, {}, 0},  // quad
+		{6, 3, 0.25f, false, Scene::kInvalidHandle, {}, 0},  // triangle
+	};
+
+	// The levels of detail of each mesh follow each other in the index buffer and share its vertices
+	constexpr size_t kVertexFloats = 8;
+	const size_t vertexCount = m_startupData.verticies.size() / kVertexFloats;
+	std::vector<uint32_t> indicies;
+	for (Mesh &mesh : m_meshes)
+	{
+		mesh.levels = MeshLod::Generate(m_startupData.verticies.data(), kVertexFloats, vertexCount,
+			m_startupData.indicies.data() + mesh.firstIndex, mesh.indexCount, indicies);
+		mesh.firstIndex = mesh.levels[0].firstIndex;
+	}
+	m_startupData.indicies = std::move(indicies);
+
+	// Vertices are already placed, so the objects only carry their bounds
+	Scene::ObjectDesc quad;
+	quad.boundsCenter = {0.0f, 0.0f, 0.5f};
+	quad.boundsExtents = {0.5f, 0.5f, 0.0f};
+	m_meshes[0].object = m_scene.Create(quad);
+
+	Scene::ObjectDesc triangle;
+	triangle.boundsCenter = {-0.75f, 0.05f, 0.25f};
+	triangle.boundsExtents = {0.15f, 0.45f, 0.0f};
+	m_meshes[1].object = m_scene.Create(triangle);
+}
+
+void App::BuffersInitialize()
+{
+	TRACE_SCOPE("BuffersInitialize");
+
+	const std::vector<float> verticies = std::move(m_startupData.verticies);
+	const std::vector<uint32_t> indicies = std::move(m_startupData.indicies);
+
 	// Vertex buffer
 	WGPUBufferDescriptor bufferDesc{};
 	bufferDesc.size = verticies.size() * sizeof(verticies[0]);
 	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex;
 	bufferDesc.mappedAtCreation = false;
-	WgpuBufferPtr wgpuBuffer = WgpuBufferPtr(wgpuDeviceCreateBuffer(m_wgpuCtx.device.get(), &bufferDesc), wgpuBufferRelease);
+	WgpuBufferPtr wgpuBuffer = CreateBuffer(bufferDesc);
 
-	std::vector<size_t> attribComponents = {2, 3, 2};
+	std::vector<size_t> attribComponents = {3, 3, 2};
 	m_verticies = WgpuBuffer(verticies.size(), sizeof(verticies[0]), std::move(attribComponents), std::move(wgpuBuffer));
 
 	// Index buffer
 	bufferDesc.size = indicies.size() * sizeof(indicies[0]);
 	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Index;
 	bufferDesc.mappedAtCreation = false;
-	wgpuBuffer = WgpuBufferPtr(wgpuDeviceCreateBuffer(m_wgpuCtx.device.get(), &bufferDesc), wgpuBufferRelease);
+	wgpuBuffer = CreateBuffer(bufferDesc);
 
 	attribComponents = {1};
 	m_indicies = WgpuBuffer(indicies.size(), sizeof(indicies[0]), std::move(attribComponents), std::move(wgpuBuffer));
 
-	wgpuQueueWriteBuffer(m_wgpuCtx.queue.get(), m_verticies.m_wgpuBuffer.get(), 0, verticies.data(), m_verticies.m_size);
-	wgpuQueueWriteBuffer(m_wgpuCtx.queue.get(), m_indicies.m_wgpuBuffer.get(), 0, indicies.data(), m_indicies.m_size);
+	WriteBuffer(m_verticies.m_wgpuBuffer.get(), 0, verticies.data(), m_verticies.m_size);
+	WriteBuffer(m_indicies.m_wgpuBuffer.get(), 0, indicies.data(), m_indicies.m_size);
+
+	// Instance buffer, filled by UpdateScene()
+	m_instanceCapacity = static_cast<uint32_t>(std::min<uint64_t>(kMaxInstances, m_wgpuCtx.limits.MaxStorageElements(sizeof(Scene::InstanceData))));
+	bufferDesc.size = m_instanceCapacity * sizeof(Scene::InstanceData);
+	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
+	bufferDesc.mappedAtCreation = false;
+	m_instanceBuffer = CreateBuffer(bufferDesc);
 
 	// Uniform buffer
 	bufferDesc.size = sizeof(Uniforms);
 	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform;
 	bufferDesc.mappedAtCreation = false;
-	m_uniformsBuffer = WgpuBufferPtr(wgpuDeviceCreateBuffer(m_wgpuCtx.device.get(), &bufferDesc), wgpuBufferRelease);
+	m_uniformsBuffer = CreateBuffer(bufferDesc);
 }
 
 bool App::WgpuBuffer::SetInfo(size_t count, size_t componentSize, std::vector<size_t> attributeComponents, WgpuBufferPtr wgpuBuffer)
@@ -471,35 +643,99 @@ bool App::WgpuBuffer::SetInfo(size_t count, size_t componentSize, std::vector<si
 	return true;
 }
 
-WgpuRenderPipelinePtr App::WgpuRenderPipelineInitialize()
+void App::WgpuPipelineLayoutInitialize()
+{
+	TRACE_SCOPE("WgpuPipelineLayoutInitialize");
+
+	// Binding Layout
+	std::array<WGPUBindGroupLayoutEntry, 4> bindingLayoutEntries;
+
+	WGPUBindGroupLayoutEntry &bindingLayout = bindingLayoutEntries[0];
+	bindingLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	bindingLayout.binding = 0;
+	bindingLayout.visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
+	bindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
+	bindingLayout.buffer.minBindingSize = sizeof(Uniforms);
+
+	WGPUBindGroupLayoutEntry &textureBindingLayout = bindingLayoutEntries[1];
+	textureBindingLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	textureBindingLayout.binding = 1;
+	textureBindingLayout.visibility = WGPUShaderStage_Fragment;
+	textureBindingLayout.texture.sampleType = WGPUTextureSampleType_Float;
+	textureBindingLayout.texture.viewDimension = WGPUTextureViewDimension_2DArray;
+
+	WGPUBindGroupLayoutEntry &instanceBindingLayout = bindingLayoutEntries[2];
+	instanceBindingLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	instanceBindingLayout.binding = 2;
+	instanceBindingLayout.visibility = WGPUShaderStage_Vertex;
+	instanceBindingLayout.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+	instanceBindingLayout.buffer.minBindingSize = sizeof(Scene::InstanceData);
+
+	WGPUBindGroupLayoutEntry &materialBindingLayout = bindingLayoutEntries[3];
+	materialBindingLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	materialBindingLayout.binding = 3;
+	materialBindingLayout.visibility = WGPUShaderStage_Fragment;
+	materialBindingLayout.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+	materialBindingLayout.buffer.minBindingSize = sizeof(TexturePool::Material);
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = bindingLayoutEntries.size();
+	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
+	WGPUBindGroupLayout bgLayout = wgpuDeviceCreateBindGroupLayout(m_wgpuCtx.device.get(), &bindGroupLayoutDesc);  // Needed to taked address of pointer
+	m_bindGroupLayout = WgpuBindGroupLayoutPtr(bgLayout, wgpuBindGroupLayoutRelease);
+
+	WGPUPipelineLayoutDescriptor pipelineLayoutDesc{};
+	pipelineLayoutDesc.bindGroupLayoutCount = 1;
+	pipelineLayoutDesc.bindGroupLayouts = &bgLayout;
+	m_pipelineLayout = WgpuPipelineLayoutPtr(
+			wgpuDeviceCreatePipelineLayout(m_wgpuCtx.device.get(), &pipelineLayoutDesc),
+			wgpuPipelineLayoutRelease);
+}
+
+uint32_t App::PipelineKey(uint32_t sampleCount, bool transparent)
+{
+	return (sampleCount << 1) | (transparent ? 1 : 0);
+}
+
+WGPUTextureFormat App::SceneFormat() const
+{
+	return m_options.hdr ? ColorGrading::kHdrFormat : m_wgpuCtx.renderFormat;
+}
+
+bool App::SceneEncodesSrgb() const
 {
+	return !m_options.hdr && !wgpuUtils::isSrgbFormat(m_wgpuCtx.renderFormat);
+}
+
+WGPURenderPipeline App::GetPipeline(uint32_t sampleCount, bool transparent)
+{
+	const uint32_t key = PipelineKey(sampleCount, transparent);
+	auto it = m_wgpuCtx.pipelines.find(key);
+	if (it != m_wgpuCtx.pipelines.end())
+		return it->second.get();
+
+	WgpuRenderPipelinePtr pipeline = WgpuRenderPipelineInitialize(sampleCount, transparent);
+	if (!pipeline)
+		return nullptr;
+
+	return m_wgpuCtx.pipelines.emplace(key, std::move(pipeline)).first->second.get();
+}
+
+WgpuRenderPipelinePtr App::WgpuRenderPipelineInitialize(uint32_t sampleCount, bool transparent)
+{
+	TRACE_SCOPE("WgpuRenderPipelineInitialize");
+
 	WGPURenderPipelineDescriptor pipelineDesc = {};
 	pipelineDesc.nextInChain = nullptr;
 
 	// Shader module
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPUShaderSourceWGSL shaderSourceDesc{};
-	shaderSourceDesc.chain.sType = WGPUSType_ShaderSourceWGSL;
-	shaderSourceDesc.code = WGPUStringView{GetShaderSource(), WGPU_STRLEN};
-#else
-	WGPUShaderModuleWGSLDescriptor shaderSourceDesc{};
-	shaderSourceDesc.chain.sType = WGPUSType_ShaderModuleWGSLDescriptor;
-	shaderSourceDesc.code = GetShaderSource();
-#endif
-	shaderSourceDesc.chain.next = nullptr;
-
-	WGPUShaderModuleDescriptor shaderDesc{};
-	shaderDesc.nextInChain = &shaderSourceDesc.chain;
-	WgpuShaderModulePtr shaderModule(
-			wgpuDeviceCreateShaderModule(m_wgpuCtx.device.get(), &shaderDesc),
-			wgpuShaderModuleRelease
-	);
+	WgpuShaderModulePtr shaderModule(wgpuUtils::createShaderModule(m_wgpuCtx.device.get(), GetShaderSource()), wgpuShaderModuleRelease);
 
 	// Vertex state
 	std::array<WGPUVertexAttribute, 3> vertAttribs;
 	// pos
 	vertAttribs[0].shaderLocation = 0;
-	vertAttribs[0].format = WGPUVertexFormat_Float32x2;
+	vertAttribs[0].format = WGPUVertexFormat_Float32x3;
 	vertAttribs[0].offset = m_verticies.m_attributeOffset[0];
 	// color
 	vertAttribs[1].shaderLocation = 1;
@@ -541,11 +777,38 @@ WgpuRenderPipelinePtr App::WgpuRenderPipelineInitialize()
 #else
 	fragment.entryPoint = "fs_main";
 #endif
-	fragment.constantCount = 0;
-	fragment.constants = nullptr;
+	// Without an sRGB view of the target the shader encodes its output
+	WGPUConstantEntry encodeSrgb{};
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	encodeSrgb.key = WGPUStringView{"encodeSrgb", WGPU_STRLEN};
+#else
+	encodeSrgb.key = "encodeSrgb";
+#endif
+	encodeSrgb.value = SceneEncodesSrgb() ? 1.0 : 0.0;
+	fragment.constantCount = 1;
+	fragment.constants = &encodeSrgb;
 
 	// Depth/Stencil state
-	pipelineDesc.depthStencil = nullptr;
+	WGPUDepthStencilState depthStencil{};
+	depthStencil.format = kDepthFormat;
+	// Transparent draws are tested against opaque geometry but must not hide each other
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	depthStencil.depthWriteEnabled = transparent ? WGPUOptionalBool_False : WGPUOptionalBool_True;
+#else
+	depthStencil.depthWriteEnabled = !transparent;
+#endif
+	depthStencil.depthCompare = WGPUCompareFunction_Less;
+	depthStencil.stencilFront.compare = WGPUCompareFunction_Always;
+	depthStencil.stencilFront.failOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.depthFailOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.passOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilBack = depthStencil.stencilFront;
+	depthStencil.stencilReadMask = 0;  // No stencil aspect in the depth format
+	depthStencil.stencilWriteMask = 0;
+	depthStencil.depthBias = 0;
+	depthStencil.depthBiasSlopeScale = 0;
+	depthStencil.depthBiasClamp = 0;
+	pipelineDesc.depthStencil = &depthStencil;
 
 	// Blend State
 	WGPUBlendState blend{};
@@ -557,11 +820,7 @@ WgpuRenderPipelinePtr App::WgpuRenderPipelineInitialize()
 	blend.alpha.operation = WGPUBlendOperation_Add;
 
 	WGPUColorTargetState colorTarget{};
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	colorTarget.format = wgpuUtils::getPreferredFormat(m_wgpuCtx.adapter.get(), m_wgpuCtx.surface.get());
-#else
-	colorTarget.format = wgpuSurfaceGetPreferredFormat(m_wgpuCtx.surface.get(), m_wgpuCtx.adapter.get());
-#endif
+	colorTarget.format = SceneFormat();
 	colorTarget.blend = &blend;
 	colorTarget.writeMask = WGPUColorWriteMask_All;
 
@@ -571,39 +830,10 @@ WgpuRenderPipelinePtr App::WgpuRenderPipelineInitialize()
 	pipelineDesc.fragment = &fragment;
 
 	// Multisampling state
-	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.count = sampleCount;
 	pipelineDesc.multisample.mask = ~0u;  // Enable all bits
 	pipelineDesc.multisample.alphaToCoverageEnabled = false;
 
-	// Binding Layout
-	std::array<WGPUBindGroupLayoutEntry, 2> bindingLayoutEntries;
-
-	WGPUBindGroupLayoutEntry &bindingLayout = bindingLayoutEntries[0];
-	bindingLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
-	bindingLayout.binding = 0;
-	bindingLayout.visibility = WGPUShaderStage_Vertex | WGPUShaderStage_Fragment;
-	bindingLayout.buffer.type = WGPUBufferBindingType_Uniform;
-	bindingLayout.buffer.minBindingSize = sizeof(Uniforms);
-
-	WGPUBindGroupLayoutEntry &textureBindingLayout = bindingLayoutEntries[1];
-	textureBindingLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
-	textureBindingLayout.binding = 1;
-	textureBindingLayout.visibility = WGPUShaderStage_Fragment;
-	textureBindingLayout.texture.sampleType = WGPUTextureSampleType_Float;
-	textureBindingLayout.texture.viewDimension = WGPUTextureViewDimension_2D;
-
-	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
-	bindGroupLayoutDesc.entryCount = bindingLayoutEntries.size();
-	bindGroupLayoutDesc.entries = bindingLayoutEntries.data();
-	WGPUBindGroupLayout bgLayout = wgpuDeviceCreateBindGroupLayout(m_wgpuCtx.device.get(), &bindGroupLayoutDesc);  // Needed to taked address of pointer
-	m_bindGroupLayout = WgpuBindGroupLayoutPtr(bgLayout, wgpuBindGroupLayoutRelease);
-
-	WGPUPipelineLayoutDescriptor pipelineLayoutDesc{};
-	pipelineLayoutDesc.bindGroupLayoutCount = 1;
-	pipelineLayoutDesc.bindGroupLayouts = &bgLayout;
-	m_pipelineLayout = WgpuPipelineLayoutPtr(
-			wgpuDeviceCreatePipelineLayout(m_wgpuCtx.device.get(), &pipelineLayoutDesc),
-			wgpuPipelineLayoutRelease);
 	pipelineDesc.layout = m_pipelineLayout.get();
 
 	return WgpuRenderPipelinePtr(
@@ -617,7 +847,7 @@ const char* App::GetShaderSource() const
 	static const char* shaderSource = R"(
 struct VertexInput
 {
-	@location(0) position: vec2f,
+	@location(0) position: vec3f,
 	@location(1) color: vec3f,
 	@location(2) uv: vec2f,
 };
@@ -627,25 +857,48 @@ struct VertexOutput
 	@builtin(position) position: vec4f,
 	@location(0) color: vec3f,
 	@location(1) uv: vec2f,
+	@location(2) @interpolate(flat) material: u32,
 };
 
 struct Uniforms
 {
-	ratio: f32,
-	gamma: f32,
-	color: vec4f,  // will be aligned to 16 byte boundary. Cpp struct must match
+	transform: mat4x4f,
+	color: vec4f,  // Cpp struct must match
+};
+
+struct Instance
+{
+	world: mat4x4f,
+	material: u32,  // Cpp Scene::InstanceData must match
+};
+
+struct Material
+{
+	uvRect: vec4f,  // Cpp TexturePool::Material must match
+	layer: u32,
 };
 
 @group(0) @binding(0) var<uniform> uniforms: Uniforms;
-@group(0) @binding(1) var texture: texture_2d<f32>;
+@group(0) @binding(1) var texture: texture_2d_array<f32>;
+@group(0) @binding(2) var<storage, read> instances: array<Instance>;
+@group(0) @binding(3) var<storage, read> materials: array<Material>;
+
+// Set when the target has no sRGB view to encode the output in hardware
+override encodeSrgb: bool = false;
+
+fn linearToSrgb(color: vec3f) -> vec3f  // Cpp ColorGrading::LinearToSrgb must match
+{
+	return select(1.055 * pow(color, vec3f(1.0 / 2.4)) - 0.055, color * 12.92, color <= vec3f(0.0031308));
+}
 
 @vertex
-fn vs_main(in: VertexInput) -> VertexOutput
+fn vs_main(in: VertexInput, @builtin(instance_index) instance: u32) -> VertexOutput
 {
 	var out: VertexOutput;
-	out.position = vec4f(in.position.x, in.position.y * uniforms.ratio, 0.0, 1.0);
+	out.position = uniforms.transform * instances[instance].world * vec4f(in.position, 1.0);
 	out.color = in.color;
 	out.uv = in.uv;
+	out.material = instances[instance].material;
 
 	return out;
 }
@@ -655,12 +908,17 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4f  // output location is the Co
 {
 	//let color = in.color * uniforms.color.rgb;
 
-	let texelCoords = vec2i( in.uv * vec2f(textureDimensions(texture)) );
-	let color = textureLoad(texture, texelCoords, 0).rgb * uniforms.color.rgb;
-
-	// Gamma correction
-	let linearColor = pow(color, vec3f(uniforms.gamma));
-	return vec4f(linearColor, 1.0);
+	// The material's region of the pool layer, clamped so neighbouring textures never bleed in
+	let material = materials[in.material];
+	let region = material.uvRect * vec2f(textureDimensions(texture)).xyxy;
+	let texelCoords = vec2i( min(region.xy + in.uv * region.zw, region.xy + region.zw - 1.0) );
+	// Linear, the sRGB texture is decoded by the load and the sRGB or HDR target takes it as it is
+	let color = textureLoad(texture, texelCoords, material.layer, 0).rgb * uniforms.color.rgb;
+	if (encodeSrgb)
+	{
+		return vec4f(linearToSrgb(color), 1.0);
+	}
+	return vec4f(color, 1.0);
 })";
 
 	return shaderSource;
@@ -668,7 +926,9 @@ fn fs_main(in: VertexOutput) -> @location(0) vec4f  // output location is the Co
 
 void App::WgpuBindGroupsInitialize()
 {
-	std::array<WGPUBindGroupEntry, 2> bindings{};
+	TRACE_SCOPE("WgpuBindGroupsInitialize");
+
+	std::array<WGPUBindGroupEntry, 4> bindings{};
 
 	WGPUBindGroupEntry &binding = bindings[0];
 	binding.binding = 0;
@@ -678,7 +938,19 @@ void App::WgpuBindGroupsInitialize()
 
 	WGPUBindGroupEntry &textureBinding = bindings[1];
 	textureBinding.binding = 1;
-	textureBinding.textureView = m_texture.textureView.get();
+	textureBinding.textureView = m_texturePool.View();
+
+	WGPUBindGroupEntry &instanceBinding = bindings[2];
+	instanceBinding.binding = 2;
+	instanceBinding.buffer = m_instanceBuffer.get();
+	instanceBinding.offset = 0;
+	instanceBinding.size = m_instanceCapacity * sizeof(Scene::InstanceData);
+
+	WGPUBindGroupEntry &materialBinding = bindings[3];
+	materialBinding.binding = 3;
+	materialBinding.buffer = m_texturePool.MaterialBuffer();
+	materialBinding.offset = 0;
+	materialBinding.size = m_texturePool.MaterialBufferSize();
 
 	WGPUBindGroupDescriptor bindGroupDesc{};
 	bindGroupDesc.layout = m_bindGroupLayout.get();
@@ -689,82 +961,202 @@ void App::WgpuBindGroupsInitialize()
 			wgpuBindGroupRelease);
 }
 
-void App::WgpuTextureInitialize()
+void App::TextureDataInitialize()
 {
-	WGPUTextureDescriptor textureDesc{};
-	textureDesc.dimension = WGPUTextureDimension_2D;
-	textureDesc.size = {256, 256, 1};
-	textureDesc.mipLevelCount = 1;
-	textureDesc.sampleCount = 1;
-	textureDesc.format = WGPUTextureFormat_RGBA8Unorm;
-	textureDesc.usage = WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
-	textureDesc.viewFormatCount = 0;
-	textureDesc.viewFormats = nullptr;
+	TRACE_SCOPE("TextureDataInitialize");
 
-	m_texture.texture = WgpuTexturePtr(wgpuDeviceCreateTexture(m_wgpuCtx.device.get(), &textureDesc), wgpuTextureRelease);
+	// sample image data, in the layout the image filters work on
+	m_startupData.textures.push_back(image::TestPattern(256, 256));
 
-	WGPUTextureViewDescriptor viewDesc{};
-	viewDesc.aspect = WGPUTextureAspect_All;
-	viewDesc.baseArrayLayer = 0;
-	viewDesc.arrayLayerCount = 1;
-	viewDesc.baseMipLevel = 0;
-	viewDesc.mipLevelCount = 1;
-	viewDesc.dimension = WGPUTextureViewDimension_2D;
-	viewDesc.format = textureDesc.format;
+	// A smaller grayscale one for the triangle, packed next to the first in the same layer
+	const Image pattern = image::TestPattern(128, 128);
+	Image grayscale;
+	image::reference::ConvertColor(pattern, image::kGrayscale, grayscale);
+	m_startupData.textures.push_back(std::move(grayscale));
+}
 
-	m_texture.textureView = WgpuTextureViewPtr(wgpuTextureCreateView(m_texture.texture.get(), &viewDesc), wgpuTextureViewRelease);
+bool App::WgpuTextureInitialize()
+{
+	TRACE_SCOPE("WgpuTextureInitialize");
 
-	// sample image data
-	std::vector<uint8_t> pixels(4 * textureDesc.size.width * textureDesc.size.height);
-	for (size_t i = 0; i < textureDesc.size.height; ++i)
+	m_meshTextures = std::move(m_startupData.textures);
+	m_meshTextures.resize(std::min(m_meshTextures.size(), m_meshes.size()));
+	m_evictedTextures.clear();
+	if (!m_texturePool.Initialize(m_wgpuCtx.device.get(), m_wgpuCtx.queue.get(), m_wgpuCtx.limits, kTextureLayerSize, kTextureLayers, kMaxMaterials))
+		return false;
+
+	for (size_t i = 0; i < m_meshTextures.size(); ++i)
 	{
-		for (size_t j = 0; j < textureDesc.size.width; ++j)
-		{
-			uint8_t *p = &pixels[4 * (i * textureDesc.size.width + j)];
-			p[0] = (uint8_t)i;
-			p[1] = (uint8_t)j;
-			p[2] = 255;
-			p[3] = 255;
-		}
+		if (!AddMeshTexture(i))
+			return false;
 	}
+	return true;
+}
 
-#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPUImageCopyTexture destination{};
-	WGPUTextureDataLayout source{};
-#else
-	WGPUTexelCopyTextureInfo destination{};
-	WGPUTexelCopyBufferLayout source{};
-#endif
+bool App::AddMeshTexture(size_t mesh)
+{
+	// The pool must not be called back from its eviction callback, the upload waits for the next frame
+	const TexturePool::Handle material = m_texturePool.Add(m_meshTextures[mesh], [this, mesh]() { m_evictedTextures.push_back(mesh); });
+	if (material == TexturePool::kInvalidHandle)
+		return false;
+	m_scene.SetMaterial(m_meshes[mesh].object, material);
+	return true;
+}
 
-	destination.texture = m_texture.texture.get();
-	destination.mipLevel = 0;  // set to first (original) image mip level
-	destination.origin = {0, 0, 0};
-	destination.aspect = WGPUTextureAspect_All;  // only relevant for depth/stencil textures
+void App::ReloadEvictedTextures()
+{
+	if (m_evictedTextures.empty())
+		return;
 
-	source.offset = 0;
-	source.bytesPerRow = 4 * sizeof(pixels[0]) * textureDesc.size.width;
-	source.rowsPerImage = textureDesc.size.height;
+	TRACE_SCOPE("ReloadEvictedTextures");
 
-	wgpuQueueWriteTexture(m_wgpuCtx.queue.get(), &destination, pixels.data(), pixels.size(), &source, &textureDesc.size);
+	// Reloading may evict others, which wait for the next frame rather than ping-ponging within this one
+	const std::vector<size_t> evicted = std::move(m_evictedTextures);
+	m_evictedTextures.clear();
+	for (size_t mesh : evicted)
+	{
+		if (!AddMeshTexture(mesh))
+			std::cerr << "Could not reload the texture of mesh " << mesh << std::endl;
+	}
 }
 
 void App::Tick()
 {
-	glfwPollEvents();
+	TRACE_SCOPE("Tick");
+
+	const std::chrono::steady_clock::time_point tickTime = std::chrono::steady_clock::now();
+	m_metrics.frameTime.Record(std::chrono::duration_cast<std::chrono::microseconds>(tickTime - m_lastTickTime).count());
+	m_lastTickTime = tickTime;
+	m_metrics.submitsPerFrame.Set(m_submitsThisFrame);
+	m_submitsThisFrame = 0;
+
+	{
+		TRACE_SCOPE("PollEvents");
+		glfwPollEvents();
+		// Jobs that need the main thread, such as GLFW calls
+		m_jobs.PumpMainThread();
+	}
+
+	if (m_surfaceDirty)
+		ResizeSurface();
+
+	// Minimized, nothing to render into. Submitted work still completes and is collected, and the
+	// loop sleeps on the window's events instead of spinning.
+	if (m_windowDim.width == 0 || m_windowDim.height == 0)
+	{
+		CollectDevice();
+#if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
+		TRACE_SCOPE("WaitEvents");
+		glfwWaitEventsTimeout(kMinimizedWaitSeconds);
+#endif
+		return;
+	}
 
 	WgpuTexturePtr nextTexture( nullptr, [](WGPUTexture){} );
 	WgpuTextureViewPtr nextTextureView( nullptr, [](WGPUTextureView){} );
 	{
 		auto [textureView, texture] = GetNextSurfaceTextureView();
-		if (textureView == nullptr) // swap chain becomes invalidated on a window resize
+		if (textureView == nullptr)
 		{
-			std::cerr << "Skipping render frame" << std::endl;
+			m_metrics.droppedFrames.Add();
+			CollectDevice();
 			return;
 		}
 		nextTexture = WgpuTexturePtr(texture, wgpuTextureRelease);
 		nextTextureView = WgpuTextureViewPtr(textureView, wgpuTextureViewRelease);
 	}
 
+	const std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+	RenderFrame({
+		nextTexture.get(),
+		nextTextureView.get(),
+		m_options.sampleCount
+	});
+	// The CPU time of the frame leaves out acquiring and presenting, which wait for vsync
+	if (m_options.dynamicResolution && m_firstFramePresented)
+		UpdateRenderScale(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count());
+
+#if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	{
+		TRACE_SCOPE("Present");
+		wgpuSurfacePresent(m_wgpuCtx.surface.get());
+	}
+#endif
+
+	if (!m_firstFramePresented)
+	{
+		m_firstFramePresented = true;
+		const auto timeToFirstFrame = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_launchTime);
+		m_metrics.timeToFirstFrame.Set(timeToFirstFrame.count());
+		std::cout << "First frame presented " << timeToFirstFrame.count() << " ms after launch" << std::endl;
+	}
+
+	CollectDevice();
+}
+
+void App::CollectDevice()
+{
+	PollDevice();
+
+	// Frame fences are signalled while polling the device above
+	{
+		TRACE_SCOPE("CollectReleases");
+		m_releaseQueue.Collect(kReleaseBudgetPerFrame);
+	}
+
+	LogDeviceErrors();
+}
+
+void App::UpdateRenderScale(double cpuMs)
+{
+	double frameMs = cpuMs;
+	if (m_gpuTimer.Available())
+	{
+		// Measurements arrive a few frames late, each one is fed once
+		if (m_gpuTimer.FramesMeasured() == m_gpuFramesMeasured)
+			return;
+		m_gpuFramesMeasured = m_gpuTimer.FramesMeasured();
+		const double gpuMs = m_gpuTimer.LastFrameMs();
+		m_metrics.gpuFrameTime.Set(std::llround(gpuMs * 1000.0));
+		frameMs = std::max(cpuMs, gpuMs);
+	}
+
+	const float scale = m_dynamicResolution.Update(frameMs);
+	m_metrics.renderScale.Set(std::lround(scale * 100.0f));
+}
+
+void App::UpdateScene()
+{
+	TRACE_SCOPE("UpdateScene");
+
+	const bool reindexed = m_scene.Update(m_jobs);
+	// Occlusion results are kept by instance index
+	if (reindexed)
+		m_occlusion.Invalidate();
+	assert(m_scene.Size() <= m_instanceCapacity);
+	m_bvh.Update(m_scene.WorldBoundsCenters(), m_scene.WorldBoundsExtents(), m_scene.Size(), m_scene.ChangedRanges(), reindexed);
+
+	const Scene::InstanceData *instances = m_scene.Instances();
+	constexpr size_t stride = sizeof(Scene::InstanceData);
+	size_t changed = 0;
+	for (const Scene::Range &range : m_scene.ChangedRanges())
+		changed += range.count;
+
+	// Past half the scene one upload of everything costs less than the many calls
+	if (reindexed || changed > m_scene.Size() / 2)
+	{
+		WriteBuffer(m_instanceBuffer.get(), 0, instances, m_scene.Size() * stride);
+		return;
+	}
+
+	for (const Scene::Range &range : m_scene.ChangedRanges())
+		WriteBuffer(m_instanceBuffer.get(), range.first * stride, instances + range.first, range.count * stride);
+}
+
+void App::RenderFrame(const FrameTargets& targets)
+{
+	TRACE_SCOPE("RenderFrame");
+
 	static unsigned long tick = 0;
 	static float colorVal = 1.0f;
 	static float delta = .01;
@@ -774,131 +1166,393 @@ void App::Tick()
 		if (colorVal < 0 || colorVal > 1) { delta *= -1; }
 	}
 
+	// Before the scene uploads the instances, which carry the material IDs
+	ReloadEvictedTextures();
+	UpdateScene();
+
 	// Update uniforms
-	UpdateGamma(nextTexture.get());
 	m_uniforms.color = {colorVal, colorVal, colorVal, 1.0f};
-	wgpuQueueWriteBuffer(m_wgpuCtx.queue.get(), m_uniformsBuffer.get(), 0, &m_uniforms, sizeof(Uniforms));
+	{
+		TRACE_SCOPE("UpdateUniforms");
+		WriteBuffer(m_uniformsBuffer.get(), 0, &m_uniforms, sizeof(Uniforms));
+	}
 
-	// First create the command encoder for this frame
-	WGPUCommandEncoderDescriptor encoderDesc{};
-	encoderDesc.nextInChain = nullptr;
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	encoderDesc.label = {"My command encoder", WGPU_STRLEN};
-#else
-	encoderDesc.label = "My command encoder";
-#endif
-	WgpuCommandEncoderPtr encoder(
-			wgpuDeviceCreateCommandEncoder(m_wgpuCtx.device.get(), &encoderDesc),
-			wgpuCommandEncoderRelease
-	);
+	{
+		TRACE_SCOPE("Cull");
+		m_bvh.Cull(Frustum::FromMatrix(m_uniforms.transform), m_jobs, m_visibleObjects);
+		m_instanceVisible.assign(m_scene.Size(), 0);
+		for (uint32_t instance : m_visibleObjects.indices)
+			m_instanceVisible[instance] = 1;
+		m_metrics.culledObjects.Set(static_cast<int64_t>(m_visibleObjects.culled));
+	}
 
-	// Next create the render pass encoder
-	WGPURenderPassColorAttachment renderPassColorAttachment{};
-	renderPassColorAttachment.view = nextTextureView.get();
-	renderPassColorAttachment.resolveTarget = nullptr;
-	renderPassColorAttachment.loadOp = WGPULoadOp_Clear;
-	renderPassColorAttachment.storeOp = WGPUStoreOp_Store;
-	renderPassColorAttachment.clearValue = WGPUColor{ colorVal, .25, .4, 1.0 };  // This will default to sRGB or RGB  depending on preferred texture format
-#if !defined(WEBGPU_BACKEND_WGPU)
-	renderPassColorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
-#endif
+	if (m_options.occlusionCulling)
+	{
+		m_occlusion.BeginFrame(m_uniforms.transform, m_visibleObjects.indices, m_scene.WorldBoundsCenters(), m_scene.WorldBoundsExtents(), m_scene.Size());
+		const OcclusionCulling::Stats &occlusionStats = m_occlusion.LastStats();
+		m_metrics.occludedObjects.Set(occlusionStats.occluded);
+		m_metrics.visibleObjects.Set(occlusionStats.visible);
+		m_metrics.occlusionQueries.Set(occlusionStats.queries);
+	}
 
-	WGPURenderPassDescriptor renderPassDesc{};
-	renderPassDesc.colorAttachmentCount = 1;
-	renderPassDesc.colorAttachments = &renderPassColorAttachment;
-	renderPassDesc.nextInChain = nullptr;
-	renderPassDesc.depthStencilAttachment = nullptr;
+	const uint32_t width = static_cast<uint32_t>(m_windowDim.width);
+	const uint32_t height = static_cast<uint32_t>(m_windowDim.height);
+	const bool scaled = m_options.dynamicResolution;
+	const uint32_t sceneWidth = scaled ? m_dynamicResolution.ScaledSize(width) : width;
+	const uint32_t sceneHeight = scaled ? m_dynamicResolution.ScaledSize(height) : height;
 
-	// useful for debugging
-	renderPassDesc.timestampWrites = nullptr;
+	m_renderQueue.Clear();
+	const math::ConstFloat3Soa centers = m_scene.WorldBoundsCenters();
+	uint64_t triangles = 0;
+	for (Mesh &mesh : m_meshes)
+	{
+		const uint32_t instance = m_scene.InstanceIndex(mesh.object);
+		if (!m_instanceVisible[instance] || m_occlusion.IsOccluded(instance))
+			continue;
 
-	// Use render pipeline created during initialization to make a draw call
-	WgpuRenderPassEncoderPtr renderPass(
-			wgpuCommandEncoderBeginRenderPass(encoder.get(), &renderPassDesc),
-			wgpuRenderPassEncoderRelease
-	);
-	wgpuRenderPassEncoderSetPipeline(renderPass.get(), m_wgpuCtx.pipeline.get());
+		// Levels are picked from the error they show at the scene's resolution
+		if (m_options.lodErrorPixels > 0.0f && mesh.levels.size() > 1)
+		{
+			const math::Vec3 center = {centers.x[instance], centers.y[instance], centers.z[instance]};
+			const float pixelsPerUnit = MeshLod::PixelsPerUnit(m_uniforms.transform, m_scene.World(mesh.object), center, static_cast<float>(sceneHeight));
+			mesh.level = MeshLod::Select(mesh.levels.data(), static_cast<uint32_t>(mesh.levels.size()), pixelsPerUnit, mesh.level,
+				m_options.lodErrorPixels);
+		}
+		else
+			mesh.level = 0;
+		const MeshLod::Level &level = mesh.levels[mesh.level];
+		triangles += level.indexCount / 3;
+		m_texturePool.Touch(m_scene.MaterialIds()[instance]);
+
+		const RenderQueue::Pass pass = mesh.transparent ? RenderQueue::Pass::Transparent : RenderQueue::Pass::Opaque;
+		RenderQueue::DrawPacket packet{};
+		packet.key = RenderQueue::MakeKey(pass, PipelineKey(targets.sampleCount, mesh.transparent), m_scene.MaterialIds()[instance], mesh.depth);
+		packet.pipeline = GetPipeline(targets.sampleCount, mesh.transparent);
+		packet.bindGroup = m_bindGroup.get();
+		packet.vertexBuffer = m_verticies.m_wgpuBuffer.get();
+		packet.vertexBufferSize = m_verticies.m_size;
+		packet.indexBuffer = m_indicies.m_wgpuBuffer.get();
+		packet.indexBufferSize = m_indicies.m_size;
+		packet.firstIndex = level.firstIndex;
+		packet.indexCount = level.indexCount;
+		packet.firstInstance = instance;
+		m_renderQueue.Submit(packet);
+	}
+	m_metrics.drawnTriangles.Set(static_cast<int64_t>(triangles));
+	{
+		TRACE_SCOPE("SortDraws");
+		m_renderQueue.Sort();
+	}
+
+	// Thumbnails of the mesh textures along the top left
+	constexpr float kThumbnailSize = 64.0f;
+	constexpr float kMargin = 8.0f;
+	m_sprites.SetBlend(SpriteBatcher::Blend::Alpha);
+	for (size_t i = 0; i < m_meshes.size(); ++i)
+	{
+		const SpriteBatcher::Rect rect{kMargin + i * (kThumbnailSize + kMargin), kMargin, kThumbnailSize, kThumbnailSize};
+		const uint32_t material = m_scene.MaterialIds()[m_scene.InstanceIndex(m_meshes[i].object)];
+		m_texturePool.Touch(material);
+		m_sprites.DrawQuad(rect, {0, 0, 1, 1}, Image::Pack(255, 255, 255, 224), material);
+	}
+
+	// The multisampled color and the depth only live within the frame, so the graph pools them
+	m_renderGraph.Begin(m_wgpuCtx.device.get());
+	const RenderGraph::Resource backbuffer = m_renderGraph.Import("Backbuffer", targets.target, targets.view);
+	m_renderGraph.MarkOutput(backbuffer);
+
+	// With HDR the scene is tone mapped and graded into the backbuffer by a last pass, which also
+	// upscales it. Without, a scene rendered at a dynamic resolution is upscaled by a pass of its own.
+	RenderGraph::Resource sceneColor = backbuffer;
+	if (m_options.hdr || scaled)
+		sceneColor = m_renderGraph.CreateTexture("SceneColor", {sceneWidth, sceneHeight, SceneFormat(), 1,
+			WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_TextureBinding});
+
+	// The clear color is given sRGB encoded like the textures, the target takes linear values unless
+	// the shaders encode for it
+	const float clearColor[3] = {colorVal, .25f, .4f};
+	auto clearChannel = [this](float value) { return SceneEncodesSrgb() ? value : ColorGrading::SrgbToLinear(value); };
+	RenderGraph::ColorAttachment color;
+	color.texture = sceneColor;
+	color.clearValue = WGPUColor{ clearChannel(clearColor[0]), clearChannel(clearColor[1]), clearChannel(clearColor[2]), 1.0 };
+	if (targets.sampleCount > 1)
+	{
+		// Samples are resolved into the scene color at the end of the pass
+		color.texture = m_renderGraph.CreateTexture("MultisampledColor", {sceneWidth, sceneHeight, SceneFormat(), targets.sampleCount});
+		color.resolveTarget = sceneColor;
+	}
+	RenderGraph::DepthAttachment depth;
+	depth.texture = m_renderGraph.CreateTexture("Depth", {sceneWidth, sceneHeight, kDepthFormat, targets.sampleCount});
+
+	m_renderGraph.AddRenderPass("Scene", {color}, depth, [this, &targets, width, height](WGPURenderPassEncoder pass) {
+		{
+			TRACE_SCOPE("RecordDraws");
+			m_renderQueue.Execute(pass);
+		}
+		// Transparent draws leave the depth alone, so the boxes are tested against the opaque ones
+		m_occlusion.Record(pass, targets.sampleCount);
+		{
+			TRACE_SCOPE("DrawSprites");
+			// Positioned in window pixels, whatever the size the scene renders at
+			m_sprites.Flush(pass, targets.sampleCount, width, height);
+			m_metrics.spriteQuads.Set(m_sprites.LastStats().quads);
+			m_metrics.spriteBatches.Set(m_sprites.LastStats().batches);
+		}
+	}).OcclusionQuerySet(m_occlusion.QuerySet());
 
-	wgpuRenderPassEncoderSetVertexBuffer(renderPass.get(), 0, m_verticies.m_wgpuBuffer.get(), 0, m_verticies.m_size);
-	wgpuRenderPassEncoderSetIndexBuffer(renderPass.get(), m_indicies.m_wgpuBuffer.get(), WGPUIndexFormat_Uint32, 0, m_indicies.m_size);
+	if (m_options.hdr)
+		m_colorGrading.AddPass(m_renderGraph, sceneColor, backbuffer);
+	else if (scaled)
+		m_dynamicResolution.AddUpscalePass(m_renderGraph, sceneColor, backbuffer);
 
-	wgpuRenderPassEncoderSetBindGroup(renderPass.get(), 0, m_bindGroup.get(), 0, nullptr);
+	if (!m_renderGraph.Compile())
+		return;
+	if (scaled)
+		m_gpuTimer.BeginFrame(m_renderGraph);
+	WgpuCommandBufferPtr command = m_renderGraph.Execute("Frame");
+	WgpuCommandBufferPtr resolveTimestamps = m_gpuTimer.Resolve();
+	WgpuCommandBufferPtr resolveOcclusion = m_occlusion.Resolve();
 
-	wgpuRenderPassEncoderDrawIndexed(renderPass.get(), m_indicies.m_count, 1, 0, 0, 0);
-	wgpuRenderPassEncoderEnd(renderPass.get());
+	{
+		// Submit the command to the queue, with the query resolves in the same submission
+		TRACE_SCOPE("Submit");
+		std::array<WGPUCommandBuffer, 3> buffers{command.get()};
+		size_t bufferCount = 1;
+		for (WGPUCommandBuffer resolve : {resolveTimestamps.get(), resolveOcclusion.get()})
+		{
+			if (resolve)
+				buffers[bufferCount++] = resolve;
+		}
+		wgpuQueueSubmit(m_wgpuCtx.queue.get(), bufferCount, buffers.data());
+		m_metrics.submits.Add();
+		++m_submitsThisFrame;
+	}
+	m_gpuTimer.EndFrame();
+	m_occlusion.EndFrame();
+	// The frame's command buffers go once the GPU is done with the frame, not while it still runs
+	m_releaseQueue.Release(std::move(command));
+	m_releaseQueue.Release(std::move(resolveTimestamps));
+	m_releaseQueue.Release(std::move(resolveOcclusion));
+	m_releaseQueue.EndFrame(m_wgpuCtx.queue.get());
 
-	// create the command
-	WGPUCommandBufferDescriptor cmdBufferDesc{};
-	cmdBufferDesc.nextInChain = nullptr;
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	cmdBufferDesc.label = {"Command Buffer", WGPU_STRLEN};
+	++tick;
+}
+
+void App::PollDevice()
+{
+	TRACE_SCOPE("PollDevice");
+	m_wgpuCtx.events.Pump();
+}
+
+void App::WaitForIdle()
+{
+	TRACE_SCOPE("WaitForIdle");
+
+	// Completes after every frame submitted so far, whose fences then complete on the next pump
+	const GpuRequest<bool> idle = m_wgpuCtx.events.OnSubmittedWorkDone(m_wgpuCtx.queue.get());
+	m_wgpuCtx.events.Wait(idle);
+	PollDevice();
+}
+
+WgpuBufferPtr App::CreateBuffer(const WGPUBufferDescriptor& desc) const
+{
+	return GpuMemory::Global().CreateBuffer(m_wgpuCtx.device.get(), desc);
+}
+
+WgpuTexturePtr App::CreateTexture(const WGPUTextureDescriptor& desc) const
+{
+	return GpuMemory::Global().CreateTexture(m_wgpuCtx.device.get(), desc);
+}
+
+void App::WriteBuffer(WGPUBuffer buffer, uint64_t offset, const void* data, size_t size)
+{
+	wgpuQueueWriteBuffer(m_wgpuCtx.queue.get(), buffer, offset, data, size);
+	m_metrics.bytesUploaded.Add(size);
+}
+
+void App::WriteTexture(const WgpuTexelCopyTextureInfo& destination, const void* data, size_t size, const WgpuTexelCopyBufferLayout& layout, const WGPUExtent3D& extent)
+{
+	wgpuQueueWriteTexture(m_wgpuCtx.queue.get(), &destination, data, size, &layout, &extent);
+	m_metrics.bytesUploaded.Add(size);
+}
+
+App::WgpuTexture App::CreateRenderTarget(WGPUTextureFormat format, const WindowDimensions& dim, uint32_t sampleCount) const
+{
+	WGPUTextureDescriptor textureDesc{};
+	textureDesc.dimension = WGPUTextureDimension_2D;
+	textureDesc.size = {static_cast<uint32_t>(dim.width), static_cast<uint32_t>(dim.height), 1};
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = sampleCount;
+	textureDesc.format = format;
+	textureDesc.usage = WGPUTextureUsage_RenderAttachment;
+	textureDesc.viewFormatCount = 0;
+	textureDesc.viewFormats = nullptr;
+
+	WgpuTexture target;
+	target.texture = CreateTexture(textureDesc);
+
+	WGPUTextureViewDescriptor viewDesc{};
+	viewDesc.aspect = WGPUTextureAspect_All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = 1;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = WGPUTextureViewDimension_2D;
+	viewDesc.format = format;
+
+	target.textureView = WgpuTextureViewPtr(wgpuTextureCreateView(target.texture.get(), &viewDesc), wgpuTextureViewRelease);
+	return target;
+}
+
+void App::RunBenchmark()
+{
+#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	std::cerr << "Benchmark is not supported on Emscripten" << std::endl;
 #else
-	cmdBufferDesc.label = "Command Buffer";
-#endif
-	WgpuCommandBufferPtr command(
-			wgpuCommandEncoderFinish(encoder.get(), &cmdBufferDesc),
-			wgpuCommandBufferRelease
-	);
+	using Clock = std::chrono::steady_clock;
+	using Ms = std::chrono::duration<double, std::milli>;
+
+	// Render offscreen so presentation (and vsync) is not part of the measurement
+	WgpuTexture resolveTarget = CreateRenderTarget(m_wgpuCtx.renderFormat, m_windowDim, 1);
+	constexpr uint32_t warmupFrames = 10;
 
+	std::cout << "Benchmark: " << m_options.benchFrames << " frames at " << m_windowDim.width << "x" << m_windowDim.height << std::endl;
+	for (uint32_t sampleCount : {1u, 4u})
 	{
-		// Submit the command to the queue
-		WGPUCommandBuffer buf = command.get();  // Hack to get the address of the pointer
-		wgpuQueueSubmit(m_wgpuCtx.queue.get(), 1, &buf);
+		if (!GetPipeline(sampleCount, false) || !GetPipeline(sampleCount, true))
+		{
+			std::cerr << "Could not create pipeline for " << sampleCount << "x MSAA" << std::endl;
+			continue;
+		}
+
+		const FrameTargets targets{
+			resolveTarget.texture.get(),
+			resolveTarget.textureView.get(),
+			sampleCount
+		};
+
+		for (uint32_t i = 0; i < warmupFrames; ++i)
+			RenderFrame(targets);
+		WaitForIdle();
+
+		Ms cpuTime{};
+		m_renderQueue.ResetStats();
+		const Clock::time_point start = Clock::now();
+		for (uint32_t i = 0; i < m_options.benchFrames; ++i)
+		{
+			const Clock::time_point frameStart = Clock::now();
+			RenderFrame(targets);
+			cpuTime += Clock::now() - frameStart;
+			PollDevice();
+		}
+		WaitForIdle();
+		const Ms totalTime = Clock::now() - start;
+
+		std::cout << "  " << sampleCount << "x MSAA: "
+			<< totalTime.count() / m_options.benchFrames << " ms/frame total, "
+			<< cpuTime.count() / m_options.benchFrames << " ms/frame CPU" << std::endl;
+
+		const RenderQueue::Stats &stats = m_renderQueue.GetStats();
+		std::cout << "    " << stats.draws / m_options.benchFrames << " draws/frame, "
+			<< (stats.pipelineChanges + stats.bindGroupChanges + stats.vertexBufferChanges + stats.indexBufferChanges) / m_options.benchFrames
+			<< " state changes/frame, "
+			<< stats.stateChangesAvoided / m_options.benchFrames << " avoided/frame" << std::endl;
+
+		const RenderGraph::Stats &graphStats = m_renderGraph.GetStats();
+		std::cout << "    " << graphStats.passes << " passes (" << graphStats.culledPasses << " culled), "
+			<< graphStats.transientTextures << " transient textures in " << graphStats.physicalTextures << ", "
+			<< graphStats.physicalBytes / (1024 * 1024) << " of " << graphStats.transientBytes / (1024 * 1024) << " MiB" << std::endl;
+
+		if (m_options.occlusionCulling)
+		{
+			const OcclusionCulling::Stats &occlusionStats = m_occlusion.LastStats();
+			std::cout << "    " << occlusionStats.queries << " occlusion queries, " << occlusionStats.occluded << " occluded and "
+				<< occlusionStats.visible << " visible objects in the last frame" << std::endl;
+		}
+
+		m_releaseQueue.Collect();
 	}
 
-#if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
-	wgpuSurfacePresent(m_wgpuCtx.surface.get());
-#endif
+	// A budget nothing fits in evicts every streamable texture, the graph's, and the next frame must recreate them
+	{
+		const FrameTargets targets{resolveTarget.texture.get(), resolveTarget.textureView.get(), 1};
+		RenderFrame(targets);
+		WaitForIdle();
+		const uint32_t physicalTextures = m_renderGraph.GetStats().physicalTextures;
+		const uint64_t evictionsBefore = GpuMemory::Global().GetReport().evictions;
+		GpuMemory::Global().SetBudget(1);
+		const uint64_t evictions = GpuMemory::Global().GetReport().evictions - evictionsBefore;
+		GpuMemory::Global().SetBudget(m_options.gpuBudget);
+		RenderFrame(targets);
+		WaitForIdle();
+		m_releaseQueue.Collect();
+
+		const bool ok = physicalTextures > 0 && evictions >= physicalTextures && m_renderGraph.GetStats().physicalTextures == physicalTextures;
+		std::cout << "  memory budget check: " << (ok ? "passed" : "FAILED") << " (" << evictions << " evicted, "
+			<< m_renderGraph.GetStats().physicalTextures << " of " << physicalTextures << " graph textures recreated)" << std::endl;
+	}
 
-#if defined(WEBGPU_BACKEND_DAWN)
-	wgpuDeviceTick(m_wgpuCtx.device.get());
-#elif defined(WEBGPU_BACKEND_WGPU)
-	wgpuDevicePoll(m_wgpuCtx.device.get(), false, nullptr);
-#endif
+	CheckColorGrading();
 
-	++tick;
+	GpuMemory::Global().PrintReport(std::cout);
 	LogDeviceErrors();
+#endif
 }
 
 std::tuple<WGPUTextureView, WGPUTexture> App::GetNextSurfaceTextureView()
 {
+	TRACE_SCOPE("AcquireSurfaceTexture");
+
 	WGPUSurfaceTexture surfaceTexture;
-	wgpuSurfaceGetCurrentTexture(m_wgpuCtx.surface.get(), &surfaceTexture);
 
-	switch(surfaceTexture.status)
+	// A surface invalidated by a resize is reconfigured and acquired again straight away instead of
+	// dropping the frame. One retry is enough since the new configuration matches the framebuffer.
+	constexpr int maxAttempts = 2;
+	bool acquired = false;
+	for (int attempt = 0; attempt < maxAttempts && !acquired; ++attempt)
 	{
+		wgpuSurfaceGetCurrentTexture(m_wgpuCtx.surface.get(), &surfaceTexture);
+
+		switch(surfaceTexture.status)
+		{
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-		case WGPUSurfaceGetCurrentTextureStatus_SuccessOptimal:
-		case WGPUSurfaceGetCurrentTextureStatus_SuccessSuboptimal:
+			case WGPUSurfaceGetCurrentTextureStatus_SuccessOptimal:
+			case WGPUSurfaceGetCurrentTextureStatus_SuccessSuboptimal:
 #else
-		case WGPUSurfaceGetCurrentTextureStatus_Success:
+			case WGPUSurfaceGetCurrentTextureStatus_Success:
 #endif
-			break;
-		case WGPUSurfaceGetCurrentTextureStatus_Outdated:
-		case WGPUSurfaceGetCurrentTextureStatus_Timeout:
-		case WGPUSurfaceGetCurrentTextureStatus_Lost:
-		{
-			// Reconfigure the surface skip current frame
-			if (surfaceTexture.texture != nullptr)
-				wgpuTextureRelease(surfaceTexture.texture);
-
-			glfwGetWindowSize(m_window.get(), &m_windowDim.width, &m_windowDim.height);
-			wgpuUtils::configureSurface(m_wgpuCtx.surface.get(), m_wgpuCtx.device.get(), m_wgpuCtx.adapter.get(), m_windowDim.width, m_windowDim.height);
-
-			return {nullptr, nullptr};
-		}
+				acquired = true;
+				break;
+			case WGPUSurfaceGetCurrentTextureStatus_Outdated:
+			case WGPUSurfaceGetCurrentTextureStatus_Lost:
+				if (surfaceTexture.texture != nullptr)
+					wgpuTextureRelease(surfaceTexture.texture);
+
+				glfwGetFramebufferSize(m_window.get(), &m_windowDim.width, &m_windowDim.height);
+				ResizeSurface();
+				if (m_windowDim.width == 0 || m_windowDim.height == 0)
+					return {nullptr, nullptr};
+				break;
+			case WGPUSurfaceGetCurrentTextureStatus_Timeout:
+				if (surfaceTexture.texture != nullptr)
+					wgpuTextureRelease(surfaceTexture.texture);
+				break;
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-		case WGPUSurfaceGetCurrentTextureStatus_Error:
+			case WGPUSurfaceGetCurrentTextureStatus_Error:
 #endif
 #if !defined(WEBGPU_BACKEND_DAWN)
-		case WGPUSurfaceGetCurrentTextureStatus_OutOfMemory:
-		case WGPUSurfaceGetCurrentTextureStatus_DeviceLost:
+			case WGPUSurfaceGetCurrentTextureStatus_OutOfMemory:
+			case WGPUSurfaceGetCurrentTextureStatus_DeviceLost:
 #endif
-		case WGPUSurfaceGetCurrentTextureStatus_Force32:
-			std::cerr << "Texture could not be retrieved. Error: " << std::hex << surfaceTexture.status << std::dec << std::endl;
-			return {nullptr, nullptr};
+			case WGPUSurfaceGetCurrentTextureStatus_Force32:
+				std::cerr << "Texture could not be retrieved. Error: " << std::hex << surfaceTexture.status << std::dec << std::endl;
+				return {nullptr, nullptr};
+		}
 	}
 
+	if (!acquired)
+		return {nullptr, nullptr};
+
 	// Successfully retrieved texture, so create a TextureView from it
 	WGPUTextureViewDescriptor viewDesc = {};
 	viewDesc.nextInChain = nullptr;
@@ -907,7 +1561,7 @@ std::tuple<WGPUTextureView, WGPUTexture> App::GetNextSurfaceTextureView()
 #else
 	viewDesc.label = "Surface texture view";
 #endif
-	viewDesc.format = wgpuTextureGetFormat(surfaceTexture.texture);
+	viewDesc.format = m_wgpuCtx.renderFormat;
 	viewDesc.dimension = WGPUTextureViewDimension_2D;
 	viewDesc.baseMipLevel = 0;
 	viewDesc.mipLevelCount = 1;
@@ -921,15 +1575,16 @@ std::tuple<WGPUTextureView, WGPUTexture> App::GetNextSurfaceTextureView()
 	return {textureView, surfaceTexture.texture};
 }
 
-void App::UpdateGamma(const WGPUTexture texture)
+void App::ResizeSurface()
 {
-	switch (wgpuTextureGetFormat(texture))
-	{
-		case WGPUTextureFormat_RGBA8UnormSrgb:
-			m_uniforms.gamma = 2.2f;
-			break;
-		default:
-			m_uniforms.gamma = 1.0f;
-			break;
-	}
+	TRACE_SCOPE("ResizeSurface");
+
+	m_surfaceDirty = false;
+
+	// Configuring a zero sized surface is invalid. Wait until the window is restored.
+	if (m_windowDim.width == 0 || m_windowDim.height == 0)
+		return;
+
+	wgpuUtils::configureSurface(m_wgpuCtx.surface.get(), m_wgpuCtx.device.get(), m_wgpuCtx.adapter.get(), m_windowDim.width, m_windowDim.height);
+	m_uniforms.transform = math::Scale({1.0f, static_cast<float>(m_windowDim.width) / m_windowDim.height, 1.0f});
 }
@@ -2,24 +2,67 @@
 
 #include <webgpu/webgpu.h>
 #include "webgputypes.hpp"
+#include "ColorGrading.hpp"
+#include "Culling.hpp"
+#include "DeviceLimits.hpp"
+#include "DynamicResolution.hpp"
+#include "GpuEvents.hpp"
+#include "GpuMemory.hpp"
+#include "GpuTimer.hpp"
+#include "Image.hpp"
+#include "Math.hpp"
+#include "MeshLod.hpp"
+#include "Metrics.hpp"
+#include "OcclusionCulling.hpp"
+#include "Parallel.hpp"
+#include "ReleaseQueue.hpp"
+#include "RenderGraph.hpp"
+#include "RenderQueue.hpp"
+#include "Scene.hpp"
+#include "SpriteBatcher.hpp"
+#include "TexturePool.hpp"
 
 #include <queue>
 #include <string>
 #include <tuple>
 #include <cassert>
 #include <array>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
 
 class GLFWwindow;
 
 class App
 {
 public:
+	struct Options
+	{
+		uint32_t sampleCount = 1;  // WebGPU only supports 1 or 4
+		uint32_t benchFrames = 0;  // Non zero runs the benchmark instead of the main loop
+		std::string tracePath;     // Chrome trace-event JSON written on Terminate() when set
+		std::string metricsFile;   // Prometheus text dump rewritten every metricsInterval
+		std::string metricsSocket; // Unix socket answering scrapes with the current metrics
+		std::chrono::milliseconds metricsInterval{5000};
+		uint64_t gpuBudget = 0;     // Bytes of GPU memory streamable resources must fit in, zero for no limit
+		std::string adapter;        // Adapter override, see SelectAdapter()
+		bool hdr = false;           // Render to an RGBA16Float target, tone mapped and graded into the surface
+		bool dynamicResolution = false;  // Scale the scene's resolution to keep frames within resolution.targetMs
+		DynamicResolution::Settings resolution;
+		bool occlusionCulling = false;  // Skip objects occlusion queries found hidden in earlier frames
+		float lodErrorPixels = MeshLod::kErrorPixels;  // Pixels a mesh's level of detail may deviate by, zero for full detail
+	};
+
 	App();
+	explicit App(const Options& options);
 	~App();
 	void Tick();
 	void Terminate();
 	bool IsInitialized() const;
 	bool IsRunning() const;
+
+	// Render benchFrames offscreen frames for each supported sample count and report the cost
+	void RunBenchmark();
 private:
 	struct WgpuContext
 	{
@@ -30,8 +73,13 @@ private:
 			device(nullptr, wgpuDeviceRelease),
 			surface(nullptr, wgpuSurfaceRelease),
 			queue(nullptr, wgpuQueueRelease),
-			pipeline(nullptr, wgpuRenderPipelineRelease)
+			surfaceFormat(WGPUTextureFormat_Undefined),
+			renderFormat(WGPUTextureFormat_Undefined)
 		{}
+
+		// Release objects in the reverse order of their creation
+		void Reset();
+
 		bool initialized;
 
 		WgpuInstancePtr instance;
@@ -39,7 +87,11 @@ private:
 		WgpuDevicePtr device;
 		WgpuSurfacePtr surface;
 		WgpuQueuePtr queue;
-		WgpuRenderPipelinePtr pipeline;
+		WGPUTextureFormat surfaceFormat;
+		WGPUTextureFormat renderFormat;  // Of the surface views, its sRGB counterpart when there is one
+		std::unordered_map<uint32_t, WgpuRenderPipelinePtr> pipelines;  // Keyed by PipelineKey()
+		GpuEvents events;  // Of the instance, pumped once per frame by PollDevice()
+		DeviceLimits limits;
 	};
 
 	struct WgpuError
@@ -80,15 +132,16 @@ private:
 		std::vector<size_t> m_attributeOffset;
 	};
 
+	// std140 layout of the WGSL Uniforms struct
 	struct Uniforms
 	{
-		Uniforms() : ratio(0), color{} {}
+		Uniforms() : transform(math::Identity()), color{} {}
 
-		float ratio;
-		float gamma;
+		math::Mat4 transform;
 		// vec4f must align on 16 byte boundary. Same for matching struct in WGSL
 		alignas(16) std::array<float, 4> color{};
 	};
+	static_assert(offsetof(Uniforms, color) == 64);
 	static_assert(sizeof(Uniforms) % sizeof(std::array<float, 4>) == 0);
 
 	struct WgpuTexture
@@ -98,42 +151,166 @@ private:
 			textureView(nullptr, wgpuTextureViewRelease)
 		{}
 
+		void Reset();
+
 		WgpuTexturePtr texture;
 		WgpuTextureViewPtr textureView;
 	};
 
 	using GlfwWindowPtr = std::unique_ptr<GLFWwindow, void(*)(GLFWwindow*)>;
 
-#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPURequiredLimits GetRequiredLimits(WGPUAdapter adapter) const;
-#else
-	WGPULimits GetRequiredLimits(WGPUAdapter adapter) const;
-#endif
+	// The texture a frame ends up in, the multisampled color and depth come from the render graph
+	struct FrameTargets
+	{
+		WGPUTexture target;
+		WGPUTextureView view;
+		uint32_t sampleCount;
+	};
+
+	// A range of the index buffer drawn as one object
+	struct Mesh
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float depth;
+		bool transparent;
+		Scene::Handle object;
+		std::vector<MeshLod::Level> levels;  // Finest first, the first one is the range above
+		uint32_t level;                      // Drawn last frame
+	};
+
+	static constexpr WGPUTextureFormat kDepthFormat = WGPUTextureFormat_Depth24Plus;
+
+	// References into the global metrics registry, looked up once
+	struct AppMetrics
+	{
+		AppMetrics();
+
+		Histogram& frameTime;  // Microseconds between consecutive ticks
+		Counter& droppedFrames;
+		Counter& submits;
+		Gauge& submitsPerFrame;
+		Counter& bytesUploaded;
+		Counter& deviceErrors;
+		Gauge& culledObjects;
+		Gauge& occludedObjects;
+		Gauge& visibleObjects;
+		Gauge& occlusionQueries;
+		Gauge& drawnTriangles;
+		Gauge& spriteQuads;
+		Gauge& spriteBatches;
+		Gauge& renderScale;   // Percent of the window's width and height the scene renders at
+		Gauge& gpuFrameTime;  // Microseconds, of the latest frame measured with timestamp queries
+		Gauge& startupTime;      // Milliseconds spent in Initialize()
+		Gauge& timeToFirstFrame; // Milliseconds from construction to the first frame presented
+	};
+
+	// CPU side data prepared by the startup phases off the main thread, dropped once uploaded
+	struct StartupData
+	{
+		std::vector<float> verticies;
+		std::vector<uint32_t> indicies;
+		std::vector<Image> textures;  // One per mesh
+	};
+
+	// Texture pool layout, the layers are clamped to the device limits
+	static constexpr uint32_t kTextureLayerSize = 1024;
+	static constexpr uint32_t kTextureLayers = 4;
+	static constexpr uint32_t kMaxMaterials = 4096;
+
+	// Most objects the instance buffer is sized for, fewer when one storage binding cannot hold them
+	static constexpr uint32_t kMaxInstances = 1 << 16;
+
+	// Upper bound on time spent destroying retired GPU objects each frame
+	static constexpr std::chrono::microseconds kReleaseBudgetPerFrame{500};
+	// Longest sleep on window events while minimized, so GPU work and main thread jobs still get through
+	static constexpr double kMinimizedWaitSeconds = 0.1;
+
 	void AddDeviceError(WGPUErrorType error, std::string_view message);
 	bool LogDeviceErrors();
 
+	// Run the startup phases, overlapping the CPU only ones with the window and device creation
 	bool Initialize();
+	bool WindowInitialize();
 	GlfwWindowPtr GlfwInitialize();
 	WgpuContext WgpuInitialize();
+	std::string AdapterReport() const;
+	void MeshDataInitialize();
+	void TextureDataInitialize();
 	void BuffersInitialize();
-	WgpuRenderPipelinePtr WgpuRenderPipelineInitialize();
+	void WgpuPipelineLayoutInitialize();
+	WgpuRenderPipelinePtr WgpuRenderPipelineInitialize(uint32_t sampleCount, bool transparent);
 	void WgpuBindGroupsInitialize();
-	void WgpuTextureInitialize();
+	bool WgpuTextureInitialize();
+	// Upload the mesh's texture as a streamable material and assign it to the mesh's object
+	bool AddMeshTexture(size_t mesh);
+	// Upload the textures evicted from the pool since the last frame again
+	void ReloadEvictedTextures();
+
+	// Resource creation and uploads go through these so they show up in the metrics and GPU memory accounting
+	WgpuBufferPtr CreateBuffer(const WGPUBufferDescriptor& desc) const;
+	WgpuTexturePtr CreateTexture(const WGPUTextureDescriptor& desc) const;
+	void WriteBuffer(WGPUBuffer buffer, uint64_t offset, const void* data, size_t size);
+	void WriteTexture(const WgpuTexelCopyTextureInfo& destination, const void* data, size_t size, const WgpuTexelCopyBufferLayout& layout, const WGPUExtent3D& extent);
 
 	const char* GetShaderSource() const;
 	std::tuple<WGPUTextureView, WGPUTexture> GetNextSurfaceTextureView();
-	void  UpdateGamma(const WGPUTexture texture);
+	static uint32_t PipelineKey(uint32_t sampleCount, bool transparent);
+	WGPURenderPipeline GetPipeline(uint32_t sampleCount, bool transparent);
+	// Of the scene pass, the HDR format or the surface's render format
+	WGPUTextureFormat SceneFormat() const;
+	// Whether the scene's shaders encode to sRGB themselves, rendering straight into a surface format
+	// without an sRGB counterpart (such as RGB10A2Unorm or RGBA16Float)
+	bool SceneEncodesSrgb() const;
+	WgpuTexture CreateRenderTarget(WGPUTextureFormat format, const WindowDimensions& dim, uint32_t sampleCount) const;
+
+	// Propagate scene transforms, upload the instances that changed and refit the culling hierarchy
+	void UpdateScene();
+
+	// Record and submit one frame as a render graph, resolving from multisampled color when sampleCount > 1
+	void RenderFrame(const FrameTargets& targets);
+	// Feed the latest frame time to the dynamic resolution controller, the longer of cpuMs, spent in
+	// RenderFrame(), and the latest GPU time when timestamp queries are supported
+	void UpdateRenderScale(double cpuMs);
+	// Complete the GPU requests that have finished, such as frame fences, without blocking
+	void PollDevice();
+	// End of every tick, rendered or not: poll the device, release what its finished frames held and log its errors
+	void CollectDevice();
+	// Block until the GPU has finished everything submitted
+	void WaitForIdle();
+
+	void ResizeSurface();
 
+	Options m_options;
 	bool m_initialized;
 	bool m_terminated;
+	// Declared before the context so it outlives any queue work done callback fired on device release
+	ReleaseQueue m_releaseQueue;
 	WgpuContext m_wgpuCtx;
 	std::queue<WgpuError> m_wgpuErrors;
 
 	GlfwWindowPtr m_window;
 	WindowDimensions m_windowDim;
+	bool m_surfaceDirty;  // Set by the framebuffer callback, handled once per frame
+	AppMetrics m_metrics;
+	MetricsExporter m_metricsExporter;
+	std::chrono::steady_clock::time_point m_lastTickTime;
+	std::chrono::steady_clock::time_point m_launchTime;
+	bool m_firstFramePresented;
+	uint32_t m_submitsThisFrame;
+	StartupData m_startupData;
 
 	WgpuBuffer m_verticies;
 	WgpuBuffer m_indicies;
+	std::vector<Mesh> m_meshes;
+	RenderQueue m_renderQueue;
+	JobSystem m_jobs;
+	Scene m_scene;
+	WgpuBufferPtr m_instanceBuffer;  // Scene::InstanceData of every object, indexed by instance
+	uint32_t m_instanceCapacity;     // Objects the instance buffer holds
+	Bvh m_bvh;                       // Over the scene's world bounds, indexed by instance
+	VisibleList m_visibleObjects;
+	std::vector<uint8_t> m_instanceVisible;
 
 	WgpuBufferPtr m_uniformsBuffer;
 	WgpuBindGroupLayoutPtr m_bindGroupLayout;
@@ -141,5 +318,14 @@ private:
 	WgpuBindGroupPtr m_bindGroup;
 	Uniforms m_uniforms;
 
-	WgpuTexture m_texture;
+	TexturePool m_texturePool;  // Textures of every material, indexed by material ID
+	std::vector<Image> m_meshTextures;     // Kept to upload evicted textures again, one per mesh
+	std::vector<size_t> m_evictedTextures; // Meshes whose texture the pool evicted
+	SpriteBatcher m_sprites;    // Overlay drawn after the scene, samples the texture pool
+	ColorGrading m_colorGrading;  // Only initialized with Options::hdr
+	RenderGraph m_renderGraph;  // Rebuilt every frame, pools the frame's transient targets
+	DynamicResolution m_dynamicResolution;  // Only initialized with Options::dynamicResolution
+	GpuTimer m_gpuTimer;                    // Likewise, and only when timestamp queries are supported
+	OcclusionCulling m_occlusion;           // Only initialized with Options::occlusionCulling
+	uint64_t m_gpuFramesMeasured;           // By m_gpuTimer when the render scale was last updated
 };
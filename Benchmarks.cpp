@@ -0,0 +1,516 @@
+#include "Benchmarks.hpp"
+#include "Culling.hpp"
+#include "Math.hpp"
+#include "Parallel.hpp"
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Nanoseconds per element of the fastest of iterations runs, the usual way to filter out noise
+template <class Fn>
+double TimePerElement(uint32_t iterations, size_t elements, Fn&& fn)
+{
+	double best = 0;
+	for (uint32_t i = 0; i < iterations; ++i)
+	{
+		const Clock::time_point start = Clock::now();
+		fn();
+		const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+		best = i == 0 ? ns : std::min(best, ns);
+	}
+	return best / elements;
+}
+
+// Relative comparison, loose enough for fused multiply adds
+bool NearlyEqual(float a, float b)
+{
+	return std::fabs(a - b) <= 1e-5f * std::max({1.0f, std::fabs(a), std::fabs(b)});
+}
+
+struct Soa3
+{
+	explicit Soa3(size_t count) : x(count), y(count), z(count) {}
+
+	math::ConstFloat3Soa In() const { return {x.data(), y.data(), z.data()}; }
+	math::Float3Soa Out() { return {x.data(), y.data(), z.data()}; }
+
+	bool Matches(const Soa3& other) const
+	{
+		for (size_t i = 0; i < x.size(); ++i)
+			if (!NearlyEqual(x[i], other.x[i]) || !NearlyEqual(y[i], other.y[i]) || !NearlyEqual(z[i], other.z[i]))
+				return false;
+		return true;
+	}
+
+	std::vector<float> x, y, z;
+};
+
+bool Matches(const std::vector<math::Mat4>& a, const std::vector<math::Mat4>& b)
+{
+	for (size_t n = 0; n < a.size(); ++n)
+	{
+		const float *fa = &a[n].cols[0].x;
+		const float *fb = &b[n].cols[0].x;
+		for (int i = 0; i < 16; ++i)
+			if (!NearlyEqual(fa[i], fb[i]))
+				return false;
+	}
+	return true;
+}
+
+double Milliseconds(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Boxes touching a plane may land on either side depending on rounding and fused multiply adds
+bool OnFrustumBoundary(const Frustum& frustum, math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, uint32_t i)
+{
+	for (size_t p = 0; p < Frustum::kPlaneCount; ++p)
+	{
+		const float dist = frustum.nx[p] * centers.x[i] + frustum.ny[p] * centers.y[i] + frustum.nz[p] * centers.z[i] + frustum.d[p];
+		const float radius = frustum.ax[p] * extents.x[i] + frustum.ay[p] * extents.y[i] + frustum.az[p] * extents.z[i];
+		if (std::fabs(dist + radius) <= 1e-4f * (std::fabs(dist) + radius + 1.0f))
+			return true;
+	}
+	return false;
+}
+
+// Same objects in any order, apart from boxes on the boundary
+bool SameVisibleSet(const Frustum& frustum, math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, std::vector<uint32_t> a, std::vector<uint32_t> b)
+{
+	std::sort(a.begin(), a.end());
+	std::sort(b.begin(), b.end());
+	std::vector<uint32_t> difference;
+	std::set_symmetric_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(difference));
+	return std::all_of(difference.begin(), difference.end(), [&](uint32_t i) { return OnFrustumBoundary(frustum, centers, extents, i); });
+}
+
+} // anonymous namespace
+
+bool RunMathBenchmark(uint32_t iterations)
+{
+	// Odd count so every backend also runs its scalar tail
+	constexpr size_t kPoints = (1 << 16) + 3;
+	constexpr size_t kMatrices = (1 << 14) + 1;
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> dist(-100.0f, 100.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 2.0f * math::kPi);
+
+	Soa3 points(kPoints), extents(kPoints);
+	for (size_t i = 0; i < kPoints; ++i)
+	{
+		points.x[i] = dist(rng); points.y[i] = dist(rng); points.z[i] = dist(rng);
+		extents.x[i] = std::fabs(dist(rng)); extents.y[i] = std::fabs(dist(rng)); extents.z[i] = std::fabs(dist(rng));
+	}
+
+	auto randomTransform = [&]() {
+		const math::Quat rotation = math::QuatFromAxisAngle(math::Normalize(math::Vec3{dist(rng), dist(rng), dist(rng)}), angle(rng));
+		return math::Trs({dist(rng), dist(rng), dist(rng)}, rotation, {1.5f, 0.5f, 2.0f});
+	};
+
+	const math::Mat4 transform = randomTransform();
+	std::vector<math::Mat4> parents(kMatrices), locals(kMatrices);
+	for (size_t i = 0; i < kMatrices; ++i)
+	{
+		parents[i] = randomTransform();
+		locals[i] = randomTransform();
+	}
+
+	size_t backendCount = 0;
+	const math::BatchBackend *backends = math::GetBatchBackends(backendCount);
+	const math::BatchBackend &reference = backends[0];
+
+	Soa3 refPoints(kPoints), refCenters(kPoints), refExtents(kPoints);
+	std::vector<math::Mat4> refMatrices(kMatrices);
+	reference.transformPoints(transform, points.In(), refPoints.Out(), kPoints);
+	reference.transformBounds(transform, points.In(), extents.In(), refCenters.Out(), refExtents.Out(), kPoints);
+	reference.multiplyMat4(parents.data(), locals.data(), refMatrices.data(), kMatrices);
+
+	std::cout << "Math benchmark: " << kPoints << " points/boxes, " << kMatrices << " matrices, best of "
+		<< iterations << " runs. Selected backend: " << math::kBackendName << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+
+	bool ok = true;
+	double scalarTimes[3] = {};
+	for (size_t b = 0; b < backendCount; ++b)
+	{
+		const math::BatchBackend &backend = backends[b];
+
+		Soa3 outPoints(kPoints), outCenters(kPoints), outExtents(kPoints);
+		std::vector<math::Mat4> outMatrices(kMatrices);
+		const double times[3] = {
+			TimePerElement(iterations, kPoints, [&]() { backend.transformPoints(transform, points.In(), outPoints.Out(), kPoints); }),
+			TimePerElement(iterations, kPoints, [&]() { backend.transformBounds(transform, points.In(), extents.In(), outCenters.Out(), outExtents.Out(), kPoints); }),
+			TimePerElement(iterations, kMatrices, [&]() { backend.multiplyMat4(parents.data(), locals.data(), outMatrices.data(), kMatrices); }),
+		};
+		if (b == 0)
+			std::copy(std::begin(times), std::end(times), std::begin(scalarTimes));
+
+		const bool matches = outPoints.Matches(refPoints) && outCenters.Matches(refCenters)
+			&& outExtents.Matches(refExtents) && Matches(outMatrices, refMatrices);
+		ok = ok && matches;
+
+		std::cout << "  " << std::left << std::setw(7) << backend.name << std::right
+			<< "points " << times[0] << " ns (" << std::setprecision(1) << scalarTimes[0] / times[0] << "x), " << std::setprecision(3)
+			<< "bounds " << times[1] << " ns (" << std::setprecision(1) << scalarTimes[1] / times[1] << "x), " << std::setprecision(3)
+			<< "mat4 " << times[2] << " ns (" << std::setprecision(1) << scalarTimes[2] / times[2] << "x)" << std::setprecision(3)
+			<< (matches ? "" : "  MISMATCH") << std::endl;
+	}
+
+	return ok;
+}
+
+bool RunSceneBenchmark(uint32_t objectCount)
+{
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> dist(-10.0f, 10.0f);
+	std::uniform_real_distribution<float> angle(0.0f, 2.0f * math::kPi);
+
+	// Random forest. Parents are picked among all earlier objects, so levels arrive out of order
+	// and the first update also exercises the rebuild.
+	Scene scene;
+	std::vector<Scene::Handle> handles(objectCount);
+	std::vector<uint32_t> parents(objectCount, ~0u);
+	std::vector<math::Vec3> positions(objectCount);
+	std::vector<math::Mat4> locals(objectCount);
+	const Clock::time_point buildStart = Clock::now();
+	for (uint32_t i = 0; i < objectCount; ++i)
+	{
+		Scene::ObjectDesc desc;
+		if (i >= objectCount / 100 && rng() % 100 != 0)
+		{
+			parents[i] = rng() % i;
+			desc.parent = handles[parents[i]];
+		}
+		desc.position = positions[i] = {dist(rng), dist(rng), dist(rng)};
+		desc.rotation = math::QuatFromAxisAngle(math::Normalize(math::Vec3{dist(rng), dist(rng), dist(rng)}), angle(rng));
+		desc.boundsExtents = {0.5f, 0.5f, 0.5f};
+		desc.materialId = i % 16;
+		handles[i] = scene.Create(desc);
+		locals[i] = math::Trs(desc.position, desc.rotation, desc.scale);
+	}
+	const double buildMs = Milliseconds(buildStart);
+
+	// Reference world transforms. Parents are created before their children, so creation order works.
+	std::vector<math::Mat4> reference(objectCount);
+	for (uint32_t i = 0; i < objectCount; ++i)
+		reference[i] = parents[i] == ~0u ? locals[i] : reference[parents[i]] * locals[i];
+
+	auto verify = [&]() {
+		for (uint32_t i = 0; i < objectCount; ++i)
+		{
+			const float *a = &scene.World(handles[i]).cols[0].x;
+			const float *b = &reference[i].cols[0].x;
+			for (int j = 0; j < 16; ++j)
+				if (std::fabs(a[j] - b[j]) > 1e-3f * std::max(1.0f, std::fabs(b[j])))
+					return false;
+		}
+		return true;
+	};
+
+	std::vector<uint32_t> roots;
+	for (uint32_t i = 0; i < objectCount; ++i)
+		if (parents[i] == ~0u)
+			roots.push_back(i);
+
+	std::vector<uint32_t> sample;
+	for (uint32_t i = 0; i < objectCount / 100; ++i)
+		sample.push_back(rng() % objectCount);
+
+	JobSystem serialJobs(0);
+	JobSystem jobs;
+	const uint32_t threads = jobs.WorkerCount() + 1;
+
+	std::cout << "Scene benchmark: " << objectCount << " objects, " << roots.size() << " roots, " << threads << " threads" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "  build                        " << buildMs << " ms" << std::endl;
+
+	Clock::time_point start = Clock::now();
+	scene.Update(jobs);
+	std::cout << "  first update (rebuild + all) " << Milliseconds(start) << " ms" << std::endl;
+	bool ok = verify();
+
+	// Setting an object's current position marks it dirty without changing the result
+	auto timeUpdate = [&](const char* name, const std::vector<uint32_t>& dirty) {
+		double times[2];
+		JobSystem *systems[2] = {&serialJobs, &jobs};
+		for (int p = 0; p < 2; ++p)
+		{
+			for (uint32_t i : dirty)
+				scene.SetPosition(handles[i], positions[i]);
+			start = Clock::now();
+			scene.Update(*systems[p]);
+			times[p] = Milliseconds(start);
+		}
+
+		size_t written = 0;
+		for (const Scene::Range &range : scene.ChangedRanges())
+			written += range.count;
+
+		std::cout << "  " << std::left << std::setw(29) << name << std::right << times[0] << " ms on 1 thread, "
+			<< times[1] << " ms on " << threads << " (" << std::setprecision(1) << times[0] / times[1] << "x), "
+			<< std::setprecision(3) << written << " instances in " << scene.ChangedRanges().size() << " ranges" << std::endl;
+	};
+
+	timeUpdate("all roots dirty", roots);
+	ok = ok && verify();
+	timeUpdate("1% dirty", sample);
+	timeUpdate("nothing dirty", {});
+	ok = ok && verify();
+
+	if (!ok)
+		std::cout << "  MISMATCH against the reference transforms" << std::endl;
+	return ok;
+}
+
+bool RunCullBenchmark(uint32_t objectCount)
+{
+	constexpr uint32_t kIterations = 10;
+	constexpr float kWorldSize = 1000.0f;
+
+	std::mt19937 rng(11);
+	std::uniform_real_distribution<float> coordinate(-kWorldSize * 0.5f, kWorldSize * 0.5f);
+	std::uniform_real_distribution<float> size(0.5f, 4.0f);
+	std::uniform_real_distribution<float> nudge(-1.0f, 1.0f);
+
+	Scene scene;
+	std::vector<Scene::Handle> handles(objectCount);
+	std::vector<math::Vec3> positions(objectCount);
+	for (uint32_t i = 0; i < objectCount; ++i)
+	{
+		Scene::ObjectDesc desc;
+		desc.position = positions[i] = {coordinate(rng), coordinate(rng), coordinate(rng)};
+		desc.boundsExtents = {size(rng), size(rng), size(rng)};
+		handles[i] = scene.Create(desc);
+	}
+
+	JobSystem serialJobs(0);
+	JobSystem jobs;
+	const uint32_t threads = jobs.WorkerCount() + 1;
+	scene.Update(jobs);
+	// Refetched after every scene update, which may reallocate the pools
+	math::ConstFloat3Soa centers = scene.WorldBoundsCenters();
+	math::ConstFloat3Soa extents = scene.WorldBoundsExtents();
+
+	std::cout << "Cull benchmark: " << objectCount << " objects, " << Bvh::kNodeWidth << " wide nodes, "
+		<< threads << " threads, best of " << kIterations << " runs" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+
+	Bvh bvh;
+	Clock::time_point start = Clock::now();
+	bvh.Build(centers, extents, scene.Size());
+	std::cout << "  build                        " << Milliseconds(start) << " ms, " << bvh.NodeCount() << " nodes" << std::endl;
+
+	// Cameras at the center of the world looking along each axis, so the views see different objects
+	const math::Mat4 projection = math::Perspective(math::kPi / 3.0f, 16.0f / 9.0f, 0.1f, kWorldSize);
+	const math::Vec3 eye{0, 0, 0};
+	const math::Mat4 views[] = {
+		math::LookAt(eye, {0, 0, -1}, {0, 1, 0}),
+		math::LookAt(eye, {1, 0, 0}, {0, 1, 0}),
+		math::LookAt(eye, {0, -1, 0}, {0, 0, 1}),
+	};
+
+	bool ok = true;
+	VisibleList visible;
+	std::vector<uint32_t> bruteForce, reference;
+	auto cullViews = [&](const char* label) {
+		for (size_t v = 0; v < std::size(views); ++v)
+		{
+			const Frustum frustum = Frustum::FromMatrix(projection * views[v]);
+
+			const double referenceNs = TimePerElement(1, objectCount, [&]() {
+				reference.clear();
+				for (uint32_t i = 0; i < objectCount; ++i)
+					if (frustum.Intersects({centers.x[i], centers.y[i], centers.z[i]}, {extents.x[i], extents.y[i], extents.z[i]}))
+						reference.push_back(i);
+			});
+			const double bruteNs = TimePerElement(kIterations, objectCount, [&]() { CullBruteForce(frustum, centers, extents, objectCount, bruteForce); });
+			const double serialNs = TimePerElement(kIterations, objectCount, [&]() { bvh.Cull(frustum, serialJobs, visible); });
+			const double parallelNs = TimePerElement(kIterations, objectCount, [&]() { bvh.Cull(frustum, jobs, visible); });
+
+			const bool matches = SameVisibleSet(frustum, centers, extents, bruteForce, reference)
+				&& SameVisibleSet(frustum, centers, extents, visible.indices, bruteForce);
+			ok = ok && matches;
+
+			std::cout << "  " << label << " view " << v << ": " << visible.indices.size() << " visible, " << visible.culled << " culled, "
+				<< visible.visitedNodes << " nodes visited, " << visible.testedBounds << " bounds tested" << (matches ? "" : "  MISMATCH") << std::endl
+				<< "    scalar " << referenceNs << " ns/object, simd " << bruteNs << " ns/object, bvh "
+				<< serialNs << " ns/object on 1 thread, " << parallelNs << " on " << threads << std::endl;
+		}
+	};
+	cullViews("built");
+
+	// Small moves refit the tree in place
+	std::vector<uint32_t> sample;
+	for (uint32_t i = 0; i < objectCount / 100; ++i)
+		sample.push_back(rng() % objectCount);
+	for (uint32_t i : sample)
+	{
+		positions[i] = {positions[i].x + nudge(rng), positions[i].y + nudge(rng), positions[i].z + nudge(rng)};
+		scene.SetPosition(handles[i], positions[i]);
+	}
+	bool reindexed = scene.Update(jobs);
+	centers = scene.WorldBoundsCenters();
+	extents = scene.WorldBoundsExtents();
+	start = Clock::now();
+	bool rebuilt = bvh.Update(centers, extents, scene.Size(), scene.ChangedRanges(), reindexed);
+	std::cout << "  refit 1% nudged              " << Milliseconds(start) << " ms" << (rebuilt ? ", rebuilt" : "") << std::endl;
+	cullViews("refit");
+
+	// Scattering everything makes the refitted boxes overlap until the tree has to be rebuilt
+	for (uint32_t i = 0; i < objectCount; ++i)
+		scene.SetPosition(handles[i], {coordinate(rng), coordinate(rng), coordinate(rng)});
+	reindexed = scene.Update(jobs);
+	centers = scene.WorldBoundsCenters();
+	extents = scene.WorldBoundsExtents();
+	start = Clock::now();
+	rebuilt = bvh.Update(centers, extents, scene.Size(), scene.ChangedRanges(), reindexed);
+	std::cout << "  update all scattered         " << Milliseconds(start) << " ms" << (rebuilt ? ", rebuilt" : ", refit only") << std::endl;
+	cullViews("scattered");
+
+	if (!ok)
+		std::cout << "  MISMATCH against the brute force result" << std::endl;
+	return ok;
+}
+
+bool RunJobBenchmark(uint32_t maxThreads)
+{
+	constexpr uint32_t kIterations = 5;
+	constexpr size_t kElements = 1 << 22;
+	constexpr uint32_t kTreeDepth = 14;
+	constexpr uint32_t kStages = 64;
+	constexpr uint32_t kJobsPerStage = 64;
+
+	// A few rounds of xorshift per element, cheap and uneven enough to need balancing
+	auto work = [](size_t i) {
+		uint32_t x = static_cast<uint32_t>(i) * 2654435761u + 1;
+		for (uint32_t r = 0; r < 8 + (i & 15); ++r)
+		{
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+		}
+		return x;
+	};
+
+	std::vector<uint32_t> reference(kElements), out(kElements);
+	for (size_t i = 0; i < kElements; ++i)
+		reference[i] = work(i);
+
+	maxThreads = std::max(maxThreads, 1u);
+	std::cout << "Job benchmark: up to " << maxThreads << " threads, best of " << kIterations << " runs" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+
+	// Powers of two, then the requested count
+	std::vector<uint32_t> threadCounts;
+	for (uint32_t threads = 1; threads < maxThreads; threads *= 2)
+		threadCounts.push_back(threads);
+	threadCounts.push_back(maxThreads);
+
+	bool ok = true;
+	double baseline[3] = {};
+	for (uint32_t threads : threadCounts)
+	{
+		JobSystem jobs(threads - 1);
+
+		double ms[4] = {};
+		auto best = [&](double& result, auto&& fn) {
+			for (uint32_t i = 0; i < kIterations; ++i)
+			{
+				const Clock::time_point start = Clock::now();
+				fn();
+				const double elapsed = Milliseconds(start);
+				result = i == 0 ? elapsed : std::min(result, elapsed);
+			}
+		};
+
+		// Data parallel loop with the adaptive grain and with a fixed one
+		bool loopsMatch = true;
+		const size_t grains[2] = {0, 1024};
+		for (int g = 0; g < 2; ++g)
+		{
+			best(ms[g], [&]() {
+				jobs.ParallelFor(kElements, grains[g], [&](size_t begin, size_t end) {
+					for (size_t i = begin; i < end; ++i)
+						out[i] = work(i);
+				});
+			});
+			loopsMatch = loopsMatch && out == reference;
+			std::fill(out.begin(), out.end(), 0u);
+		}
+
+		// Every job spawns two children and waits on them, so threads steal from the middle of the tree
+		std::atomic<uint32_t> leaves{0};
+		std::function<void(uint32_t)> fork = [&](uint32_t depth) {
+			if (depth == 0)
+			{
+				leaves.fetch_add(work(depth) != 0 ? 1 : 0, std::memory_order_relaxed);
+				return;
+			}
+			JobSystem::Counter children;
+			jobs.Run([&fork, depth]() { fork(depth - 1); }, &children);
+			jobs.Run([&fork, depth]() { fork(depth - 1); }, &children);
+			jobs.Wait(children);
+		};
+		best(ms[2], [&]() {
+			leaves = 0;
+			fork(kTreeDepth);
+		});
+		const bool treeComplete = leaves == (1u << kTreeDepth);
+
+		// Stages that may only start once the previous one has finished
+		std::atomic<uint32_t> finished{0}, outOfOrder{0};
+		best(ms[3], [&]() {
+			finished = 0;
+			std::vector<JobSystem::Counter> stages(kStages);
+			for (uint32_t stage = 0; stage < kStages; ++stage)
+				for (uint32_t job = 0; job < kJobsPerStage; ++job)
+				{
+					const uint32_t before = stage * kJobsPerStage;
+					auto fn = [&finished, &outOfOrder, before]() {
+						if (finished.load() < before)
+							outOfOrder.fetch_add(1);
+						finished.fetch_add(1);
+					};
+					if (stage == 0)
+						jobs.Run(fn, &stages[stage]);
+					else
+						jobs.RunAfter(stages[stage - 1], fn, &stages[stage]);
+				}
+			jobs.Wait(stages.back());
+		});
+		const bool chainOrdered = outOfOrder == 0 && finished == kStages * kJobsPerStage;
+
+		const bool matches = loopsMatch && treeComplete && chainOrdered;
+		ok = ok && matches;
+		if (threads == 1)
+		{
+			baseline[0] = ms[0];
+			baseline[1] = ms[2];
+			baseline[2] = ms[3];
+		}
+
+		std::cout << "  " << threads << " threads: parallel for " << ms[0] << " ms adaptive (" << baseline[0] / ms[0] << "x), "
+			<< ms[1] << " ms grain 1024, fork join " << ((2u << kTreeDepth) - 1) << " jobs " << ms[2] << " ms (" << baseline[1] / ms[2] << "x), "
+			<< kStages << " dependent stages " << ms[3] << " ms (" << baseline[2] / ms[3] << "x)" << (matches ? "" : "  MISMATCH") << std::endl;
+	}
+
+	if (!ok)
+		std::cout << "  MISMATCH against the serial result" << std::endl;
+	return ok;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * CPU only benchmarks, run from the command line without creating a window or device.
+ * Each one first checks the optimized code paths against their reference implementation and
+ * returns false on a mismatch, so they double as correctness checks.
+ */
+
+// Compare every math batch backend compiled into this build against the scalar reference
+bool RunMathBenchmark(uint32_t iterations);
+
+// Build a random hierarchy of objectCount objects and time full, partial and empty scene updates
+bool RunSceneBenchmark(uint32_t objectCount);
+
+// Cull a random scene of objectCount objects from several views with the BVH, checked against brute force
+bool RunCullBenchmark(uint32_t objectCount);
+
+// Time data parallel loops, fork join trees and dependency chains on the job system with 1 up to maxThreads threads
+bool RunJobBenchmark(uint32_t maxThreads);
@@ -0,0 +1,197 @@
+#include "ColorGrading.hpp"
+#include "GpuMemory.hpp"
+#include "Image.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+const char* kColorGradingShader = R"(
+@group(0) @binding(0) var hdr: texture_2d<f32>;
+@group(0) @binding(1) var linearSampler: sampler;
+@group(0) @binding(2) var lut: texture_3d<f32>;
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f
+{
+	// Filtered, so an HDR image rendered below the output size is upscaled on the way
+	let color = max(textureSampleLevel(hdr, linearSampler, in.uv, 0.0).rgb, vec3f(0.0));
+
+	// The LUT covers [0, inf) folded into [0, 1), sampled at its texel centers
+	let size = f32(textureDimensions(lut).x);
+	let coords = color / (1.0 + color) * ((size - 1.0) / size) + 0.5 / size;
+	return vec4f(textureSampleLevel(lut, linearSampler, coords, 0.0).rgb, 1.0);
+})";
+
+// Narkowicz's fit of the ACES filmic curve
+float ToneMap(float x)
+{
+	return std::clamp((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 0.0f, 1.0f);
+}
+
+uint8_t ToUnorm8(float value)
+{
+	return static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+} // anonymous namespace
+
+ColorGrading::ColorGrading() :
+	m_lut(nullptr, wgpuTextureRelease),
+	m_lutView(nullptr, wgpuTextureViewRelease),
+	m_bytesUploaded(UploadBytesCounter())
+{
+}
+
+bool ColorGrading::Initialize(WGPUDevice device, WGPUQueue queue, WGPUTextureFormat outputFormat, const Grading& grading)
+{
+	TRACE_SCOPE("ColorGradingInitialize");
+
+	Reset();
+
+	// sRGB encoded, so sampling decodes to linear in hardware for an sRGB output to encode again. An
+	// output without an sRGB view takes the encoded texels as they are.
+	WGPUTextureDescriptor lutDesc{};
+	lutDesc.dimension = WGPUTextureDimension_3D;
+	lutDesc.size = {kLutSize, kLutSize, kLutSize};
+	lutDesc.mipLevelCount = 1;
+	lutDesc.sampleCount = 1;
+	lutDesc.format = wgpuUtils::isSrgbFormat(outputFormat) ? WGPUTextureFormat_RGBA8UnormSrgb : WGPUTextureFormat_RGBA8Unorm;
+	lutDesc.usage = WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
+	m_lut = GpuMemory::Global().CreateTexture(device, lutDesc);
+	if (!m_lut)
+		return false;
+
+	WGPUTextureViewDescriptor lutViewDesc{};
+	lutViewDesc.aspect = WGPUTextureAspect_All;
+	lutViewDesc.baseArrayLayer = 0;
+	lutViewDesc.arrayLayerCount = 1;
+	lutViewDesc.baseMipLevel = 0;
+	lutViewDesc.mipLevelCount = 1;
+	lutViewDesc.dimension = WGPUTextureViewDimension_3D;
+	lutViewDesc.format = lutDesc.format;
+	m_lutView = WgpuTextureViewPtr(wgpuTextureCreateView(m_lut.get(), &lutViewDesc), wgpuTextureViewRelease);
+
+	std::vector<uint32_t> texels;
+	BakeLut(grading, kLutSize, texels);
+
+	WgpuTexelCopyTextureInfo destination{};
+	destination.texture = m_lut.get();
+	destination.mipLevel = 0;
+	destination.origin = {0, 0, 0};
+	destination.aspect = WGPUTextureAspect_All;
+
+	WgpuTexelCopyBufferLayout source{};
+	source.offset = 0;
+	source.bytesPerRow = kLutSize * sizeof(uint32_t);
+	source.rowsPerImage = kLutSize;
+
+	const size_t byteSize = texels.size() * sizeof(uint32_t);
+	wgpuQueueWriteTexture(queue, &destination, texels.data(), byteSize, &source, &lutDesc.size);
+	m_bytesUploaded.Add(byteSize);
+
+	return m_lutView && m_blit.Initialize(device, outputFormat, kColorGradingShader, {{m_lutView.get(), WGPUTextureViewDimension_3D}});
+}
+
+void ColorGrading::Reset()
+{
+	m_blit.Reset();
+	m_lutView.reset();
+	m_lut.reset();
+}
+
+void ColorGrading::AddPass(RenderGraph& graph, RenderGraph::Resource hdr, RenderGraph::Resource output)
+{
+	m_blit.AddPass(graph, "ColorGrading", hdr, output);
+}
+
+void ColorGrading::BakeLut(const Grading& grading, uint32_t size, std::vector<uint32_t>& texels)
+{
+	TRACE_SCOPE("BakeColorLut");
+
+	// Rec. 709 luminance, middle grey as the pivot of the contrast curve
+	constexpr float kLuminance[3] = {0.2126f, 0.7152f, 0.0722f};
+	constexpr float kMiddleGrey = 0.18f;
+	// The last texel stands for infinity, which x / (1 + x) never reaches
+	constexpr float kMaxFolded = 0.9999f;
+
+	texels.resize(size_t{size} * size * size);
+	const float scale = 1.0f / (size - 1);
+	for (uint32_t b = 0; b < size; ++b)
+	{
+		for (uint32_t g = 0; g < size; ++g)
+		{
+			for (uint32_t r = 0; r < size; ++r)
+			{
+				float color[3] = {r * scale, g * scale, b * scale};
+				float luminance = 0.0f;
+				for (int c = 0; c < 3; ++c)
+				{
+					const float folded = std::min(color[c], kMaxFolded);
+					color[c] = folded / (1.0f - folded) * grading.exposure;
+					luminance += kLuminance[c] * color[c];
+				}
+
+				uint8_t encoded[3];
+				for (int c = 0; c < 3; ++c)
+				{
+					const float saturated = std::max(luminance + (color[c] - luminance) * grading.saturation, 0.0f);
+					const float contrasted = kMiddleGrey * std::pow(saturated / kMiddleGrey, grading.contrast);
+					encoded[c] = ToUnorm8(LinearToSrgb(ToneMap(contrasted)));
+				}
+				texels[(size_t{b} * size + g) * size + r] = Image::Pack(encoded[0], encoded[1], encoded[2], 255);
+			}
+		}
+	}
+}
+
+float ColorGrading::SrgbToLinear(float value)
+{
+	return value <= 0.04045f ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+}
+
+float ColorGrading::LinearToSrgb(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+bool CheckColorGrading()
+{
+	constexpr uint32_t kSize = ColorGrading::kLutSize;
+	auto channel = [](uint32_t texel, uint32_t c) { return static_cast<int>((texel >> (8 * c)) & 0xff); };
+
+	// Exposure, contrast and saturation of 1 leave the grey axis to the tone curve
+	std::vector<uint32_t> texels;
+	ColorGrading::BakeLut({}, kSize, texels);
+	bool grey = texels.size() == size_t{kSize} * kSize * kSize;
+	for (uint32_t i = 0; i < kSize && grey; ++i)
+	{
+		const float folded = std::min(static_cast<float>(i) / (kSize - 1), 0.9999f);
+		const int expected = ToUnorm8(ColorGrading::LinearToSrgb(ToneMap(folded / (1.0f - folded))));
+		const uint32_t texel = texels[(size_t{i} * kSize + i) * kSize + i];
+		for (uint32_t c = 0; c < 3; ++c)
+			grey = grey && std::abs(channel(texel, c) - expected) <= 1;
+	}
+
+	bool roundTrip = ColorGrading::SrgbToLinear(0.0f) == 0.0f && std::abs(ColorGrading::LinearToSrgb(1.0f) - 1.0f) < 1e-5f;
+	for (int value = 0; value < 256 && roundTrip; ++value)
+		roundTrip = ToUnorm8(ColorGrading::LinearToSrgb(ColorGrading::SrgbToLinear(value / 255.0f))) == value;
+
+	// Neutral grading keeps pure colors pure, so one step from black along red, green then blue
+	// brightens only that channel
+	bool layout = grey;
+	for (uint32_t c = 0, stride = 1; c < 3 && layout; ++c, stride *= kSize)
+	{
+		for (uint32_t other = 0; other < 3; ++other)
+			layout = layout && (other == c ? channel(texels[stride], other) > 0 : channel(texels[stride], other) == 0);
+	}
+
+	std::cout << "  color grading check: grey axis " << (grey ? "passed" : "FAILED") << ", sRGB round trip "
+		<< (roundTrip ? "passed" : "FAILED") << ", LUT layout " << (layout ? "passed" : "FAILED") << std::endl;
+	return grey && roundTrip && layout;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "FullscreenBlit.hpp"
+#include "Metrics.hpp"
+#include "RenderGraph.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Final pass of the HDR path: tone maps and grades a linear RGBA16Float image into the output
+ * through a 3D lookup table.
+ *
+ * The LUT is baked on the CPU once. Its input is the HDR color folded into [0, 1) by x / (1 + x),
+ * its output the graded and tone mapped color, stored sRGB encoded so the hardware decodes it when
+ * sampling and the 8 bits go where the eye needs them. The pass is a bilinear sample of the HDR
+ * image, a division and a filtered LUT sample per pixel, so the HDR image may be smaller than the
+ * output and is upscaled along the way. Outputs without an sRGB view get the encoded color as it is.
+ */
+class ColorGrading
+{
+public:
+	struct Grading
+	{
+		float exposure = 1.0f;    // Linear scale before tone mapping
+		float contrast = 1.0f;    // Power around middle grey
+		float saturation = 1.0f;  // Scale of the difference to the luminance
+	};
+
+	static constexpr WGPUTextureFormat kHdrFormat = WGPUTextureFormat_RGBA16Float;
+	static constexpr uint32_t kLutSize = 33;
+
+	ColorGrading();
+
+	bool Initialize(WGPUDevice device, WGPUQueue queue, WGPUTextureFormat outputFormat, const Grading& grading);
+	void Reset();
+
+	// Add the pass reading hdr (kHdrFormat, with TextureBinding usage) and writing output, of any size
+	void AddPass(RenderGraph& graph, RenderGraph::Resource hdr, RenderGraph::Resource output);
+
+	// RGBA8 texels of a size^3 LUT, red varying fastest
+	static void BakeLut(const Grading& grading, uint32_t size, std::vector<uint32_t>& texels);
+
+	static float SrgbToLinear(float value);
+	static float LinearToSrgb(float value);
+
+private:
+	WgpuTexturePtr m_lut;
+	WgpuTextureViewPtr m_lutView;
+	FullscreenBlit m_blit;
+
+	Counter& m_bytesUploaded;
+};
+
+/*
+ * Check the baked LUT and the sRGB conversions on the CPU: the grey axis of a neutral grading is the
+ * tone curve alone, 8 bit values survive a round trip through linear, and texels are laid out red
+ * fastest. Returns false when any of them fails.
+ */
+bool CheckColorGrading();
@@ -0,0 +1,589 @@
+#include "Compute.hpp"
+#include "AdapterSelection.hpp"
+#include "GpuMemory.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+namespace {
+
+WGPUBufferBindingType BufferBindingType(ComputeContext::Binding binding)
+{
+	switch (binding)
+	{
+		case ComputeContext::Binding::Uniform: return WGPUBufferBindingType_Uniform;
+		case ComputeContext::Binding::ReadOnlyStorage: return WGPUBufferBindingType_ReadOnlyStorage;
+		case ComputeContext::Binding::Storage: return WGPUBufferBindingType_Storage;
+	}
+	return WGPUBufferBindingType_Undefined;
+}
+
+// Buffer copies and mapping work in multiples of 4 bytes
+uint64_t AlignCopySize(uint64_t size)
+{
+	return (size + 3) & ~uint64_t(3);
+}
+
+} // anonymous namespace
+
+ComputeContext::ComputeContext() :
+	m_initialized(false),
+	m_errorCount(0),
+	m_limits{},
+	m_instance(nullptr, wgpuInstanceRelease),
+	m_adapter(nullptr, wgpuAdapterRelease),
+	m_device(nullptr, wgpuDeviceRelease),
+	m_queue(nullptr, wgpuQueueRelease)
+{
+#if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	const WGPUInstanceDescriptor instanceDesc = GpuEvents::InstanceDescriptor();
+	m_instance.reset(wgpuCreateInstance(&instanceDesc));
+#else
+	m_instance.reset(wgpuCreateInstance(nullptr));
+#endif
+	if (!m_instance)
+	{
+		std::cerr << "Could not initialize WebGPU" << std::endl;
+		return;
+	}
+	m_events = GpuEvents(m_instance.get());
+
+	m_adapter = SelectAdapter(m_events, nullptr);
+	if (!m_adapter)
+	{
+		std::cerr << "Could not retrieve adapter" << std::endl;
+		return;
+	}
+
+	// Jobs are sized by their input, so ask for everything the adapter supports
+#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPUSupportedLimits supportedLimits{};
+	wgpuAdapterGetLimits(m_adapter.get(), &supportedLimits);
+	WGPURequiredLimits limits{};
+	limits.limits = supportedLimits.limits;
+	limits.limits.maxInterStageShaderComponents = WGPU_LIMIT_U32_UNDEFINED;
+	m_limits = supportedLimits.limits;
+#else
+	WGPULimits limits{};
+	wgpuAdapterGetLimits(m_adapter.get(), &limits);
+	m_limits = limits;
+#endif
+
+	auto onDeviceError = [](
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+			[[maybe_unused]]WGPUDevice const *device, WGPUErrorType type, WGPUStringView message,
+			void* pUserData1, [[maybe_unused]]void* pUserData2)
+#else
+			WGPUErrorType type, char const *message, void* pUserData1)
+#endif  // EMSCRIPTEN_WEBGPU_DEPRECATED
+	{
+		ComputeContext *context = static_cast<ComputeContext*>(pUserData1);
+		context->m_errorCount.fetch_add(1, std::memory_order_relaxed);
+		std::cerr << "Compute device error " << type << ": " << message << std::endl;
+	};
+
+	WGPUDeviceDescriptor deviceDesc{};
+	deviceDesc.requiredLimits = &limits;
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	deviceDesc.label = wgpuUtils::label("Compute Device");
+	deviceDesc.defaultQueue.label = wgpuUtils::label("Compute Queue");
+	deviceDesc.uncapturedErrorCallbackInfo.callback = onDeviceError;
+	deviceDesc.uncapturedErrorCallbackInfo.userdata1 = this;
+#else
+	deviceDesc.label = "Compute Device";
+	deviceDesc.defaultQueue.label = "Compute Queue";
+#endif
+
+	GpuRequest<WGPUDevice> deviceRequest = m_events.RequestDevice(m_adapter.get(), &deviceDesc);
+	m_events.Wait(deviceRequest);
+	m_device.reset(deviceRequest.Result());
+	if (!m_device)
+	{
+		std::cerr << "Could not retrieve device" << std::endl;
+		return;
+	}
+#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	wgpuDeviceSetUncapturedErrorCallback(m_device.get(), onDeviceError, this);
+#endif
+
+	m_events.SetDevice(m_device.get());
+
+	m_queue.reset(wgpuDeviceGetQueue(m_device.get()));
+	m_initialized = true;
+}
+
+ComputeContext::~ComputeContext()
+{
+	// Map callbacks refer to the pending readbacks, so they must all have fired
+	if (m_initialized)
+		Wait();
+}
+
+std::string ComputeContext::LayoutKey(const Layout& layout)
+{
+	std::string key;
+	for (Binding binding : layout)
+		key.push_back(static_cast<char>('0' + static_cast<int>(binding)));
+	return key;
+}
+
+const ComputeContext::CachedLayout* ComputeContext::GetLayout(const Layout& layout)
+{
+	const std::string key = LayoutKey(layout);
+	auto it = m_layouts.find(key);
+	if (it != m_layouts.end())
+		return &it->second;
+
+	std::vector<WGPUBindGroupLayoutEntry> entries(layout.size());
+	for (size_t i = 0; i < layout.size(); ++i)
+	{
+		entries[i].binding = static_cast<uint32_t>(i);
+		entries[i].visibility = WGPUShaderStage_Compute;
+		entries[i].buffer.type = BufferBindingType(layout[i]);
+	}
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.label = wgpuUtils::label("Compute bind group layout");
+	bindGroupLayoutDesc.entryCount = entries.size();
+	bindGroupLayoutDesc.entries = entries.data();
+	WgpuBindGroupLayoutPtr bindGroupLayout(
+			wgpuDeviceCreateBindGroupLayout(m_device.get(), &bindGroupLayoutDesc),
+			wgpuBindGroupLayoutRelease
+	);
+	if (!bindGroupLayout)
+		return nullptr;
+
+	WGPUBindGroupLayout bindGroupLayouts[] = {bindGroupLayout.get()};
+	WGPUPipelineLayoutDescriptor pipelineLayoutDesc{};
+	pipelineLayoutDesc.label = wgpuUtils::label("Compute pipeline layout");
+	pipelineLayoutDesc.bindGroupLayoutCount = 1;
+	pipelineLayoutDesc.bindGroupLayouts = bindGroupLayouts;
+	WgpuPipelineLayoutPtr pipelineLayout(
+			wgpuDeviceCreatePipelineLayout(m_device.get(), &pipelineLayoutDesc),
+			wgpuPipelineLayoutRelease
+	);
+	if (!pipelineLayout)
+		return nullptr;
+
+	CachedLayout &cached = m_layouts.emplace(key, CachedLayout{std::move(bindGroupLayout), std::move(pipelineLayout)}).first->second;
+	return &cached;
+}
+
+WGPUBindGroupLayout ComputeContext::GetBindGroupLayout(const Layout& layout)
+{
+	const CachedLayout *cached = GetLayout(layout);
+	return cached ? cached->bindGroupLayout.get() : nullptr;
+}
+
+WGPUComputePipeline ComputeContext::GetPipeline(const std::string& wgsl, const std::string& entryPoint, const Layout& layout)
+{
+	// The whole source is part of the key, so edited shaders never hit a stale pipeline
+	const std::string key = entryPoint + '\n' + LayoutKey(layout) + '\n' + wgsl;
+	auto it = m_pipelines.find(key);
+	if (it != m_pipelines.end())
+		return it->second.get();
+
+	TRACE_SCOPE("CreateComputePipeline");
+	const CachedLayout *cached = GetLayout(layout);
+	if (!cached)
+		return nullptr;
+
+	WgpuShaderModulePtr shaderModule(wgpuUtils::createShaderModule(m_device.get(), wgsl.c_str()), wgpuShaderModuleRelease);
+	if (!shaderModule)
+		return nullptr;
+
+	WGPUComputePipelineDescriptor pipelineDesc{};
+	pipelineDesc.label = wgpuUtils::label("Compute pipeline");
+	pipelineDesc.layout = cached->pipelineLayout.get();
+	pipelineDesc.compute.module = shaderModule.get();
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	pipelineDesc.compute.entryPoint = WGPUStringView{entryPoint.data(), entryPoint.size()};
+#else
+	pipelineDesc.compute.entryPoint = entryPoint.c_str();
+#endif
+	WgpuComputePipelinePtr pipeline(
+			wgpuDeviceCreateComputePipeline(m_device.get(), &pipelineDesc),
+			wgpuComputePipelineRelease
+	);
+	if (!pipeline)
+		return nullptr;
+
+	return m_pipelines.emplace(key, std::move(pipeline)).first->second.get();
+}
+
+WgpuBindGroupPtr ComputeContext::CreateBindGroup(const Layout& layout, std::initializer_list<BufferBinding> buffers)
+{
+	WGPUBindGroupLayout bindGroupLayout = GetBindGroupLayout(layout);
+	if (!bindGroupLayout || buffers.size() != layout.size())
+	{
+		std::cerr << "Compute bind group does not match its layout" << std::endl;
+		return WgpuBindGroupPtr(nullptr, wgpuBindGroupRelease);
+	}
+
+	std::vector<WGPUBindGroupEntry> entries;
+	entries.reserve(buffers.size());
+	for (const BufferBinding &binding : buffers)
+	{
+		WGPUBindGroupEntry entry{};
+		entry.binding = static_cast<uint32_t>(entries.size());
+		entry.buffer = binding.buffer;
+		entry.offset = binding.offset;
+		entry.size = binding.size == WGPU_WHOLE_SIZE ? wgpuBufferGetSize(binding.buffer) - binding.offset : binding.size;
+		entries.push_back(entry);
+	}
+
+	WGPUBindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.label = wgpuUtils::label("Compute bind group");
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = entries.size();
+	bindGroupDesc.entries = entries.data();
+	return WgpuBindGroupPtr(wgpuDeviceCreateBindGroup(m_device.get(), &bindGroupDesc), wgpuBindGroupRelease);
+}
+
+WgpuBufferPtr ComputeContext::CreateBuffer(uint64_t size, WGPUFlags usage, const char* label)
+{
+	WGPUBufferDescriptor bufferDesc{};
+	bufferDesc.label = wgpuUtils::label(label);
+	bufferDesc.size = AlignCopySize(size);
+	bufferDesc.usage = usage;
+	bufferDesc.mappedAtCreation = false;
+	return GpuMemory::Global().CreateBuffer(m_device.get(), bufferDesc);
+}
+
+void ComputeContext::WriteBuffer(WGPUBuffer buffer, uint64_t offset, const void* data, size_t size)
+{
+	wgpuQueueWriteBuffer(m_queue.get(), buffer, offset, data, size);
+}
+
+ComputeContext::OffscreenTarget ComputeContext::CreateOffscreenTarget(uint32_t width, uint32_t height, WGPUTextureFormat format, WGPUFlags usage)
+{
+	WGPUTextureDescriptor textureDesc{};
+	textureDesc.dimension = WGPUTextureDimension_2D;
+	textureDesc.size = {width, height, 1};
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	textureDesc.format = format;
+	textureDesc.usage = usage;
+
+	OffscreenTarget target;
+	target.texture = GpuMemory::Global().CreateTexture(m_device.get(), textureDesc);
+	if (target.texture)
+		target.view = WgpuTextureViewPtr(wgpuTextureCreateView(target.texture.get(), nullptr), wgpuTextureViewRelease);
+	return target;
+}
+
+WgpuBufferPtr ComputeContext::AcquireStaging(uint64_t size)
+{
+	// Smallest free staging buffer that fits, buffers are recycled once their readback completes
+	auto best = m_freeStaging.end();
+	for (auto it = m_freeStaging.begin(); it != m_freeStaging.end(); ++it)
+	{
+		const uint64_t capacity = wgpuBufferGetSize(it->get());
+		if (capacity >= size && (best == m_freeStaging.end() || capacity < wgpuBufferGetSize(best->get())))
+			best = it;
+	}
+
+	if (best == m_freeStaging.end())
+		return CreateBuffer(size, WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst, "Compute readback");
+
+	WgpuBufferPtr staging = std::move(*best);
+	m_freeStaging.erase(best);
+	return staging;
+}
+
+ComputeContext::Batch::Batch(ComputeContext& context, WgpuCommandEncoderPtr encoder) :
+	m_context(&context),
+	m_encoder(std::move(encoder)),
+	m_pass(nullptr, wgpuComputePassEncoderRelease)
+{}
+
+ComputeContext::Batch ComputeContext::Begin()
+{
+	WGPUCommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = wgpuUtils::label("Compute command encoder");
+	return Batch(*this, WgpuCommandEncoderPtr(
+			wgpuDeviceCreateCommandEncoder(m_device.get(), &encoderDesc),
+			wgpuCommandEncoderRelease
+	));
+}
+
+bool ComputeContext::Batch::Dispatch(WGPUComputePipeline pipeline, WGPUBindGroup bindGroup, Dim3 invocations, Dim3 workgroupSize)
+{
+	const Dim3 count{
+		WorkgroupCount(invocations.x, workgroupSize.x),
+		WorkgroupCount(invocations.y, workgroupSize.y),
+		WorkgroupCount(invocations.z, workgroupSize.z),
+	};
+	const uint32_t maxCount = m_context->m_limits.maxComputeWorkgroupsPerDimension;
+	if (count.x > maxCount || count.y > maxCount || count.z > maxCount)
+	{
+		std::cerr << "Dispatch of " << count.x << "x" << count.y << "x" << count.z
+			<< " workgroups exceeds the limit of " << maxCount << " per dimension" << std::endl;
+		return false;
+	}
+
+	if (!m_pass)
+	{
+		WGPUComputePassDescriptor passDesc{};
+		passDesc.label = wgpuUtils::label("Compute pass");
+		m_pass.reset(wgpuCommandEncoderBeginComputePass(m_encoder.get(), &passDesc));
+	}
+
+	wgpuComputePassEncoderSetPipeline(m_pass.get(), pipeline);
+	wgpuComputePassEncoderSetBindGroup(m_pass.get(), 0, bindGroup, 0, nullptr);
+	wgpuComputePassEncoderDispatchWorkgroups(m_pass.get(), count.x, count.y, count.z);
+	return true;
+}
+
+void ComputeContext::Batch::EndPass()
+{
+	if (!m_pass)
+		return;
+	wgpuComputePassEncoderEnd(m_pass.get());
+	m_pass.reset();
+}
+
+void ComputeContext::Batch::Readback(WGPUBuffer source, uint64_t offset, uint64_t size, ReadbackFn fn)
+{
+	EndPass();
+
+	const uint64_t copySize = AlignCopySize(size);
+	auto readback = std::make_unique<PendingReadback>(PendingReadback{m_context, m_context->AcquireStaging(copySize), size, std::move(fn), {}, false});
+	wgpuCommandEncoderCopyBufferToBuffer(m_encoder.get(), source, offset, readback->staging.get(), 0, copySize);
+	m_readbacks.push_back(std::move(readback));
+}
+
+void ComputeContext::Submit(Batch&& batch)
+{
+	TRACE_SCOPE("ComputeSubmit");
+
+	batch.EndPass();
+	WGPUCommandBufferDescriptor cmdBufferDesc{};
+	cmdBufferDesc.label = wgpuUtils::label("Compute command buffer");
+	WgpuCommandBufferPtr commands(
+			wgpuCommandEncoderFinish(batch.m_encoder.get(), &cmdBufferDesc),
+			wgpuCommandBufferRelease
+	);
+	WGPUCommandBuffer buffer = commands.get();
+	wgpuQueueSubmit(m_queue.get(), 1, &buffer);
+
+	// Mapping waits for the submitted copies, so it can only start now
+	for (std::unique_ptr<Batch::PendingReadback> &readback : batch.m_readbacks)
+	{
+		MapReadback(*readback);
+		m_readbacks.push_back(std::move(readback));
+	}
+	batch.m_readbacks.clear();
+}
+
+void ComputeContext::FinishReadback(Batch::PendingReadback& readback, bool mapped)
+{
+	if (mapped)
+	{
+		readback.fn(wgpuBufferGetConstMappedRange(readback.staging.get(), 0, AlignCopySize(readback.size)), readback.size);
+		wgpuBufferUnmap(readback.staging.get());
+		readback.context->m_freeStaging.push_back(std::move(readback.staging));
+	}
+	else
+	{
+		readback.fn(nullptr, 0);
+	}
+	readback.done = true;
+}
+
+void ComputeContext::MapReadback(Batch::PendingReadback& readback)
+{
+	readback.mapped = m_events.MapBuffer(readback.staging.get(), WGPUMapMode_Read, 0, AlignCopySize(readback.size));
+	Batch::PendingReadback *pending = &readback;
+	readback.mapped.Then([pending](bool mapped) { FinishReadback(*pending, mapped); });
+}
+
+void ComputeContext::Poll()
+{
+	m_events.Pump();
+
+	// Callbacks only mark their readback, which must outlive the callback itself
+	m_readbacks.erase(std::remove_if(m_readbacks.begin(), m_readbacks.end(),
+		[](const std::unique_ptr<Batch::PendingReadback>& readback) { return readback->done; }), m_readbacks.end());
+}
+
+void ComputeContext::Wait()
+{
+	TRACE_SCOPE("ComputeWait");
+
+	// Readback callbacks may submit more work, which is waited on too
+	for (size_t i = 0; i < m_readbacks.size(); ++i)
+		m_events.Wait(m_readbacks[i]->mapped);
+	Poll();
+}
+
+void ComputeContext::WaitForQueue()
+{
+	TRACE_SCOPE("ComputeWaitForQueue");
+	m_events.Wait(m_events.OnSubmittedWorkDone(m_queue.get()));
+	Poll();
+}
+
+namespace {
+
+bool ReadFile(const std::string& path, std::string& contents)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		std::cerr << "Could not open " << path << std::endl;
+		return false;
+	}
+	contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	return true;
+}
+
+struct ComputeJob
+{
+	std::string shaderPath;
+	std::string inputPath;
+	std::string outputPath;
+	uint32_t workgroupSize = 64;
+};
+
+bool ParseJobs(const std::string& jobFile, std::vector<ComputeJob>& jobs)
+{
+	std::ifstream file(jobFile);
+	if (!file)
+	{
+		std::cerr << "Could not open " << jobFile << std::endl;
+		return false;
+	}
+
+	std::string line;
+	for (size_t lineNumber = 1; std::getline(file, line); ++lineNumber)
+	{
+		std::istringstream fields(line);
+		ComputeJob job;
+		if (!(fields >> job.shaderPath) || job.shaderPath[0] == '#')
+			continue;
+
+		if (!(fields >> job.inputPath >> job.outputPath))
+		{
+			std::cerr << jobFile << ":" << lineNumber << ": expected <shader> <input> <output> [workgroup size]" << std::endl;
+			return false;
+		}
+		if (!fields.eof() && (!(fields >> job.workgroupSize) || job.workgroupSize == 0))
+		{
+			std::cerr << jobFile << ":" << lineNumber << ": invalid workgroup size" << std::endl;
+			return false;
+		}
+		jobs.push_back(std::move(job));
+	}
+	return true;
+}
+
+} // anonymous namespace
+
+bool RunComputeBatch(const std::string& jobFile)
+{
+	using Clock = std::chrono::steady_clock;
+
+#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	std::cerr << "Compute batches need to block on the GPU, which the browser does not allow" << std::endl;
+	return false;
+#endif
+
+	std::vector<ComputeJob> jobs;
+	if (!ParseJobs(jobFile, jobs))
+		return false;
+
+	ComputeContext context;
+	if (!context.IsInitialized())
+		return false;
+
+	const ComputeContext::Layout layout = {
+		ComputeContext::Binding::ReadOnlyStorage,
+		ComputeContext::Binding::Storage,
+		ComputeContext::Binding::Uniform,
+	};
+
+	const Clock::time_point batchStart = Clock::now();
+	size_t failed = 0;
+	for (size_t i = 0; i < jobs.size(); ++i)
+	{
+		const ComputeJob &job = jobs[i];
+		std::string shader, input;
+		if (!ReadFile(job.shaderPath, shader) || !ReadFile(job.inputPath, input))
+		{
+			++failed;
+			continue;
+		}
+
+		const uint64_t inputSize = input.size();
+		const uint32_t wordCount = static_cast<uint32_t>((inputSize + 3) / 4);
+		if (wordCount == 0 || inputSize > context.Limits().maxStorageBufferBindingSize)
+		{
+			std::cerr << job.inputPath << ": size must be between 1 and " << context.Limits().maxStorageBufferBindingSize << " bytes" << std::endl;
+			++failed;
+			continue;
+		}
+		input.resize(wordCount * 4, '\0');
+
+		WGPUComputePipeline pipeline = context.GetPipeline(shader, "main", layout);
+		WgpuBufferPtr inputBuffer = context.CreateBuffer(input.size(), WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst, "Compute input");
+		WgpuBufferPtr outputBuffer = context.CreateBuffer(input.size(), WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc, "Compute output");
+		WgpuBufferPtr paramsBuffer = context.CreateBuffer(16, WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst, "Compute params");
+		if (!pipeline || !inputBuffer || !outputBuffer || !paramsBuffer)
+		{
+			std::cerr << job.shaderPath << ": could not create the pipeline or buffers" << std::endl;
+			++failed;
+			continue;
+		}
+
+		const uint32_t params[4] = {wordCount, 0, 0, 0};
+		context.WriteBuffer(inputBuffer.get(), 0, input.data(), input.size());
+		context.WriteBuffer(paramsBuffer.get(), 0, params, sizeof(params));
+		WgpuBindGroupPtr bindGroup = context.CreateBindGroup(layout, {{inputBuffer.get()}, {outputBuffer.get()}, {paramsBuffer.get()}});
+
+		// The buffers can be released once submitted, the GPU keeps what it still uses alive
+		ComputeContext::Batch batch = context.Begin();
+		if (!batch.Dispatch(pipeline, bindGroup.get(), {wordCount}, {job.workgroupSize}))
+		{
+			++failed;
+			continue;
+		}
+
+		const Clock::time_point submitTime = Clock::now();
+		batch.Readback(outputBuffer.get(), 0, inputSize, [&job, &failed, submitTime](const void* data, uint64_t size) {
+			if (!data)
+			{
+				++failed;
+				return;
+			}
+
+			std::ofstream output(job.outputPath, std::ios::binary);
+			output.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+			if (!output)
+			{
+				std::cerr << "Could not write " << job.outputPath << std::endl;
+				++failed;
+				return;
+			}
+			const double ms = std::chrono::duration<double, std::milli>(Clock::now() - submitTime).count();
+			std::cout << job.shaderPath << ": " << job.inputPath << " -> " << job.outputPath << ", "
+				<< size << " bytes in " << ms << " ms" << std::endl;
+		});
+		context.Submit(std::move(batch));
+		context.Poll();
+	}
+
+	context.Wait();
+	const double totalMs = std::chrono::duration<double, std::milli>(Clock::now() - batchStart).count();
+	if (context.ErrorCount() > 0 && failed == 0)
+		failed = 1;
+
+	std::cout << jobs.size() - std::min(failed, jobs.size()) << " of " << jobs.size() << " compute jobs succeeded in " << totalMs << " ms" << std::endl;
+	return failed == 0;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "GpuEvents.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * General purpose compute on a WebGPU device of its own, without a window or surface.
+ *
+ * Every binding lives in group 0 and is a buffer, so a bind group layout is just the type of each
+ * binding in order. Layouts and pipelines are cached, the latter by shader source, entry point and
+ * layout, so jobs run many times only pay for shader compilation once.
+ *
+ * Work is recorded into a Batch and submitted at once. Results come back through readback
+ * callbacks fired from Poll() once the GPU is done, so the CPU can prepare the next batch while
+ * the previous one runs.
+ */
+class ComputeContext
+{
+public:
+	enum class Binding
+	{
+		Uniform,
+		ReadOnlyStorage,
+		Storage,
+	};
+	using Layout = std::vector<Binding>;
+
+	// Buffer for the binding of the same index in the layout
+	struct BufferBinding
+	{
+		WGPUBuffer buffer;
+		uint64_t offset = 0;
+		uint64_t size = WGPU_WHOLE_SIZE;
+	};
+
+	struct Dim3
+	{
+		uint32_t x = 1;
+		uint32_t y = 1;
+		uint32_t z = 1;
+	};
+
+	// A texture to render into without a surface, and its default view
+	struct OffscreenTarget
+	{
+		WgpuTexturePtr texture{nullptr, wgpuTextureRelease};
+		WgpuTextureViewPtr view{nullptr, wgpuTextureViewRelease};
+	};
+
+	// data is null if the buffer could not be mapped
+	using ReadbackFn = std::function<void(const void* data, uint64_t size)>;
+
+	// Commands recorded for one submission
+	class Batch
+	{
+	public:
+		/*
+		 * Dispatch enough workgroups of workgroupSize (which must match the shader) to cover the
+		 * invocations. Consecutive dispatches share a compute pass. Returns false if a dimension
+		 * needs more workgroups than the device allows.
+		 */
+		bool Dispatch(WGPUComputePipeline pipeline, WGPUBindGroup bindGroup, Dim3 invocations, Dim3 workgroupSize);
+
+		// Copy size bytes of source once the preceding dispatches are done, and pass them to fn from Poll()
+		void Readback(WGPUBuffer source, uint64_t offset, uint64_t size, ReadbackFn fn);
+
+	private:
+		friend class ComputeContext;
+
+		struct PendingReadback
+		{
+			ComputeContext *context;
+			WgpuBufferPtr staging;
+			uint64_t size;
+			ReadbackFn fn;
+			GpuRequest<bool> mapped;
+			bool done;
+		};
+
+		Batch(ComputeContext& context, WgpuCommandEncoderPtr encoder);
+		void EndPass();
+
+		ComputeContext *m_context;
+		WgpuCommandEncoderPtr m_encoder;
+		WgpuComputePassEncoderPtr m_pass;
+		std::vector<std::unique_ptr<PendingReadback>> m_readbacks;
+	};
+
+	// Creates the device, check IsInitialized()
+	ComputeContext();
+	~ComputeContext();
+
+	ComputeContext(const ComputeContext&) = delete;
+	ComputeContext& operator=(const ComputeContext&) = delete;
+
+	bool IsInitialized() const { return m_initialized; }
+	WGPUDevice Device() const { return m_device.get(); }
+	WGPUQueue Queue() const { return m_queue.get(); }
+	const WGPULimits& Limits() const { return m_limits; }
+
+	// Uncaptured device errors so far, such as shader compilation or validation failures
+	uint32_t ErrorCount() const { return m_errorCount.load(std::memory_order_relaxed); }
+
+	// Cached for the lifetime of the context. The entry point must be a @compute function.
+	WGPUComputePipeline GetPipeline(const std::string& wgsl, const std::string& entryPoint, const Layout& layout);
+	WGPUBindGroupLayout GetBindGroupLayout(const Layout& layout);
+	WgpuBindGroupPtr CreateBindGroup(const Layout& layout, std::initializer_list<BufferBinding> buffers);
+
+	// Tracked by GpuMemory like every other buffer
+	WgpuBufferPtr CreateBuffer(uint64_t size, WGPUFlags usage, const char* label);
+	void WriteBuffer(WGPUBuffer buffer, uint64_t offset, const void* data, size_t size);
+
+	// Tracked by GpuMemory as well, the view is null if the texture could not be created
+	OffscreenTarget CreateOffscreenTarget(uint32_t width, uint32_t height, WGPUTextureFormat format,
+		WGPUFlags usage = WGPUTextureUsage_RenderAttachment);
+
+	static uint32_t WorkgroupCount(uint64_t invocations, uint32_t workgroupSize)
+	{
+		return static_cast<uint32_t>((invocations + workgroupSize - 1) / workgroupSize);
+	}
+
+	Batch Begin();
+	void Submit(Batch&& batch);
+
+	// Fire the callbacks of readbacks that have completed
+	void Poll();
+
+	// Block until every submitted readback has completed and fired its callback
+	void Wait();
+
+	// Block until the GPU has finished everything submitted to the queue so far, not only compute
+	void WaitForQueue();
+
+	size_t PendingReadbacks() const { return m_readbacks.size(); }
+
+private:
+	struct CachedLayout
+	{
+		WgpuBindGroupLayoutPtr bindGroupLayout;
+		WgpuPipelineLayoutPtr pipelineLayout;
+	};
+
+	static std::string LayoutKey(const Layout& layout);
+	const CachedLayout* GetLayout(const Layout& layout);
+	WgpuBufferPtr AcquireStaging(uint64_t size);
+	void MapReadback(Batch::PendingReadback& readback);
+	static void FinishReadback(Batch::PendingReadback& readback, bool mapped);
+
+	bool m_initialized;
+	std::atomic<uint32_t> m_errorCount;
+	WGPULimits m_limits;
+
+	WgpuInstancePtr m_instance;
+	GpuEvents m_events;
+	WgpuAdapterPtr m_adapter;
+	WgpuDevicePtr m_device;
+	WgpuQueuePtr m_queue;
+
+	// Declared after the device so they are released first
+	std::unordered_map<std::string, CachedLayout> m_layouts;                  // Keyed by LayoutKey()
+	std::unordered_map<std::string, WgpuComputePipelinePtr> m_pipelines;      // Keyed by entry point, layout and source
+	std::vector<std::unique_ptr<Batch::PendingReadback>> m_readbacks;
+	std::vector<WgpuBufferPtr> m_freeStaging;
+};
+
+/*
+ * Run the compute jobs listed in jobFile, one per line, on a headless device:
+ *
+ *     <shader.wgsl> <input file> <output file> [workgroup size, default 64]
+ *
+ * Blank lines and lines starting with # are skipped. Each shader's `main` entry point sees
+ *
+ *     @group(0) @binding(0) var<storage, read> input: array<u32>;
+ *     @group(0) @binding(1) var<storage, read_write> output: array<u32>;
+ *     @group(0) @binding(2) var<uniform> params: vec4u;  // x is the number of words
+ *
+ * and is dispatched once per 32 bit word of the input, which is zero padded to a whole word. The
+ * output has the size of the input. Jobs are submitted back to back and written out as their
+ * readbacks complete. Returns false if any job failed.
+ */
+bool RunComputeBatch(const std::string& jobFile);
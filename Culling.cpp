@@ -0,0 +1,387 @@
+#include "Culling.hpp"
+#include "Simd.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+
+namespace {
+
+using Ops = simd::Native;
+using V = Ops::V;
+
+static_assert(Bvh::kNodeWidth % Ops::kWidth == 0, "A node must fill whole registers");
+
+// Frustum planes broadcast once per traversal
+struct PlaneSet
+{
+	explicit PlaneSet(const Frustum& frustum)
+	{
+		for (size_t p = 0; p < Frustum::kPlaneCount; ++p)
+		{
+			nx[p] = Ops::Set1(frustum.nx[p]);
+			ny[p] = Ops::Set1(frustum.ny[p]);
+			nz[p] = Ops::Set1(frustum.nz[p]);
+			d[p] = Ops::Set1(frustum.d[p]);
+			ax[p] = Ops::Set1(frustum.ax[p]);
+			ay[p] = Ops::Set1(frustum.ay[p]);
+			az[p] = Ops::Set1(frustum.az[p]);
+		}
+	}
+
+	V nx[Frustum::kPlaneCount], ny[Frustum::kPlaneCount], nz[Frustum::kPlaneCount], d[Frustum::kPlaneCount];
+	V ax[Frustum::kPlaneCount], ay[Frustum::kPlaneCount], az[Frustum::kPlaneCount];
+};
+
+/*
+ * Test Bvh::kNodeWidth boxes. A box is outside when its center is further behind a plane than its
+ * projected radius, and entirely inside when it is at least that far in front of every plane.
+ * Sets a bit per lane in outside, and in partial for boxes that are not entirely inside.
+ */
+void TestBoxes(const PlaneSet& planes, const float* cx, const float* cy, const float* cz,
+	const float* ex, const float* ey, const float* ez, uint32_t& outside, uint32_t& partial)
+{
+	outside = 0;
+	partial = 0;
+	for (uint32_t lane = 0; lane < Bvh::kNodeWidth; lane += Ops::kWidth)
+	{
+		const V x = Ops::Load(cx + lane), y = Ops::Load(cy + lane), z = Ops::Load(cz + lane);
+		const V hx = Ops::Load(ex + lane), hy = Ops::Load(ey + lane), hz = Ops::Load(ez + lane);
+
+		int outsideBits = 0;
+		int partialBits = 0;
+		for (size_t p = 0; p < Frustum::kPlaneCount; ++p)
+		{
+			const V dist = Ops::Madd(planes.nx[p], x, Ops::Madd(planes.ny[p], y, Ops::Madd(planes.nz[p], z, planes.d[p])));
+			const V radius = Ops::Madd(planes.ax[p], hx, Ops::Madd(planes.ay[p], hy, Ops::Mul(planes.az[p], hz)));
+			outsideBits |= Ops::MoveMask(Ops::Less(Ops::Add(dist, radius), Ops::Set1(0.0f)));
+			partialBits |= Ops::MoveMask(Ops::Less(dist, radius));
+		}
+		outside |= static_cast<uint32_t>(outsideBits) << lane;
+		partial |= static_cast<uint32_t>(partialBits) << lane;
+	}
+}
+
+float SurfaceArea(float ex, float ey, float ez)
+{
+	return 8.0f * (ex * ey + ey * ez + ez * ex);
+}
+
+} // anonymous namespace
+
+Frustum Frustum::FromMatrix(const math::Mat4& m)
+{
+	// Clip space is -w <= x, y <= w and 0 <= z <= w, each a combination of rows of the matrix
+	const math::Vec4 *c = m.cols;
+	const math::Vec4 row0{c[0].x, c[1].x, c[2].x, c[3].x};
+	const math::Vec4 row1{c[0].y, c[1].y, c[2].y, c[3].y};
+	const math::Vec4 row2{c[0].z, c[1].z, c[2].z, c[3].z};
+	const math::Vec4 row3{c[0].w, c[1].w, c[2].w, c[3].w};
+	const math::Vec4 planes[kPlaneCount] = {
+		{row3.x + row0.x, row3.y + row0.y, row3.z + row0.z, row3.w + row0.w},  // Left
+		{row3.x - row0.x, row3.y - row0.y, row3.z - row0.z, row3.w - row0.w},  // Right
+		{row3.x + row1.x, row3.y + row1.y, row3.z + row1.z, row3.w + row1.w},  // Bottom
+		{row3.x - row1.x, row3.y - row1.y, row3.z - row1.z, row3.w - row1.w},  // Top
+		row2,                                                                  // Near
+		{row3.x - row2.x, row3.y - row2.y, row3.z - row2.z, row3.w - row2.w},  // Far
+	};
+
+	Frustum frustum;
+	for (size_t p = 0; p < kPlaneCount; ++p)
+	{
+		// Normalized so distances are in world units, which keeps the box radius comparable
+		const float length = std::sqrt(planes[p].x * planes[p].x + planes[p].y * planes[p].y + planes[p].z * planes[p].z);
+		const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+		frustum.nx[p] = planes[p].x * scale;
+		frustum.ny[p] = planes[p].y * scale;
+		frustum.nz[p] = planes[p].z * scale;
+		frustum.d[p] = planes[p].w * scale;
+		frustum.ax[p] = std::fabs(frustum.nx[p]);
+		frustum.ay[p] = std::fabs(frustum.ny[p]);
+		frustum.az[p] = std::fabs(frustum.nz[p]);
+	}
+	return frustum;
+}
+
+bool Frustum::Intersects(const math::Vec3& center, const math::Vec3& extents) const
+{
+	for (size_t p = 0; p < kPlaneCount; ++p)
+	{
+		const float dist = nx[p] * center.x + ny[p] * center.y + nz[p] * center.z + d[p];
+		const float radius = ax[p] * extents.x + ay[p] * extents.y + az[p] * extents.z;
+		if (dist + radius < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+void CullBruteForce(const Frustum& frustum, math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, size_t count, std::vector<uint32_t>& visible)
+{
+	visible.clear();
+	const PlaneSet planes(frustum);
+
+	size_t i = 0;
+	for (; i + Bvh::kNodeWidth <= count; i += Bvh::kNodeWidth)
+	{
+		uint32_t outside, partial;
+		TestBoxes(planes, centers.x + i, centers.y + i, centers.z + i, extents.x + i, extents.y + i, extents.z + i, outside, partial);
+		for (uint32_t lane = 0; lane < Bvh::kNodeWidth; ++lane)
+			if (!(outside & (1u << lane)))
+				visible.push_back(static_cast<uint32_t>(i + lane));
+	}
+
+	for (; i < count; ++i)
+		if (frustum.Intersects({centers.x[i], centers.y[i], centers.z[i]}, {extents.x[i], extents.y[i], extents.z[i]}))
+			visible.push_back(static_cast<uint32_t>(i));
+}
+
+void Bvh::Build(math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, size_t count)
+{
+	m_objectCount = count;
+	m_objects.resize(count);
+	std::iota(m_objects.begin(), m_objects.end(), 0u);
+	m_objectSlots.assign(count, 0);
+	m_nodes.Clear();
+	m_nodes.Reserve(count / (kNodeWidth - 1) + 1);
+	m_area = 0.0;
+
+	if (count > 0)
+		BuildNode(0, static_cast<uint32_t>(count), kNoNode, 0, centers);
+
+	// The topology is done, boxes are filled in bottom up like a refit of every object
+	m_nodeDirty.assign(m_nodes.Size(), 0);
+	for (uint32_t i = 0; i < count; ++i)
+		SetObjectBounds(i, centers, extents);
+	PropagateBounds();
+	m_builtArea = m_area;
+}
+
+uint32_t Bvh::BuildNode(uint32_t begin, uint32_t end, uint32_t parent, uint32_t parentSlot, math::ConstFloat3Soa centers)
+{
+	const uint32_t index = static_cast<uint32_t>(m_nodes.Size());
+	m_nodes.Resize(index + 1);
+	{
+		Node &node = m_nodes[index];
+		node.parent = parent;
+		node.parentSlot = parentSlot;
+		node.first = begin;
+		node.count = end - begin;
+	}
+
+	// Split into up to kNodeWidth parts by repeatedly halving the largest one at the median of
+	// its centers along their longest axis
+	struct Part { uint32_t begin, end; };
+	Part parts[kNodeWidth] = {{begin, end}};
+	uint32_t partCount = 1;
+	while (partCount < kNodeWidth)
+	{
+		uint32_t largest = 0;
+		for (uint32_t p = 1; p < partCount; ++p)
+			if (parts[p].end - parts[p].begin > parts[largest].end - parts[largest].begin)
+				largest = p;
+
+		const Part part = parts[largest];
+		if (part.end - part.begin < 2)
+			break;
+
+		math::Vec3 lo{INFINITY, INFINITY, INFINITY};
+		math::Vec3 hi{-INFINITY, -INFINITY, -INFINITY};
+		for (uint32_t i = part.begin; i < part.end; ++i)
+		{
+			const uint32_t object = m_objects[i];
+			lo = {std::min(lo.x, centers.x[object]), std::min(lo.y, centers.y[object]), std::min(lo.z, centers.z[object])};
+			hi = {std::max(hi.x, centers.x[object]), std::max(hi.y, centers.y[object]), std::max(hi.z, centers.z[object])};
+		}
+		const math::Vec3 size{hi.x - lo.x, hi.y - lo.y, hi.z - lo.z};
+		const float *axis = size.x >= size.y && size.x >= size.z ? centers.x : size.y >= size.z ? centers.y : centers.z;
+
+		const uint32_t middle = part.begin + (part.end - part.begin) / 2;
+		std::nth_element(m_objects.begin() + part.begin, m_objects.begin() + middle, m_objects.begin() + part.end,
+			[axis](uint32_t a, uint32_t b) { return axis[a] < axis[b]; });
+
+		parts[largest] = {part.begin, middle};
+		parts[partCount++] = {middle, part.end};
+	}
+	std::sort(parts, parts + partCount, [](const Part& a, const Part& b) { return a.begin < b.begin; });
+
+	m_nodes[index].childCount = partCount;
+	for (uint32_t slot = 0; slot < partCount; ++slot)
+	{
+		uint32_t child;
+		if (parts[slot].end - parts[slot].begin == 1)
+		{
+			const uint32_t object = m_objects[parts[slot].begin];
+			m_objectSlots[object] = index * kNodeWidth + slot;
+			child = kLeafBit | object;
+		}
+		else
+		{
+			child = BuildNode(parts[slot].begin, parts[slot].end, index, slot, centers);
+		}
+		// Not kept as a reference, building the child may have moved the nodes
+		m_nodes[index].children[slot] = child;
+	}
+	return index;
+}
+
+void Bvh::SetObjectBounds(uint32_t object, math::ConstFloat3Soa centers, math::ConstFloat3Soa extents)
+{
+	const uint32_t slot = m_objectSlots[object];
+	const math::Vec3 center{centers.x[object], centers.y[object], centers.z[object]};
+	const math::Vec3 extent{extents.x[object], extents.y[object], extents.z[object]};
+	SetSlotBounds(m_nodes[slot / kNodeWidth], slot % kNodeWidth,
+		{center.x - extent.x, center.y - extent.y, center.z - extent.z},
+		{center.x + extent.x, center.y + extent.y, center.z + extent.z});
+	m_nodeDirty[slot / kNodeWidth] = 1;
+}
+
+void Bvh::SetSlotBounds(Node& node, uint32_t slot, const math::Vec3& min, const math::Vec3& max)
+{
+	m_area -= SurfaceArea(node.extentX[slot], node.extentY[slot], node.extentZ[slot]);
+	node.centerX[slot] = (min.x + max.x) * 0.5f;
+	node.centerY[slot] = (min.y + max.y) * 0.5f;
+	node.centerZ[slot] = (min.z + max.z) * 0.5f;
+	node.extentX[slot] = (max.x - min.x) * 0.5f;
+	node.extentY[slot] = (max.y - min.y) * 0.5f;
+	node.extentZ[slot] = (max.z - min.z) * 0.5f;
+	m_area += SurfaceArea(node.extentX[slot], node.extentY[slot], node.extentZ[slot]);
+}
+
+void Bvh::PropagateBounds()
+{
+	// Children always come after their parent, so one backwards pass reaches the root
+	for (size_t n = m_nodes.Size(); n-- > 0;)
+	{
+		if (!m_nodeDirty[n])
+			continue;
+		m_nodeDirty[n] = 0;
+
+		const Node &node = m_nodes[n];
+		if (node.parent == kNoNode)
+			continue;
+
+		math::Vec3 lo{INFINITY, INFINITY, INFINITY};
+		math::Vec3 hi{-INFINITY, -INFINITY, -INFINITY};
+		for (uint32_t slot = 0; slot < node.childCount; ++slot)
+		{
+			lo.x = std::min(lo.x, node.centerX[slot] - node.extentX[slot]);
+			lo.y = std::min(lo.y, node.centerY[slot] - node.extentY[slot]);
+			lo.z = std::min(lo.z, node.centerZ[slot] - node.extentZ[slot]);
+			hi.x = std::max(hi.x, node.centerX[slot] + node.extentX[slot]);
+			hi.y = std::max(hi.y, node.centerY[slot] + node.extentY[slot]);
+			hi.z = std::max(hi.z, node.centerZ[slot] + node.extentZ[slot]);
+		}
+		SetSlotBounds(m_nodes[node.parent], node.parentSlot, lo, hi);
+		m_nodeDirty[node.parent] = 1;
+	}
+}
+
+void Bvh::AppendObjects(uint32_t node, std::vector<uint32_t>& visible) const
+{
+	const Node &n = m_nodes[node];
+	visible.insert(visible.end(), m_objects.begin() + n.first, m_objects.begin() + n.first + n.count);
+}
+
+void Bvh::CullSubtree(uint32_t root, const Frustum& frustum, std::vector<uint32_t>& visible, size_t& visited, size_t& tested) const
+{
+	const PlaneSet planes(frustum);
+	uint32_t stack[128];
+	uint32_t depth = 0;
+	stack[depth++] = root;
+
+	while (depth > 0)
+	{
+		const Node &node = m_nodes[stack[--depth]];
+		uint32_t outside, partial;
+		TestBoxes(planes, node.centerX, node.centerY, node.centerZ, node.extentX, node.extentY, node.extentZ, outside, partial);
+		++visited;
+		tested += node.childCount;
+
+		const uint32_t valid = (1u << node.childCount) - 1;
+		const uint32_t candidates = ~outside & valid;
+		for (uint32_t slot = 0; slot < node.childCount; ++slot)
+		{
+			if (!(candidates & (1u << slot)))
+				continue;
+
+			const uint32_t child = node.children[slot];
+			if (child & kLeafBit)
+				visible.push_back(child & ~kLeafBit);
+			else if (!(partial & (1u << slot)))
+				AppendObjects(child, visible);
+			else
+			{
+				// The tree is balanced, so the depth stays far below the stack size
+				assert(depth < std::size(stack));
+				stack[depth++] = child;
+			}
+		}
+	}
+}
+
+void Bvh::Cull(const Frustum& frustum, JobSystem& jobs, VisibleList& out) const
+{
+	out.indices.clear();
+	out.visitedNodes = 0;
+	out.testedBounds = 0;
+	out.culled = m_objectCount;
+	if (m_nodes.Empty())
+		return;
+
+	// Expand the top of the tree breadth first on this thread until there are enough
+	// independent subtrees to keep every thread busy
+	const PlaneSet planes(frustum);
+	const size_t targetTasks = (jobs.WorkerCount() + 1) * kTasksPerThread;
+	std::vector<uint32_t> &tasks = out.m_tasks;
+	tasks.assign(1, 0);
+	size_t head = 0;
+	while (head < tasks.size() && tasks.size() - head < targetTasks)
+	{
+		const Node &node = m_nodes[tasks[head++]];
+		uint32_t outside, partial;
+		TestBoxes(planes, node.centerX, node.centerY, node.centerZ, node.extentX, node.extentY, node.extentZ, outside, partial);
+		++out.visitedNodes;
+		out.testedBounds += node.childCount;
+
+		for (uint32_t slot = 0; slot < node.childCount; ++slot)
+		{
+			if (outside & (1u << slot))
+				continue;
+
+			const uint32_t child = node.children[slot];
+			if (child & kLeafBit)
+				out.indices.push_back(child & ~kLeafBit);
+			else if (!(partial & (1u << slot)))
+				AppendObjects(child, out.indices);
+			else
+				tasks.push_back(child);
+		}
+	}
+
+	const size_t taskCount = tasks.size() - head;
+	out.m_taskIndices.resize(std::max(out.m_taskIndices.size(), taskCount));
+	out.m_taskVisited.assign(taskCount, 0);
+	out.m_taskTested.assign(taskCount, 0);
+	jobs.ParallelFor(taskCount, 1, [&](size_t begin, size_t end) {
+		for (size_t t = begin; t < end; ++t)
+		{
+			out.m_taskIndices[t].clear();
+			CullSubtree(tasks[head + t], frustum, out.m_taskIndices[t], out.m_taskVisited[t], out.m_taskTested[t]);
+		}
+	});
+
+	// Compact in task order, so the list does not depend on scheduling
+	size_t total = out.indices.size();
+	for (size_t t = 0; t < taskCount; ++t)
+		total += out.m_taskIndices[t].size();
+	out.indices.reserve(total);
+	for (size_t t = 0; t < taskCount; ++t)
+	{
+		out.indices.insert(out.indices.end(), out.m_taskIndices[t].begin(), out.m_taskIndices[t].end());
+		out.visitedNodes += out.m_taskVisited[t];
+		out.testedBounds += out.m_taskTested[t];
+	}
+	out.culled = m_objectCount - out.indices.size();
+}
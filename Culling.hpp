@@ -0,0 +1,146 @@
+#pragma once
+
+#include "AlignedArray.hpp"
+#include "Math.hpp"
+#include "Parallel.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * View frustum as six planes facing inwards, extracted from a view projection matrix with WebGPU
+ * clip space (depth in [0, 1]). A point p is inside a plane when dot(normal, p) + d >= 0.
+ * Planes are stored as structure of arrays, with the absolute normals precomputed for box tests.
+ */
+struct Frustum
+{
+	static constexpr size_t kPlaneCount = 6;
+
+	float nx[kPlaneCount], ny[kPlaneCount], nz[kPlaneCount], d[kPlaneCount];
+	float ax[kPlaneCount], ay[kPlaneCount], az[kPlaneCount];
+
+	static Frustum FromMatrix(const math::Mat4& viewProjection);
+
+	// Scalar reference test of one box, true unless the box is entirely outside a plane
+	bool Intersects(const math::Vec3& center, const math::Vec3& extents) const;
+};
+
+// Objects visible from one view, as indices into the bounds arrays the hierarchy was built from
+struct VisibleList
+{
+	std::vector<uint32_t> indices;
+	size_t visitedNodes = 0;
+	size_t testedBounds = 0;
+	size_t culled = 0;
+
+private:
+	friend class Bvh;
+
+	// Per task output, reused between frames
+	std::vector<uint32_t> m_tasks;
+	std::vector<std::vector<uint32_t>> m_taskIndices;
+	std::vector<size_t> m_taskVisited;
+	std::vector<size_t> m_taskTested;
+};
+
+// Test every box against the frustum, Bvh::kNodeWidth boxes at a time. The reference for Bvh::Cull.
+void CullBruteForce(const Frustum& frustum, math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, size_t count, std::vector<uint32_t>& visible);
+
+/**
+ * Bounding volume hierarchy over axis aligned boxes, for frustum culling on the CPU.
+ *
+ * Each node holds the boxes of up to kNodeWidth children as structure of arrays, so one node is
+ * tested against a plane with a single pass of SIMD instructions. A child is either another node
+ * or a single object. Subtrees found entirely inside the frustum are appended without testing
+ * their contents, since every node knows the contiguous run of objects below it.
+ *
+ * Moving objects only refit the boxes on their path to the root. Refitting keeps the topology, so
+ * the tree degrades as objects wander, and Update() rebuilds it once the total box area has grown
+ * past kRebuildRatio times the area right after the last build.
+ */
+class Bvh
+{
+public:
+#if defined(MATH_HAS_AVX2)
+	static constexpr uint32_t kNodeWidth = 8;
+#else
+	static constexpr uint32_t kNodeWidth = 4;
+#endif
+
+	static constexpr double kRebuildRatio = 1.5;
+
+	// Build from scratch over count boxes given as centers and half extents
+	void Build(math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, size_t count);
+
+	// Update the boxes of the objects in the given ranges and everything above them
+	template <class RangeList>
+	void Refit(math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, const RangeList& changed)
+	{
+		for (const auto &range : changed)
+			for (uint32_t i = range.first; i < range.first + range.count; ++i)
+				SetObjectBounds(i, centers, extents);
+		PropagateBounds();
+	}
+
+	/*
+	 * Keep the hierarchy in step with a set of boxes: rebuild when indices changed (reindexed), the
+	 * count differs or the tree degraded, refit the changed ranges otherwise. Returns true on rebuild.
+	 */
+	template <class RangeList>
+	bool Update(math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, size_t count, const RangeList& changed, bool reindexed)
+	{
+		if (!reindexed && count == m_objectCount)
+		{
+			Refit(centers, extents, changed);
+			if (!Degraded())
+				return false;
+		}
+		Build(centers, extents, count);
+		return true;
+	}
+
+	bool Degraded() const { return m_area > m_builtArea * kRebuildRatio; }
+
+	// Collect the objects intersecting the frustum, splitting the traversal between the job system's threads
+	void Cull(const Frustum& frustum, JobSystem& jobs, VisibleList& out) const;
+
+	size_t Size() const { return m_objectCount; }
+	size_t NodeCount() const { return m_nodes.Size(); }
+
+private:
+	static constexpr uint32_t kLeafBit = 1u << 31;
+	static constexpr uint32_t kNoNode = ~0u;
+
+	// Independent subtrees handed out per thread, more than one to balance uneven subtrees
+	static constexpr size_t kTasksPerThread = 4;
+
+	struct alignas(64) Node
+	{
+		// Child boxes as centers and half extents, lanes past childCount are unused
+		float centerX[kNodeWidth], centerY[kNodeWidth], centerZ[kNodeWidth];
+		float extentX[kNodeWidth], extentY[kNodeWidth], extentZ[kNodeWidth];
+		uint32_t children[kNodeWidth];  // Node index, or kLeafBit | object index
+		uint32_t childCount;
+		uint32_t parent;      // kNoNode for the root
+		uint32_t parentSlot;
+		uint32_t first;       // Objects below this node are m_objects[first, first + count)
+		uint32_t count;
+	};
+
+	uint32_t BuildNode(uint32_t begin, uint32_t end, uint32_t parent, uint32_t parentSlot, math::ConstFloat3Soa centers);
+	void SetObjectBounds(uint32_t object, math::ConstFloat3Soa centers, math::ConstFloat3Soa extents);
+	void SetSlotBounds(Node& node, uint32_t slot, const math::Vec3& min, const math::Vec3& max);
+	void PropagateBounds();
+
+	// Depth first traversal below node, appending visible objects
+	void CullSubtree(uint32_t node, const Frustum& frustum, std::vector<uint32_t>& visible, size_t& visited, size_t& tested) const;
+	void AppendObjects(uint32_t node, std::vector<uint32_t>& visible) const;
+
+	AlignedArray<Node> m_nodes;
+	std::vector<uint32_t> m_objects;       // Object indices in leaf order
+	std::vector<uint32_t> m_objectSlots;   // Object index to node index * kNodeWidth + slot
+	std::vector<uint8_t> m_nodeDirty;
+	size_t m_objectCount = 0;
+	double m_area = 0.0;       // Sum of the surface areas of every child box
+	double m_builtArea = 0.0;
+};
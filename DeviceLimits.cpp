@@ -0,0 +1,104 @@
+#include "DeviceLimits.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace {
+
+constexpr size_t kTierCount = static_cast<size_t>(DeviceLimits::Tier::Count);
+constexpr uint64_t kMiB = 1024 * 1024;
+
+template <class T>
+struct TierLimit
+{
+	T WGPULimits::* limit;
+	std::array<T, kTierCount> values;  // Indexed by tier, never decreasing
+};
+
+constexpr TierLimit<uint32_t> kTierLimits32[] = {
+	{&WGPULimits::maxTextureDimension2D, {8192, 16384, 16384}},
+	{&WGPULimits::maxTextureArrayLayers, {256, 256, 2048}},
+	{&WGPULimits::maxComputeWorkgroupStorageSize, {16384, 32768, 32768}},
+	{&WGPULimits::maxComputeInvocationsPerWorkgroup, {256, 1024, 1024}},
+	{&WGPULimits::maxComputeWorkgroupSizeX, {256, 1024, 1024}},
+	{&WGPULimits::maxComputeWorkgroupSizeY, {256, 1024, 1024}},
+};
+
+constexpr TierLimit<uint64_t> kTierLimits64[] = {
+	{&WGPULimits::maxBufferSize, {256 * kMiB, 1024 * kMiB, 2048 * kMiB}},
+	// Backends keep binding sizes a multiple of 4 below 2 GiB
+	{&WGPULimits::maxStorageBufferBindingSize, {128 * kMiB, 1024 * kMiB, 2048 * kMiB - 4}},
+};
+
+template <class T, size_t N>
+bool Supports(const WGPULimits& supported, const TierLimit<T> (&tierLimits)[N], size_t tier)
+{
+	return std::all_of(std::begin(tierLimits), std::end(tierLimits),
+		[&](const TierLimit<T>& tierLimit) { return supported.*tierLimit.limit >= tierLimit.values[tier]; });
+}
+
+template <class T, size_t N>
+void Apply(WGPULimits& limits, const TierLimit<T> (&tierLimits)[N], size_t tier)
+{
+	for (const TierLimit<T> &tierLimit : tierLimits)
+		limits.*tierLimit.limit = tierLimit.values[tier];
+}
+
+} // anonymous namespace
+
+DeviceLimits::DeviceLimits() :
+	m_tier(Tier::Baseline),
+	m_limits{}
+{
+	Apply(m_limits, kTierLimits32, 0);
+	Apply(m_limits, kTierLimits64, 0);
+}
+
+DeviceLimits DeviceLimits::Negotiate(WGPUAdapter adapter)
+{
+#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPUSupportedLimits supportedLimits{};
+	wgpuAdapterGetLimits(adapter, &supportedLimits);
+	const WGPULimits &supported = supportedLimits.limits;
+#else
+	WGPULimits supported{};
+	wgpuAdapterGetLimits(adapter, &supported);
+#endif
+
+	size_t tier = kTierCount - 1;
+	while (tier > 0 && !(Supports(supported, kTierLimits32, tier) && Supports(supported, kTierLimits64, tier)))
+		--tier;
+
+	DeviceLimits limits;
+	limits.m_tier = static_cast<Tier>(tier);
+	limits.m_limits = supported;
+	Apply(limits.m_limits, kTierLimits32, tier);
+	Apply(limits.m_limits, kTierLimits64, tier);
+	return limits;
+}
+
+const char* DeviceLimits::TierName(Tier tier)
+{
+	switch (tier)
+	{
+	case Tier::Baseline: return "baseline";
+	case Tier::Standard: return "standard";
+	case Tier::High: return "high";
+	default: return "unknown";
+	}
+}
+
+#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+WGPURequiredLimits DeviceLimits::RequiredLimits() const
+{
+	WGPURequiredLimits required{};
+	required.limits = m_limits;
+	required.limits.maxInterStageShaderComponents = WGPU_LIMIT_U32_UNDEFINED;  // This is removed in latest webgpu but firefox complains about this
+	return required;
+}
+#endif
+
+uint64_t DeviceLimits::MaxStorageElements(uint64_t elementSize) const
+{
+	return std::min(m_limits.maxStorageBufferBindingSize, m_limits.maxBufferSize) / elementSize;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include <cstdint>
+
+/**
+ * The device limits, negotiated as one of a few tiers rather than limit by limit.
+ *
+ * Each tier sets the limits that decide how large the app's data can get: buffer and storage
+ * binding sizes, texture dimensions and array layers, and compute workgroup sizes. Negotiate()
+ * picks the highest tier the adapter fully supports, so the same tier behaves the same on every
+ * machine. Limits outside the tiers are requested as the adapter supports them.
+ *
+ * Subsystems query Limits() to pick their fast path or fall back at runtime, rather than assuming
+ * any particular tier.
+ */
+class DeviceLimits
+{
+public:
+	enum class Tier
+	{
+		Baseline,  // The WebGPU defaults, supported by every adapter
+		Standard,  // Typical of integrated GPUs
+		High,      // Typical of discrete GPUs
+		Count,
+	};
+
+	// The baseline tier's limits, until negotiated
+	DeviceLimits();
+
+	static DeviceLimits Negotiate(WGPUAdapter adapter);
+
+	Tier GetTier() const { return m_tier; }
+	static const char* TierName(Tier tier);
+
+	// What the device is created with, so what it can be relied on to support
+	const WGPULimits& Limits() const { return m_limits; }
+
+	// For WGPUDeviceDescriptor::requiredLimits
+#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPURequiredLimits RequiredLimits() const;
+#else
+	WGPULimits RequiredLimits() const { return m_limits; }
+#endif
+
+	// Largest number of elements of elementSize bytes one storage buffer binding holds
+	uint64_t MaxStorageElements(uint64_t elementSize) const;
+
+private:
+	Tier m_tier;
+	WGPULimits m_limits;
+};
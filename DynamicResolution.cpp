@@ -0,0 +1,80 @@
+#include "DynamicResolution.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const char* kUpscaleShader = R"(
+@group(0) @binding(0) var scene: texture_2d<f32>;
+@group(0) @binding(1) var sceneSampler: sampler;
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f
+{
+	return vec4f(textureSampleLevel(scene, sceneSampler, in.uv, 0.0).rgb, 1.0);
+})";
+
+} // anonymous namespace
+
+DynamicResolution::DynamicResolution() :
+	m_scale(1.0f),
+	m_error(0.0),
+	m_previousError(0.0)
+{
+}
+
+bool DynamicResolution::Initialize(WGPUDevice device, WGPUTextureFormat outputFormat, const Settings& settings)
+{
+	TRACE_SCOPE("DynamicResolutionInitialize");
+
+	Reset();
+	m_settings = settings;
+	m_settings.minScale = std::clamp(settings.minScale, kScaleStep, 1.0f);
+	m_settings.maxScale = std::clamp(settings.maxScale, m_settings.minScale, 1.0f);
+	m_scale = m_settings.maxScale;
+	m_error = 0.0;
+	m_previousError = 0.0;
+
+	return m_upscale.Initialize(device, outputFormat, kUpscaleShader);
+}
+
+void DynamicResolution::Reset()
+{
+	m_upscale.Reset();
+}
+
+float DynamicResolution::Update(double frameMs)
+{
+	// Positive when there is time to spare
+	double error = (m_settings.targetMs - frameMs) / m_settings.targetMs;
+	if (std::abs(error) < m_settings.hysteresis)
+		error = 0.0;
+
+	// Velocity form, the integral lives in the scale itself so clamping it cannot wind up
+	const double delta = m_settings.kp * (error - m_error)
+		+ m_settings.ki * error
+		+ m_settings.kd * (error - 2.0 * m_error + m_previousError);
+	m_previousError = m_error;
+	m_error = error;
+
+	m_scale = std::clamp(static_cast<float>(m_scale + delta), m_settings.minScale, m_settings.maxScale);
+	return Scale();
+}
+
+float DynamicResolution::Scale() const
+{
+	const float quantized = std::round(m_scale / kScaleStep) * kScaleStep;
+	return std::clamp(quantized, m_settings.minScale, m_settings.maxScale);
+}
+
+uint32_t DynamicResolution::ScaledSize(uint32_t size) const
+{
+	return std::max(1u, static_cast<uint32_t>(size * Scale() + 0.5f));
+}
+
+void DynamicResolution::AddUpscalePass(RenderGraph& graph, RenderGraph::Resource scene, RenderGraph::Resource output)
+{
+	m_upscale.AddPass(graph, "Upscale", scene, output);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "FullscreenBlit.hpp"
+#include "RenderGraph.hpp"
+
+#include <cstdint>
+
+/**
+ * Scales the resolution the scene renders at so frames fit a time budget, and upscales the scene
+ * into the output with a bilinear filter.
+ *
+ * Update() takes the frame time of each frame, the longer of the CPU and GPU times, and runs a PID
+ * controller in velocity form on the error to the target, normalized by the target. Errors within
+ * the hysteresis band are taken as zero, so the scale holds still once the frame time is close
+ * enough and small variations do not reallocate the scaled targets. The scale is clamped to the
+ * configured bounds and applied in steps, so consecutive frames mostly share their targets.
+ */
+class DynamicResolution
+{
+public:
+	struct Settings
+	{
+		double targetMs = 1000.0 / 60.0;
+		float minScale = 0.5f;
+		float maxScale = 1.0f;
+		double hysteresis = 0.1;  // Fraction of the target
+		double kp = 0.1;
+		double ki = 0.03;
+		double kd = 0.02;
+	};
+
+	// Scales are multiples of this, of each dimension
+	static constexpr float kScaleStep = 1.0f / 32.0f;
+
+	DynamicResolution();
+
+	bool Initialize(WGPUDevice device, WGPUTextureFormat outputFormat, const Settings& settings);
+	void Reset();
+
+	// Feed the time of the latest frame, returns the scale to render the next one at
+	float Update(double frameMs);
+	float Scale() const;
+
+	// Size of the scene at the current scale, at least one pixel
+	uint32_t ScaledSize(uint32_t size) const;
+
+	// Add the pass filtering scene (with TextureBinding usage) into output, whatever their sizes
+	void AddUpscalePass(RenderGraph& graph, RenderGraph::Resource scene, RenderGraph::Resource output);
+
+private:
+	Settings m_settings;
+	float m_scale;  // Unquantized output of the controller
+	double m_error;
+	double m_previousError;
+
+	FullscreenBlit m_upscale;
+};
@@ -0,0 +1,177 @@
+#include "FullscreenBlit.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#include <string>
+
+namespace {
+
+const char* kVertexShader = R"(
+struct VertexOutput
+{
+	@builtin(position) position: vec4f,
+	@location(0) uv: vec2f,
+};
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex: u32) -> VertexOutput
+{
+	// One triangle covering the viewport, uv spans [0, 1] over it
+	let corner = vec2f(f32((vertex << 1u) & 2u), f32(vertex & 2u));
+	var out: VertexOutput;
+	out.position = vec4f(corner * vec2f(2.0, -2.0) + vec2f(-1.0, 1.0), 0.0, 1.0);
+	out.uv = corner;
+	return out;
+}
+)";
+
+} // anonymous namespace
+
+FullscreenBlit::FullscreenBlit() :
+	m_device(nullptr),
+	m_sampler(nullptr, wgpuSamplerRelease),
+	m_shaderModule(nullptr, wgpuShaderModuleRelease),
+	m_bindGroupLayout(nullptr, wgpuBindGroupLayoutRelease),
+	m_pipelineLayout(nullptr, wgpuPipelineLayoutRelease),
+	m_pipeline(nullptr, wgpuRenderPipelineRelease),
+	m_bindGroup(nullptr, wgpuBindGroupRelease),
+	m_boundView(nullptr)
+{
+}
+
+bool FullscreenBlit::Initialize(WGPUDevice device, WGPUTextureFormat outputFormat, const char* fragmentShader,
+	const std::vector<Texture>& extraTextures)
+{
+	TRACE_SCOPE("FullscreenBlitInitialize");
+
+	Reset();
+	m_device = device;
+
+	WGPUSamplerDescriptor samplerDesc{};
+	samplerDesc.addressModeU = WGPUAddressMode_ClampToEdge;
+	samplerDesc.addressModeV = WGPUAddressMode_ClampToEdge;
+	samplerDesc.addressModeW = WGPUAddressMode_ClampToEdge;
+	samplerDesc.magFilter = WGPUFilterMode_Linear;
+	samplerDesc.minFilter = WGPUFilterMode_Linear;
+	samplerDesc.mipmapFilter = WGPUMipmapFilterMode_Nearest;
+	samplerDesc.lodMinClamp = 0.0f;
+	samplerDesc.lodMaxClamp = 1.0f;
+	samplerDesc.maxAnisotropy = 1;
+	m_sampler = WgpuSamplerPtr(wgpuDeviceCreateSampler(device, &samplerDesc), wgpuSamplerRelease);
+
+	const std::string source = std::string(kVertexShader) + fragmentShader;
+	m_shaderModule = WgpuShaderModulePtr(wgpuUtils::createShaderModule(device, source.c_str()), wgpuShaderModuleRelease);
+
+	std::vector<WGPUBindGroupLayoutEntry> layoutEntries(2 + extraTextures.size());
+
+	WGPUBindGroupLayoutEntry &sourceLayout = layoutEntries[0];
+	sourceLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	sourceLayout.binding = 0;
+	sourceLayout.visibility = WGPUShaderStage_Fragment;
+	sourceLayout.texture.sampleType = WGPUTextureSampleType_Float;
+	sourceLayout.texture.viewDimension = WGPUTextureViewDimension_2D;
+
+	WGPUBindGroupLayoutEntry &samplerLayout = layoutEntries[1];
+	samplerLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	samplerLayout.binding = 1;
+	samplerLayout.visibility = WGPUShaderStage_Fragment;
+	samplerLayout.sampler.type = WGPUSamplerBindingType_Filtering;
+
+	for (size_t i = 0; i < extraTextures.size(); ++i)
+	{
+		WGPUBindGroupLayoutEntry &textureLayout = layoutEntries[2 + i];
+		textureLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+		textureLayout.binding = 2 + i;
+		textureLayout.visibility = WGPUShaderStage_Fragment;
+		textureLayout.texture.sampleType = WGPUTextureSampleType_Float;
+		textureLayout.texture.viewDimension = extraTextures[i].dimension;
+		m_extraViews.push_back(extraTextures[i].view);
+	}
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = layoutEntries.size();
+	bindGroupLayoutDesc.entries = layoutEntries.data();
+	WGPUBindGroupLayout bindGroupLayout = wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDesc);
+	m_bindGroupLayout = WgpuBindGroupLayoutPtr(bindGroupLayout, wgpuBindGroupLayoutRelease);
+
+	WGPUPipelineLayoutDescriptor pipelineLayoutDesc{};
+	pipelineLayoutDesc.bindGroupLayoutCount = 1;
+	pipelineLayoutDesc.bindGroupLayouts = &bindGroupLayout;
+	m_pipelineLayout = WgpuPipelineLayoutPtr(wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDesc), wgpuPipelineLayoutRelease);
+
+	WGPURenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = m_pipelineLayout.get();
+	pipelineDesc.vertex.module = m_shaderModule.get();
+	pipelineDesc.vertex.entryPoint = wgpuUtils::label("vs_main");
+	pipelineDesc.primitive.topology = WGPUPrimitiveTopology_TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
+	pipelineDesc.primitive.frontFace = WGPUFrontFace_CCW;
+	pipelineDesc.primitive.cullMode = WGPUCullMode_None;
+
+	WGPUColorTargetState colorTarget{};
+	colorTarget.format = outputFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = WGPUColorWriteMask_All;
+
+	WGPUFragmentState fragment{};
+	fragment.module = m_shaderModule.get();
+	fragment.entryPoint = wgpuUtils::label("fs_main");
+	fragment.targetCount = 1;
+	fragment.targets = &colorTarget;
+	pipelineDesc.fragment = &fragment;
+
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+	m_pipeline = WgpuRenderPipelinePtr(wgpuDeviceCreateRenderPipeline(device, &pipelineDesc), wgpuRenderPipelineRelease);
+
+	return m_sampler && m_pipeline;
+}
+
+void FullscreenBlit::Reset()
+{
+	m_bindGroup.reset();
+	m_boundView = nullptr;
+	m_pipeline.reset();
+	m_pipelineLayout.reset();
+	m_bindGroupLayout.reset();
+	m_shaderModule.reset();
+	m_sampler.reset();
+	m_extraViews.clear();
+}
+
+void FullscreenBlit::AddPass(RenderGraph& graph, const char* name, RenderGraph::Resource source, RenderGraph::Resource output)
+{
+	// Every pixel is written, the clear only avoids loading the previous contents
+	RenderGraph::ColorAttachment color;
+	color.texture = output;
+
+	graph.AddRenderPass(name, {color}, {}, [this, &graph, source](WGPURenderPassEncoder pass) {
+		// The graph hands out the same pooled view frame after frame, so the bind group rarely changes
+		WGPUTextureView view = graph.View(source);
+		if (view != m_boundView)
+		{
+			std::vector<WGPUBindGroupEntry> entries(2 + m_extraViews.size());
+			entries[0].binding = 0;
+			entries[0].textureView = view;
+			entries[1].binding = 1;
+			entries[1].sampler = m_sampler.get();
+			for (size_t i = 0; i < m_extraViews.size(); ++i)
+			{
+				entries[2 + i].binding = 2 + i;
+				entries[2 + i].textureView = m_extraViews[i];
+			}
+
+			WGPUBindGroupDescriptor bindGroupDesc{};
+			bindGroupDesc.layout = m_bindGroupLayout.get();
+			bindGroupDesc.entryCount = entries.size();
+			bindGroupDesc.entries = entries.data();
+			m_bindGroup = WgpuBindGroupPtr(wgpuDeviceCreateBindGroup(m_device, &bindGroupDesc), wgpuBindGroupRelease);
+			m_boundView = view;
+		}
+
+		wgpuRenderPassEncoderSetPipeline(pass, m_pipeline.get());
+		wgpuRenderPassEncoderSetBindGroup(pass, 0, m_bindGroup.get(), 0, nullptr);
+		wgpuRenderPassEncoderDraw(pass, 3, 1, 0, 0);
+	}).Read(source);
+}
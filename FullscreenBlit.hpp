@@ -0,0 +1,46 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "RenderGraph.hpp"
+
+#include <vector>
+
+/**
+ * A pass drawing one triangle over the whole output, which samples a source texture of any size
+ * through a fragment shader.
+ *
+ * The fragment shader is appended to a vertex stage declaring VertexOutput, with uv spanning [0, 1]
+ * over the output. It binds the source as texture_2d<f32> at binding 0 of group 0, a linear clamping
+ * sampler at binding 1, and the extra textures given to Initialize() from binding 2 on, and its entry
+ * point is fs_main(in: VertexOutput).
+ */
+class FullscreenBlit
+{
+public:
+	struct Texture
+	{
+		WGPUTextureView view;
+		WGPUTextureViewDimension dimension;
+	};
+
+	FullscreenBlit();
+
+	bool Initialize(WGPUDevice device, WGPUTextureFormat outputFormat, const char* fragmentShader,
+		const std::vector<Texture>& extraTextures = {});
+	void Reset();
+
+	// Add the pass reading source (with TextureBinding usage) and writing every pixel of output
+	void AddPass(RenderGraph& graph, const char* name, RenderGraph::Resource source, RenderGraph::Resource output);
+
+private:
+	WGPUDevice m_device;
+	std::vector<WGPUTextureView> m_extraViews;
+	WgpuSamplerPtr m_sampler;
+	WgpuShaderModulePtr m_shaderModule;
+	WgpuBindGroupLayoutPtr m_bindGroupLayout;
+	WgpuPipelineLayoutPtr m_pipelineLayout;
+	WgpuRenderPipelinePtr m_pipeline;
+	WgpuBindGroupPtr m_bindGroup;
+	WGPUTextureView m_boundView;  // The source view m_bindGroup was made for, kept alive by it
+};
@@ -0,0 +1,191 @@
+#include "GpuEvents.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#if defined(WEBGPU_BACKEND_WGPU)
+#include <webgpu/wgpu.h>
+#elif defined(WEBGPU_BACKEND_EMSCRIPTEN)
+#include <emscripten.h>
+#endif
+
+#include <algorithm>
+#include <iostream>
+
+#if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
+WGPUInstanceDescriptor GpuEvents::InstanceDescriptor()
+{
+	WGPUInstanceDescriptor desc{};
+	desc.nextInChain = nullptr;
+#if !defined(WEBGPU_FUTURE_UNIMPLEMENTED)
+	desc.features.timedWaitAnyEnable = true;
+#endif
+	return desc;
+}
+#endif
+
+// The callback owns a reference to the state until it fires, which happens exactly once
+template <class T>
+std::pair<std::shared_ptr<typename GpuRequest<T>::State>, void*> GpuEvents::NewState()
+{
+	auto state = std::make_shared<typename GpuRequest<T>::State>();
+	return {state, new std::shared_ptr<typename GpuRequest<T>::State>(state)};
+}
+
+template <class T>
+void GpuEvents::Complete(void* userdata, T result)
+{
+	std::unique_ptr<std::shared_ptr<typename GpuRequest<T>::State>> state(
+		static_cast<std::shared_ptr<typename GpuRequest<T>::State>*>(userdata));
+	(*state)->Complete(result);
+}
+
+GpuRequest<WGPUAdapter> GpuEvents::RequestAdapter(const WGPURequestAdapterOptions* options)
+{
+	auto [state, userdata] = NewState<WGPUAdapter>();
+
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	auto onAdapterRequestEnded = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, WGPUStringView message, void* pUserData1, [[maybe_unused]]void* pUserData2)
+#else
+	auto onAdapterRequestEnded = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, const char* message, void* pUserData1)
+#endif
+	{
+		if (status != WGPURequestAdapterStatus_Success)
+			std::cerr << "Could not retrieve WebGPU adapter: " << message << std::endl;
+		Complete<WGPUAdapter>(pUserData1, status == WGPURequestAdapterStatus_Success ? adapter : nullptr);
+	};
+
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPURequestAdapterCallbackInfo callbackInfo{};
+	callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+	callbackInfo.callback = onAdapterRequestEnded;
+	callbackInfo.userdata1 = userdata;
+	state->futureId = wgpuInstanceRequestAdapter(m_instance, options, callbackInfo).id;
+#else
+	wgpuInstanceRequestAdapter(m_instance, options, onAdapterRequestEnded, userdata);
+#endif
+	return GpuRequest<WGPUAdapter>(state);
+}
+
+GpuRequest<WGPUDevice> GpuEvents::RequestDevice(WGPUAdapter adapter, const WGPUDeviceDescriptor* descriptor)
+{
+	auto [state, userdata] = NewState<WGPUDevice>();
+
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	auto onDeviceRequestEnded = [](WGPURequestDeviceStatus status, WGPUDevice device, WGPUStringView message, void* pUserData1, [[maybe_unused]]void* pUserData2)
+#else
+	auto onDeviceRequestEnded = [](WGPURequestDeviceStatus status, WGPUDevice device, const char* message, void* pUserData1)
+#endif
+	{
+		if (status != WGPURequestDeviceStatus_Success)
+			std::cerr << "Could not retrieve WebGPU device: " << message << std::endl;
+		Complete<WGPUDevice>(pUserData1, status == WGPURequestDeviceStatus_Success ? device : nullptr);
+	};
+
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPURequestDeviceCallbackInfo callbackInfo{};
+	callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+	callbackInfo.callback = onDeviceRequestEnded;
+	callbackInfo.userdata1 = userdata;
+	state->futureId = wgpuAdapterRequestDevice(adapter, descriptor, callbackInfo).id;
+#else
+	wgpuAdapterRequestDevice(adapter, descriptor, onDeviceRequestEnded, userdata);
+#endif
+	return GpuRequest<WGPUDevice>(state);
+}
+
+GpuRequest<bool> GpuEvents::MapBuffer(WGPUBuffer buffer, WGPUMapMode mode, size_t offset, size_t size)
+{
+	auto [state, userdata] = NewState<bool>();
+
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPUBufferMapCallbackInfo callbackInfo{};
+	callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+	callbackInfo.callback = [](WGPUMapAsyncStatus status, WGPUStringView message, void* pUserData1, [[maybe_unused]]void* pUserData2) {
+		if (status != WGPUMapAsyncStatus_Success)
+			std::cerr << "Could not map buffer: " << message << std::endl;
+		Complete<bool>(pUserData1, status == WGPUMapAsyncStatus_Success);
+	};
+	callbackInfo.userdata1 = userdata;
+	state->futureId = wgpuBufferMapAsync(buffer, mode, offset, size, callbackInfo).id;
+#else
+	auto onMapped = [](WGPUBufferMapAsyncStatus status, void* pUserData) {
+		if (status != WGPUBufferMapAsyncStatus_Success)
+			std::cerr << "Could not map buffer: " << status << std::endl;
+		Complete<bool>(pUserData, status == WGPUBufferMapAsyncStatus_Success);
+	};
+	wgpuBufferMapAsync(buffer, mode, offset, size, onMapped, userdata);
+#endif
+	return GpuRequest<bool>(state);
+}
+
+GpuRequest<bool> GpuEvents::OnSubmittedWorkDone(WGPUQueue queue)
+{
+	auto [state, userdata] = NewState<bool>();
+
+	auto onQueueWorkDone = [](
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+			WGPUQueueWorkDoneStatus status, void* pUserData1, [[maybe_unused]]void* pUserData2)
+#else
+			WGPUQueueWorkDoneStatus status, void* pUserData1)
+#endif
+	{
+		Complete<bool>(pUserData1, status == WGPUQueueWorkDoneStatus_Success);
+	};
+
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPUQueueWorkDoneCallbackInfo callbackInfo{};
+	callbackInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+	callbackInfo.callback = onQueueWorkDone;
+	callbackInfo.userdata1 = userdata;
+	state->futureId = wgpuQueueOnSubmittedWorkDone(queue, callbackInfo).id;
+#else
+	wgpuQueueOnSubmittedWorkDone(queue, onQueueWorkDone, userdata);
+#endif
+	return GpuRequest<bool>(state);
+}
+
+void GpuEvents::Pump()
+{
+#if defined(WEBGPU_BACKEND_DAWN)
+	// Also ticks the instance's devices
+	wgpuInstanceProcessEvents(m_instance);
+#elif defined(WEBGPU_BACKEND_WGPU)
+	if (m_device)
+		wgpuDevicePoll(m_device, false, nullptr);
+#endif
+	// The browser runs the callbacks between frames on the web
+}
+
+bool GpuEvents::WaitFuture([[maybe_unused]]uint64_t futureId, const bool& ready, std::chrono::nanoseconds timeout)
+{
+	TRACE_SCOPE("GpuWait");
+
+	using Clock = std::chrono::steady_clock;
+	[[maybe_unused]]const Clock::time_point start = Clock::now();
+	[[maybe_unused]]auto remaining = [&]() {
+		return timeout == kForever ? kForever : timeout - std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+	};
+
+#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	while (!ready && remaining().count() > 0)
+		emscripten_sleep(1);
+#elif defined(WEBGPU_FUTURE_UNIMPLEMENTED)
+	if (m_device)
+		wgpuDevicePoll(m_device, true, nullptr);
+#else
+	WGPUFutureWaitInfo waitInfo{};
+	waitInfo.future.id = futureId;
+	for (std::chrono::nanoseconds left = remaining(); !ready && left.count() > 0; left = remaining())
+	{
+		// The callback runs inside the wait that sees the future complete
+		const WGPUWaitStatus status = wgpuInstanceWaitAny(m_instance, 1, &waitInfo, std::min(left, kWaitSlice).count());
+		if (status != WGPUWaitStatus_Success && status != WGPUWaitStatus_TimedOut)
+		{
+			std::cerr << "Waiting on a WebGPU future failed with status " << status << std::endl;
+			break;
+		}
+	}
+#endif
+
+	return ready;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+
+class GpuEvents;
+
+/*
+ * Handle to the result of an asynchronous WebGPU request, shared with the request's callback. The
+ * result is the adapter or device for those requests, null if they failed, and whether the buffer
+ * was mapped or the queue work succeeded for the others.
+ */
+template <class T>
+class GpuRequest
+{
+public:
+	using Continuation = std::function<void(const T& result)>;
+
+	GpuRequest() = default;
+
+	bool Valid() const { return m_state != nullptr; }
+	bool Ready() const { return m_state && m_state->ready; }
+
+	// Null or false until Ready()
+	const T& Result() const { return m_state->result; }
+
+	// Run fn once the request has completed, right away if it already has. Replaces any earlier one.
+	void Then(Continuation fn)
+	{
+		if (m_state->ready)
+			fn(m_state->result);
+		else
+			m_state->continuation = std::move(fn);
+	}
+
+private:
+	friend class GpuEvents;
+
+	struct State
+	{
+		uint64_t futureId = 0;
+		bool ready = false;
+		T result{};
+		Continuation continuation;
+
+		void Complete(T value)
+		{
+			result = value;
+			ready = true;
+			if (Continuation fn = std::move(continuation))
+				fn(result);
+		}
+	};
+
+	explicit GpuRequest(std::shared_ptr<State> state) : m_state(std::move(state)) {}
+
+	std::shared_ptr<State> m_state;
+};
+
+/**
+ * Completes the asynchronous requests of one WebGPU instance: adapters, devices, buffer maps and
+ * queue work done. Callbacks use the AllowProcessEvents mode, so a request completes, and runs the
+ * continuation given to its handle, only from Pump() or a Wait() on it, on the thread calling them.
+ * App pumps once per frame from Tick().
+ *
+ * Waits block rather than poll. Dawn blocks in wgpuInstanceWaitAny(), which needs the instance
+ * created from InstanceDescriptor() to allow timeouts. wgpu-native has no futures yet and completes
+ * requests while polling the device, so waits poll it once, blocking until the queue is idle, and
+ * ignore the timeout; adapter and device requests complete before returning there. On the web,
+ * waits sleep, handing control back to the browser, which runs the callbacks.
+ */
+class GpuEvents
+{
+public:
+	static constexpr std::chrono::nanoseconds kForever = std::chrono::nanoseconds::max();
+
+#if !defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	// For wgpuCreateInstance(), with the features the waits rely on
+	static WGPUInstanceDescriptor InstanceDescriptor();
+#endif
+
+	explicit GpuEvents(WGPUInstance instance = nullptr) : m_instance(instance), m_device(nullptr) {}
+
+	// The device whose polls complete requests where futures are not implemented
+	void SetDevice(WGPUDevice device) { m_device = device; }
+
+	GpuRequest<WGPUAdapter> RequestAdapter(const WGPURequestAdapterOptions* options);
+	GpuRequest<WGPUDevice> RequestDevice(WGPUAdapter adapter, const WGPUDeviceDescriptor* descriptor);
+	GpuRequest<bool> MapBuffer(WGPUBuffer buffer, WGPUMapMode mode, size_t offset, size_t size);
+
+	// Completes once the GPU has finished everything submitted to the queue so far
+	GpuRequest<bool> OnSubmittedWorkDone(WGPUQueue queue);
+
+	// Block until the request has completed or timeout has passed, returns whether it completed
+	template <class T>
+	bool Wait(const GpuRequest<T>& request, std::chrono::nanoseconds timeout = kForever)
+	{
+		return request.Ready() || WaitFuture(request.m_state->futureId, request.m_state->ready, timeout);
+	}
+
+	// Complete the requests that have finished, without blocking
+	void Pump();
+
+private:
+	// Longest single wgpuInstanceWaitAny(), so unbounded waits never pass the backend a huge timeout
+	static constexpr std::chrono::nanoseconds kWaitSlice = std::chrono::seconds(1);
+
+	template <class T>
+	static std::pair<std::shared_ptr<typename GpuRequest<T>::State>, void*> NewState();
+
+	template <class T>
+	static void Complete(void* userdata, T result);
+
+	bool WaitFuture(uint64_t futureId, const bool& ready, std::chrono::nanoseconds timeout);
+
+	WGPUInstance m_instance;
+	WGPUDevice m_device;
+};
@@ -0,0 +1,303 @@
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+namespace {
+
+uint32_t BytesPerTexel(WGPUTextureFormat format)
+{
+	switch (format)
+	{
+		case WGPUTextureFormat_R8Unorm:
+			return 1;
+		case WGPUTextureFormat_RG8Unorm:
+		case WGPUTextureFormat_R16Float:
+		case WGPUTextureFormat_Depth16Unorm:
+			return 2;
+		case WGPUTextureFormat_RG32Float:
+		case WGPUTextureFormat_RGBA16Float:
+			return 8;
+		case WGPUTextureFormat_RGBA32Float:
+			return 16;
+		default:
+			// 8 bit RGBA/BGRA, packed 10 bit, 32 bit single channel and depth formats
+			return 4;
+	}
+}
+
+bool IsBufferCategory(GpuMemory::Category category)
+{
+	return category != GpuMemory::Category::Texture && category != GpuMemory::Category::RenderTarget;
+}
+
+GpuMemory::Category BufferCategory(WGPUBufferUsage usage)
+{
+	if (usage & WGPUBufferUsage_Vertex)
+		return GpuMemory::Category::Vertex;
+	if (usage & WGPUBufferUsage_Index)
+		return GpuMemory::Category::Index;
+	if (usage & WGPUBufferUsage_Uniform)
+		return GpuMemory::Category::Uniform;
+	return GpuMemory::Category::Other;
+}
+
+GpuMemory::Category TextureCategory(WGPUTextureUsage usage)
+{
+	return (usage & WGPUTextureUsage_RenderAttachment) ? GpuMemory::Category::RenderTarget : GpuMemory::Category::Texture;
+}
+
+} // anonymous namespace
+
+GpuMemory& GpuMemory::Global()
+{
+	static GpuMemory memory;
+	return memory;
+}
+
+GpuMemory::GpuMemory() :
+	m_evictingBytes(0),
+	m_liveBuffers(MetricsRegistry::Global().GetGauge("webgpu_live_buffers", "Number of buffers currently allocated")),
+	m_liveTextures(MetricsRegistry::Global().GetGauge("webgpu_live_textures", "Number of textures currently allocated, excluding surface textures")),
+	m_evictionCounter(MetricsRegistry::Global().GetCounter("webgpu_memory_evictions_total", "Streamable resources evicted to stay within the memory budget"))
+{
+	for (size_t i = 0; i < m_bytesGauges.size(); ++i)
+	{
+		const std::string name = std::string("webgpu_memory_") + CategoryName(static_cast<Category>(i)) + "_bytes";
+		m_bytesGauges[i] = &MetricsRegistry::Global().GetGauge(name, "Estimated GPU memory allocated for this category");
+	}
+}
+
+const char* GpuMemory::CategoryName(Category category)
+{
+	switch (category)
+	{
+		case Category::Vertex: return "vertex";
+		case Category::Index: return "index";
+		case Category::Uniform: return "uniform";
+		case Category::Texture: return "texture";
+		case Category::RenderTarget: return "render_target";
+		case Category::Other: return "other";
+		case Category::Count: break;
+	}
+	return "unknown";
+}
+
+uint64_t GpuMemory::TextureSize(const WGPUTextureDescriptor& desc)
+{
+	const bool is3D = desc.dimension == WGPUTextureDimension_3D;
+	const uint32_t mipLevels = std::max(desc.mipLevelCount, 1u);
+
+	uint64_t texels = 0;
+	for (uint32_t level = 0; level < mipLevels; ++level)
+	{
+		const uint64_t width = std::max(desc.size.width >> level, 1u);
+		const uint64_t height = std::max(desc.size.height >> level, 1u);
+		// Array layers do not shrink with the mip level, 3D slices do
+		const uint64_t depth = is3D ? std::max(desc.size.depthOrArrayLayers >> level, 1u) : std::max(desc.size.depthOrArrayLayers, 1u);
+		texels += width * height * depth;
+	}
+
+	return texels * BytesPerTexel(desc.format) * std::max(desc.sampleCount, 1u);
+}
+
+void GpuMemory::SetBudget(uint64_t bytes)
+{
+	std::vector<EvictCallback> evictions;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_report.budgetBytes = bytes;
+		// Shrinking the budget evicts right away
+		Reserve(0, evictions);
+	}
+
+	for (EvictCallback &evict : evictions)
+		evict();
+}
+
+bool GpuMemory::Reserve(uint64_t size, std::vector<EvictCallback>& evictions)
+{
+	if (m_report.budgetBytes == 0)
+		return true;
+
+	auto fits = [&]() { return m_report.totalBytes - m_evictingBytes + size <= m_report.budgetBytes; };
+	while (!fits() && !m_lru.empty())
+	{
+		Allocation &victim = m_allocations.at(m_lru.front());
+		m_lru.pop_front();
+		victim.evicting = true;
+		m_evictingBytes += victim.size;
+		evictions.push_back(std::move(victim.onEvict));
+		++m_report.evictions;
+		m_evictionCounter.Add();
+	}
+
+	return fits();
+}
+
+WgpuBufferPtr GpuMemory::CreateBuffer(WGPUDevice device, const WGPUBufferDescriptor& desc, EvictCallback onEvict)
+{
+	std::vector<EvictCallback> evictions;
+	bool fits;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		fits = Reserve(desc.size, evictions);
+		if (!fits && onEvict)
+			++m_report.failedAllocations;
+	}
+
+	for (EvictCallback &evict : evictions)
+		evict();
+
+	if (!fits)
+	{
+		std::cerr << "GPU memory budget exceeded by a " << desc.size << " byte " << CategoryName(BufferCategory(desc.usage)) << " buffer";
+		std::cerr << (onEvict ? ", allocation refused" : "") << std::endl;
+		if (onEvict)
+			return WgpuBufferPtr(nullptr, wgpuBufferRelease);
+	}
+
+	WGPUBuffer buffer = wgpuDeviceCreateBuffer(device, &desc);
+	if (!buffer)
+		return WgpuBufferPtr(nullptr, wgpuBufferRelease);
+
+	Track(buffer, BufferCategory(desc.usage), desc.size, std::move(onEvict));
+	return WgpuBufferPtr(buffer, ReleaseBuffer);
+}
+
+WgpuTexturePtr GpuMemory::CreateTexture(WGPUDevice device, const WGPUTextureDescriptor& desc, EvictCallback onEvict)
+{
+	const uint64_t size = TextureSize(desc);
+	std::vector<EvictCallback> evictions;
+	bool fits;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		fits = Reserve(size, evictions);
+		if (!fits && onEvict)
+			++m_report.failedAllocations;
+	}
+
+	for (EvictCallback &evict : evictions)
+		evict();
+
+	if (!fits)
+	{
+		std::cerr << "GPU memory budget exceeded by a " << size << " byte " << CategoryName(TextureCategory(desc.usage)) << " texture";
+		std::cerr << (onEvict ? ", allocation refused" : "") << std::endl;
+		if (onEvict)
+			return WgpuTexturePtr(nullptr, wgpuTextureRelease);
+	}
+
+	WGPUTexture texture = wgpuDeviceCreateTexture(device, &desc);
+	if (!texture)
+		return WgpuTexturePtr(nullptr, wgpuTextureRelease);
+
+	Track(texture, TextureCategory(desc.usage), size, std::move(onEvict));
+	return WgpuTexturePtr(texture, ReleaseTexture);
+}
+
+void GpuMemory::Track(const void* handle, Category category, uint64_t size, EvictCallback onEvict)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Allocation allocation{category, size, false, std::move(onEvict), {}};
+	if (allocation.onEvict)
+		allocation.lru = m_lru.insert(m_lru.end(), handle);
+	m_allocations.emplace(handle, std::move(allocation));
+
+	CategoryStats &stats = m_report.categories[static_cast<size_t>(category)];
+	stats.bytes += size;
+	stats.peakBytes = std::max(stats.peakBytes, stats.bytes);
+	++stats.count;
+	m_report.totalBytes += size;
+	m_report.peakTotalBytes = std::max(m_report.peakTotalBytes, m_report.totalBytes);
+
+	UpdateMetrics(category);
+}
+
+void GpuMemory::Untrack(const void* handle)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_allocations.find(handle);
+	if (it == m_allocations.end())
+		return;
+
+	const Allocation &allocation = it->second;
+	if (allocation.evicting)
+		m_evictingBytes -= allocation.size;
+	else if (allocation.onEvict)
+		m_lru.erase(allocation.lru);
+
+	CategoryStats &stats = m_report.categories[static_cast<size_t>(allocation.category)];
+	stats.bytes -= allocation.size;
+	--stats.count;
+	m_report.totalBytes -= allocation.size;
+
+	const Category category = allocation.category;
+	m_allocations.erase(it);
+	UpdateMetrics(category);
+}
+
+void GpuMemory::Touch(const void* handle)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_allocations.find(handle);
+	if (it != m_allocations.end() && it->second.onEvict && !it->second.evicting)
+		m_lru.splice(m_lru.end(), m_lru, it->second.lru);
+}
+
+void GpuMemory::UpdateMetrics(Category category)
+{
+	m_bytesGauges[static_cast<size_t>(category)]->Set(m_report.categories[static_cast<size_t>(category)].bytes);
+
+	int64_t buffers = 0;
+	int64_t textures = 0;
+	for (size_t i = 0; i < m_report.categories.size(); ++i)
+		(IsBufferCategory(static_cast<Category>(i)) ? buffers : textures) += m_report.categories[i].count;
+	m_liveBuffers.Set(buffers);
+	m_liveTextures.Set(textures);
+}
+
+GpuMemory::Report GpuMemory::GetReport() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_report;
+}
+
+void GpuMemory::PrintReport(std::ostream& os) const
+{
+	const Report report = GetReport();
+	auto mib = [](uint64_t bytes) { return bytes / (1024.0 * 1024.0); };
+
+	os << "GPU memory (estimated, MiB):" << std::endl;
+	os << std::fixed << std::setprecision(2);
+	for (size_t i = 0; i < report.categories.size(); ++i)
+	{
+		const CategoryStats &stats = report.categories[i];
+		os << "  " << std::left << std::setw(14) << CategoryName(static_cast<Category>(i)) << std::right
+			<< std::setw(10) << mib(stats.bytes) << " in " << std::setw(4) << stats.count << " resource(s), peak "
+			<< mib(stats.peakBytes) << std::endl;
+	}
+	os << "  total " << mib(report.totalBytes) << ", peak " << mib(report.peakTotalBytes);
+	if (report.budgetBytes)
+		os << ", budget " << mib(report.budgetBytes) << ", " << report.evictions << " eviction(s), "
+			<< report.failedAllocations << " refused allocation(s)";
+	os << std::endl;
+	os.unsetf(std::ios::floatfield);
+}
+
+void GpuMemory::ReleaseBuffer(WGPUBuffer buffer)
+{
+	Global().Untrack(buffer);
+	wgpuBufferRelease(buffer);
+}
+
+void GpuMemory::ReleaseTexture(WGPUTexture texture)
+{
+	Global().Untrack(texture);
+	wgpuTextureRelease(texture);
+}
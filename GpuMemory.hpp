@@ -0,0 +1,117 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "Metrics.hpp"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Accounts for every buffer and texture allocated through it.
+ *
+ * Sizes are estimated from the descriptors (the driver may pad them), tallied per category with
+ * high-water marks, and checked against an optional budget. Resources created with an eviction
+ * callback are streamable: when an allocation would exceed the budget the least recently used
+ * streamable resources are asked to release themselves until it fits.
+ *
+ * The returned pointers carry a deleter that updates the accounting, so resources must be released
+ * through them (directly or via a ReleaseQueue) rather than by calling wgpu*Release on the handle.
+ */
+class GpuMemory
+{
+public:
+	enum class Category
+	{
+		Vertex,
+		Index,
+		Uniform,
+		Texture,
+		RenderTarget,
+		Other,  // Storage, staging and query buffers
+		Count,
+	};
+
+	// Must drop the owning pointer. Called without any tracker lock held.
+	using EvictCallback = std::function<void()>;
+
+	struct CategoryStats
+	{
+		uint64_t bytes = 0;
+		uint64_t peakBytes = 0;
+		uint32_t count = 0;
+	};
+
+	struct Report
+	{
+		std::array<CategoryStats, static_cast<size_t>(Category::Count)> categories;
+		uint64_t totalBytes = 0;
+		uint64_t peakTotalBytes = 0;
+		uint64_t budgetBytes = 0;
+		uint64_t evictions = 0;
+		uint64_t failedAllocations = 0;
+	};
+
+	static GpuMemory& Global();
+
+	// Zero disables the budget
+	void SetBudget(uint64_t bytes);
+
+	/*
+	 * Create and track a resource. Its category is derived from the usage flags.
+	 * Without an eviction callback the resource is always created, even over budget. Streamable
+	 * resources are refused (null is returned) when evicting everything else still does not make room.
+	 */
+	WgpuBufferPtr CreateBuffer(WGPUDevice device, const WGPUBufferDescriptor& desc, EvictCallback onEvict = nullptr);
+	WgpuTexturePtr CreateTexture(WGPUDevice device, const WGPUTextureDescriptor& desc, EvictCallback onEvict = nullptr);
+
+	// Mark a streamable resource as used, moving it to the back of the eviction order
+	void Touch(const void* handle);
+
+	Report GetReport() const;
+	void PrintReport(std::ostream& os) const;
+
+	static const char* CategoryName(Category category);
+	static uint64_t TextureSize(const WGPUTextureDescriptor& desc);
+
+private:
+	struct Allocation
+	{
+		Category category;
+		uint64_t size;
+		bool evicting;
+		EvictCallback onEvict;
+		std::list<const void*>::iterator lru;  // Only valid for streamable allocations
+	};
+
+	GpuMemory();
+
+	/*
+	 * Make room for size bytes. Returns false if the budget cannot be met, after scheduling the
+	 * evictions that were possible.
+	 */
+	bool Reserve(uint64_t size, std::vector<EvictCallback>& evictions);
+	void Track(const void* handle, Category category, uint64_t size, EvictCallback onEvict);
+	void Untrack(const void* handle);
+	void UpdateMetrics(Category category);
+
+	static void ReleaseBuffer(WGPUBuffer buffer);
+	static void ReleaseTexture(WGPUTexture texture);
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<const void*, Allocation> m_allocations;
+	std::list<const void*> m_lru;  // Streamable allocations, least recently used first
+	Report m_report;
+	uint64_t m_evictingBytes;  // Evicted but not yet released, eg. parked in a ReleaseQueue
+
+	std::array<Gauge*, static_cast<size_t>(Category::Count)> m_bytesGauges;
+	Gauge &m_liveBuffers;
+	Gauge &m_liveTextures;
+	Counter &m_evictionCounter;
+};
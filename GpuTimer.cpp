@@ -0,0 +1,158 @@
+#include "GpuTimer.hpp"
+#include "GpuMemory.hpp"
+#include "Trace.hpp"
+
+#include <iostream>
+
+GpuTimer::GpuTimer() :
+	m_device(nullptr),
+	m_events(nullptr),
+	m_querySet(nullptr, wgpuQuerySetRelease),
+	m_resolveBuffer(nullptr, wgpuBufferRelease),
+	m_current(kReadbacks),
+	m_lastFrameMs(0.0),
+	m_framesMeasured(0)
+{
+}
+
+bool GpuTimer::Initialize(WGPUDevice device, GpuEvents& events)
+{
+	TRACE_SCOPE("GpuTimerInitialize");
+
+	Reset();
+	if (!wgpuDeviceHasFeature(device, WGPUFeatureName_TimestampQuery))
+	{
+		std::cerr << "Timestamp queries are not supported, GPU frame times are not measured" << std::endl;
+		return false;
+	}
+	m_device = device;
+	m_events = &events;
+
+	WGPUQuerySetDescriptor querySetDesc{};
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	querySetDesc.label = {"Frame timestamps", WGPU_STRLEN};
+#else
+	querySetDesc.label = "Frame timestamps";
+#endif
+	querySetDesc.type = WGPUQueryType_Timestamp;
+	querySetDesc.count = 2 * kReadbacks;
+	m_querySet = WgpuQuerySetPtr(wgpuDeviceCreateQuerySet(device, &querySetDesc), wgpuQuerySetRelease);
+
+	WGPUBufferDescriptor bufferDesc{};
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	bufferDesc.label = {"Frame timestamps resolve", WGPU_STRLEN};
+#else
+	bufferDesc.label = "Frame timestamps resolve";
+#endif
+	bufferDesc.size = kFrameBytes * kReadbacks;
+	bufferDesc.usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc;
+	bufferDesc.mappedAtCreation = false;
+	m_resolveBuffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+
+	for (Readback &readback : m_readbacks)
+	{
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+		bufferDesc.label = {"Frame timestamps readback", WGPU_STRLEN};
+#else
+		bufferDesc.label = "Frame timestamps readback";
+#endif
+		bufferDesc.size = kFrameBytes;
+		bufferDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+		readback.buffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+		if (!readback.buffer)
+		{
+			Reset();
+			return false;
+		}
+	}
+
+	if (!m_querySet || !m_resolveBuffer)
+	{
+		Reset();
+		return false;
+	}
+	return true;
+}
+
+void GpuTimer::Reset()
+{
+	for (Readback &readback : m_readbacks)
+	{
+		// A map still pending completes when the buffer is released, after the timer may be gone
+		if (readback.state == State::Resolved)
+			readback.mapped.Then([](bool) {});
+		readback.mapped = {};
+		readback.buffer.reset();
+		readback.state = State::Free;
+	}
+	m_resolveBuffer.reset();
+	m_querySet.reset();
+	m_current = kReadbacks;
+	m_device = nullptr;
+	m_events = nullptr;
+}
+
+bool GpuTimer::BeginFrame(RenderGraph& graph)
+{
+	m_current = kReadbacks;
+	if (!Available())
+		return false;
+
+	for (uint32_t i = 0; i < kReadbacks; ++i)
+	{
+		if (m_readbacks[i].state != State::Free)
+			continue;
+
+		m_current = i;
+		m_readbacks[i].state = State::Recorded;
+		graph.SetTimestampWrites(m_querySet.get(), 2 * i, 2 * i + 1);
+		return true;
+	}
+	return false;
+}
+
+WgpuCommandBufferPtr GpuTimer::Resolve()
+{
+	if (m_current == kReadbacks)
+		return WgpuCommandBufferPtr(nullptr, wgpuCommandBufferRelease);
+
+	WGPUCommandEncoderDescriptor encoderDesc{};
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	encoderDesc.label = {"Resolve frame timestamps", WGPU_STRLEN};
+#else
+	encoderDesc.label = "Resolve frame timestamps";
+#endif
+	WgpuCommandEncoderPtr encoder(wgpuDeviceCreateCommandEncoder(m_device, &encoderDesc), wgpuCommandEncoderRelease);
+
+	const uint64_t offset = kFrameBytes * m_current;
+	wgpuCommandEncoderResolveQuerySet(encoder.get(), m_querySet.get(), 2 * m_current, 2, m_resolveBuffer.get(), offset);
+	wgpuCommandEncoderCopyBufferToBuffer(encoder.get(), m_resolveBuffer.get(), offset, m_readbacks[m_current].buffer.get(), 0, kFrameBytes);
+
+	WGPUCommandBufferDescriptor commandDesc{};
+	return WgpuCommandBufferPtr(wgpuCommandEncoderFinish(encoder.get(), &commandDesc), wgpuCommandBufferRelease);
+}
+
+void GpuTimer::EndFrame()
+{
+	if (m_current == kReadbacks)
+		return;
+
+	Readback &readback = m_readbacks[m_current];
+	m_current = kReadbacks;
+	readback.state = State::Resolved;
+	readback.mapped = m_events->MapBuffer(readback.buffer.get(), WGPUMapMode_Read, 0, kFrameBytes);
+	readback.mapped.Then([this, &readback](bool mapped) {
+		readback.state = State::Free;
+		if (!mapped)
+			return;
+
+		const uint64_t *timestamps = static_cast<const uint64_t*>(wgpuBufferGetConstMappedRange(readback.buffer.get(), 0, kFrameBytes));
+		// Some backends reset their clock between passes, such frames are skipped
+		if (timestamps && timestamps[1] > timestamps[0])
+		{
+			m_lastFrameMs = (timestamps[1] - timestamps[0]) / 1e6;
+			++m_framesMeasured;
+		}
+		wgpuBufferUnmap(readback.buffer.get());
+	});
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "GpuEvents.hpp"
+#include "RenderGraph.hpp"
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Measures the GPU time of whole frames with timestamp queries, written by the render graph at the
+ * start of the frame's first render pass and the end of its last.
+ *
+ * Each frame resolves its pair of timestamps into a readback buffer of its own, mapped once the
+ * frame's submission completes, so the result of a frame arrives a few frames later and reading it
+ * never stalls. Frames recorded while every readback is still in flight go unmeasured.
+ *
+ * Needs WGPUFeatureName_TimestampQuery on the device, without it Initialize() fails and the timer
+ * measures nothing.
+ */
+class GpuTimer
+{
+public:
+	static constexpr uint32_t kReadbacks = 4;
+
+	GpuTimer();
+
+	bool Initialize(WGPUDevice device, GpuEvents& events);
+	void Reset();
+	bool Available() const { return m_querySet != nullptr; }
+
+	// Have the graph write this frame's timestamps, returns false when no readback is free
+	bool BeginFrame(RenderGraph& graph);
+	// Resolve the timestamps written since BeginFrame(), to submit along with the frame. Null when
+	// the frame is not measured.
+	WgpuCommandBufferPtr Resolve();
+	// Once the frame is submitted, map its readback when the GPU is done with it
+	void EndFrame();
+
+	// GPU time of the latest frame measured, in milliseconds, zero until one is
+	double LastFrameMs() const { return m_lastFrameMs; }
+	uint64_t FramesMeasured() const { return m_framesMeasured; }
+
+private:
+	enum class State
+	{
+		Free,
+		Recorded,  // Timestamps written in the frame being recorded
+		Resolved,  // Copied into the readback, waiting for the map
+	};
+
+	struct Readback
+	{
+		Readback() : buffer(nullptr, wgpuBufferRelease), state(State::Free) {}
+
+		WgpuBufferPtr buffer;
+		State state;
+		GpuRequest<bool> mapped;
+	};
+
+	// Two 64-bit timestamps per frame
+	static constexpr uint64_t kFrameBytes = 2 * sizeof(uint64_t);
+
+	WGPUDevice m_device;
+	GpuEvents* m_events;
+	WgpuQuerySetPtr m_querySet;
+	WgpuBufferPtr m_resolveBuffer;  // A frame's pair of timestamps at kFrameBytes * readback
+	std::array<Readback, kReadbacks> m_readbacks;
+	uint32_t m_current;  // Readback of the frame being recorded, kReadbacks when not measured
+	double m_lastFrameMs;
+	uint64_t m_framesMeasured;
+};
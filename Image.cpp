@@ -0,0 +1,383 @@
+#include "Image.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+// Rows per task of the separable filter. Each task also filters radius rows above and below its
+// block horizontally, so blocks grow with the radius to keep that overhead under half.
+constexpr uint32_t kMinBlockRows = 32;
+
+// Rows per task of the per pixel filters
+constexpr size_t kRowGrain = 16;
+
+// One pixel per register, channels as floats in [0, 255]
+#if defined(MATH_HAS_SSE)
+using Pixel = __m128;
+
+inline Pixel LoadPixel(uint32_t rgba)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(rgba)), zero);
+	v = _mm_unpacklo_epi16(v, zero);
+	return _mm_cvtepi32_ps(v);
+}
+
+// Clamp, round half up and pack
+inline uint32_t StorePixel(Pixel p)
+{
+	p = _mm_min_ps(_mm_max_ps(p, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+	__m128i v = _mm_cvttps_epi32(_mm_add_ps(p, _mm_set1_ps(0.5f)));
+	v = _mm_packs_epi32(v, v);
+	v = _mm_packus_epi16(v, v);
+	return static_cast<uint32_t>(_mm_cvtsi128_si32(v));
+}
+
+inline Pixel Splat(float s) { return _mm_set1_ps(s); }
+inline Pixel FromVec4(const math::Vec4& v) { return _mm_load_ps(&v.x); }
+inline Pixel Add(Pixel a, Pixel b) { return _mm_add_ps(a, b); }
+inline Pixel Mul(Pixel a, Pixel b) { return _mm_mul_ps(a, b); }
+inline Pixel Madd(Pixel a, Pixel b, Pixel c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+
+template <int kLane>
+inline Pixel Broadcast(Pixel p) { return _mm_shuffle_ps(p, p, _MM_SHUFFLE(kLane, kLane, kLane, kLane)); }
+
+#elif defined(MATH_HAS_NEON)
+using Pixel = float32x4_t;
+
+inline Pixel LoadPixel(uint32_t rgba)
+{
+	const uint16x8_t v = vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(rgba)));
+	return vcvtq_f32_u32(vmovl_u16(vget_low_u16(v)));
+}
+
+inline uint32_t StorePixel(Pixel p)
+{
+	p = vminq_f32(vmaxq_f32(p, vdupq_n_f32(0.0f)), vdupq_n_f32(255.0f));
+	const uint16x4_t v = vmovn_u32(vcvtq_u32_f32(vaddq_f32(p, vdupq_n_f32(0.5f))));
+	return vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(v, v))), 0);
+}
+
+inline Pixel Splat(float s) { return vdupq_n_f32(s); }
+inline Pixel FromVec4(const math::Vec4& v) { return vld1q_f32(&v.x); }
+inline Pixel Add(Pixel a, Pixel b) { return vaddq_f32(a, b); }
+inline Pixel Mul(Pixel a, Pixel b) { return vmulq_f32(a, b); }
+inline Pixel Madd(Pixel a, Pixel b, Pixel c) { return vmlaq_f32(c, a, b); }
+
+template <int kLane>
+inline Pixel Broadcast(Pixel p) { return vdupq_n_f32(vgetq_lane_f32(p, kLane)); }
+
+#else
+struct Pixel
+{
+	float c[4];
+};
+
+inline Pixel LoadPixel(uint32_t rgba)
+{
+	Pixel p;
+	for (int i = 0; i < 4; ++i)
+		p.c[i] = static_cast<float>((rgba >> (8 * i)) & 0xff);
+	return p;
+}
+
+inline uint32_t StorePixel(Pixel p)
+{
+	uint32_t rgba = 0;
+	for (int i = 0; i < 4; ++i)
+		rgba |= static_cast<uint32_t>(std::min(std::max(p.c[i], 0.0f), 255.0f) + 0.5f) << (8 * i);
+	return rgba;
+}
+
+inline Pixel Splat(float s) { return {{s, s, s, s}}; }
+inline Pixel FromVec4(const math::Vec4& v) { return {{v.x, v.y, v.z, v.w}}; }
+inline Pixel Add(Pixel a, Pixel b) { return {{a.c[0] + b.c[0], a.c[1] + b.c[1], a.c[2] + b.c[2], a.c[3] + b.c[3]}}; }
+inline Pixel Mul(Pixel a, Pixel b) { return {{a.c[0] * b.c[0], a.c[1] * b.c[1], a.c[2] * b.c[2], a.c[3] * b.c[3]}}; }
+inline Pixel Madd(Pixel a, Pixel b, Pixel c) { return Add(Mul(a, b), c); }
+
+template <int kLane>
+inline Pixel Broadcast(Pixel p) { return Splat(p.c[kLane]); }
+#endif
+
+// For containers, which drop the alignment attributes of vector types used as template arguments
+struct StoredPixel
+{
+	Pixel v;
+};
+
+uint32_t Clamp(int64_t i, uint32_t size)
+{
+	return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(i, 0), size - 1));
+}
+
+uint8_t Channel(uint32_t rgba, int channel)
+{
+	return static_cast<uint8_t>(rgba >> (8 * channel));
+}
+
+uint8_t RoundChannel(float value)
+{
+	return static_cast<uint8_t>(std::floor(std::min(std::max(value, 0.0f), 255.0f) + 0.5f));
+}
+
+std::vector<float> Normalized(std::vector<float> weights)
+{
+	float sum = weights[0];
+	for (size_t i = 1; i < weights.size(); ++i)
+		sum += 2.0f * weights[i];
+	for (float &weight : weights)
+		weight /= sum;
+	return weights;
+}
+
+} // anonymous namespace
+
+namespace image {
+
+std::vector<float> GaussianWeights(float sigma)
+{
+	const uint32_t radius = std::min(static_cast<uint32_t>(std::ceil(3.0f * std::max(sigma, 0.0f))), kMaxRadius);
+	std::vector<float> weights(radius + 1, 1.0f);
+	for (uint32_t i = 1; i <= radius; ++i)
+		weights[i] = std::exp(-0.5f * static_cast<float>(i * i) / (sigma * sigma));
+	return Normalized(std::move(weights));
+}
+
+std::vector<float> BoxWeights(uint32_t radius)
+{
+	return Normalized(std::vector<float>(std::min(radius, kMaxRadius) + 1, 1.0f));
+}
+
+void SeparableFilter(const Image& src, const std::vector<float>& weights, Image& dst, JobSystem& jobs)
+{
+	TRACE_SCOPE("SeparableFilter");
+
+	const uint32_t width = src.width;
+	const uint32_t height = src.height;
+	const uint32_t radius = static_cast<uint32_t>(weights.size()) - 1;
+	dst.Resize(width, height);
+	if (width == 0 || height == 0)
+		return;
+
+	const uint32_t blockRows = std::max(kMinBlockRows, 4 * radius);
+	const size_t blockCount = (height + blockRows - 1) / blockRows;
+	jobs.ParallelFor(blockCount, 1, [&](size_t begin, size_t end) {
+		std::vector<StoredPixel> taps(weights.size());
+		for (size_t k = 0; k < weights.size(); ++k)
+			taps[k].v = Splat(weights[k]);
+
+		// One source row with radius edge pixels on each side, then the block's rows filtered horizontally
+		std::vector<StoredPixel> padded(width + 2 * radius);
+		std::vector<StoredPixel> rows(size_t{blockRows + 2 * radius} * width);
+		std::vector<StoredPixel> sums(width);
+
+		for (size_t block = begin; block < end; ++block)
+		{
+			const int64_t firstRow = static_cast<int64_t>(block * blockRows);
+			const int64_t lastRow = std::min<int64_t>(firstRow + blockRows, height);
+
+			for (int64_t y = firstRow - radius; y < lastRow + radius; ++y)
+			{
+				const uint32_t *row = src.Row(Clamp(y, height));
+				std::fill_n(padded.begin(), radius, StoredPixel{LoadPixel(row[0])});
+				for (uint32_t x = 0; x < width; ++x)
+					padded[radius + x].v = LoadPixel(row[x]);
+				std::fill_n(padded.begin() + radius + width, radius, StoredPixel{LoadPixel(row[width - 1])});
+
+				StoredPixel *out = &rows[static_cast<size_t>(y - firstRow + radius) * width];
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					const StoredPixel *center = &padded[radius + x];
+					Pixel sum = Mul(center->v, taps[0].v);
+					for (uint32_t k = 1; k <= radius; ++k)
+						sum = Madd(Add((center - k)->v, (center + k)->v), taps[k].v, sum);
+					out[x].v = sum;
+				}
+			}
+
+			// Accumulate whole rows per tap, so the inner loop streams through two rows at a time
+			for (int64_t y = firstRow; y < lastRow; ++y)
+			{
+				const StoredPixel *center = &rows[static_cast<size_t>(y - firstRow + radius) * width];
+				for (uint32_t x = 0; x < width; ++x)
+					sums[x].v = Mul(center[x].v, taps[0].v);
+				for (uint32_t k = 1; k <= radius; ++k)
+				{
+					const StoredPixel *above = center - size_t{k} * width;
+					const StoredPixel *below = center + size_t{k} * width;
+					for (uint32_t x = 0; x < width; ++x)
+						sums[x].v = Madd(Add(above[x].v, below[x].v), taps[k].v, sums[x].v);
+				}
+
+				uint32_t *out = dst.Row(static_cast<uint32_t>(y));
+				for (uint32_t x = 0; x < width; ++x)
+					out[x] = StorePixel(sums[x].v);
+			}
+		}
+	});
+}
+
+void Downsample(const Image& src, Image& dst, JobSystem& jobs)
+{
+	TRACE_SCOPE("Downsample");
+
+	dst.Resize(std::max(src.width / 2, 1u), std::max(src.height / 2, 1u));
+	if (src.width == 0 || src.height == 0)
+	{
+		dst.Resize(0, 0);
+		return;
+	}
+
+	jobs.ParallelFor(dst.height, kRowGrain, [&](size_t begin, size_t end) {
+		const Pixel quarter = Splat(0.25f);
+		for (size_t y = begin; y < end; ++y)
+		{
+			const uint32_t *top = src.Row(Clamp(2 * y, src.height));
+			const uint32_t *bottom = src.Row(Clamp(2 * y + 1, src.height));
+			uint32_t *out = dst.Row(static_cast<uint32_t>(y));
+			for (uint32_t x = 0; x < dst.width; ++x)
+			{
+				const uint32_t left = 2 * x;
+				const uint32_t right = Clamp(2 * x + 1, src.width);
+				const Pixel sum = Add(Add(LoadPixel(top[left]), LoadPixel(top[right])), Add(LoadPixel(bottom[left]), LoadPixel(bottom[right])));
+				// Quarters of integers are exact, so this rounds exactly like (sum + 2) / 4
+				out[x] = StorePixel(Mul(sum, quarter));
+			}
+		}
+	});
+}
+
+void ConvertColor(const Image& src, const ColorMatrix& color, Image& dst, JobSystem& jobs)
+{
+	TRACE_SCOPE("ConvertColor");
+
+	dst.Resize(src.width, src.height);
+	jobs.ParallelFor(src.height, kRowGrain, [&](size_t begin, size_t end) {
+		const Pixel columns[4] = {
+			FromVec4(color.matrix.cols[0]), FromVec4(color.matrix.cols[1]),
+			FromVec4(color.matrix.cols[2]), FromVec4(color.matrix.cols[3]),
+		};
+		const Pixel offset = FromVec4(color.offset);
+		for (size_t y = begin; y < end; ++y)
+		{
+			const uint32_t *in = src.Row(static_cast<uint32_t>(y));
+			uint32_t *out = dst.Row(static_cast<uint32_t>(y));
+			for (uint32_t x = 0; x < src.width; ++x)
+			{
+				const Pixel p = LoadPixel(in[x]);
+				Pixel result = Madd(Broadcast<3>(p), columns[3], offset);
+				result = Madd(Broadcast<2>(p), columns[2], result);
+				result = Madd(Broadcast<1>(p), columns[1], result);
+				result = Madd(Broadcast<0>(p), columns[0], result);
+				out[x] = StorePixel(result);
+			}
+		}
+	});
+}
+
+Image TestPattern(uint32_t width, uint32_t height)
+{
+	Image pattern(width, height);
+	for (uint32_t y = 0; y < height; ++y)
+		for (uint32_t x = 0; x < width; ++x)
+			pattern.Row(y)[x] = Image::Pack(static_cast<uint8_t>(y), static_cast<uint8_t>(x), 255, 255);
+	return pattern;
+}
+
+uint32_t MaxDifference(const Image& a, const Image& b)
+{
+	if (a.width != b.width || a.height != b.height)
+		return 255;
+
+	uint32_t difference = 0;
+	for (size_t i = 0; i < a.pixels.size(); ++i)
+		for (int c = 0; c < 4; ++c)
+			difference = std::max(difference, static_cast<uint32_t>(std::abs(Channel(a.pixels[i], c) - Channel(b.pixels[i], c))));
+	return difference;
+}
+
+namespace reference {
+
+void SeparableFilter(const Image& src, const std::vector<float>& weights, Image& dst)
+{
+	const uint32_t width = src.width;
+	const uint32_t height = src.height;
+	const int64_t radius = static_cast<int64_t>(weights.size()) - 1;
+	dst.Resize(width, height);
+
+	std::vector<float> horizontal(size_t{width} * height * 4);
+	for (uint32_t y = 0; y < height; ++y)
+		for (uint32_t x = 0; x < width; ++x)
+			for (int c = 0; c < 4; ++c)
+			{
+				float sum = 0.0f;
+				for (int64_t k = -radius; k <= radius; ++k)
+					sum += weights[std::abs(k)] * Channel(src.Row(y)[Clamp(x + k, width)], c);
+				horizontal[(size_t{y} * width + x) * 4 + c] = sum;
+			}
+
+	for (uint32_t y = 0; y < height; ++y)
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			uint8_t channels[4];
+			for (int c = 0; c < 4; ++c)
+			{
+				float sum = 0.0f;
+				for (int64_t k = -radius; k <= radius; ++k)
+					sum += weights[std::abs(k)] * horizontal[(size_t{Clamp(y + k, height)} * width + x) * 4 + c];
+				channels[c] = RoundChannel(sum);
+			}
+			dst.Row(y)[x] = Image::Pack(channels[0], channels[1], channels[2], channels[3]);
+		}
+}
+
+void Downsample(const Image& src, Image& dst)
+{
+	dst.Resize(std::max(src.width / 2, 1u), std::max(src.height / 2, 1u));
+	if (src.width == 0 || src.height == 0)
+	{
+		dst.Resize(0, 0);
+		return;
+	}
+
+	for (uint32_t y = 0; y < dst.height; ++y)
+		for (uint32_t x = 0; x < dst.width; ++x)
+		{
+			const uint32_t block[4] = {
+				src.Row(Clamp(2 * y, src.height))[Clamp(2 * x, src.width)],
+				src.Row(Clamp(2 * y, src.height))[Clamp(2 * x + 1, src.width)],
+				src.Row(Clamp(2 * y + 1, src.height))[Clamp(2 * x, src.width)],
+				src.Row(Clamp(2 * y + 1, src.height))[Clamp(2 * x + 1, src.width)],
+			};
+			uint8_t channels[4];
+			for (int c = 0; c < 4; ++c)
+				channels[c] = static_cast<uint8_t>((Channel(block[0], c) + Channel(block[1], c) + Channel(block[2], c) + Channel(block[3], c) + 2) / 4);
+			dst.Row(y)[x] = Image::Pack(channels[0], channels[1], channels[2], channels[3]);
+		}
+}
+
+void ConvertColor(const Image& src, const ColorMatrix& color, Image& dst)
+{
+	dst.Resize(src.width, src.height);
+	const float *m = &color.matrix.cols[0].x;
+	const float *offset = &color.offset.x;
+	for (size_t i = 0; i < src.pixels.size(); ++i)
+	{
+		uint8_t channels[4];
+		for (int row = 0; row < 4; ++row)
+		{
+			float sum = offset[row];
+			for (int column = 0; column < 4; ++column)
+				sum += m[column * 4 + row] * Channel(src.pixels[i], column);
+			channels[row] = RoundChannel(sum);
+		}
+		dst.pixels[i] = Image::Pack(channels[0], channels[1], channels[2], channels[3]);
+	}
+}
+
+} // namespace reference
+
+} // namespace image
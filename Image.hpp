@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Math.hpp"
+#include "Parallel.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * RGBA8 image, stored row after row without padding. Each pixel is one little endian word with
+ * red in the low byte, so the bytes are exactly those of an RGBA8Unorm texture upload and the
+ * words those of the packed arrays the compute kernels of ImageCompute.hpp work on.
+ */
+struct Image
+{
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint32_t> pixels;
+
+	Image() = default;
+	Image(uint32_t width, uint32_t height) : width(width), height(height), pixels(size_t{width} * height) {}
+
+	void Resize(uint32_t newWidth, uint32_t newHeight)
+	{
+		width = newWidth;
+		height = newHeight;
+		pixels.resize(size_t{width} * height);
+	}
+
+	uint32_t* Row(uint32_t y) { return &pixels[size_t{y} * width]; }
+	const uint32_t* Row(uint32_t y) const { return &pixels[size_t{y} * width]; }
+
+	const void* Data() const { return pixels.data(); }
+	size_t ByteSize() const { return pixels.size() * sizeof(uint32_t); }
+
+	static uint32_t Pack(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+	{
+		return uint32_t{r} | (uint32_t{g} << 8) | (uint32_t{b} << 16) | (uint32_t{a} << 24);
+	}
+};
+
+/*
+ * Filters over RGBA8 images on the CPU.
+ *
+ * Each pixel is processed as one SIMD register of four float channels, and the rows are split
+ * between the job system's threads. Results are rounded half up like WGSL's pack4x8unorm. The GPU
+ * kernels round their intermediate pass to 8 bits, so they agree with these to within one step
+ * per channel, except Downsample which is exact. dst must not be the source image.
+ */
+namespace image {
+
+// Largest filter radius, bounded by the workgroup memory of the GPU kernels
+constexpr uint32_t kMaxRadius = 16;
+
+// Normalized taps of a symmetric kernel from the center outwards, radius + 1 of them
+std::vector<float> GaussianWeights(float sigma);  // Radius of 3 sigma, at most kMaxRadius
+std::vector<float> BoxWeights(uint32_t radius);
+
+// Convolve the rows then the columns with the kernel, repeating the edge pixels
+void SeparableFilter(const Image& src, const std::vector<float>& weights, Image& dst, JobSystem& jobs);
+
+inline void GaussianBlur(const Image& src, float sigma, Image& dst, JobSystem& jobs)
+{
+	SeparableFilter(src, GaussianWeights(sigma), dst, jobs);
+}
+
+inline void BoxFilter(const Image& src, uint32_t radius, Image& dst, JobSystem& jobs)
+{
+	SeparableFilter(src, BoxWeights(radius), dst, jobs);
+}
+
+// Half the size rounded down, at least one pixel, each pixel the average of a 2x2 block
+void Downsample(const Image& src, Image& dst, JobSystem& jobs);
+
+// Channels as a column vector in [0, 255], transformed by matrix then offset
+struct ColorMatrix
+{
+	math::Mat4 matrix;
+	math::Vec4 offset;
+};
+
+// Rec. 709 luma in every color channel
+inline constexpr ColorMatrix kGrayscale = {
+	{{{0.2126f, 0.2126f, 0.2126f, 0}, {0.7152f, 0.7152f, 0.7152f, 0}, {0.0722f, 0.0722f, 0.0722f, 0}, {0, 0, 0, 1}}},
+	{0, 0, 0, 0}};
+
+// Full range BT.601 as used by JPEG, Y Cb Cr in the red, green and blue channels
+inline constexpr ColorMatrix kRgbToYCbCr = {
+	{{{0.299f, -0.168736f, 0.5f, 0}, {0.587f, -0.331264f, -0.418688f, 0}, {0.114f, 0.5f, -0.081312f, 0}, {0, 0, 0, 1}}},
+	{0, 128, 128, 0}};
+
+inline constexpr ColorMatrix kYCbCrToRgb = {
+	{{{1, 1, 1, 0}, {0, -0.344136f, 1.772f, 0}, {1.402f, -0.714136f, 0, 0}, {0, 0, 0, 1}}},
+	{-179.456f, 135.458816f, -226.816f, 0}};
+
+void ConvertColor(const Image& src, const ColorMatrix& color, Image& dst, JobSystem& jobs);
+
+// Red ramping down the rows and green across the columns, repeating every 256 pixels
+Image TestPattern(uint32_t width, uint32_t height);
+
+// Largest difference between two channels, 255 if the sizes differ
+uint32_t MaxDifference(const Image& a, const Image& b);
+
+// Scalar single threaded versions, the reference the other paths are checked against
+namespace reference {
+
+void SeparableFilter(const Image& src, const std::vector<float>& weights, Image& dst);
+void Downsample(const Image& src, Image& dst);
+void ConvertColor(const Image& src, const ColorMatrix& color, Image& dst);
+
+} // namespace reference
+
+} // namespace image
@@ -0,0 +1,442 @@
+#include "ImageCompute.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+namespace {
+
+constexpr uint32_t kTileSize = 16;
+
+// Every kernel reads binding 0, writes binding 1 and takes its parameters from binding 2
+const ComputeContext::Layout kImageLayout = {
+	ComputeContext::Binding::ReadOnlyStorage,
+	ComputeContext::Binding::Storage,
+	ComputeContext::Binding::Uniform,
+};
+
+// Plus the weights of the filter from the center outwards
+const ComputeContext::Layout kFilterLayout = {
+	ComputeContext::Binding::ReadOnlyStorage,
+	ComputeContext::Binding::Storage,
+	ComputeContext::Binding::Uniform,
+	ComputeContext::Binding::ReadOnlyStorage,
+};
+
+const char* const kSeparableFilterShader = R"(
+const TILE: u32 = 16u;
+const MAX_RADIUS: u32 = 16u;  // image::kMaxRadius
+const SPAN: u32 = TILE + 2u * MAX_RADIUS;
+
+struct Params
+{
+	width: u32,
+	height: u32,
+	radius: u32,
+	horizontal: u32,
+};
+
+@group(0) @binding(0) var<storage, read> src: array<u32>;
+@group(0) @binding(1) var<storage, read_write> dst: array<u32>;
+@group(0) @binding(2) var<uniform> params: Params;
+@group(0) @binding(3) var<storage, read> weights: array<f32>;
+
+// One line of the tile and its apron per line of invocations, running along the filter direction
+var<workgroup> lines: array<vec4f, SPAN * TILE>;
+
+// Pixel at along in the filter direction on line across, clamped to the image
+fn load_pixel(along: i32, across: u32) -> vec4f
+{
+	var p = vec2i(i32(across), along);
+	if (params.horizontal != 0u)
+	{
+		p = p.yx;
+	}
+	p = clamp(p, vec2i(0), vec2i(i32(params.width), i32(params.height)) - 1);
+	return unpack4x8unorm(src[u32(p.y) * params.width + u32(p.x)]);
+}
+
+@compute @workgroup_size(16, 16)
+fn separable_filter(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_id) local: vec3u)
+{
+	let horizontal = params.horizontal != 0u;
+	let pixel = group.xy * TILE + local.xy;
+
+	// Invocations next to each other in x load words next to each other, whatever the direction
+	let along = select(local.y, local.x, horizontal);
+	let line = select(local.x, local.y, horizontal) * SPAN;
+	let across = select(pixel.x, pixel.y, horizontal);
+	let start = i32(select(group.y, group.x, horizontal) * TILE) - i32(params.radius);
+
+	for (var i = along; i < TILE + 2u * params.radius; i += TILE)
+	{
+		lines[line + i] = load_pixel(start + i32(i), across);
+	}
+	workgroupBarrier();
+
+	let center = line + along + params.radius;
+	var sum = lines[center] * weights[0];
+	for (var k = 1u; k <= params.radius; k++)
+	{
+		sum += (lines[center - k] + lines[center + k]) * weights[k];
+	}
+
+	if (pixel.x < params.width && pixel.y < params.height)
+	{
+		dst[pixel.y * params.width + pixel.x] = pack4x8unorm(sum);
+	}
+})";
+
+const char* const kDownsampleShader = R"(
+struct Params
+{
+	srcWidth: u32,
+	srcHeight: u32,
+	dstWidth: u32,
+	dstHeight: u32,
+};
+
+@group(0) @binding(0) var<storage, read> src: array<u32>;
+@group(0) @binding(1) var<storage, read_write> dst: array<u32>;
+@group(0) @binding(2) var<uniform> params: Params;
+
+// Source pixels of the workgroup's 16x16 output pixels
+var<workgroup> tile: array<u32, 1024>;
+
+fn channels(rgba: u32) -> vec4u
+{
+	return (vec4u(rgba) >> vec4u(0u, 8u, 16u, 24u)) & vec4u(255u);
+}
+
+@compute @workgroup_size(16, 16)
+fn downsample(@builtin(workgroup_id) group: vec3u, @builtin(local_invocation_id) local: vec3u)
+{
+	// Two rows of two 16 pixel runs per invocation, so each run is read by consecutive invocations
+	let last = vec2u(params.srcWidth, params.srcHeight) - 1u;
+	for (var i = 0u; i < 4u; i++)
+	{
+		let t = vec2u(local.x + (i & 1u) * 16u, local.y * 2u + (i >> 1u));
+		let s = min(group.xy * 32u + t, last);
+		tile[t.y * 32u + t.x] = src[s.y * params.srcWidth + s.x];
+	}
+	workgroupBarrier();
+
+	let pixel = group.xy * 16u + local.xy;
+	if (pixel.x < params.dstWidth && pixel.y < params.dstHeight)
+	{
+		let t = local.y * 64u + local.x * 2u;
+		let sum = channels(tile[t]) + channels(tile[t + 1u]) + channels(tile[t + 32u]) + channels(tile[t + 33u]);
+		let c = (sum + 2u) >> vec4u(2u);
+		dst[pixel.y * params.dstWidth + pixel.x] = c.x | (c.y << 8u) | (c.z << 16u) | (c.w << 24u);
+	}
+})";
+
+const char* const kConvertColorShader = R"(
+struct Params
+{
+	matrix: mat4x4f,
+	offset: vec4f,
+	width: u32,
+	height: u32,
+};
+
+@group(0) @binding(0) var<storage, read> src: array<u32>;
+@group(0) @binding(1) var<storage, read_write> dst: array<u32>;
+@group(0) @binding(2) var<uniform> params: Params;
+
+@compute @workgroup_size(16, 16)
+fn convert_color(@builtin(global_invocation_id) id: vec3u)
+{
+	if (id.x < params.width && id.y < params.height)
+	{
+		let index = id.y * params.width + id.x;
+		let color = params.matrix * (unpack4x8unorm(src[index]) * 255.0) + params.offset;
+		dst[index] = pack4x8unorm(color / 255.0);
+	}
+})";
+
+struct FilterParams
+{
+	uint32_t width, height, radius, horizontal;
+};
+
+struct DownsampleParams
+{
+	uint32_t srcWidth, srcHeight, dstWidth, dstHeight;
+};
+
+struct ColorParams
+{
+	image::ColorMatrix color;
+	uint32_t width, height;
+	uint32_t padding[2];  // Uniform structs are a multiple of 16 bytes
+};
+static_assert(sizeof(ColorParams) == 96, "ColorParams must match the WGSL Params struct");
+
+} // anonymous namespace
+
+ImageKernels::ImageKernels(ComputeContext& context) :
+	m_context(&context)
+{}
+
+bool ImageKernels::Allocate(GpuImage& image, uint32_t width, uint32_t height)
+{
+	if (image.buffer && image.width == width && image.height == height)
+		return true;
+
+	const uint64_t size = uint64_t{width} * height * sizeof(uint32_t);
+	if (size == 0 || size > m_context->Limits().maxStorageBufferBindingSize)
+	{
+		std::cerr << "Image of " << width << "x" << height << " does not fit in a storage buffer" << std::endl;
+		return false;
+	}
+
+	image.buffer = m_context->CreateBuffer(size, WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst | WGPUBufferUsage_CopySrc, "Image");
+	image.width = width;
+	image.height = height;
+	return image.buffer != nullptr;
+}
+
+bool ImageKernels::Upload(const Image& source, GpuImage& image)
+{
+	if (!Allocate(image, source.width, source.height))
+		return false;
+
+	m_context->WriteBuffer(image.buffer.get(), 0, source.Data(), source.ByteSize());
+	return true;
+}
+
+void ImageKernels::Download(ComputeContext::Batch& batch, const GpuImage& image, Image& dst)
+{
+	const uint32_t width = image.width;
+	const uint32_t height = image.height;
+	batch.Readback(image.buffer.get(), 0, uint64_t{width} * height * sizeof(uint32_t), [&dst, width, height](const void* data, uint64_t size) {
+		if (!data)
+		{
+			dst.Resize(0, 0);
+			return;
+		}
+		dst.Resize(width, height);
+		std::memcpy(dst.pixels.data(), data, std::min<uint64_t>(size, dst.ByteSize()));
+	});
+}
+
+bool ImageKernels::SeparableFilter(ComputeContext::Batch& batch, const GpuImage& src, const std::vector<float>& weights, GpuImage& dst)
+{
+	TRACE_SCOPE("ImageKernels::SeparableFilter");
+
+	if (weights.empty() || weights.size() > image::kMaxRadius + 1)
+	{
+		std::cerr << "Filter radius must be at most " << image::kMaxRadius << std::endl;
+		return false;
+	}
+	if (!Allocate(m_intermediate, src.width, src.height) || !Allocate(dst, src.width, src.height))
+		return false;
+
+	WGPUComputePipeline pipeline = m_context->GetPipeline(kSeparableFilterShader, "separable_filter", kFilterLayout);
+	WgpuBufferPtr weightsBuffer = m_context->CreateBuffer(weights.size() * sizeof(float), WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst, "Filter weights");
+	if (!pipeline || !weightsBuffer)
+		return false;
+	m_context->WriteBuffer(weightsBuffer.get(), 0, weights.data(), weights.size() * sizeof(float));
+
+	// Rows into the intermediate image, then its columns into dst
+	const uint32_t radius = static_cast<uint32_t>(weights.size()) - 1;
+	const FilterParams passes[2] = {
+		{src.width, src.height, radius, 1},
+		{src.width, src.height, radius, 0},
+	};
+	const WGPUBuffer sources[2] = {src.buffer.get(), m_intermediate.buffer.get()};
+	const WGPUBuffer targets[2] = {m_intermediate.buffer.get(), dst.buffer.get()};
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		WgpuBufferPtr params = CreateParams(&passes[pass], sizeof(FilterParams));
+		if (!params)
+			return false;
+		WgpuBindGroupPtr bindGroup = m_context->CreateBindGroup(kFilterLayout, {{sources[pass]}, {targets[pass]}, {params.get()}, {weightsBuffer.get()}});
+		if (!batch.Dispatch(pipeline, bindGroup.get(), {src.width, src.height}, {kTileSize, kTileSize}))
+			return false;
+	}
+	return true;
+}
+
+bool ImageKernels::Downsample(ComputeContext::Batch& batch, const GpuImage& src, GpuImage& dst)
+{
+	TRACE_SCOPE("ImageKernels::Downsample");
+
+	if (!Allocate(dst, std::max(src.width / 2, 1u), std::max(src.height / 2, 1u)))
+		return false;
+
+	WGPUComputePipeline pipeline = m_context->GetPipeline(kDownsampleShader, "downsample", kImageLayout);
+	const DownsampleParams downsample = {src.width, src.height, dst.width, dst.height};
+	WgpuBufferPtr params = CreateParams(&downsample, sizeof(downsample));
+	if (!pipeline || !params)
+		return false;
+
+	WgpuBindGroupPtr bindGroup = m_context->CreateBindGroup(kImageLayout, {{src.buffer.get()}, {dst.buffer.get()}, {params.get()}});
+	return batch.Dispatch(pipeline, bindGroup.get(), {dst.width, dst.height}, {kTileSize, kTileSize});
+}
+
+bool ImageKernels::ConvertColor(ComputeContext::Batch& batch, const GpuImage& src, const image::ColorMatrix& color, GpuImage& dst)
+{
+	TRACE_SCOPE("ImageKernels::ConvertColor");
+
+	if (!Allocate(dst, src.width, src.height))
+		return false;
+
+	WGPUComputePipeline pipeline = m_context->GetPipeline(kConvertColorShader, "convert_color", kImageLayout);
+	const ColorParams convert = {color, src.width, src.height, {0, 0}};
+	WgpuBufferPtr params = CreateParams(&convert, sizeof(convert));
+	if (!pipeline || !params)
+		return false;
+
+	WgpuBindGroupPtr bindGroup = m_context->CreateBindGroup(kImageLayout, {{src.buffer.get()}, {dst.buffer.get()}, {params.get()}});
+	return batch.Dispatch(pipeline, bindGroup.get(), {src.width, src.height}, {kTileSize, kTileSize});
+}
+
+// Queue writes land before the submission, so every dispatch in a batch needs parameters of its own
+WgpuBufferPtr ImageKernels::CreateParams(const void* data, size_t size)
+{
+	WgpuBufferPtr params = m_context->CreateBuffer(size, WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst, "Image kernel params");
+	if (params)
+		m_context->WriteBuffer(params.get(), 0, data, size);
+	return params;
+}
+
+bool RunImageBenchmark(uint32_t maxSize)
+{
+	using Clock = std::chrono::steady_clock;
+	constexpr uint32_t kIterations = 5;
+	constexpr uint32_t kMinSize = 256;
+
+	struct Kernel
+	{
+		const char* name;
+		uint32_t tolerance;  // Largest channel difference from the reference that rounding explains
+		std::function<void(const Image&, Image&)> reference;
+		std::function<void(const Image&, Image&, JobSystem&)> cpu;
+		std::function<bool(ImageKernels&, ComputeContext::Batch&, const ImageKernels::GpuImage&, ImageKernels::GpuImage&)> gpu;
+	};
+
+	const std::vector<float> gaussian = image::GaussianWeights(2.0f);
+	const std::vector<float> box = image::BoxWeights(4);
+	const Kernel kernels[] = {
+		{"gaussian sigma 2", 1,
+			[&](const Image& src, Image& dst) { image::reference::SeparableFilter(src, gaussian, dst); },
+			[&](const Image& src, Image& dst, JobSystem& jobs) { image::SeparableFilter(src, gaussian, dst, jobs); },
+			[&](ImageKernels& gpu, ComputeContext::Batch& batch, const ImageKernels::GpuImage& src, ImageKernels::GpuImage& dst) {
+				return gpu.SeparableFilter(batch, src, gaussian, dst);
+			}},
+		{"box radius 4", 1,
+			[&](const Image& src, Image& dst) { image::reference::SeparableFilter(src, box, dst); },
+			[&](const Image& src, Image& dst, JobSystem& jobs) { image::SeparableFilter(src, box, dst, jobs); },
+			[&](ImageKernels& gpu, ComputeContext::Batch& batch, const ImageKernels::GpuImage& src, ImageKernels::GpuImage& dst) {
+				return gpu.SeparableFilter(batch, src, box, dst);
+			}},
+		{"downsample", 0,
+			[](const Image& src, Image& dst) { image::reference::Downsample(src, dst); },
+			[](const Image& src, Image& dst, JobSystem& jobs) { image::Downsample(src, dst, jobs); },
+			[](ImageKernels& gpu, ComputeContext::Batch& batch, const ImageKernels::GpuImage& src, ImageKernels::GpuImage& dst) {
+				return gpu.Downsample(batch, src, dst);
+			}},
+		{"rgb to ycbcr", 1,
+			[](const Image& src, Image& dst) { image::reference::ConvertColor(src, image::kRgbToYCbCr, dst); },
+			[](const Image& src, Image& dst, JobSystem& jobs) { image::ConvertColor(src, image::kRgbToYCbCr, dst, jobs); },
+			[](ImageKernels& gpu, ComputeContext::Batch& batch, const ImageKernels::GpuImage& src, ImageKernels::GpuImage& dst) {
+				return gpu.ConvertColor(batch, src, image::kRgbToYCbCr, dst);
+			}},
+	};
+
+	JobSystem serialJobs(0);
+	JobSystem jobs;
+	const uint32_t threads = jobs.WorkerCount() + 1;
+
+	// The GPU is optional, the CPU paths are what the app falls back to without one
+#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
+	std::unique_ptr<ComputeContext> context;
+#else
+	std::unique_ptr<ComputeContext> context = std::make_unique<ComputeContext>();
+	if (!context->IsInitialized())
+		context.reset();
+#endif
+	std::unique_ptr<ImageKernels> gpu = context ? std::make_unique<ImageKernels>(*context) : nullptr;
+
+	std::cout << "Image benchmark: " << threads << " threads, " << (gpu ? "with" : "without") << " GPU, best of "
+		<< kIterations << " runs, milliseconds per image" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+
+	auto milliseconds = [](Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	};
+	auto best = [&](auto&& fn) {
+		double fastest = 0;
+		for (uint32_t i = 0; i < kIterations; ++i)
+		{
+			const Clock::time_point start = Clock::now();
+			fn();
+			const double ms = milliseconds(start);
+			fastest = i == 0 ? ms : std::min(fastest, ms);
+		}
+		return fastest;
+	};
+
+	bool ok = true;
+	std::mt19937 rng(5);
+	for (uint32_t size = kMinSize; size <= std::max(maxSize, kMinSize); size *= 2)
+	{
+		// The gradient of the app's texture with noise in the blue channel, so filters change something
+		Image src = image::TestPattern(size, size);
+		for (uint32_t &pixel : src.pixels)
+			pixel = (pixel & 0xff00ffffu) | ((rng() & 0xffu) << 16);
+
+		ImageKernels::GpuImage gpuSrc, gpuDst;
+		const bool uploaded = gpu && gpu->Upload(src, gpuSrc);
+
+		for (const Kernel &kernel : kernels)
+		{
+			Image reference, serial, parallel, fromGpu;
+			Clock::time_point start = Clock::now();
+			kernel.reference(src, reference);
+			const double referenceMs = milliseconds(start);
+			const double serialMs = best([&]() { kernel.cpu(src, serial, serialJobs); });
+			const double parallelMs = best([&]() { kernel.cpu(src, parallel, jobs); });
+
+			uint32_t difference = std::max(image::MaxDifference(serial, reference), image::MaxDifference(parallel, reference));
+			double gpuMs = 0;
+			if (uploaded)
+			{
+				// Submission to readback, so this includes copying the result back
+				gpuMs = best([&]() {
+					ComputeContext::Batch batch = context->Begin();
+					if (!kernel.gpu(*gpu, batch, gpuSrc, gpuDst))
+						return;
+					gpu->Download(batch, gpuDst, fromGpu);
+					context->Submit(std::move(batch));
+					context->Wait();
+				});
+				difference = std::max(difference, image::MaxDifference(fromGpu, reference));
+			}
+
+			const bool matches = difference <= kernel.tolerance;
+			ok = ok && matches;
+			std::cout << "  " << std::setw(4) << size << "x" << std::setw(4) << std::left << size << std::right << " " << std::setw(16) << std::left << kernel.name << std::right
+				<< " scalar " << referenceMs << ", simd " << serialMs << " on 1 thread, " << parallelMs << " on " << threads;
+			if (uploaded)
+				std::cout << ", gpu " << gpuMs;
+			std::cout << ", max difference " << difference << (matches ? "" : "  MISMATCH") << std::endl;
+		}
+	}
+
+	if (context && context->ErrorCount() > 0)
+	{
+		std::cout << "  GPU errors were reported" << std::endl;
+		ok = false;
+	}
+	if (!ok)
+		std::cout << "  MISMATCH against the scalar reference" << std::endl;
+	return ok;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Compute.hpp"
+#include "Image.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * The filters of Image.hpp as compute kernels, on images held in storage buffers as the packed
+ * RGBA8 words of Image::pixels.
+ *
+ * The separable filters run one pass per direction. Every 16x16 workgroup first copies its tile
+ * and an apron of radius pixels along the filter direction into workgroup memory, so each source
+ * pixel is read from the buffer once per workgroup rather than once per tap, and the loads of
+ * neighbouring invocations are neighbouring words in both directions. Downsample stages its 32x32
+ * source tile the same way. The CPU versions are the reference for these and the fallback when
+ * there is no device.
+ */
+class ImageKernels
+{
+public:
+	struct GpuImage
+	{
+		GpuImage() : buffer(nullptr, wgpuBufferRelease) {}
+
+		WgpuBufferPtr buffer;
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+
+	explicit ImageKernels(ComputeContext& context);
+
+	// Size image to width x height, keeping its buffer when the size is unchanged
+	bool Allocate(GpuImage& image, uint32_t width, uint32_t height);
+	bool Upload(const Image& source, GpuImage& image);
+
+	// Fill dst from Poll() once the batch has run, dst must outlive that. Empty if mapping failed.
+	void Download(ComputeContext::Batch& batch, const GpuImage& image, Image& dst);
+
+	// Record the kernels into batch, sizing dst to fit. False if the image is too large for the device.
+	bool SeparableFilter(ComputeContext::Batch& batch, const GpuImage& src, const std::vector<float>& weights, GpuImage& dst);
+	bool Downsample(ComputeContext::Batch& batch, const GpuImage& src, GpuImage& dst);
+	bool ConvertColor(ComputeContext::Batch& batch, const GpuImage& src, const image::ColorMatrix& color, GpuImage& dst);
+
+private:
+	WgpuBufferPtr CreateParams(const void* data, size_t size);
+
+	ComputeContext *m_context;
+	GpuImage m_intermediate;  // Between the passes of SeparableFilter
+};
+
+/*
+ * Time every image filter on the reference, SIMD and multithreaded CPU paths and, when a device is
+ * available, the GPU, for square images from 256 pixels up to maxSize. Returns false if any path
+ * differs from the reference by more than its rounding allows.
+ */
+bool RunImageBenchmark(uint32_t maxSize);
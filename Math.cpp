@@ -0,0 +1,307 @@
+#include "Math.hpp"
+#include "Simd.hpp"
+
+namespace math {
+
+Mat4 InverseAffine(const Mat4& m)
+{
+	const Vec3 a{m.cols[0].x, m.cols[0].y, m.cols[0].z};
+	const Vec3 b{m.cols[1].x, m.cols[1].y, m.cols[1].z};
+	const Vec3 c{m.cols[2].x, m.cols[2].y, m.cols[2].z};
+	const Vec3 t{m.cols[3].x, m.cols[3].y, m.cols[3].z};
+
+	// Rows of the inverse 3x3 are the cross products of the columns over the determinant
+	const Vec3 r0 = Cross(b, c);
+	const Vec3 r1 = Cross(c, a);
+	const Vec3 r2 = Cross(a, b);
+	const float det = Dot(a, r0);
+	const float invDet = det != 0 ? 1.0f / det : 0.0f;
+
+	const Vec3 i0 = r0 * invDet;
+	const Vec3 i1 = r1 * invDet;
+	const Vec3 i2 = r2 * invDet;
+	return {{
+		{i0.x, i1.x, i2.x, 0},
+		{i0.y, i1.y, i2.y, 0},
+		{i0.z, i1.z, i2.z, 0},
+		{-Dot(i0, t), -Dot(i1, t), -Dot(i2, t), 1}
+	}};
+}
+
+namespace {
+
+ConstFloat3Soa Offset(ConstFloat3Soa soa, size_t offset)
+{
+	return {soa.x + offset, soa.y + offset, soa.z + offset};
+}
+
+Float3Soa Offset(Float3Soa soa, size_t offset)
+{
+	return {soa.x + offset, soa.y + offset, soa.z + offset};
+}
+
+namespace scalar {
+
+void TransformPoints(const Mat4& m, ConstFloat3Soa in, Float3Soa out, size_t count)
+{
+	const Vec4 *c = m.cols;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float x = in.x[i], y = in.y[i], z = in.z[i];
+		out.x[i] = c[0].x * x + c[1].x * y + c[2].x * z + c[3].x;
+		out.y[i] = c[0].y * x + c[1].y * y + c[2].y * z + c[3].y;
+		out.z[i] = c[0].z * x + c[1].z * y + c[2].z * z + c[3].z;
+	}
+}
+
+void TransformBounds(const Mat4& m, ConstFloat3Soa centers, ConstFloat3Soa extents, Float3Soa outCenters, Float3Soa outExtents, size_t count)
+{
+	const Vec4 *c = m.cols;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float ex = extents.x[i], ey = extents.y[i], ez = extents.z[i];
+		outExtents.x[i] = std::fabs(c[0].x) * ex + std::fabs(c[1].x) * ey + std::fabs(c[2].x) * ez;
+		outExtents.y[i] = std::fabs(c[0].y) * ex + std::fabs(c[1].y) * ey + std::fabs(c[2].y) * ez;
+		outExtents.z[i] = std::fabs(c[0].z) * ex + std::fabs(c[1].z) * ey + std::fabs(c[2].z) * ez;
+	}
+	scalar::TransformPoints(m, centers, outCenters, count);
+}
+
+void MultiplyMat4(const Mat4* a, const Mat4* b, Mat4* out, size_t count)
+{
+	for (size_t n = 0; n < count; ++n)
+	{
+		const Vec4 *ac = a[n].cols;
+		Mat4 result;
+		for (int i = 0; i < 4; ++i)
+		{
+			const Vec4 &v = b[n].cols[i];
+			result.cols[i] = {
+				ac[0].x * v.x + ac[1].x * v.y + ac[2].x * v.z + ac[3].x * v.w,
+				ac[0].y * v.x + ac[1].y * v.y + ac[2].y * v.z + ac[3].y * v.w,
+				ac[0].z * v.x + ac[1].z * v.y + ac[2].z * v.z + ac[3].z * v.w,
+				ac[0].w * v.x + ac[1].w * v.y + ac[2].w * v.z + ac[3].w * v.w
+			};
+		}
+		out[n] = result;
+	}
+}
+
+} // namespace scalar
+
+/*
+ * The SoA loops are the same for every instruction set, only the register width differs.
+ * Ops is one of the simd:: wrappers.
+ */
+template <class Ops>
+void TransformPointsSimd(const Mat4& m, ConstFloat3Soa in, Float3Soa out, size_t count)
+{
+	using V = typename Ops::V;
+	const Vec4 *c = m.cols;
+	const V c0x = Ops::Set1(c[0].x), c1x = Ops::Set1(c[1].x), c2x = Ops::Set1(c[2].x), c3x = Ops::Set1(c[3].x);
+	const V c0y = Ops::Set1(c[0].y), c1y = Ops::Set1(c[1].y), c2y = Ops::Set1(c[2].y), c3y = Ops::Set1(c[3].y);
+	const V c0z = Ops::Set1(c[0].z), c1z = Ops::Set1(c[1].z), c2z = Ops::Set1(c[2].z), c3z = Ops::Set1(c[3].z);
+
+	size_t i = 0;
+	for (; i + Ops::kWidth <= count; i += Ops::kWidth)
+	{
+		const V x = Ops::Load(in.x + i);
+		const V y = Ops::Load(in.y + i);
+		const V z = Ops::Load(in.z + i);
+		Ops::Store(out.x + i, Ops::Madd(c2x, z, Ops::Madd(c1x, y, Ops::Madd(c0x, x, c3x))));
+		Ops::Store(out.y + i, Ops::Madd(c2y, z, Ops::Madd(c1y, y, Ops::Madd(c0y, x, c3y))));
+		Ops::Store(out.z + i, Ops::Madd(c2z, z, Ops::Madd(c1z, y, Ops::Madd(c0z, x, c3z))));
+	}
+
+	scalar::TransformPoints(m, Offset(in, i), Offset(out, i), count - i);
+}
+
+template <class Ops>
+void TransformBoundsSimd(const Mat4& m, ConstFloat3Soa centers, ConstFloat3Soa extents, Float3Soa outCenters, Float3Soa outExtents, size_t count)
+{
+	using V = typename Ops::V;
+	const Vec4 *c = m.cols;
+	const V a0x = Ops::Set1(std::fabs(c[0].x)), a1x = Ops::Set1(std::fabs(c[1].x)), a2x = Ops::Set1(std::fabs(c[2].x));
+	const V a0y = Ops::Set1(std::fabs(c[0].y)), a1y = Ops::Set1(std::fabs(c[1].y)), a2y = Ops::Set1(std::fabs(c[2].y));
+	const V a0z = Ops::Set1(std::fabs(c[0].z)), a1z = Ops::Set1(std::fabs(c[1].z)), a2z = Ops::Set1(std::fabs(c[2].z));
+
+	size_t i = 0;
+	for (; i + Ops::kWidth <= count; i += Ops::kWidth)
+	{
+		const V ex = Ops::Load(extents.x + i);
+		const V ey = Ops::Load(extents.y + i);
+		const V ez = Ops::Load(extents.z + i);
+		Ops::Store(outExtents.x + i, Ops::Madd(a2x, ez, Ops::Madd(a1x, ey, Ops::Mul(a0x, ex))));
+		Ops::Store(outExtents.y + i, Ops::Madd(a2y, ez, Ops::Madd(a1y, ey, Ops::Mul(a0y, ex))));
+		Ops::Store(outExtents.z + i, Ops::Madd(a2z, ez, Ops::Madd(a1z, ey, Ops::Mul(a0z, ex))));
+	}
+
+	scalar::TransformBounds(m, Offset(centers, i), Offset(extents, i), Offset(outCenters, i), Offset(outExtents, i), count - i);
+	TransformPointsSimd<Ops>(m, centers, outCenters, i);
+}
+
+#if defined(MATH_HAS_SSE)
+namespace sse {
+
+using Ops = simd::Sse;
+
+void TransformPoints(const Mat4& m, ConstFloat3Soa in, Float3Soa out, size_t count)
+{
+	TransformPointsSimd<Ops>(m, in, out, count);
+}
+
+void TransformBounds(const Mat4& m, ConstFloat3Soa centers, ConstFloat3Soa extents, Float3Soa outCenters, Float3Soa outExtents, size_t count)
+{
+	TransformBoundsSimd<Ops>(m, centers, extents, outCenters, outExtents, count);
+}
+
+void MultiplyMat4(const Mat4* a, const Mat4* b, Mat4* out, size_t count)
+{
+	for (size_t n = 0; n < count; ++n)
+	{
+		// All of a is loaded before anything is stored, and each column of b is read before its
+		// output column is written, so out may alias either input
+		const __m128 a0 = _mm_load_ps(&a[n].cols[0].x);
+		const __m128 a1 = _mm_load_ps(&a[n].cols[1].x);
+		const __m128 a2 = _mm_load_ps(&a[n].cols[2].x);
+		const __m128 a3 = _mm_load_ps(&a[n].cols[3].x);
+		for (int i = 0; i < 4; ++i)
+		{
+			const __m128 v = _mm_load_ps(&b[n].cols[i].x);
+			__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+			r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+			r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+			r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+			_mm_store_ps(&out[n].cols[i].x, r);
+		}
+	}
+}
+
+} // namespace sse
+#endif // MATH_HAS_SSE
+
+#if defined(MATH_HAS_AVX2)
+namespace avx2 {
+
+using Ops = simd::Avx2;
+
+void TransformPoints(const Mat4& m, ConstFloat3Soa in, Float3Soa out, size_t count)
+{
+	TransformPointsSimd<Ops>(m, in, out, count);
+}
+
+void TransformBounds(const Mat4& m, ConstFloat3Soa centers, ConstFloat3Soa extents, Float3Soa outCenters, Float3Soa outExtents, size_t count)
+{
+	TransformBoundsSimd<Ops>(m, centers, extents, outCenters, outExtents, count);
+}
+
+void MultiplyMat4(const Mat4* a, const Mat4* b, Mat4* out, size_t count)
+{
+	for (size_t n = 0; n < count; ++n)
+	{
+		// Two output columns per register: each column of a is repeated in both 128 bit halves and
+		// multiplied with one component of two adjacent columns of b
+		const __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&a[n].cols[0].x));
+		const __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&a[n].cols[1].x));
+		const __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&a[n].cols[2].x));
+		const __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&a[n].cols[3].x));
+		for (int i = 0; i < 4; i += 2)
+		{
+			const __m256 v = _mm256_loadu_ps(&b[n].cols[i].x);  // Mat4 is only 16 byte aligned
+			__m256 r = Ops::Mul(a0, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+			r = Ops::Madd(a1, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)), r);
+			r = Ops::Madd(a2, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)), r);
+			r = Ops::Madd(a3, _mm256_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3)), r);
+			_mm256_storeu_ps(&out[n].cols[i].x, r);
+		}
+	}
+}
+
+} // namespace avx2
+#endif // MATH_HAS_AVX2
+
+#if defined(MATH_HAS_NEON)
+namespace neon {
+
+using Ops = simd::Neon;
+
+void TransformPoints(const Mat4& m, ConstFloat3Soa in, Float3Soa out, size_t count)
+{
+	TransformPointsSimd<Ops>(m, in, out, count);
+}
+
+void TransformBounds(const Mat4& m, ConstFloat3Soa centers, ConstFloat3Soa extents, Float3Soa outCenters, Float3Soa outExtents, size_t count)
+{
+	TransformBoundsSimd<Ops>(m, centers, extents, outCenters, outExtents, count);
+}
+
+void MultiplyMat4(const Mat4* a, const Mat4* b, Mat4* out, size_t count)
+{
+	for (size_t n = 0; n < count; ++n)
+	{
+		const float32x4_t a0 = vld1q_f32(&a[n].cols[0].x);
+		const float32x4_t a1 = vld1q_f32(&a[n].cols[1].x);
+		const float32x4_t a2 = vld1q_f32(&a[n].cols[2].x);
+		const float32x4_t a3 = vld1q_f32(&a[n].cols[3].x);
+		for (int i = 0; i < 4; ++i)
+		{
+			const Vec4 v = b[n].cols[i];
+			float32x4_t r = vmulq_n_f32(a0, v.x);
+			r = vmlaq_n_f32(r, a1, v.y);
+			r = vmlaq_n_f32(r, a2, v.z);
+			r = vmlaq_n_f32(r, a3, v.w);
+			vst1q_f32(&out[n].cols[i].x, r);
+		}
+	}
+}
+
+} // namespace neon
+#endif // MATH_HAS_NEON
+
+#if defined(MATH_HAS_AVX2)
+namespace active = avx2;
+#elif defined(MATH_HAS_SSE)
+namespace active = sse;
+#elif defined(MATH_HAS_NEON)
+namespace active = neon;
+#else
+namespace active = scalar;
+#endif
+
+const BatchBackend kBackends[] = {
+	{"scalar", scalar::TransformPoints, scalar::TransformBounds, scalar::MultiplyMat4},
+#if defined(MATH_HAS_NEON)
+	{"neon", neon::TransformPoints, neon::TransformBounds, neon::MultiplyMat4},
+#endif
+#if defined(MATH_HAS_SSE)
+	{"sse", sse::TransformPoints, sse::TransformBounds, sse::MultiplyMat4},
+#endif
+#if defined(MATH_HAS_AVX2)
+	{"avx2", avx2::TransformPoints, avx2::TransformBounds, avx2::MultiplyMat4},
+#endif
+};
+
+} // anonymous namespace
+
+void TransformPoints(const Mat4& m, ConstFloat3Soa in, Float3Soa out, size_t count)
+{
+	active::TransformPoints(m, in, out, count);
+}
+
+void TransformBounds(const Mat4& m, ConstFloat3Soa centers, ConstFloat3Soa extents, Float3Soa outCenters, Float3Soa outExtents, size_t count)
+{
+	active::TransformBounds(m, centers, extents, outCenters, outExtents, count);
+}
+
+void MultiplyMat4(const Mat4* a, const Mat4* b, Mat4* out, size_t count)
+{
+	active::MultiplyMat4(a, b, out, count);
+}
+
+const BatchBackend* GetBatchBackends(size_t& count)
+{
+	count = sizeof(kBackends) / sizeof(kBackends[0]);
+	return kBackends;
+}
+
+} // namespace math
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Vector, matrix and quaternion math for transforms.
+ *
+ * Matrices are column major with the columns stored as 16 byte aligned vec4s, which is exactly the
+ * std140 layout of a WGSL mat4x4f, so a Mat4 can be copied into a uniform buffer as is.
+ *
+ * The SIMD backend is chosen at compile time from the target architecture: AVX2 (when the compiler
+ * targets it, see the APP_MATH_AVX2 CMake option), SSE2, NEON, or the scalar reference. Defining
+ * APP_MATH_SCALAR forces the scalar backend. The scalar batch functions are always compiled so the
+ * SIMD ones can be checked against them.
+ */
+#if !defined(APP_MATH_SCALAR)
+	#if defined(__AVX2__)
+		#define MATH_HAS_AVX2
+	#endif
+	#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		#define MATH_HAS_SSE
+		#include <emmintrin.h>
+	#endif
+	#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+		#define MATH_HAS_NEON
+		#include <arm_neon.h>
+	#endif
+#endif
+
+namespace math {
+
+constexpr float kPi = 3.14159265358979323846f;
+
+struct Vec3
+{
+	float x, y, z;
+};
+
+struct alignas(16) Vec4
+{
+	float x, y, z, w;
+};
+
+struct Quat
+{
+	float x, y, z, w;
+};
+
+struct alignas(16) Mat4
+{
+	Vec4 cols[4];
+};
+static_assert(sizeof(Mat4) == 16 * sizeof(float), "Mat4 must match the std140 layout of mat4x4f");
+
+// Name of the backend selected for this build
+constexpr const char* kBackendName =
+#if defined(MATH_HAS_AVX2)
+	"avx2";
+#elif defined(MATH_HAS_SSE)
+	"sse";
+#elif defined(MATH_HAS_NEON)
+	"neon";
+#else
+	"scalar";
+#endif
+
+inline Vec3 operator+(const Vec3& a, const Vec3& b) { return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+inline Vec3 operator-(const Vec3& a, const Vec3& b) { return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+inline Vec3 operator-(const Vec3& a) { return {-a.x, -a.y, -a.z}; }
+inline Vec3 operator*(const Vec3& a, float s) { return {a.x * s, a.y * s, a.z * s}; }
+inline Vec3 operator*(const Vec3& a, const Vec3& b) { return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+
+inline float Dot(const Vec3& a, const Vec3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3 Cross(const Vec3& a, const Vec3& b) { return {a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x}; }
+inline float Length(const Vec3& a) { return std::sqrt(Dot(a, a)); }
+
+inline Vec3 Normalize(const Vec3& a)
+{
+	const float length = Length(a);
+	return length > 0 ? a * (1.0f / length) : a;
+}
+
+inline Quat QuatIdentity() { return {0, 0, 0, 1}; }
+
+// Rotation of angle radians around a unit axis
+inline Quat QuatFromAxisAngle(const Vec3& axis, float angle)
+{
+	const float s = std::sin(angle * 0.5f);
+	return {axis.x * s, axis.y * s, axis.z * s, std::cos(angle * 0.5f)};
+}
+
+// Applies b first, then a
+inline Quat operator*(const Quat& a, const Quat& b)
+{
+	return {
+		a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+		a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+		a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+		a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z
+	};
+}
+
+inline Quat Normalize(const Quat& q)
+{
+	const float length = std::sqrt(q.x * q.x + q.y * q.y + q.z * q.z + q.w * q.w);
+	const float inv = length > 0 ? 1.0f / length : 0.0f;
+	return {q.x * inv, q.y * inv, q.z * inv, q.w * inv};
+}
+
+inline Vec3 Rotate(const Quat& q, const Vec3& v)
+{
+	// v + 2w(u x v) + 2u x (u x v), with u the vector part
+	const Vec3 u{q.x, q.y, q.z};
+	const Vec3 t = Cross(u, v) * 2.0f;
+	return v + t * q.w + Cross(u, t);
+}
+
+inline Mat4 Identity()
+{
+	return {{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}}};
+}
+
+inline Mat4 Translation(const Vec3& t)
+{
+	return {{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {t.x, t.y, t.z, 1}}};
+}
+
+inline Mat4 Scale(const Vec3& s)
+{
+	return {{{s.x, 0, 0, 0}, {0, s.y, 0, 0}, {0, 0, s.z, 0}, {0, 0, 0, 1}}};
+}
+
+// q must be normalized
+inline Mat4 Rotation(const Quat& q)
+{
+	const float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	const float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	const float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+	return {{
+		{1 - 2 * (yy + zz), 2 * (xy + wz), 2 * (xz - wy), 0},
+		{2 * (xy - wz), 1 - 2 * (xx + zz), 2 * (yz + wx), 0},
+		{2 * (xz + wy), 2 * (yz - wx), 1 - 2 * (xx + yy), 0},
+		{0, 0, 0, 1}
+	}};
+}
+
+// Translation * Rotation * Scale without the full matrix products
+inline Mat4 Trs(const Vec3& t, const Quat& r, const Vec3& s)
+{
+	Mat4 m = Rotation(r);
+	m.cols[0] = {m.cols[0].x * s.x, m.cols[0].y * s.x, m.cols[0].z * s.x, 0};
+	m.cols[1] = {m.cols[1].x * s.y, m.cols[1].y * s.y, m.cols[1].z * s.y, 0};
+	m.cols[2] = {m.cols[2].x * s.z, m.cols[2].y * s.z, m.cols[2].z * s.z, 0};
+	m.cols[3] = {t.x, t.y, t.z, 1};
+	return m;
+}
+
+// Right handed, maps depth to WebGPU's [0, 1] clip range
+inline Mat4 Perspective(float fovY, float aspect, float zNear, float zFar)
+{
+	const float f = 1.0f / std::tan(fovY * 0.5f);
+	const float range = zNear - zFar;
+	return {{
+		{f / aspect, 0, 0, 0},
+		{0, f, 0, 0},
+		{0, 0, zFar / range, -1},
+		{0, 0, zNear * zFar / range, 0}
+	}};
+}
+
+inline Mat4 LookAt(const Vec3& eye, const Vec3& target, const Vec3& up)
+{
+	const Vec3 f = Normalize(target - eye);
+	const Vec3 s = Normalize(Cross(f, up));
+	const Vec3 u = Cross(s, f);
+	return {{
+		{s.x, u.x, -f.x, 0},
+		{s.y, u.y, -f.y, 0},
+		{s.z, u.z, -f.z, 0},
+		{-Dot(s, eye), -Dot(u, eye), Dot(f, eye), 1}
+	}};
+}
+
+inline Mat4 Transpose(const Mat4& m)
+{
+	const Vec4 *c = m.cols;
+	return {{
+		{c[0].x, c[1].x, c[2].x, c[3].x},
+		{c[0].y, c[1].y, c[2].y, c[3].y},
+		{c[0].z, c[1].z, c[2].z, c[3].z},
+		{c[0].w, c[1].w, c[2].w, c[3].w}
+	}};
+}
+
+// Inverse of a matrix whose last row is (0, 0, 0, 1)
+Mat4 InverseAffine(const Mat4& m);
+
+inline Vec4 operator*(const Mat4& m, const Vec4& v)
+{
+#if defined(MATH_HAS_SSE)
+	__m128 r = _mm_mul_ps(_mm_load_ps(&m.cols[0].x), _mm_set1_ps(v.x));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.cols[1].x), _mm_set1_ps(v.y)));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.cols[2].x), _mm_set1_ps(v.z)));
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(&m.cols[3].x), _mm_set1_ps(v.w)));
+	Vec4 out;
+	_mm_store_ps(&out.x, r);
+	return out;
+#elif defined(MATH_HAS_NEON)
+	float32x4_t r = vmulq_n_f32(vld1q_f32(&m.cols[0].x), v.x);
+	r = vmlaq_n_f32(r, vld1q_f32(&m.cols[1].x), v.y);
+	r = vmlaq_n_f32(r, vld1q_f32(&m.cols[2].x), v.z);
+	r = vmlaq_n_f32(r, vld1q_f32(&m.cols[3].x), v.w);
+	Vec4 out;
+	vst1q_f32(&out.x, r);
+	return out;
+#else
+	const Vec4 *c = m.cols;
+	return {
+		c[0].x * v.x + c[1].x * v.y + c[2].x * v.z + c[3].x * v.w,
+		c[0].y * v.x + c[1].y * v.y + c[2].y * v.z + c[3].y * v.w,
+		c[0].z * v.x + c[1].z * v.y + c[2].z * v.z + c[3].z * v.w,
+		c[0].w * v.x + c[1].w * v.y + c[2].w * v.z + c[3].w * v.w
+	};
+#endif
+}
+
+inline Mat4 operator*(const Mat4& a, const Mat4& b)
+{
+	// Each column of the product is a times the matching column of b
+	Mat4 out;
+	for (int i = 0; i < 4; ++i)
+		out.cols[i] = a * b.cols[i];
+	return out;
+}
+
+inline Vec3 TransformPoint(const Mat4& m, const Vec3& p)
+{
+	const Vec4 r = m * Vec4{p.x, p.y, p.z, 1.0f};
+	return {r.x, r.y, r.z};
+}
+
+/*
+ * Batch transforms over structure of arrays data.
+ *
+ * Each component lives in its own array so every SIMD lane handles one element. Arrays need no
+ * particular alignment, but 16 (SSE, NEON) or 32 (AVX2) byte aligned arrays load fastest.
+ */
+struct Float3Soa
+{
+	float* x;
+	float* y;
+	float* z;
+};
+
+struct ConstFloat3Soa
+{
+	const float* x;
+	const float* y;
+	const float* z;
+};
+
+// out[i] = m * (in[i], 1). out may alias in.
+void TransformPoints(const Mat4& m, ConstFloat3Soa in, Float3Soa out, size_t count);
+
+/*
+ * Transform axis aligned boxes given as center and half extents, producing the boxes enclosing the
+ * transformed ones. Outputs may alias the inputs.
+ */
+void TransformBounds(const Mat4& m, ConstFloat3Soa centers, ConstFloat3Soa extents, Float3Soa outCenters, Float3Soa outExtents, size_t count);
+
+// out[i] = a[i] * b[i], eg. parent world times local transforms. out may alias a or b.
+void MultiplyMat4(const Mat4* a, const Mat4* b, Mat4* out, size_t count);
+
+// One set of batch functions, used to compare the backends compiled into this build
+struct BatchBackend
+{
+	const char* name;
+	void (*transformPoints)(const Mat4&, ConstFloat3Soa, Float3Soa, size_t);
+	void (*transformBounds)(const Mat4&, ConstFloat3Soa, ConstFloat3Soa, Float3Soa, Float3Soa, size_t);
+	void (*multiplyMat4)(const Mat4*, const Mat4*, Mat4*, size_t);
+};
+
+// The scalar reference comes first and the backend selected for this build last
+const BatchBackend* GetBatchBackends(size_t& count);
+
+} // namespace math
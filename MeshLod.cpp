@@ -0,0 +1,733 @@
+#include "MeshLod.hpp"
+#include "Compute.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+
+// Collapses may turn the normal of a triangle by at most about 75 degrees
+constexpr float kMinNormalCos = 0.25f;
+
+// Sum of area weighted squared distances to planes, the symmetric 4x4 matrix of (a, b, c, d) products
+struct Quadric
+{
+	double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+	double weight;
+};
+
+Quadric PlaneQuadric(const math::Vec3& normal, float d, double weight)
+{
+	const double a = normal.x, b = normal.y, c = normal.z;
+	return {weight * a * a, weight * a * b, weight * a * c, weight * a * d, weight * b * b, weight * b * c, weight * b * d,
+		weight * c * c, weight * c * d, weight * d * d, weight};
+}
+
+void Add(Quadric& q, const Quadric& other)
+{
+	q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+	q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+	q.c2 += other.c2; q.cd += other.cd;
+	q.d2 += other.d2;
+	q.weight += other.weight;
+}
+
+// Mean squared distance of p to the planes of q
+double Cost(const Quadric& q, const math::Vec3& p)
+{
+	const double x = p.x, y = p.y, z = p.z;
+	const double sum = q.a2 * x * x + q.b2 * y * y + q.c2 * z * z + q.d2
+		+ 2.0 * (q.ab * x * y + q.ac * x * z + q.ad * x + q.bc * y * z + q.bd * y + q.cd * z);
+	return std::max(sum, 0.0) / std::max(q.weight, 1e-30);
+}
+
+math::Vec3 Position(const float* vertices, size_t stride, uint32_t vertex)
+{
+	const float *p = vertices + stride * vertex;
+	return {p[0], p[1], p[2]};
+}
+
+math::Vec3 TriangleNormal(const math::Vec3& p0, const math::Vec3& p1, const math::Vec3& p2)
+{
+	return math::Cross(p1 - p0, p2 - p0);
+}
+
+uint64_t EdgeKey(uint32_t a, uint32_t b)
+{
+	return a < b ? (uint64_t{a} << 32) | b : (uint64_t{b} << 32) | a;
+}
+
+struct Collapse
+{
+	uint32_t from;
+	uint32_t to;
+	double cost;
+};
+
+} // anonymous namespace
+
+float MeshLod::Simplify(const float* vertices, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+	size_t targetIndexCount, std::vector<uint32_t>& out)
+{
+	TRACE_SCOPE("SimplifyMesh");
+
+	std::vector<uint32_t> triangles(indices, indices + indexCount - indexCount % 3);
+	const size_t triangleCount = triangles.size() / 3;
+
+	// Edges not shared by exactly two triangles are borders (or worse), their vertices stay
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	edgeUses.reserve(triangles.size());
+	for (size_t t = 0; t < triangleCount; ++t)
+		for (uint32_t e = 0; e < 3; ++e)
+			++edgeUses[EdgeKey(triangles[3 * t + e], triangles[3 * t + (e + 1) % 3])];
+	std::vector<uint8_t> locked(vertexCount, 0);
+	for (const auto &[key, uses] : edgeUses)
+	{
+		if (uses != 2)
+			locked[key >> 32] = locked[key & 0xffffffffu] = 1;
+	}
+
+	// Area weighted vertex normals of the mesh, which triangles must still face after any number of
+	// collapses. Unlike the normals of single triangles they hold up for slivers, such as at poles.
+	std::vector<math::Vec3> normals(vertexCount, math::Vec3{0.0f, 0.0f, 0.0f});
+	std::vector<Quadric> quadrics(vertexCount, Quadric{});
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		const uint32_t *v = &triangles[3 * t];
+		const math::Vec3 p0 = Position(vertices, stride, v[0]);
+		const math::Vec3 normal = TriangleNormal(p0, Position(vertices, stride, v[1]), Position(vertices, stride, v[2]));
+		for (uint32_t i = 0; i < 3; ++i)
+			normals[v[i]] = normals[v[i]] + normal;
+		const float length = math::Length(normal);
+		if (length <= 0.0f)
+			continue;
+
+		const math::Vec3 unit = normal * (1.0f / length);
+		const Quadric q = PlaneQuadric(unit, -math::Dot(unit, p0), 0.5 * length);
+		for (uint32_t i = 0; i < 3; ++i)
+			Add(quadrics[v[i]], q);
+	}
+
+	std::vector<uint8_t> alive(triangleCount, 1);
+	size_t liveIndices = triangles.size();
+	double maxCost = 0.0;
+
+	std::vector<uint32_t> adjacencyOffsets;
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<uint8_t> touched;
+
+	// Each pass collapses the cheapest edges around which no other collapse of the pass changed a
+	// triangle, so every collapse is checked against the triangles it actually changes
+	while (liveIndices > targetIndexCount)
+	{
+		// Triangles around each vertex
+		adjacencyOffsets.assign(vertexCount + 1, 0);
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			if (alive[t])
+				for (uint32_t i = 0; i < 3; ++i)
+					++adjacencyOffsets[triangles[3 * t + i] + 1];
+		}
+		std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+		adjacency.resize(adjacencyOffsets.back());
+		std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			if (alive[t])
+				for (uint32_t i = 0; i < 3; ++i)
+					adjacency[fill[triangles[3 * t + i]]++] = static_cast<uint32_t>(t);
+		}
+
+		// Interior edges are seen from both their triangles, once in each direction
+		collapses.clear();
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			if (!alive[t])
+				continue;
+			for (uint32_t e = 0; e < 3; ++e)
+			{
+				const uint32_t a = triangles[3 * t + e];
+				const uint32_t b = triangles[3 * t + (e + 1) % 3];
+				if (a > b)
+					continue;
+
+				Quadric q = quadrics[a];
+				Add(q, quadrics[b]);
+				if (!locked[a])
+					collapses.push_back({a, b, Cost(q, Position(vertices, stride, b))});
+				if (!locked[b])
+					collapses.push_back({b, a, Cost(q, Position(vertices, stride, a))});
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+		touched.assign(vertexCount, 0);
+		const size_t needed = liveIndices - targetIndexCount;
+		size_t removed = 0;
+		for (const Collapse &collapse : collapses)
+		{
+			if (removed >= needed)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			// Triangles keeping their area must neither turn sharply nor face away from where they did in the mesh
+			bool flips = false;
+			for (uint32_t i = adjacencyOffsets[collapse.from]; i < adjacencyOffsets[collapse.from + 1] && !flips; ++i)
+			{
+				const uint32_t *v = &triangles[3 * adjacency[i]];
+				if (!alive[adjacency[i]] || v[0] == collapse.to || v[1] == collapse.to || v[2] == collapse.to)
+					continue;
+
+				std::array<math::Vec3, 3> p;
+				for (uint32_t k = 0; k < 3; ++k)
+					p[k] = Position(vertices, stride, v[k]);
+				const math::Vec3 before = TriangleNormal(p[0], p[1], p[2]);
+				math::Vec3 facing = {0.0f, 0.0f, 0.0f};
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					const uint32_t vertex = v[k] == collapse.from ? collapse.to : v[k];
+					p[k] = Position(vertices, stride, vertex);
+					facing = facing + normals[vertex];
+				}
+				const math::Vec3 after = TriangleNormal(p[0], p[1], p[2]);
+				flips = math::Dot(before, after) <= kMinNormalCos * math::Length(before) * math::Length(after)
+					|| math::Dot(facing, after) <= 0.0f;
+			}
+			if (flips)
+				continue;
+
+			for (uint32_t i = adjacencyOffsets[collapse.from]; i < adjacencyOffsets[collapse.from + 1]; ++i)
+			{
+				const uint32_t t = adjacency[i];
+				uint32_t *v = &triangles[3 * t];
+				if (!alive[t])
+					continue;
+				for (uint32_t k = 0; k < 3; ++k)
+					touched[v[k]] = 1;
+				if (v[0] == collapse.to || v[1] == collapse.to || v[2] == collapse.to)
+				{
+					alive[t] = 0;
+					removed += 3;
+					continue;
+				}
+				for (uint32_t k = 0; k < 3; ++k)
+				{
+					if (v[k] == collapse.from)
+						v[k] = collapse.to;
+				}
+			}
+			Add(quadrics[collapse.to], quadrics[collapse.from]);
+			maxCost = std::max(maxCost, collapse.cost);
+		}
+
+		if (removed == 0)
+			break;
+		liveIndices -= removed;
+	}
+
+	out.clear();
+	out.reserve(liveIndices);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		if (alive[t])
+			out.insert(out.end(), &triangles[3 * t], &triangles[3 * t] + 3);
+	}
+	return static_cast<float>(std::sqrt(maxCost));
+}
+
+std::vector<MeshLod::Level> MeshLod::Generate(const float* vertices, size_t stride, size_t vertexCount, const uint32_t* meshIndices,
+	uint32_t meshIndexCount, std::vector<uint32_t>& indices)
+{
+	TRACE_SCOPE("GenerateLods");
+
+	std::vector<Level> levels;
+	levels.push_back({static_cast<uint32_t>(indices.size()), meshIndexCount, 0.0f});
+	indices.insert(indices.end(), meshIndices, meshIndices + meshIndexCount);
+
+	// Each level is simplified from the mesh itself, so its error is measured against the mesh
+	std::vector<uint32_t> simplified;
+	while (levels.size() < kMaxLevels)
+	{
+		const Level &previous = levels.back();
+		const size_t target = static_cast<size_t>(previous.indexCount * kLevelReduction) / 3 * 3;
+		if (target == 0)
+			break;
+
+		const float error = Simplify(vertices, stride, vertexCount, meshIndices, meshIndexCount, target, simplified);
+		if (simplified.empty() || simplified.size() > previous.indexCount * kMinReduction)
+			break;
+
+		levels.push_back({static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(simplified.size()), std::max(error, previous.error)});
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+	}
+	return levels;
+}
+
+float MeshLod::PixelsPerUnit(const math::Mat4& viewProjection, const math::Mat4& world, const math::Vec3& point, float targetHeight)
+{
+	// Clip space y spans the height over [-w, w]. Its rate of change along the object's axes is the
+	// second row of the full transform, whose length holds any scale of the object.
+	const math::Mat4 transform = viewProjection * world;
+	const math::Vec3 row = {transform.cols[0].y, transform.cols[1].y, transform.cols[2].y};
+	const float w = (viewProjection * math::Vec4{point.x, point.y, point.z, 1.0f}).w;
+	if (w <= std::numeric_limits<float>::epsilon())
+		return std::numeric_limits<float>::max();
+	return 0.5f * targetHeight * math::Length(row) / w;
+}
+
+uint32_t MeshLod::Select(const Level* levels, uint32_t levelCount, float pixelsPerUnit, uint32_t current, float errorPixels, float hysteresis)
+{
+	if (levelCount == 0)
+		return 0;
+
+	// Finer as soon as the error shows, coarser only once the next level's is well below the threshold
+	uint32_t level = std::min(current, levelCount - 1);
+	while (level > 0 && levels[level].error * pixelsPerUnit > errorPixels)
+		--level;
+	while (level + 1 < levelCount && levels[level + 1].error * pixelsPerUnit <= errorPixels * (1.0f - hysteresis))
+		++level;
+	return level;
+}
+
+#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
+
+bool RunLodBenchmark(uint32_t)
+{
+	std::cerr << "The LOD benchmark needs a headless device, which the web does not have" << std::endl;
+	return false;
+}
+
+#else
+
+namespace {
+
+const char* kLodShader = R"(
+@group(0) @binding(0) var<uniform> viewProjection: mat4x4f;
+@group(0) @binding(1) var<storage, read> objects: array<vec4f>;  // Position and scale
+
+struct VertexOutput
+{
+	@builtin(position) position: vec4f,
+	@location(0) normal: vec3f,
+};
+
+@vertex
+fn vs_main(@location(0) position: vec3f, @location(1) normal: vec3f, @builtin(instance_index) instance: u32) -> VertexOutput
+{
+	let object = objects[instance];
+	var out: VertexOutput;
+	out.position = viewProjection * vec4f(object.xyz + position * object.w, 1.0);
+	out.normal = normal;
+	return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f
+{
+	let light = max(dot(normalize(in.normal), normalize(vec3f(0.4, 0.8, -0.3))), 0.0);
+	return vec4f(vec3f(0.1 + 0.9 * light), 1.0);
+})";
+
+// Position then normal
+constexpr size_t kVertexFloats = 6;
+
+// A closed sphere with bumps, so simplifying it costs more in some places than in others
+void CreateSphere(uint32_t rings, uint32_t segments, std::vector<float>& vertices, std::vector<uint32_t>& indices)
+{
+	constexpr float kPi = 3.14159265358979f;
+	auto addVertex = [&vertices](float theta, float phi) {
+		const float radius = 1.0f + 0.04f * std::sin(6.0f * theta) * std::sin(6.0f * phi);
+		const math::Vec3 normal = {std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+		const math::Vec3 position = normal * radius;
+		vertices.insert(vertices.end(), {position.x, position.y, position.z, normal.x, normal.y, normal.z});
+	};
+
+	vertices.clear();
+	indices.clear();
+	addVertex(0.0f, 0.0f);
+	for (uint32_t ring = 1; ring < rings; ++ring)
+		for (uint32_t segment = 0; segment < segments; ++segment)
+			addVertex(kPi * ring / rings, 2.0f * kPi * segment / segments);
+	addVertex(kPi, 0.0f);
+
+	// The poles are fans, the rings between them quads wrapping around without a seam
+	const uint32_t south = 1 + (rings - 1) * segments;
+	auto ringVertex = [segments](uint32_t ring, uint32_t segment) { return 1 + (ring - 1) * segments + segment % segments; };
+	for (uint32_t segment = 0; segment < segments; ++segment)
+	{
+		indices.insert(indices.end(), {0, ringVertex(1, segment + 1), ringVertex(1, segment)});
+		for (uint32_t ring = 1; ring + 1 < rings; ++ring)
+		{
+			const uint32_t a = ringVertex(ring, segment), b = ringVertex(ring, segment + 1);
+			const uint32_t c = ringVertex(ring + 1, segment), d = ringVertex(ring + 1, segment + 1);
+			indices.insert(indices.end(), {a, b, d, a, d, c});
+		}
+		indices.insert(indices.end(), {south, ringVertex(rings - 1, segment), ringVertex(rings - 1, segment + 1)});
+	}
+}
+
+// Drawing the levels instanced, each object's position and scale in the storage buffer
+struct LodRenderer
+{
+	WgpuShaderModulePtr shaderModule{nullptr, wgpuShaderModuleRelease};
+	WgpuBindGroupLayoutPtr bindGroupLayout{nullptr, wgpuBindGroupLayoutRelease};
+	WgpuPipelineLayoutPtr pipelineLayout{nullptr, wgpuPipelineLayoutRelease};
+	WgpuRenderPipelinePtr pipeline{nullptr, wgpuRenderPipelineRelease};
+	WgpuBindGroupPtr bindGroup{nullptr, wgpuBindGroupRelease};
+};
+
+bool CreateRenderer(WGPUDevice device, WGPUBuffer uniforms, WGPUBuffer objects, WGPUTextureFormat colorFormat, WGPUTextureFormat depthFormat,
+	LodRenderer& renderer)
+{
+	renderer.shaderModule = WgpuShaderModulePtr(wgpuUtils::createShaderModule(device, kLodShader), wgpuShaderModuleRelease);
+
+	std::array<WGPUBindGroupLayoutEntry, 2> layoutEntries;
+	layoutEntries[0] = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	layoutEntries[0].binding = 0;
+	layoutEntries[0].visibility = WGPUShaderStage_Vertex;
+	layoutEntries[0].buffer.type = WGPUBufferBindingType_Uniform;
+	layoutEntries[0].buffer.minBindingSize = sizeof(math::Mat4);
+	layoutEntries[1] = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	layoutEntries[1].binding = 1;
+	layoutEntries[1].visibility = WGPUShaderStage_Vertex;
+	layoutEntries[1].buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = layoutEntries.size();
+	bindGroupLayoutDesc.entries = layoutEntries.data();
+	WGPUBindGroupLayout bindGroupLayout = wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDesc);
+	renderer.bindGroupLayout = WgpuBindGroupLayoutPtr(bindGroupLayout, wgpuBindGroupLayoutRelease);
+
+	WGPUPipelineLayoutDescriptor pipelineLayoutDesc{};
+	pipelineLayoutDesc.bindGroupLayoutCount = 1;
+	pipelineLayoutDesc.bindGroupLayouts = &bindGroupLayout;
+	renderer.pipelineLayout = WgpuPipelineLayoutPtr(wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDesc), wgpuPipelineLayoutRelease);
+
+	std::array<WGPUVertexAttribute, 2> attributes{};
+	for (uint32_t i = 0; i < attributes.size(); ++i)
+	{
+		attributes[i].format = WGPUVertexFormat_Float32x3;
+		attributes[i].offset = 3 * sizeof(float) * i;
+		attributes[i].shaderLocation = i;
+	}
+
+	WGPUVertexBufferLayout vertexLayout{};
+	vertexLayout.attributeCount = attributes.size();
+	vertexLayout.attributes = attributes.data();
+	vertexLayout.arrayStride = kVertexFloats * sizeof(float);
+	vertexLayout.stepMode = WGPUVertexStepMode_Vertex;
+
+	WGPURenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = renderer.pipelineLayout.get();
+	pipelineDesc.vertex.module = renderer.shaderModule.get();
+	pipelineDesc.vertex.entryPoint = wgpuUtils::label("vs_main");
+	pipelineDesc.vertex.bufferCount = 1;
+	pipelineDesc.vertex.buffers = &vertexLayout;
+	pipelineDesc.primitive.topology = WGPUPrimitiveTopology_TriangleList;
+	pipelineDesc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
+	pipelineDesc.primitive.frontFace = WGPUFrontFace_CCW;
+	pipelineDesc.primitive.cullMode = WGPUCullMode_Back;
+
+	WGPUDepthStencilState depthStencil{};
+	depthStencil.format = depthFormat;
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	depthStencil.depthWriteEnabled = WGPUOptionalBool_True;
+#else
+	depthStencil.depthWriteEnabled = true;
+#endif
+	depthStencil.depthCompare = WGPUCompareFunction_Less;
+	depthStencil.stencilFront.compare = WGPUCompareFunction_Always;
+	depthStencil.stencilFront.failOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.depthFailOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.passOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilBack = depthStencil.stencilFront;
+	depthStencil.stencilReadMask = 0;
+	depthStencil.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencil;
+
+	WGPUColorTargetState colorTarget{};
+	colorTarget.format = colorFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = WGPUColorWriteMask_All;
+
+	WGPUFragmentState fragment{};
+	fragment.module = renderer.shaderModule.get();
+	fragment.entryPoint = wgpuUtils::label("fs_main");
+	fragment.targetCount = 1;
+	fragment.targets = &colorTarget;
+	pipelineDesc.fragment = &fragment;
+
+	pipelineDesc.multisample.count = 1;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+	renderer.pipeline = WgpuRenderPipelinePtr(wgpuDeviceCreateRenderPipeline(device, &pipelineDesc), wgpuRenderPipelineRelease);
+
+	std::array<WGPUBindGroupEntry, 2> entries{};
+	entries[0].binding = 0;
+	entries[0].buffer = uniforms;
+	entries[0].size = wgpuBufferGetSize(uniforms);
+	entries[1].binding = 1;
+	entries[1].buffer = objects;
+	entries[1].size = wgpuBufferGetSize(objects);
+
+	WGPUBindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = entries.size();
+	bindGroupDesc.entries = entries.data();
+	renderer.bindGroup = WgpuBindGroupPtr(wgpuDeviceCreateBindGroup(device, &bindGroupDesc), wgpuBindGroupRelease);
+
+	return renderer.pipeline && renderer.bindGroup;
+}
+
+// Instances of one level, consecutive in the objects buffer
+struct LevelDraw
+{
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+};
+
+void RenderFrame(ComputeContext& context, const LodRenderer& renderer, const ComputeContext::OffscreenTarget& color, const ComputeContext::OffscreenTarget& depth,
+	WGPUBuffer vertices, WGPUBuffer indices, const std::vector<MeshLod::Level>& levels, const std::vector<LevelDraw>& draws)
+{
+	WgpuCommandEncoderPtr encoder(wgpuDeviceCreateCommandEncoder(context.Device(), nullptr), wgpuCommandEncoderRelease);
+
+	WGPURenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = color.view.get();
+	colorAttachment.loadOp = WGPULoadOp_Clear;
+	colorAttachment.storeOp = WGPUStoreOp_Store;
+	colorAttachment.clearValue = WGPUColor{0.1, 0.2, 0.3, 1};
+#if !defined(WEBGPU_BACKEND_WGPU)
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif
+	WGPURenderPassDepthStencilAttachment depthAttachment{};
+	depthAttachment.view = depth.view.get();
+	depthAttachment.depthLoadOp = WGPULoadOp_Clear;
+	depthAttachment.depthStoreOp = WGPUStoreOp_Discard;
+	depthAttachment.depthClearValue = 1.0f;
+
+	WGPURenderPassDescriptor passDesc{};
+	passDesc.colorAttachmentCount = 1;
+	passDesc.colorAttachments = &colorAttachment;
+	passDesc.depthStencilAttachment = &depthAttachment;
+
+	WgpuRenderPassEncoderPtr pass(wgpuCommandEncoderBeginRenderPass(encoder.get(), &passDesc), wgpuRenderPassEncoderRelease);
+	wgpuRenderPassEncoderSetPipeline(pass.get(), renderer.pipeline.get());
+	wgpuRenderPassEncoderSetBindGroup(pass.get(), 0, renderer.bindGroup.get(), 0, nullptr);
+	wgpuRenderPassEncoderSetVertexBuffer(pass.get(), 0, vertices, 0, wgpuBufferGetSize(vertices));
+	wgpuRenderPassEncoderSetIndexBuffer(pass.get(), indices, WGPUIndexFormat_Uint32, 0, wgpuBufferGetSize(indices));
+	for (size_t i = 0; i < draws.size(); ++i)
+	{
+		if (draws[i].instanceCount > 0)
+			wgpuRenderPassEncoderDrawIndexed(pass.get(), levels[i].indexCount, draws[i].instanceCount, levels[i].firstIndex, 0, draws[i].firstInstance);
+	}
+	wgpuRenderPassEncoderEnd(pass.get());
+
+	WgpuCommandBufferPtr commands(wgpuCommandEncoderFinish(encoder.get(), nullptr), wgpuCommandBufferRelease);
+	WGPUCommandBuffer buffer = commands.get();
+	wgpuQueueSubmit(context.Queue(), 1, &buffer);
+}
+
+bool CheckLevels(const std::vector<MeshLod::Level>& levels, const std::vector<uint32_t>& indices, const std::vector<float>& vertices)
+{
+	const size_t vertexCount = vertices.size() / kVertexFloats;
+	bool ok = levels.size() >= 4 && levels[0].error == 0.0f;
+	for (size_t i = 1; i < levels.size(); ++i)
+		ok = ok && levels[i].indexCount < levels[i - 1].indexCount && levels[i].error >= levels[i - 1].error
+			&& levels[i].firstIndex == levels[i - 1].firstIndex + levels[i - 1].indexCount;
+	for (uint32_t index : indices)
+		ok = ok && index < vertexCount;
+	if (!ok)
+		return false;
+
+	// No level turns a triangle over, facing away from the area weighted normals level 0 has at its corners
+	auto triangleNormal = [&](const uint32_t* v) {
+		return TriangleNormal(Position(vertices.data(), kVertexFloats, v[0]), Position(vertices.data(), kVertexFloats, v[1]),
+			Position(vertices.data(), kVertexFloats, v[2]));
+	};
+	std::vector<math::Vec3> normals(vertexCount, math::Vec3{0.0f, 0.0f, 0.0f});
+	for (uint32_t i = 0; i + 2 < levels[0].indexCount; i += 3)
+	{
+		const uint32_t *v = &indices[levels[0].firstIndex + i];
+		const math::Vec3 normal = triangleNormal(v);
+		for (uint32_t k = 0; k < 3; ++k)
+			normals[v[k]] = normals[v[k]] + normal;
+	}
+	for (const MeshLod::Level &level : levels)
+	{
+		for (uint32_t i = 0; i + 2 < level.indexCount; i += 3)
+		{
+			const uint32_t *v = &indices[level.firstIndex + i];
+			ok = ok && math::Dot(triangleNormal(v), normals[v[0]] + normals[v[1]] + normals[v[2]]) > 0.0f;
+		}
+	}
+
+	// Far enough for any error, close enough for none, and held within the hysteresis band
+	const uint32_t count = static_cast<uint32_t>(levels.size());
+	const float threshold = MeshLod::kErrorPixels;
+	ok = ok && MeshLod::Select(levels.data(), count, 1e-6f, 0) == count - 1
+		&& MeshLod::Select(levels.data(), count, 1e9f, count - 1) == 0;
+	if (count > 1)
+	{
+		const float switchPixelsPerUnit = threshold / levels[1].error;
+		const float bandPixelsPerUnit = switchPixelsPerUnit * (1.0f - 0.5f * MeshLod::kHysteresis);
+		ok = ok && MeshLod::Select(levels.data(), count, bandPixelsPerUnit, 0) == 0
+			&& MeshLod::Select(levels.data(), count, bandPixelsPerUnit, 1) == 1
+			&& MeshLod::Select(levels.data(), count, switchPixelsPerUnit * 1.01f, 1) == 0;
+	}
+	return ok;
+}
+
+} // anonymous namespace
+
+bool RunLodBenchmark(uint32_t maxObjects)
+{
+	using Clock = std::chrono::steady_clock;
+	constexpr uint32_t kWidth = 1920;
+	constexpr uint32_t kHeight = 1080;
+	constexpr uint32_t kWarmupFrames = 3;
+	constexpr uint32_t kFrames = 20;
+	constexpr uint32_t kMinObjects = 256;
+	constexpr float kSpacing = 3.0f;
+	constexpr WGPUTextureFormat kColorFormat = WGPUTextureFormat_RGBA8Unorm;
+	constexpr WGPUTextureFormat kDepthFormat = WGPUTextureFormat_Depth24Plus;
+	auto milliseconds = [](Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+
+	std::vector<float> vertices;
+	std::vector<uint32_t> sphereIndices;
+	CreateSphere(64, 128, vertices, sphereIndices);
+	const size_t vertexCount = vertices.size() / kVertexFloats;
+
+	const Clock::time_point generateStart = Clock::now();
+	std::vector<uint32_t> indices;
+	const std::vector<MeshLod::Level> levels = MeshLod::Generate(vertices.data(), kVertexFloats, vertexCount, sphereIndices.data(),
+		static_cast<uint32_t>(sphereIndices.size()), indices);
+	const double generateMs = milliseconds(Clock::now() - generateStart);
+	bool ok = CheckLevels(levels, indices, vertices);
+
+	std::cout << "LOD benchmark: " << kWidth << "x" << kHeight << ", average of " << kFrames << " frames" << std::endl;
+	std::cout << "  check: " << (ok ? "passed" : "FAILED") << ", " << levels.size() << " levels generated in " << std::fixed
+		<< std::setprecision(1) << generateMs << " ms" << std::endl;
+	for (size_t i = 0; i < levels.size(); ++i)
+		std::cout << "  level " << i << ": " << levels[i].indexCount / 3 << " triangles, error " << std::setprecision(5) << levels[i].error << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+
+	ComputeContext context;
+	if (!context.IsInitialized())
+		return false;
+
+	maxObjects = std::max(maxObjects, kMinObjects);
+	WgpuBufferPtr vertexBuffer = context.CreateBuffer(vertices.size() * sizeof(float), WGPUBufferUsage_Vertex | WGPUBufferUsage_CopyDst, "LOD vertices");
+	WgpuBufferPtr indexBuffer = context.CreateBuffer(indices.size() * sizeof(uint32_t), WGPUBufferUsage_Index | WGPUBufferUsage_CopyDst, "LOD indices");
+	WgpuBufferPtr uniformBuffer = context.CreateBuffer(sizeof(math::Mat4), WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst, "LOD view projection");
+	WgpuBufferPtr objectBuffer = context.CreateBuffer(uint64_t{maxObjects} * sizeof(math::Vec4), WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst, "LOD objects");
+	ComputeContext::OffscreenTarget color = context.CreateOffscreenTarget(kWidth, kHeight, kColorFormat);
+	ComputeContext::OffscreenTarget depth = context.CreateOffscreenTarget(kWidth, kHeight, kDepthFormat);
+	LodRenderer renderer;
+	if (!vertexBuffer || !indexBuffer || !uniformBuffer || !objectBuffer || !color.view || !depth.view
+		|| !CreateRenderer(context.Device(), uniformBuffer.get(), objectBuffer.get(), kColorFormat, kDepthFormat, renderer))
+	{
+		std::cerr << "Could not create the LOD benchmark resources" << std::endl;
+		return false;
+	}
+	context.WriteBuffer(vertexBuffer.get(), 0, vertices.data(), vertices.size() * sizeof(float));
+	context.WriteBuffer(indexBuffer.get(), 0, indices.data(), indices.size() * sizeof(uint32_t));
+
+	std::cout << std::fixed;
+	for (uint32_t objectCount = kMinObjects; objectCount <= maxObjects; objectCount *= 4)
+	{
+		// A square grid on the ground, seen from above one edge so most of it is far away
+		const uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(objectCount))));
+		const float extent = side * kSpacing;
+		std::vector<math::Vec3> positions(objectCount);
+		for (uint32_t i = 0; i < objectCount; ++i)
+			positions[i] = {(i % side + 0.5f) * kSpacing - 0.5f * extent, 1.0f, (i / side + 0.5f) * kSpacing};
+
+		const math::Vec3 eye = {0.0f, 6.0f, -4.0f};
+		const math::Mat4 viewProjection = math::Perspective(1.0f, static_cast<float>(kWidth) / kHeight, 0.1f, 2.0f * extent + 10.0f)
+			* math::LookAt(eye, {0.0f, 0.0f, 0.25f * extent}, {0.0f, 1.0f, 0.0f});
+		context.WriteBuffer(uniformBuffer.get(), 0, &viewProjection, sizeof(viewProjection));
+
+		std::cout << "  " << objectCount << " objects:" << std::endl;
+		double fullFrameMs = 0.0;
+		for (bool selectLevels : {false, true})
+		{
+			std::vector<uint32_t> objectLevels(objectCount, 0);
+			std::vector<math::Vec4> objects(objectCount);
+			std::vector<LevelDraw> draws(levels.size());
+			double selectMs = 0.0, frameMs = 0.0;
+			uint64_t triangles = 0;
+			for (uint32_t frame = 0; frame < kWarmupFrames + kFrames; ++frame)
+			{
+				const Clock::time_point start = Clock::now();
+
+				// Objects sorted by level, so each level is one instanced draw
+				std::fill(draws.begin(), draws.end(), LevelDraw{0, 0});
+				for (uint32_t i = 0; i < objectCount; ++i)
+				{
+					if (selectLevels)
+					{
+						const math::Mat4 world = math::Translation(positions[i]);
+						const float pixelsPerUnit = MeshLod::PixelsPerUnit(viewProjection, world, positions[i], kHeight);
+						objectLevels[i] = MeshLod::Select(levels.data(), static_cast<uint32_t>(levels.size()), pixelsPerUnit, objectLevels[i]);
+					}
+					++draws[objectLevels[i]].instanceCount;
+				}
+				uint64_t frameTriangles = 0;
+				for (size_t level = 0, first = 0; level < draws.size(); ++level)
+				{
+					draws[level].firstInstance = static_cast<uint32_t>(first);
+					first += draws[level].instanceCount;
+					frameTriangles += uint64_t{draws[level].instanceCount} * levels[level].indexCount / 3;
+				}
+				std::vector<LevelDraw> fill = draws;
+				for (uint32_t i = 0; i < objectCount; ++i)
+					objects[fill[objectLevels[i]].firstInstance++] = {positions[i].x, positions[i].y, positions[i].z, 1.0f};
+				const Clock::time_point selected = Clock::now();
+
+				context.WriteBuffer(objectBuffer.get(), 0, objects.data(), objects.size() * sizeof(math::Vec4));
+				RenderFrame(context, renderer, color, depth, vertexBuffer.get(), indexBuffer.get(), levels, draws);
+				context.WaitForQueue();
+				const Clock::time_point done = Clock::now();
+
+				triangles = frameTriangles;
+				if (frame < kWarmupFrames)
+					continue;
+				selectMs += milliseconds(selected - start);
+				frameMs += milliseconds(done - start);
+			}
+			selectMs /= kFrames;
+			frameMs /= kFrames;
+			if (!selectLevels)
+				fullFrameMs = frameMs;
+
+			std::cout << std::setprecision(3) << "    " << (selectLevels ? "selected levels: " : "full detail:     ") << triangles << " triangles, frame "
+				<< frameMs << " ms (select " << selectMs << " ms), " << std::setprecision(1) << triangles / frameMs / 1000.0 << " million triangles per second";
+			if (selectLevels)
+				std::cout << ", " << fullFrameMs / frameMs << "x faster";
+			std::cout << std::endl;
+		}
+		if (objectCount > maxObjects / 4)
+			break;
+	}
+	std::cout.unsetf(std::ios::floatfield);
+
+	if (context.ErrorCount() > 0)
+	{
+		std::cout << "  GPU errors were reported" << std::endl;
+		ok = false;
+	}
+	return ok;
+}
+
+#endif  // WEBGPU_BACKEND_EMSCRIPTEN
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Math.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Levels of detail of indexed triangle meshes, and the choice of a level per object.
+ *
+ * Simplify() collapses edges in the order of their quadric error (Garland and Heckbert): each vertex
+ * sums the squared distances to the planes of its triangles, weighted by their area, and collapsing
+ * an edge costs what the quadrics of both ends measure at the vertex it collapses onto. A vertex only
+ * ever moves onto a neighbour, so every level indexes the vertices of the original mesh and the
+ * levels of a mesh share its vertex range. Vertices on open borders never move, which also keeps
+ * attribute seams (vertices sharing a position but not their other attributes) and unwelded meshes in
+ * place. Collapses turning a triangle sharply, or away from the mesh's vertex normals at its corners,
+ * are skipped, and so are collapses next to a triangle another collapse of the same pass changed.
+ *
+ * Select() picks the coarsest level whose error projects to at most a threshold of pixels. Switching to
+ * a coarser level waits until its error is a hysteresis fraction below the threshold, so objects
+ * hovering around a switching distance do not flicker between two levels.
+ */
+class MeshLod
+{
+public:
+	struct Level
+	{
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;  // Distance in the mesh's units the level may deviate from the mesh by, zero for the mesh
+	};
+
+	static constexpr uint32_t kMaxLevels = 8;
+	// Each level aims for this fraction of the previous one's triangles
+	static constexpr float kLevelReduction = 0.5f;
+	// Levels shrinking less than to this fraction of the previous one are not worth keeping
+	static constexpr float kMinReduction = 0.85f;
+	static constexpr float kErrorPixels = 1.0f;
+	static constexpr float kHysteresis = 0.25f;
+
+	/*
+	 * Collapse the triangles of indices until at most targetIndexCount indices remain or nothing more
+	 * can collapse, into out. Positions are the first 3 of the stride floats of each vertex. Returns
+	 * the error of the result.
+	 */
+	static float Simplify(const float* vertices, size_t stride, size_t vertexCount, const uint32_t* indices, size_t indexCount,
+		size_t targetIndexCount, std::vector<uint32_t>& out);
+
+	/*
+	 * Append the levels of the mesh to indices, the mesh itself then each simplified level, and
+	 * return them finest first. Errors never decrease from one level to the next.
+	 */
+	static std::vector<Level> Generate(const float* vertices, size_t stride, size_t vertexCount, const uint32_t* meshIndices,
+		uint32_t meshIndexCount, std::vector<uint32_t>& indices);
+
+	// Pixels one unit of the object's space covers on a target of the height, at a world space point of it
+	static float PixelsPerUnit(const math::Mat4& viewProjection, const math::Mat4& world, const math::Vec3& point, float targetHeight);
+
+	// Level to draw an object at, given the one it was drawn at last (0 when new)
+	static uint32_t Select(const Level* levels, uint32_t levelCount, float pixelsPerUnit, uint32_t current,
+		float errorPixels = kErrorPixels, float hysteresis = kHysteresis);
+};
+
+/*
+ * Generate the levels of a sphere of about 16k triangles, check them, then draw grids of objects of
+ * increasing sizes, up to maxObjects, receding from the camera on a headless device, with every object
+ * at full detail and with a level selected per object. Reports the triangles and time per frame of
+ * each. Returns false when a check fails or on a device error.
+ */
+bool RunLodBenchmark(uint32_t maxObjects);
@@ -0,0 +1,526 @@
+#include "Metrics.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#if !defined(__EMSCRIPTEN__)
+#define METRICS_UNIX_SOCKET
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#endif
+
+namespace {
+
+uint32_t MostSignificantBit(uint64_t value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return 63 - __builtin_clzll(value);
+#else
+	uint32_t msb = 0;
+	while (value >>= 1)
+		++msb;
+	return msb;
+#endif
+}
+
+#if defined(METRICS_UNIX_SOCKET)
+#if defined(MSG_NOSIGNAL)
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+// One request to the exporter's socket, the body of the response or empty on failure
+std::string Scrape(const std::string& socketPath)
+{
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	socketPath.copy(address.sun_path, sizeof(address.sun_path) - 1);
+
+	const int client = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (client < 0)
+		return {};
+	if (connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		close(client);
+		return {};
+	}
+
+	const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+	std::string response;
+	if (send(client, request.data(), request.size(), kSendFlags) == static_cast<ssize_t>(request.size()))
+	{
+		char buffer[4096];
+		ssize_t n = 0;
+		while ((n = read(client, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))
+			response.append(buffer, n > 0 ? static_cast<size_t>(n) : 0);
+	}
+	close(client);
+
+	const size_t headerEnd = response.find("\r\n\r\n");
+	if (response.rfind("HTTP/1.0 200 OK\r\n", 0) != 0 || headerEnd == std::string::npos)
+		return {};
+	return response.substr(headerEnd + 4);
+}
+#endif
+
+bool HasLine(const std::string& text, const std::string& line)
+{
+	return ("\n" + text).find("\n" + line + "\n") != std::string::npos;
+}
+
+/*
+ * The lines the check registered: counter 3, gauge -7, and 1, 5 and 1000 microseconds recorded into
+ * a histogram in seconds, whose buckets must be cumulative over increasing bounds up to +Inf.
+ */
+bool CheckExposition(const std::string& text)
+{
+	bool ok = HasLine(text, "# TYPE metrics_check_events_total counter") && HasLine(text, "metrics_check_events_total 3")
+		&& HasLine(text, "# TYPE metrics_check_level gauge") && HasLine(text, "metrics_check_level -7")
+		&& HasLine(text, "# TYPE metrics_check_latency_seconds histogram")
+		&& HasLine(text, "metrics_check_latency_seconds_bucket{le=\"+Inf\"} 3")
+		&& HasLine(text, "metrics_check_latency_seconds_count 3");
+
+	const std::string bucketPrefix = "metrics_check_latency_seconds_bucket{le=\"";
+	std::istringstream lines(text);
+	std::string line;
+	double previousBound = -1.0;
+	uint64_t previousCount = 0;
+	uint32_t finiteBuckets = 0;
+	bool sumSeen = false;
+	while (std::getline(lines, line))
+	{
+		if (line.rfind(bucketPrefix, 0) == 0)
+		{
+			const size_t boundEnd = line.find("\"}", bucketPrefix.size());
+			if (boundEnd == std::string::npos)
+				return false;
+			const std::string bound = line.substr(bucketPrefix.size(), boundEnd - bucketPrefix.size());
+			const uint64_t count = std::strtoull(line.c_str() + boundEnd + 3, nullptr, 10);
+			const double value = bound == "+Inf" ? INFINITY : std::strtod(bound.c_str(), nullptr);
+			ok = ok && value > previousBound && count >= previousCount;
+			finiteBuckets += bound == "+Inf" ? 0 : 1;
+			previousBound = value;
+			previousCount = count;
+		}
+		else if (line.rfind("metrics_check_latency_seconds_sum ", 0) == 0)
+		{
+			const double sum = std::strtod(line.c_str() + line.find(' ') + 1, nullptr);
+			ok = ok && std::abs(sum - 1006e-6) < 1e-9;
+			sumSeen = true;
+		}
+	}
+	// Every sample lands in a bucket of its own
+	return ok && sumSeen && finiteBuckets == 3 && std::isinf(previousBound) && previousCount == 3;
+}
+
+} // anonymous namespace
+
+uint32_t Histogram::BucketIndex(uint64_t value)
+{
+	// Small values get one exact bucket each
+	if (value < kSubBuckets)
+		return static_cast<uint32_t>(value);
+
+	const uint32_t shift = MostSignificantBit(value) - kSubBucketBits;
+	const uint32_t subBucket = static_cast<uint32_t>(value >> shift) & (kSubBuckets - 1);
+	return (shift + 1) * kSubBuckets + subBucket;
+}
+
+uint64_t Histogram::BucketUpperBound(uint32_t index)
+{
+	if (index < kSubBuckets)
+		return index;
+
+	const uint32_t shift = index / kSubBuckets - 1;
+	const uint64_t lower = static_cast<uint64_t>(kSubBuckets + index % kSubBuckets) << shift;
+	return lower + ((uint64_t{1} << shift) - 1);
+}
+
+void Histogram::Record(uint64_t value)
+{
+	m_buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::Quantile(double q) const
+{
+	const uint64_t count = Count();
+	if (count == 0)
+		return 0;
+
+	const uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < kBucketCount; ++i)
+	{
+		seen += BucketCount(i);
+		if (seen >= rank)
+			return BucketUpperBound(i);
+	}
+	return BucketUpperBound(kBucketCount - 1);
+}
+
+Counter& UploadBytesCounter()
+{
+	return MetricsRegistry::Global().GetCounter("webgpu_upload_bytes_total", "Bytes written through wgpuQueueWriteBuffer and wgpuQueueWriteTexture");
+}
+
+MetricsRegistry& MetricsRegistry::Global()
+{
+	static MetricsRegistry registry;
+	return registry;
+}
+
+MetricsRegistry::Entry* MetricsRegistry::Find(const std::string& name, Type type)
+{
+	for (const std::unique_ptr<Entry> &entry : m_entries)
+	{
+		if (entry->name == name)
+		{
+			if (entry->type != type)
+				std::cerr << "Metric " << name << " registered twice with different types" << std::endl;
+			return entry->type == type ? entry.get() : nullptr;
+		}
+	}
+
+	auto entry = std::make_unique<Entry>();
+	entry->name = name;
+	entry->type = type;
+	m_entries.push_back(std::move(entry));
+	return m_entries.back().get();
+}
+
+Counter& MetricsRegistry::GetCounter(const std::string& name, const std::string& help)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Entry *entry = Find(name, Type::Counter);
+	if (!entry)
+	{
+		// Type clash, hand out a detached metric so callers still have something valid to update
+		static Counter detached;
+		return detached;
+	}
+
+	if (!entry->counter)
+	{
+		entry->help = help;
+		entry->counter = std::make_unique<Counter>();
+	}
+	return *entry->counter;
+}
+
+Gauge& MetricsRegistry::GetGauge(const std::string& name, const std::string& help)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Entry *entry = Find(name, Type::Gauge);
+	if (!entry)
+	{
+		static Gauge detached;
+		return detached;
+	}
+
+	if (!entry->gauge)
+	{
+		entry->help = help;
+		entry->gauge = std::make_unique<Gauge>();
+	}
+	return *entry->gauge;
+}
+
+Histogram& MetricsRegistry::GetHistogram(const std::string& name, const std::string& help, double scale)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Entry *entry = Find(name, Type::Histogram);
+	if (!entry)
+	{
+		static Histogram detached;
+		return detached;
+	}
+
+	if (!entry->histogram)
+	{
+		entry->help = help;
+		entry->histogram = std::make_unique<Histogram>(scale);
+	}
+	return *entry->histogram;
+}
+
+std::string MetricsRegistry::ExportPrometheus() const
+{
+	std::ostringstream os;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const std::unique_ptr<Entry> &entry : m_entries)
+	{
+		os << "# HELP " << entry->name << " " << entry->help << "\n";
+		switch (entry->type)
+		{
+			case Type::Counter:
+				os << "# TYPE " << entry->name << " counter\n";
+				os << entry->name << " " << entry->counter->Value() << "\n";
+				break;
+			case Type::Gauge:
+				os << "# TYPE " << entry->name << " gauge\n";
+				os << entry->name << " " << entry->gauge->Value() << "\n";
+				break;
+			case Type::Histogram:
+			{
+				// Buckets are cumulative in the exposition format. Empty ones are skipped to keep the
+				// output small, which is valid as long as the le bounds stay increasing.
+				const Histogram &histogram = *entry->histogram;
+				os << "# TYPE " << entry->name << " histogram\n";
+				uint64_t cumulative = 0;
+				for (uint32_t i = 0; i < Histogram::kBucketCount; ++i)
+				{
+					const uint64_t count = histogram.BucketCount(i);
+					if (count == 0)
+						continue;
+
+					cumulative += count;
+					os << entry->name << "_bucket{le=\"" << Histogram::BucketUpperBound(i) * histogram.Scale() << "\"} " << cumulative << "\n";
+				}
+				os << entry->name << "_bucket{le=\"+Inf\"} " << histogram.Count() << "\n";
+				os << entry->name << "_sum " << histogram.Sum() * histogram.Scale() << "\n";
+				os << entry->name << "_count " << histogram.Count() << "\n";
+				break;
+			}
+		}
+	}
+
+	return os.str();
+}
+
+bool MetricsRegistry::WriteFile(const std::string& path) const
+{
+	const std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::trunc);
+		if (!file)
+			return false;
+		file << ExportPrometheus();
+	}
+
+	return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+MetricsExporter::~MetricsExporter()
+{
+	Stop();
+}
+
+bool MetricsExporter::StartFileDump(const std::string& path, std::chrono::milliseconds interval)
+{
+#if defined(__EMSCRIPTEN__)
+	std::cerr << "Metrics file dump is not supported on Emscripten" << std::endl;
+	return false;
+#else
+	if (!MetricsRegistry::Global().WriteFile(path))
+	{
+		std::cerr << "Could not write metrics to " << path << std::endl;
+		return false;
+	}
+
+	m_threads.emplace_back(&MetricsExporter::FileDumpLoop, this, path, interval);
+	return true;
+#endif
+}
+
+void MetricsExporter::FileDumpLoop(std::string path, std::chrono::milliseconds interval)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stopCondition.wait_for(lock, interval, [this]{ return m_stop; }))
+	{
+		lock.unlock();
+		MetricsRegistry::Global().WriteFile(path);
+		lock.lock();
+	}
+
+	// Final values on shutdown
+	lock.unlock();
+	MetricsRegistry::Global().WriteFile(path);
+}
+
+bool MetricsExporter::StartSocketServer(const std::string& socketPath)
+{
+#if defined(METRICS_UNIX_SOCKET)
+	sockaddr_un address{};
+	if (socketPath.size() >= sizeof(address.sun_path))
+	{
+		std::cerr << "Metrics socket path is too long: " << socketPath << std::endl;
+		return false;
+	}
+
+	m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (m_socket < 0)
+	{
+		std::cerr << "Could not create metrics socket" << std::endl;
+		return false;
+	}
+
+	address.sun_family = AF_UNIX;
+	socketPath.copy(address.sun_path, socketPath.size());
+	unlink(socketPath.c_str());  // Stale socket from a previous run
+
+	if (bind(m_socket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(m_socket, 4) != 0)
+	{
+		std::cerr << "Could not listen on metrics socket " << socketPath << std::endl;
+		close(m_socket);
+		m_socket = -1;
+		return false;
+	}
+
+	m_socketPath = socketPath;
+	m_threads.emplace_back(&MetricsExporter::SocketLoop, this);
+	return true;
+#else
+	std::cerr << "Metrics socket is not supported on this platform: " << socketPath << std::endl;
+	return false;
+#endif
+}
+
+void MetricsExporter::SocketLoop()
+{
+#if defined(METRICS_UNIX_SOCKET)
+	for (;;)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_stop)
+				break;
+		}
+
+		// Wake up regularly to notice Stop()
+		pollfd listenFd{m_socket, POLLIN, 0};
+		if (poll(&listenFd, 1, 200) <= 0)
+			continue;
+
+		const int client = accept(m_socket, nullptr, nullptr);
+		if (client < 0)
+			continue;
+#if defined(SO_NOSIGPIPE)
+		// Where send() has no MSG_NOSIGNAL, a scraper hanging up must not raise SIGPIPE either
+		const int noSigPipe = 1;
+		setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+
+		// Answer as HTTP so regular scrapers work (eg. curl --unix-socket <path> http://localhost/metrics).
+		// The request itself is irrelevant, every path returns the dump.
+		char request[1024];
+		pollfd clientFd{client, POLLIN, 0};
+		if (poll(&clientFd, 1, 100) > 0)
+		{
+			[[maybe_unused]] ssize_t ignored = read(client, request, sizeof(request));
+		}
+
+		const std::string body = MetricsRegistry::Global().ExportPrometheus();
+		std::ostringstream response;
+		response << "HTTP/1.0 200 OK\r\n"
+			<< "Content-Type: text/plain; version=0.0.4\r\n"
+			<< "Content-Length: " << body.size() << "\r\n\r\n"
+			<< body;
+
+		const std::string data = response.str();
+		size_t sent = 0;
+		while (sent < data.size())
+		{
+			// A scraper disconnecting early gives EPIPE instead of a SIGPIPE killing the app
+			const ssize_t n = send(client, data.data() + sent, data.size() - sent, kSendFlags);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			sent += static_cast<size_t>(n);
+		}
+		close(client);
+	}
+#endif
+}
+
+void MetricsExporter::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_stopCondition.notify_all();
+
+	for (std::thread &thread : m_threads)
+		thread.join();
+	m_threads.clear();
+
+#if defined(METRICS_UNIX_SOCKET)
+	if (m_socket >= 0)
+	{
+		close(m_socket);
+		unlink(m_socketPath.c_str());
+		m_socket = -1;
+	}
+#endif
+}
+
+bool RunMetricsBenchmark(uint32_t scrapes)
+{
+#if defined(METRICS_UNIX_SOCKET)
+	using Clock = std::chrono::steady_clock;
+
+	MetricsRegistry &registry = MetricsRegistry::Global();
+	registry.GetCounter("metrics_check_events_total", "Events counted by the metrics check").Add(3);
+	registry.GetGauge("metrics_check_level", "Level set by the metrics check").Set(-7);
+	Histogram &latency = registry.GetHistogram("metrics_check_latency_seconds", "Latencies recorded by the metrics check", 1e-6);
+	for (uint64_t microseconds : {1, 5, 1000})
+		latency.Record(microseconds);
+
+	const std::string prefix = "/tmp/app-metrics-check-" + std::to_string(getpid());
+	const std::string filePath = prefix + ".prom";
+	const std::string socketPath = prefix + ".sock";
+
+	bool ok = false;
+	double scrapeMs = 0.0;
+	size_t dumpBytes = 0;
+	{
+		MetricsExporter exporter;
+		if (exporter.StartFileDump(filePath, std::chrono::milliseconds(60000)) && exporter.StartSocketServer(socketPath))
+		{
+			std::ifstream file(filePath);
+			std::stringstream fileText;
+			fileText << file.rdbuf();
+			const std::string socketText = Scrape(socketPath);
+			const bool fileOk = CheckExposition(fileText.str());
+			const bool socketOk = CheckExposition(socketText);
+			ok = fileOk && socketOk;
+			dumpBytes = socketText.size();
+
+			std::cout << "Metrics benchmark: " << scrapes << " socket scrapes" << std::endl;
+			std::cout << "  check: file " << (fileOk ? "passed" : "FAILED") << ", socket " << (socketOk ? "passed" : "FAILED") << std::endl;
+
+			const Clock::time_point start = Clock::now();
+			for (uint32_t i = 0; i < scrapes && ok; ++i)
+				ok = !Scrape(socketPath).empty();
+			scrapeMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		}
+	}
+	std::remove(filePath.c_str());
+	std::remove(socketPath.c_str());
+
+	if (ok && scrapes > 0)
+		std::cout << std::fixed << std::setprecision(3) << "  " << scrapeMs / scrapes << " ms per scrape of " << dumpBytes
+			<< " bytes" << std::endl;
+	return ok;
+#else
+	(void)scrapes;
+	std::cerr << "The metrics benchmark needs Unix sockets, which this platform does not have" << std::endl;
+	return false;
+#endif
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Process wide runtime metrics exposed in the Prometheus text format.
+ *
+ * Counters, gauges and histograms are lock free to update from any thread. Metrics are registered
+ * once by name and live for the duration of the process, so references can be cached.
+ */
+
+class Counter
+{
+public:
+	void Add(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t Value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> m_value{0};
+};
+
+class Gauge
+{
+public:
+	void Set(int64_t value) { m_value.store(value, std::memory_order_relaxed); }
+	void Add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+	int64_t Value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<int64_t> m_value{0};
+};
+
+/**
+ * HDR style histogram of unsigned integer samples.
+ *
+ * Values are bucketed by their power of two and then linearly into kSubBuckets within it, which
+ * bounds the relative error of any reported value to 1/kSubBuckets over the full 64 bit range
+ * with a fixed, small number of buckets.
+ */
+class Histogram
+{
+public:
+	static constexpr uint32_t kSubBucketBits = 3;
+	static constexpr uint32_t kSubBuckets = 1u << kSubBucketBits;
+	static constexpr uint32_t kBucketCount = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+	// scale converts recorded values into the exported unit, eg. 1e-6 for microseconds to seconds
+	explicit Histogram(double scale = 1.0) : m_scale(scale) {}
+
+	void Record(uint64_t value);
+
+	uint64_t Count() const { return m_count.load(std::memory_order_relaxed); }
+	uint64_t Sum() const { return m_sum.load(std::memory_order_relaxed); }
+	double Scale() const { return m_scale; }
+
+	// Upper bound of the bucket holding the q-th quantile, q in [0, 1]
+	uint64_t Quantile(double q) const;
+
+	static uint32_t BucketIndex(uint64_t value);
+	static uint64_t BucketUpperBound(uint32_t index);
+	uint64_t BucketCount(uint32_t index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+
+private:
+	std::array<std::atomic<uint64_t>, kBucketCount> m_buckets{};
+	std::atomic<uint64_t> m_count{0};
+	std::atomic<uint64_t> m_sum{0};
+	double m_scale;
+};
+
+class MetricsRegistry
+{
+public:
+	static MetricsRegistry& Global();
+
+	// Return the metric registered under name, creating it on first use
+	Counter& GetCounter(const std::string& name, const std::string& help);
+	Gauge& GetGauge(const std::string& name, const std::string& help);
+	Histogram& GetHistogram(const std::string& name, const std::string& help, double scale = 1.0);
+
+	std::string ExportPrometheus() const;
+
+	// Written to a temporary file first so a scraper never reads a partial dump
+	bool WriteFile(const std::string& path) const;
+
+private:
+	enum class Type
+	{
+		Counter,
+		Gauge,
+		Histogram,
+	};
+
+	struct Entry
+	{
+		std::string name;
+		std::string help;
+		Type type;
+		std::unique_ptr<Counter> counter;
+		std::unique_ptr<Gauge> gauge;
+		std::unique_ptr<Histogram> histogram;
+	};
+
+	Entry* Find(const std::string& name, Type type);
+
+	mutable std::mutex m_mutex;
+	std::vector<std::unique_ptr<Entry>> m_entries;
+};
+
+// The webgpu_upload_bytes_total counter every wgpuQueueWriteBuffer and wgpuQueueWriteTexture caller adds to
+Counter& UploadBytesCounter();
+
+/**
+ * Publishes the global registry from a background thread, either by rewriting a file every
+ * interval (for node exporter's textfile collector and similar) or by answering every connection
+ * on a local Unix socket with the current dump.
+ */
+class MetricsExporter
+{
+public:
+	MetricsExporter() = default;
+	~MetricsExporter();
+
+	MetricsExporter(const MetricsExporter&) = delete;
+	MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+	bool StartFileDump(const std::string& path, std::chrono::milliseconds interval);
+	bool StartSocketServer(const std::string& socketPath);
+	void Stop();
+
+private:
+	void FileDumpLoop(std::string path, std::chrono::milliseconds interval);
+	void SocketLoop();
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_stopCondition;
+	bool m_stop = false;
+
+	int m_socket = -1;
+	std::string m_socketPath;
+};
+
+/*
+ * Register a counter, a gauge and a histogram of known values, publish them through an exporter to
+ * a temporary file and a temporary Unix socket, read both back like a scraper and check their
+ * Prometheus lines, then time scrapes socket requests. Returns false when a check fails.
+ */
+bool RunMetricsBenchmark(uint32_t scrapes);
@@ -0,0 +1,401 @@
+#include "OcclusionCulling.hpp"
+#include "GpuMemory.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const char* kOcclusionShader = R"(
+struct Box
+{
+	center: vec4f,  // Cpp OcclusionCulling::Box must match
+	extent: vec4f,
+};
+
+@group(0) @binding(0) var<uniform> viewProjection: mat4x4f;
+@group(0) @binding(1) var<storage, read> boxes: array<Box>;
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex: u32, @builtin(instance_index) index: u32) -> @builtin(position) vec4f
+{
+	// A cube as one 14 vertex triangle strip, corners in [-1, 1]
+	let corner = vec3f(f32((0x287Au >> vertex) & 1u), f32((0x02AFu >> vertex) & 1u), f32((0x31E3u >> vertex) & 1u)) * 2.0 - 1.0;
+	let box = boxes[index];
+	return viewProjection * vec4f(box.center.xyz + corner * box.extent.xyz, 1.0);
+}
+
+@fragment
+fn fs_main() -> @location(0) vec4f
+{
+	// Masked off, only the samples passing the depth test matter
+	return vec4f(0.0);
+})";
+
+} // anonymous namespace
+
+OcclusionCulling::OcclusionCulling() :
+	m_device(nullptr),
+	m_queue(nullptr),
+	m_events(nullptr),
+	m_colorFormat(WGPUTextureFormat_Undefined),
+	m_depthFormat(WGPUTextureFormat_Undefined),
+	m_querySet(nullptr, wgpuQuerySetRelease),
+	m_resolveBuffer(nullptr, wgpuBufferRelease),
+	m_uniformBuffer(nullptr, wgpuBufferRelease),
+	m_boxBuffer(nullptr, wgpuBufferRelease),
+	m_shaderModule(nullptr, wgpuShaderModuleRelease),
+	m_bindGroupLayout(nullptr, wgpuBindGroupLayoutRelease),
+	m_pipelineLayout(nullptr, wgpuPipelineLayoutRelease),
+	m_bindGroup(nullptr, wgpuBindGroupRelease),
+	m_current(kReadbacks),
+	m_nextCandidate(0),
+	m_epoch(0),
+	m_bytesUploaded(UploadBytesCounter())
+{
+}
+
+bool OcclusionCulling::Initialize(WGPUDevice device, WGPUQueue queue, GpuEvents& events, WGPUTextureFormat colorFormat, WGPUTextureFormat depthFormat)
+{
+	TRACE_SCOPE("OcclusionCullingInitialize");
+
+	Reset();
+	m_device = device;
+	m_queue = queue;
+	m_events = &events;
+	m_colorFormat = colorFormat;
+	m_depthFormat = depthFormat;
+
+	WGPUQuerySetDescriptor querySetDesc{};
+	querySetDesc.label = wgpuUtils::label("Occlusion queries");
+	querySetDesc.type = WGPUQueryType_Occlusion;
+	querySetDesc.count = kMaxQueries;
+	m_querySet = WgpuQuerySetPtr(wgpuDeviceCreateQuerySet(device, &querySetDesc), wgpuQuerySetRelease);
+
+	WGPUBufferDescriptor bufferDesc{};
+	bufferDesc.label = wgpuUtils::label("Occlusion resolve");
+	bufferDesc.size = kMaxQueries * sizeof(uint64_t);
+	bufferDesc.usage = WGPUBufferUsage_QueryResolve | WGPUBufferUsage_CopySrc;
+	bufferDesc.mappedAtCreation = false;
+	m_resolveBuffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+
+	for (Readback &readback : m_readbacks)
+	{
+		bufferDesc.label = wgpuUtils::label("Occlusion readback");
+		bufferDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
+		readback.buffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+		if (!readback.buffer)
+		{
+			Reset();
+			return false;
+		}
+	}
+
+	bufferDesc.label = wgpuUtils::label("Occlusion view projection");
+	bufferDesc.size = sizeof(math::Mat4);
+	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform;
+	m_uniformBuffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+
+	bufferDesc.label = wgpuUtils::label("Occlusion boxes");
+	bufferDesc.size = kMaxQueries * sizeof(Box);
+	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
+	m_boxBuffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+	if (!m_querySet || !m_resolveBuffer || !m_uniformBuffer || !m_boxBuffer)
+	{
+		Reset();
+		return false;
+	}
+
+	m_shaderModule = WgpuShaderModulePtr(wgpuUtils::createShaderModule(device, kOcclusionShader), wgpuShaderModuleRelease);
+
+	std::array<WGPUBindGroupLayoutEntry, 2> layoutEntries;
+
+	WGPUBindGroupLayoutEntry &uniformLayout = layoutEntries[0];
+	uniformLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	uniformLayout.binding = 0;
+	uniformLayout.visibility = WGPUShaderStage_Vertex;
+	uniformLayout.buffer.type = WGPUBufferBindingType_Uniform;
+	uniformLayout.buffer.minBindingSize = sizeof(math::Mat4);
+
+	WGPUBindGroupLayoutEntry &boxLayout = layoutEntries[1];
+	boxLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	boxLayout.binding = 1;
+	boxLayout.visibility = WGPUShaderStage_Vertex;
+	boxLayout.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+	boxLayout.buffer.minBindingSize = sizeof(Box);
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = layoutEntries.size();
+	bindGroupLayoutDesc.entries = layoutEntries.data();
+	WGPUBindGroupLayout bindGroupLayout = wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDesc);
+	m_bindGroupLayout = WgpuBindGroupLayoutPtr(bindGroupLayout, wgpuBindGroupLayoutRelease);
+
+	WGPUPipelineLayoutDescriptor pipelineLayoutDesc{};
+	pipelineLayoutDesc.bindGroupLayoutCount = 1;
+	pipelineLayoutDesc.bindGroupLayouts = &bindGroupLayout;
+	m_pipelineLayout = WgpuPipelineLayoutPtr(wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDesc), wgpuPipelineLayoutRelease);
+
+	std::array<WGPUBindGroupEntry, 2> entries{};
+	entries[0].binding = 0;
+	entries[0].buffer = m_uniformBuffer.get();
+	entries[0].size = sizeof(math::Mat4);
+	entries[1].binding = 1;
+	entries[1].buffer = m_boxBuffer.get();
+	entries[1].size = kMaxQueries * sizeof(Box);
+
+	WGPUBindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = entries.size();
+	bindGroupDesc.entries = entries.data();
+	m_bindGroup = WgpuBindGroupPtr(wgpuDeviceCreateBindGroup(device, &bindGroupDesc), wgpuBindGroupRelease);
+
+	return m_shaderModule && m_pipelineLayout && m_bindGroup;
+}
+
+void OcclusionCulling::Reset()
+{
+	for (Readback &readback : m_readbacks)
+	{
+		// A map still pending completes when the buffer is released, after this may be gone
+		if (readback.state == State::Resolved)
+			readback.mapped.Then([](bool) {});
+		readback.mapped = {};
+		readback.buffer.reset();
+		readback.instances.clear();
+		readback.state = State::Free;
+	}
+	m_pipelines.clear();
+	m_bindGroup.reset();
+	m_pipelineLayout.reset();
+	m_bindGroupLayout.reset();
+	m_shaderModule.reset();
+	m_boxBuffer.reset();
+	m_uniformBuffer.reset();
+	m_resolveBuffer.reset();
+	m_querySet.reset();
+	m_current = kReadbacks;
+	m_nextCandidate = 0;
+	m_occludedResults.clear();
+	m_boxes.clear();
+	m_stats = {};
+}
+
+void OcclusionCulling::Invalidate()
+{
+	// Results in flight are for the old indices, and are dropped when they arrive
+	++m_epoch;
+	std::fill(m_occludedResults.begin(), m_occludedResults.end(), 0);
+}
+
+void OcclusionCulling::BeginFrame(const math::Mat4& viewProjection, const std::vector<uint32_t>& candidates,
+	math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, size_t objectCount)
+{
+	TRACE_SCOPE("OcclusionBeginFrame");
+
+	m_stats = {};
+	m_occludedResults.resize(objectCount, 0);
+
+	// A frame recorded but never submitted leaves its readback behind
+	m_current = kReadbacks;
+	for (uint32_t i = 0; i < kReadbacks; ++i)
+	{
+		if (m_readbacks[i].state == State::Recorded)
+			m_readbacks[i].state = State::Free;
+		if (m_readbacks[i].state == State::Free && m_current == kReadbacks)
+			m_current = i;
+	}
+
+	// Without a free readback the objects keep their latest results a frame longer
+	if (Initialized() && m_current != kReadbacks && !candidates.empty())
+		PickQueries(viewProjection, candidates, centers, extents);
+	else
+		m_current = kReadbacks;
+
+	for (uint32_t instance : candidates)
+		++(IsOccluded(instance) ? m_stats.occluded : m_stats.visible);
+}
+
+void OcclusionCulling::PickQueries(const math::Mat4& viewProjection, const std::vector<uint32_t>& candidates,
+	math::ConstFloat3Soa centers, math::ConstFloat3Soa extents)
+{
+	Readback &readback = m_readbacks[m_current];
+	readback.epoch = m_epoch;
+	readback.instances.clear();
+	m_boxes.clear();
+
+	// Signed distance to the near plane, clip space z >= 0, whose normal is the third row
+	const math::Vec4 *c = viewProjection.cols;
+	const float near[4] = {c[0].z, c[1].z, c[2].z, c[3].z};
+
+	// When they do not all fit, later frames carry on where this one stopped
+	const size_t count = candidates.size();
+	const size_t tested = std::min<size_t>(count, kMaxQueries);
+	const size_t first = m_nextCandidate < count ? m_nextCandidate : 0;
+	m_nextCandidate = static_cast<uint32_t>((first + tested) % count);
+	for (size_t i = 0; i < tested; ++i)
+	{
+		const uint32_t instance = candidates[(first + i) % count];
+		const float ex = extents.x[instance] * (1.0f + kBoxMargin);
+		const float ey = extents.y[instance] * (1.0f + kBoxMargin);
+		const float ez = extents.z[instance] * (1.0f + kBoxMargin);
+		const float distance = near[0] * centers.x[instance] + near[1] * centers.y[instance] + near[2] * centers.z[instance] + near[3];
+		const float radius = std::abs(near[0]) * ex + std::abs(near[1]) * ey + std::abs(near[2]) * ez;
+		if (distance - radius <= 0.0f)
+		{
+			m_occludedResults[instance] = 0;
+			continue;
+		}
+
+		readback.instances.push_back(instance);
+		m_boxes.push_back({{centers.x[instance], centers.y[instance], centers.z[instance], 0.0f}, {ex, ey, ez, 0.0f}});
+	}
+
+	m_stats.queries = static_cast<uint32_t>(m_boxes.size());
+	if (m_boxes.empty())
+	{
+		m_current = kReadbacks;
+		return;
+	}
+	readback.state = State::Recorded;
+
+	const size_t size = m_boxes.size() * sizeof(Box);
+	wgpuQueueWriteBuffer(m_queue, m_uniformBuffer.get(), 0, &viewProjection, sizeof(math::Mat4));
+	wgpuQueueWriteBuffer(m_queue, m_boxBuffer.get(), 0, m_boxes.data(), size);
+	m_bytesUploaded.Add(sizeof(math::Mat4) + size);
+}
+
+void OcclusionCulling::Record(WGPURenderPassEncoder pass, uint32_t sampleCount)
+{
+	if (m_current == kReadbacks)
+		return;
+
+	TRACE_SCOPE("OcclusionQueries");
+
+	WGPURenderPipeline pipeline = GetPipeline(sampleCount);
+	if (!pipeline)
+		return;
+
+	wgpuRenderPassEncoderSetPipeline(pass, pipeline);
+	wgpuRenderPassEncoderSetBindGroup(pass, 0, m_bindGroup.get(), 0, nullptr);
+	for (uint32_t i = 0; i < m_stats.queries; ++i)
+	{
+		wgpuRenderPassEncoderBeginOcclusionQuery(pass, i);
+		wgpuRenderPassEncoderDraw(pass, 14, 1, 0, i);
+		wgpuRenderPassEncoderEndOcclusionQuery(pass);
+	}
+}
+
+WgpuCommandBufferPtr OcclusionCulling::Resolve()
+{
+	if (m_current == kReadbacks)
+		return WgpuCommandBufferPtr(nullptr, wgpuCommandBufferRelease);
+
+	WGPUCommandEncoderDescriptor encoderDesc{};
+	encoderDesc.label = wgpuUtils::label("Resolve occlusion queries");
+	WgpuCommandEncoderPtr encoder(wgpuDeviceCreateCommandEncoder(m_device, &encoderDesc), wgpuCommandEncoderRelease);
+
+	const uint64_t size = uint64_t{m_stats.queries} * sizeof(uint64_t);
+	wgpuCommandEncoderResolveQuerySet(encoder.get(), m_querySet.get(), 0, m_stats.queries, m_resolveBuffer.get(), 0);
+	wgpuCommandEncoderCopyBufferToBuffer(encoder.get(), m_resolveBuffer.get(), 0, m_readbacks[m_current].buffer.get(), 0, size);
+
+	WGPUCommandBufferDescriptor commandDesc{};
+	return WgpuCommandBufferPtr(wgpuCommandEncoderFinish(encoder.get(), &commandDesc), wgpuCommandBufferRelease);
+}
+
+void OcclusionCulling::EndFrame()
+{
+	if (m_current == kReadbacks)
+		return;
+
+	Readback &readback = m_readbacks[m_current];
+	m_current = kReadbacks;
+	readback.state = State::Resolved;
+	const size_t size = readback.instances.size() * sizeof(uint64_t);
+	readback.mapped = m_events->MapBuffer(readback.buffer.get(), WGPUMapMode_Read, 0, size);
+	readback.mapped.Then([this, &readback, size](bool mapped) {
+		readback.state = State::Free;
+		if (!mapped)
+			return;
+
+		const void *results = wgpuBufferGetConstMappedRange(readback.buffer.get(), 0, size);
+		if (results)
+			ApplyResults(readback, static_cast<const uint64_t*>(results));
+		wgpuBufferUnmap(readback.buffer.get());
+	});
+}
+
+void OcclusionCulling::ApplyResults(const Readback& readback, const uint64_t* results)
+{
+	if (readback.epoch != m_epoch)
+		return;
+
+	// Any sample passing makes the object visible, hidden ones need several results in a row
+	for (size_t i = 0; i < readback.instances.size(); ++i)
+	{
+		if (readback.instances[i] >= m_occludedResults.size())
+			continue;
+		uint8_t &occluded = m_occludedResults[readback.instances[i]];
+		occluded = results[i] != 0 ? 0 : static_cast<uint8_t>(std::min(occluded + 1, 255));
+	}
+}
+
+WGPURenderPipeline OcclusionCulling::GetPipeline(uint32_t sampleCount)
+{
+	auto it = m_pipelines.find(sampleCount);
+	if (it != m_pipelines.end())
+		return it->second.get();
+
+	TRACE_SCOPE("OcclusionPipelineInitialize");
+
+	WGPURenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = m_pipelineLayout.get();
+	pipelineDesc.vertex.module = m_shaderModule.get();
+	pipelineDesc.vertex.entryPoint = wgpuUtils::label("vs_main");
+	pipelineDesc.primitive.topology = WGPUPrimitiveTopology_TriangleStrip;
+	pipelineDesc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
+	pipelineDesc.primitive.frontFace = WGPUFrontFace_CCW;
+	// The strip's winding alternates, and from inside a box only its back faces show
+	pipelineDesc.primitive.cullMode = WGPUCullMode_None;
+
+	// Tested against the scene's depth, never written so the boxes cannot hide each other
+	WGPUDepthStencilState depthStencil{};
+	depthStencil.format = m_depthFormat;
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	depthStencil.depthWriteEnabled = WGPUOptionalBool_False;
+#else
+	depthStencil.depthWriteEnabled = false;
+#endif
+	depthStencil.depthCompare = WGPUCompareFunction_LessEqual;
+	depthStencil.stencilFront.compare = WGPUCompareFunction_Always;
+	depthStencil.stencilFront.failOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.depthFailOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.passOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilBack = depthStencil.stencilFront;
+	depthStencil.stencilReadMask = 0;
+	depthStencil.stencilWriteMask = 0;
+	pipelineDesc.depthStencil = &depthStencil;
+
+	// The pass's color attachment must have a target, which is left untouched
+	WGPUColorTargetState colorTarget{};
+	colorTarget.format = m_colorFormat;
+	colorTarget.blend = nullptr;
+	colorTarget.writeMask = WGPUColorWriteMask_None;
+
+	WGPUFragmentState fragment{};
+	fragment.module = m_shaderModule.get();
+	fragment.entryPoint = wgpuUtils::label("fs_main");
+	fragment.targetCount = 1;
+	fragment.targets = &colorTarget;
+	pipelineDesc.fragment = &fragment;
+
+	pipelineDesc.multisample.count = sampleCount;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	WgpuRenderPipelinePtr pipeline(wgpuDeviceCreateRenderPipeline(m_device, &pipelineDesc), wgpuRenderPipelineRelease);
+	if (!pipeline)
+		return nullptr;
+	return m_pipelines.emplace(sampleCount, std::move(pipeline)).first->second.get();
+}
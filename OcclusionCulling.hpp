@@ -0,0 +1,134 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "GpuEvents.hpp"
+#include "Math.hpp"
+#include "Metrics.hpp"
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Skips drawing objects hidden behind others, from occlusion queries on their bounding boxes.
+ *
+ * Each frame the objects inside the frustum are tested, drawn or not: Record() draws their world
+ * bounds as boxes against the depth of the opaque geometry, each inside an occlusion query, without
+ * writing color or depth. The results are resolved into a readback of the frame's own and mapped
+ * once the GPU is done with the frame, so they arrive a frame or two later and never stall.
+ *
+ * Culling is conservative so objects do not pop in late. An object is only skipped once its last
+ * kResultsToCull results all found it occluded, and skipped objects keep being tested, so one result
+ * finding a sample of its box visible draws it again. The boxes are inflated by kBoxMargin of their
+ * size to catch objects about to come out, and boxes crossing the near plane, whose front faces
+ * would be clipped, are not tested and count as visible. Objects without results are drawn.
+ */
+class OcclusionCulling
+{
+public:
+	// The most queries a WebGPU query set holds, objects past that in a frame are not tested
+	static constexpr uint32_t kMaxQueries = 4096;
+	static constexpr uint32_t kReadbacks = 3;
+	static constexpr uint8_t kResultsToCull = 2;
+	static constexpr float kBoxMargin = 0.05f;
+
+	// Of the last BeginFrame()
+	struct Stats
+	{
+		uint32_t queries = 0;
+		uint32_t occluded = 0;  // Candidates skipped
+		uint32_t visible = 0;   // Candidates drawn
+	};
+
+	OcclusionCulling();
+
+	bool Initialize(WGPUDevice device, WGPUQueue queue, GpuEvents& events, WGPUTextureFormat colorFormat, WGPUTextureFormat depthFormat);
+	void Reset();
+	bool Initialized() const { return m_querySet != nullptr; }
+
+	// Drop the results so far, eg. when the objects' instance indices changed
+	void Invalidate();
+
+	/*
+	 * Pick the candidates, indices of the objects inside the frustum, tested this frame and upload
+	 * their boxes. Bounds are the world bounds of every object, indexed by instance.
+	 */
+	void BeginFrame(const math::Mat4& viewProjection, const std::vector<uint32_t>& candidates,
+		math::ConstFloat3Soa centers, math::ConstFloat3Soa extents, size_t objectCount);
+	// Whether the latest results allow skipping the object
+	bool IsOccluded(uint32_t instance) const
+	{
+		return instance < m_occludedResults.size() && m_occludedResults[instance] >= kResultsToCull;
+	}
+
+	// Of the render pass Record() is called in, null when not initialized
+	WGPUQuerySet QuerySet() const { return m_querySet.get(); }
+	// After the opaque draws of the pass, whose depth attachment the boxes are tested against
+	void Record(WGPURenderPassEncoder pass, uint32_t sampleCount);
+	// Resolve the frame's queries, to submit after the frame. Null when nothing was tested.
+	WgpuCommandBufferPtr Resolve();
+	// Once the frame is submitted, map its readback when the GPU is done with it
+	void EndFrame();
+
+	const Stats& LastStats() const { return m_stats; }
+
+private:
+	enum class State
+	{
+		Free,
+		Recorded,
+		Resolved,
+	};
+
+	struct Readback
+	{
+		Readback() : buffer(nullptr, wgpuBufferRelease), state(State::Free), epoch(0) {}
+
+		WgpuBufferPtr buffer;
+		State state;
+		GpuRequest<bool> mapped;
+		std::vector<uint32_t> instances;  // Tested by each query
+		uint64_t epoch;                   // Of the instance indices
+	};
+
+	// Cpp side of the shader's Box
+	struct Box
+	{
+		float center[4];
+		float extent[4];
+	};
+	static_assert(sizeof(Box) == 32);
+
+	void PickQueries(const math::Mat4& viewProjection, const std::vector<uint32_t>& candidates,
+		math::ConstFloat3Soa centers, math::ConstFloat3Soa extents);
+	WGPURenderPipeline GetPipeline(uint32_t sampleCount);
+	void ApplyResults(const Readback& readback, const uint64_t* results);
+
+	WGPUDevice m_device;
+	WGPUQueue m_queue;
+	GpuEvents* m_events;
+	WGPUTextureFormat m_colorFormat;
+	WGPUTextureFormat m_depthFormat;
+
+	WgpuQuerySetPtr m_querySet;
+	WgpuBufferPtr m_resolveBuffer;
+	WgpuBufferPtr m_uniformBuffer;  // The view projection matrix
+	WgpuBufferPtr m_boxBuffer;
+	WgpuShaderModulePtr m_shaderModule;
+	WgpuBindGroupLayoutPtr m_bindGroupLayout;
+	WgpuPipelineLayoutPtr m_pipelineLayout;
+	WgpuBindGroupPtr m_bindGroup;
+	std::unordered_map<uint32_t, WgpuRenderPipelinePtr> m_pipelines;  // By sample count
+
+	std::array<Readback, kReadbacks> m_readbacks;
+	uint32_t m_current;                   // Readback of the frame being recorded, kReadbacks when none
+	uint32_t m_nextCandidate;             // Where the next frame starts testing, when not all fit
+	std::vector<uint8_t> m_occludedResults;  // Consecutive occluded results, by instance
+	uint64_t m_epoch;
+	std::vector<Box> m_boxes;
+	Stats m_stats;
+
+	Counter& m_bytesUploaded;
+};
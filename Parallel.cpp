@@ -0,0 +1,350 @@
+#include "Parallel.hpp"
+
+#include <algorithm>
+
+struct JobSystem::Job
+{
+	JobFn fn;
+	Counter *counter;
+};
+
+namespace {
+
+constexpr uint32_t kNoThread = ~0u;
+
+// Which system's worker the current thread is, if any
+thread_local const JobSystem* t_system = nullptr;
+thread_local uint32_t t_index = kNoThread;
+
+// Per thread xorshift state for picking steal victims
+thread_local uint32_t t_random = 0x9e3779b9u;
+
+uint32_t NextRandom()
+{
+	t_random ^= t_random << 13;
+	t_random ^= t_random >> 17;
+	t_random ^= t_random << 5;
+	return t_random;
+}
+
+} // anonymous namespace
+
+bool JobSystem::Counter::Done() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_pending == 0;
+}
+
+// The Chase-Lev deque as formulated for C11 atomics by Lê et al., with sequentially consistent
+// operations where the paper has fences. The only race, over the last job, is settled on m_top.
+bool JobSystem::Deque::Push(Job* job)
+{
+	const int64_t bottom = m_bottom.load(std::memory_order_relaxed);
+	const int64_t top = m_top.load(std::memory_order_acquire);
+	if (bottom - top >= kCapacity)
+		return false;
+
+	m_jobs[bottom & (kCapacity - 1)].store(job, std::memory_order_relaxed);
+	m_bottom.store(bottom + 1, std::memory_order_release);
+	return true;
+}
+
+JobSystem::Job* JobSystem::Deque::Pop()
+{
+	const int64_t bottom = m_bottom.load(std::memory_order_relaxed) - 1;
+	m_bottom.store(bottom, std::memory_order_seq_cst);
+	int64_t top = m_top.load(std::memory_order_seq_cst);
+	if (top > bottom)
+	{
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Job *job = m_jobs[bottom & (kCapacity - 1)].load(std::memory_order_relaxed);
+	if (top == bottom)
+	{
+		// Last job, a thief may be taking it too
+		if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			job = nullptr;
+		m_bottom.store(bottom + 1, std::memory_order_relaxed);
+	}
+	return job;
+}
+
+JobSystem::Job* JobSystem::Deque::Steal()
+{
+	int64_t top = m_top.load(std::memory_order_seq_cst);
+	const int64_t bottom = m_bottom.load(std::memory_order_seq_cst);
+	if (top >= bottom)
+		return nullptr;
+
+	Job *job = m_jobs[top & (kCapacity - 1)].load(std::memory_order_relaxed);
+	if (!m_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+	return job;
+}
+
+bool JobSystem::Deque::Empty() const
+{
+	return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+}
+
+uint32_t JobSystem::DefaultWorkerCount()
+{
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+	return 0;
+#else
+	const uint32_t hardwareThreads = std::thread::hardware_concurrency();
+	return hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+#endif
+}
+
+JobSystem::JobSystem(uint32_t workerCount) :
+	m_mainThread(std::this_thread::get_id())
+{
+	for (uint32_t i = 0; i <= workerCount; ++i)
+		m_deques.push_back(std::make_unique<Deque>());
+
+	m_workers.reserve(workerCount);
+	for (uint32_t i = 0; i < workerCount; ++i)
+		m_workers.emplace_back(&JobSystem::WorkerLoop, this, i + 1);
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop.store(true);
+	}
+	m_wake.notify_all();
+
+	for (std::thread &worker : m_workers)
+		worker.join();
+
+	// Whatever is left was never waited on
+	PumpMainThread();
+	while (Job *job = FindJob(0))
+		Execute(job);
+}
+
+void JobSystem::Run(JobFn fn, Counter* counter)
+{
+	if (counter)
+	{
+		std::lock_guard<std::mutex> lock(counter->m_mutex);
+		++counter->m_pending;
+	}
+	Push(new Job{std::move(fn), counter});
+}
+
+void JobSystem::RunAfter(Counter& dependency, JobFn fn, Counter* counter)
+{
+	if (counter)
+	{
+		std::lock_guard<std::mutex> lock(counter->m_mutex);
+		++counter->m_pending;
+	}
+
+	Job *job = new Job{std::move(fn), counter};
+	{
+		std::lock_guard<std::mutex> lock(dependency.m_mutex);
+		if (dependency.m_pending > 0)
+		{
+			dependency.m_continuations.push_back(job);
+			return;
+		}
+	}
+	Push(job);
+}
+
+void JobSystem::RunOnMainThread(JobFn fn, Counter* counter)
+{
+	if (counter)
+	{
+		std::lock_guard<std::mutex> lock(counter->m_mutex);
+		++counter->m_pending;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mainMutex);
+	m_mainQueue.push_back(new Job{std::move(fn), counter});
+}
+
+size_t JobSystem::PumpMainThread()
+{
+	if (!IsMainThread())
+		return 0;
+
+	std::deque<Job*> jobs;
+	{
+		std::lock_guard<std::mutex> lock(m_mainMutex);
+		jobs.swap(m_mainQueue);
+	}
+	for (Job *job : jobs)
+		Execute(job);
+	return jobs.size();
+}
+
+void JobSystem::Wait(Counter& counter)
+{
+	const uint32_t index = ThreadIndex();
+	while (!counter.Done())
+	{
+		if (index == 0 && PumpMainThread() > 0)
+			continue;
+
+		if (Job *job = FindJob(index))
+			Execute(job);
+		else
+			std::this_thread::yield();
+	}
+}
+
+void JobSystem::ParallelFor(size_t count, size_t grain, const RangeFn& fn)
+{
+	if (count == 0)
+		return;
+
+	if (grain == 0)
+		grain = std::max<size_t>(count / ((WorkerCount() + 1) * kRangesPerThread), 1);
+
+	// Waking the workers costs more than a single chunk of work
+	if (m_workers.empty() || count <= grain)
+	{
+		for (size_t begin = 0; begin < count; begin += grain)
+			fn(begin, std::min(begin + grain, count));
+		return;
+	}
+
+	Counter counter;
+	RunRange(0, count, grain, fn, counter);
+	Wait(counter);
+}
+
+void JobSystem::RunRange(size_t begin, size_t end, size_t grain, const RangeFn& fn, Counter& counter)
+{
+	const uint32_t index = ThreadIndex();
+	while (end - begin > grain)
+	{
+		// Offer the upper half whenever the last offer has been taken, idle threads will steal it
+		if (index != kNoThread && end - begin >= 2 * grain && m_deques[index]->Empty())
+		{
+			const size_t middle = begin + (end - begin) / 2;
+			Run([this, middle, end, grain, &fn, &counter]() { RunRange(middle, end, grain, fn, counter); }, &counter);
+			end = middle;
+			continue;
+		}
+
+		fn(begin, begin + grain);
+		begin += grain;
+	}
+	fn(begin, end);
+}
+
+void JobSystem::Push(Job* job)
+{
+	const uint32_t index = ThreadIndex();
+	if (index == kNoThread || !m_deques[index]->Push(job))
+	{
+		std::lock_guard<std::mutex> lock(m_injectedMutex);
+		m_injected.push_back(job);
+	}
+
+	// Pairs with the check in WorkerLoop, one of the two sees the other's update
+	m_queued.fetch_add(1);
+	if (m_sleeping.load() > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_sleepMutex);
+		}
+		m_wake.notify_one();
+	}
+}
+
+JobSystem::Job* JobSystem::FindJob(uint32_t index)
+{
+	Job *job = index != kNoThread ? m_deques[index]->Pop() : nullptr;
+	if (!job)
+	{
+		std::lock_guard<std::mutex> lock(m_injectedMutex);
+		if (!m_injected.empty())
+		{
+			job = m_injected.front();
+			m_injected.pop_front();
+		}
+	}
+
+	// Start at a random victim so thieves spread out
+	const uint32_t dequeCount = static_cast<uint32_t>(m_deques.size());
+	const uint32_t first = NextRandom() % dequeCount;
+	for (uint32_t i = 0; i < dequeCount && !job; ++i)
+	{
+		const uint32_t victim = (first + i) % dequeCount;
+		if (victim != index)
+			job = m_deques[victim]->Steal();
+	}
+
+	if (job)
+		m_queued.fetch_sub(1, std::memory_order_relaxed);
+	return job;
+}
+
+void JobSystem::Execute(Job* job)
+{
+	job->fn();
+	Counter *counter = job->counter;
+	delete job;
+	Finish(counter);
+}
+
+void JobSystem::Finish(Counter* counter)
+{
+	if (!counter)
+		return;
+
+	// Nothing may touch the counter after the lock is released, a waiter can destroy it then
+	std::vector<Job*> ready;
+	{
+		std::lock_guard<std::mutex> lock(counter->m_mutex);
+		if (--counter->m_pending == 0)
+			ready.swap(counter->m_continuations);
+	}
+	for (Job *job : ready)
+		Push(job);
+}
+
+uint32_t JobSystem::ThreadIndex() const
+{
+	if (IsMainThread())
+		return 0;
+	return t_system == this ? t_index : kNoThread;
+}
+
+void JobSystem::WorkerLoop(uint32_t index)
+{
+	t_system = this;
+	t_index = index;
+	t_random ^= index * 0x85ebca6bu;
+
+	uint32_t misses = 0;
+	while (!m_stop.load(std::memory_order_relaxed))
+	{
+		if (Job *job = FindJob(index))
+		{
+			Execute(job);
+			misses = 0;
+			continue;
+		}
+
+		if (++misses < kSpinCount)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_sleeping.fetch_add(1);
+		m_wake.wait(lock, [this]() { return m_stop.load() || m_queued.load() > 0; });
+		m_sleeping.fetch_sub(1);
+		misses = 0;
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * One set of worker threads, sized to the cores, shared by everything that runs in parallel.
+ *
+ * Every thread that runs jobs, the workers and the thread that created the system, owns a
+ * Chase-Lev deque. It pushes and pops jobs at the bottom of its own deque, last in first out for
+ * cache locality, and idle threads steal the oldest jobs from the top of others'. Jobs queued from
+ * any other thread go through a shared injection queue.
+ *
+ * Completion is tracked with counters: a job given a counter holds it up until the job has run,
+ * RunAfter() holds a job back until a counter reaches zero, and Wait() runs other jobs until one
+ * does, so jobs may wait on the work they spawn.
+ *
+ * Jobs queued with RunOnMainThread() only run on the creating thread, from PumpMainThread() or
+ * while it waits, for APIs such as GLFW that must only be called from the main thread.
+ */
+class JobSystem
+{
+	struct Job;
+
+public:
+	using JobFn = std::function<void()>;
+	using RangeFn = std::function<void(size_t begin, size_t end)>;
+
+	// Jobs not yet finished. Must outlive the jobs it counts and anything waiting on it.
+	class Counter
+	{
+	public:
+		Counter() = default;
+		Counter(const Counter&) = delete;
+		Counter& operator=(const Counter&) = delete;
+
+		bool Done() const;
+
+	private:
+		friend class JobSystem;
+
+		mutable std::mutex m_mutex;
+		uint32_t m_pending = 0;
+		std::vector<Job*> m_continuations;  // Queued by RunAfter() until m_pending drops to zero
+	};
+
+	// One less than the number of hardware threads, since the creating thread works too
+	static uint32_t DefaultWorkerCount();
+
+	explicit JobSystem(uint32_t workerCount = DefaultWorkerCount());
+	~JobSystem();
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	uint32_t WorkerCount() const { return static_cast<uint32_t>(m_workers.size()); }
+
+	// Run fn on any thread, counted by counter if given
+	void Run(JobFn fn, Counter* counter = nullptr);
+
+	// Run fn once dependency has reached zero
+	void RunAfter(Counter& dependency, JobFn fn, Counter* counter = nullptr);
+
+	// Run fn on the creating thread, from PumpMainThread() or while it waits
+	void RunOnMainThread(JobFn fn, Counter* counter = nullptr);
+
+	// Run the jobs queued for the main thread, returns how many ran. Only on the creating thread.
+	size_t PumpMainThread();
+	bool IsMainThread() const { return std::this_thread::get_id() == m_mainThread; }
+
+	// Run other jobs until counter reaches zero
+	void Wait(Counter& counter);
+
+	/*
+	 * Call fn on [begin, end) chunks covering [0, count) and return once all have run. Chunks are
+	 * at most grain elements. A grain of 0 picks one from the count and the number of threads.
+	 * Ranges are split in half lazily, only while the thread running them has nothing else queued,
+	 * so the number of jobs adapts to how many threads are actually idle. fn may itself run jobs
+	 * and wait on them.
+	 */
+	void ParallelFor(size_t count, size_t grain, const RangeFn& fn);
+
+private:
+	// Bounded, jobs that do not fit go to the injection queue
+	class Deque
+	{
+	public:
+		static constexpr int64_t kCapacity = 4096;
+
+		bool Push(Job* job);      // Owner only
+		Job* Pop();               // Owner only
+		Job* Steal();             // Any thread
+		bool Empty() const;
+
+	private:
+		alignas(64) std::atomic<int64_t> m_top{0};
+		alignas(64) std::atomic<int64_t> m_bottom{0};
+		std::atomic<Job*> m_jobs[kCapacity] = {};
+	};
+
+	// Splits per thread for a grain of 0, enough to even out uneven chunks
+	static constexpr size_t kRangesPerThread = 16;
+
+	// Attempts to find a job before a worker goes to sleep
+	static constexpr uint32_t kSpinCount = 64;
+
+	void Push(Job* job);
+	Job* FindJob(uint32_t index);
+	void Execute(Job* job);
+	void Finish(Counter* counter);
+	void RunRange(size_t begin, size_t end, size_t grain, const RangeFn& fn, Counter& counter);
+	uint32_t ThreadIndex() const;
+	void WorkerLoop(uint32_t index);
+
+	std::thread::id m_mainThread;
+	std::vector<std::unique_ptr<Deque>> m_deques;  // The creating thread's first, then one per worker
+	std::vector<std::thread> m_workers;
+
+	std::mutex m_injectedMutex;
+	std::deque<Job*> m_injected;
+
+	std::mutex m_mainMutex;
+	std::deque<Job*> m_mainQueue;
+
+	// Workers sleep once nothing is queued anywhere
+	std::atomic<int64_t> m_queued{0};
+	std::atomic<uint32_t> m_sleeping{0};
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+	std::atomic<bool> m_stop{false};
+};
@@ -0,0 +1,72 @@
+#include "ReleaseQueue.hpp"
+
+ReleaseQueue::ReleaseQueue() :
+	m_recordingFrame(0),
+	m_completedFrames(0)
+{}
+
+ReleaseQueue::~ReleaseQueue()
+{
+	Flush();
+}
+
+void ReleaseQueue::EndFrame(WGPUQueue queue)
+{
+	auto onQueueWorkDone = [](
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+			[[maybe_unused]]WGPUQueueWorkDoneStatus status, void* pUserData1, [[maybe_unused]]void* pUserData2)
+#else
+			[[maybe_unused]]WGPUQueueWorkDoneStatus status, void* pUserData1)
+#endif
+	{
+		// Work is completed in submission order, so every callback retires exactly one frame.
+		// Even on failure (eg. device lost) the frame will never touch its resources again.
+		static_cast<ReleaseQueue*>(pUserData1)->OnFrameCompleted();
+	};
+
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	WGPUQueueWorkDoneCallbackInfo queueWorkDoneInfo{};
+	queueWorkDoneInfo.mode = WGPUCallbackMode_AllowProcessEvents;
+	queueWorkDoneInfo.callback = onQueueWorkDone;
+	queueWorkDoneInfo.userdata1 = this;
+	wgpuQueueOnSubmittedWorkDone(queue, queueWorkDoneInfo);
+#else
+	wgpuQueueOnSubmittedWorkDone(queue, onQueueWorkDone, this);
+#endif
+
+	++m_recordingFrame;
+}
+
+void ReleaseQueue::OnFrameCompleted()
+{
+	++m_completedFrames;
+}
+
+size_t ReleaseQueue::Collect(std::chrono::microseconds budget)
+{
+	using Clock = std::chrono::steady_clock;
+	const Clock::time_point start = Clock::now();
+
+	size_t released = 0;
+	// Entries are pushed in frame order, so stop at the first one still in flight
+	while (!m_pending.empty() && m_pending.front().frame < m_completedFrames)
+	{
+		m_pending.front().release();
+		m_pending.pop_front();
+		++released;
+
+		if (budget.count() > 0 && (Clock::now() - start) >= budget)
+			break;
+	}
+
+	return released;
+}
+
+void ReleaseQueue::Flush()
+{
+	while (!m_pending.empty())
+	{
+		m_pending.front().release();
+		m_pending.pop_front();
+	}
+}
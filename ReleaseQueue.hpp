@@ -0,0 +1,73 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+
+/**
+ * Parks released WebGPU objects until the GPU has finished the frame that last used them.
+ *
+ * Every submitted frame registers a queue work done callback (the frame "fence"). Since the queue
+ * completes work in submission order, counting completed callbacks is enough to know which frames
+ * are retired. Objects handed to Release() are tagged with the frame currently being recorded and
+ * are destroyed in bulk by Collect() once that frame has completed.
+ */
+class ReleaseQueue
+{
+public:
+	ReleaseQueue();
+	~ReleaseQueue();
+
+	ReleaseQueue(const ReleaseQueue&) = delete;
+	ReleaseQueue& operator=(const ReleaseQueue&) = delete;
+
+	/*
+	 * Take ownership of a Wgpu<Type>Ptr and defer its release.
+	 * The deleter is kept so custom deleters (eg. surface unconfigure) still run.
+	 */
+	template <class T, class Deleter>
+	void Release(std::unique_ptr<T, Deleter> ptr)
+	{
+		if (!ptr)
+			return;
+
+		Deleter deleter = ptr.get_deleter();
+		T* handle = ptr.release();
+		m_pending.push_back({ m_recordingFrame, [handle, deleter]() { deleter(handle); } });
+	}
+
+	// Signal the end of the frame being recorded. Must be called right after the frame's submit.
+	void EndFrame(WGPUQueue queue);
+
+	/*
+	 * Destroy all objects whose frame has completed. A non zero budget limits the time spent
+	 * destroying objects; whatever is left over is retried on the next call.
+	 * Returns the number of objects destroyed.
+	 */
+	size_t Collect(std::chrono::microseconds budget = std::chrono::microseconds::zero());
+
+	// Destroy everything regardless of GPU progress. Only safe once the device is idle or being torn down.
+	void Flush();
+
+	uint64_t SubmittedFrames() const { return m_recordingFrame; }
+	uint64_t CompletedFrames() const { return m_completedFrames; }
+	size_t PendingCount() const { return m_pending.size(); }
+
+private:
+	struct Pending
+	{
+		uint64_t frame;
+		std::function<void()> release;
+	};
+
+	// The callback keeps a pointer to this, so the address must not change while frames are in flight
+	void OnFrameCompleted();
+
+	std::deque<Pending> m_pending;
+	uint64_t m_recordingFrame;
+	uint64_t m_completedFrames;
+};
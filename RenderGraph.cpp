@@ -0,0 +1,472 @@
+#include "RenderGraph.hpp"
+#include "GpuMemory.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace {
+
+WGPUTextureDescriptor Describe(const RenderGraph::TextureDesc& desc)
+{
+	WGPUTextureDescriptor textureDesc{};
+	textureDesc.dimension = WGPUTextureDimension_2D;
+	textureDesc.size = {desc.width, desc.height, 1};
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = desc.sampleCount;
+	textureDesc.format = desc.format;
+	textureDesc.usage = desc.usage;
+	return textureDesc;
+}
+
+} // anonymous namespace
+
+bool RenderGraph::TextureDesc::operator==(const TextureDesc& other) const
+{
+	return width == other.width && height == other.height && format == other.format
+		&& sampleCount == other.sampleCount && usage == other.usage;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Read(Resource resource)
+{
+	m_graph.AddAccess(m_pass, resource, true, false);
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::Write(Resource resource)
+{
+	m_graph.AddAccess(m_pass, resource, false, true);
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::KeepAlive()
+{
+	m_graph.m_passes[m_pass].keepAlive = true;
+	return *this;
+}
+
+RenderGraph::PassBuilder& RenderGraph::PassBuilder::OcclusionQuerySet(WGPUQuerySet querySet)
+{
+	m_graph.m_passes[m_pass].occlusionQuerySet = querySet;
+	return *this;
+}
+
+RenderGraph::RenderGraph(ReleaseQueue& releaseQueue) :
+	m_releaseQueue(releaseQueue),
+	m_device(nullptr),
+	m_frame(0),
+	m_nextPhysicalId(0),
+	m_timestampQuerySet(nullptr),
+	m_timestampBegin(0),
+	m_timestampEnd(0)
+{
+}
+
+void RenderGraph::Begin(WGPUDevice device)
+{
+	m_device = device;
+	++m_frame;
+	m_resources.clear();
+	m_passes.clear();
+	m_order.clear();
+	m_stats = {};
+	m_timestampQuerySet = nullptr;
+}
+
+void RenderGraph::Reset()
+{
+	m_resources.clear();
+	m_passes.clear();
+	m_order.clear();
+	m_physical.clear();
+	m_device = nullptr;
+	m_timestampQuerySet = nullptr;
+}
+
+RenderGraph::Resource RenderGraph::Import(const char* name, WGPUTexture texture, WGPUTextureView view)
+{
+	m_resources.push_back({name, TextureDesc{}, true, false, texture, view, kNoPhysical, 0, 0});
+	return static_cast<Resource>(m_resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::CreateTexture(const char* name, const TextureDesc& desc)
+{
+	m_resources.push_back({name, desc, false, false, nullptr, nullptr, kNoPhysical, 0, 0});
+	return static_cast<Resource>(m_resources.size() - 1);
+}
+
+void RenderGraph::MarkOutput(Resource resource)
+{
+	m_resources[resource].output = true;
+}
+
+void RenderGraph::SetTimestampWrites(WGPUQuerySet querySet, uint32_t beginIndex, uint32_t endIndex)
+{
+	m_timestampQuerySet = querySet;
+	m_timestampBegin = beginIndex;
+	m_timestampEnd = endIndex;
+}
+
+RenderGraph::PassBuilder RenderGraph::AddRenderPass(const char* name, const std::vector<ColorAttachment>& colors, const DepthAttachment& depth, RenderFn fn)
+{
+	const uint32_t pass = static_cast<uint32_t>(m_passes.size());
+	m_passes.push_back({name, true, false, false, nullptr, colors, depth, std::move(fn), nullptr, {}});
+
+	for (const ColorAttachment &color : colors)
+	{
+		AddAccess(pass, color.texture, color.loadOp == WGPULoadOp_Load, true);
+		if (color.resolveTarget != kNoResource)
+			AddAccess(pass, color.resolveTarget, false, true);
+	}
+	if (depth.texture != kNoResource)
+		AddAccess(pass, depth.texture, depth.loadOp == WGPULoadOp_Load, true);
+
+	return PassBuilder(*this, pass);
+}
+
+RenderGraph::PassBuilder RenderGraph::AddPass(const char* name, EncodeFn fn)
+{
+	m_passes.push_back({name, false, false, false, nullptr, {}, {}, nullptr, std::move(fn), {}});
+	return PassBuilder(*this, static_cast<uint32_t>(m_passes.size() - 1));
+}
+
+void RenderGraph::AddAccess(uint32_t pass, Resource resource, bool read, bool write)
+{
+	std::vector<Access> &accesses = m_passes[pass].accesses;
+	auto it = std::find_if(accesses.begin(), accesses.end(), [resource](const Access& access) { return access.resource == resource; });
+	if (it == accesses.end())
+	{
+		accesses.push_back({resource, read, write, false});
+		return;
+	}
+	it->read |= read;
+	it->write |= write;
+}
+
+const RenderGraph::Access* RenderGraph::FindAccess(const Pass& pass, Resource resource) const
+{
+	for (const Access &access : pass.accesses)
+		if (access.resource == resource)
+			return &access;
+	return nullptr;
+}
+
+bool RenderGraph::Compile()
+{
+	TRACE_SCOPE("RenderGraphCompile");
+
+	Cull();
+	Order();
+	return Allocate();
+}
+
+void RenderGraph::Cull()
+{
+	// Backwards from the outputs: a pass is live when a later live pass or an output needs one of its writes
+	std::vector<bool> needed(m_resources.size());
+	for (size_t i = 0; i < m_resources.size(); ++i)
+		needed[i] = m_resources[i].output;
+
+	for (auto pass = m_passes.rbegin(); pass != m_passes.rend(); ++pass)
+	{
+		pass->live = pass->keepAlive;
+		for (const Access &access : pass->accesses)
+			pass->live |= access.write && needed[access.resource];
+		if (!pass->live)
+			continue;
+
+		for (Access &access : pass->accesses)
+		{
+			if (!access.write)
+				continue;
+			access.store = needed[access.resource] || m_resources[access.resource].imported;
+			// Overwritten here, so whatever earlier passes wrote is dead unless read below
+			needed[access.resource] = false;
+		}
+		for (const Access &access : pass->accesses)
+			if (access.read)
+				needed[access.resource] = true;
+	}
+}
+
+void RenderGraph::Order()
+{
+	const uint32_t passCount = static_cast<uint32_t>(m_passes.size());
+
+	// A pass depends on the earlier passes touching a resource it writes, or writing one it touches
+	std::vector<std::vector<uint32_t>> dependencies(passCount);
+	for (uint32_t later = 0; later < passCount; ++later)
+	{
+		if (!m_passes[later].live)
+			continue;
+		for (uint32_t earlier = 0; earlier < later; ++earlier)
+		{
+			if (!m_passes[earlier].live)
+				continue;
+			for (const Access &access : m_passes[later].accesses)
+			{
+				const Access *other = FindAccess(m_passes[earlier], access.resource);
+				if (other && (other->write || access.write))
+				{
+					dependencies[later].push_back(earlier);
+					break;
+				}
+			}
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> dependents(passCount);
+	for (uint32_t pass = 0; pass < passCount; ++pass)
+		for (uint32_t dependency : dependencies[pass])
+			dependents[dependency].push_back(pass);
+
+	// Kahn's algorithm from the last consumers backwards, picking the ready pass that produces for the
+	// most recently placed one. Producers then run just before their consumers, keeping lifetimes short.
+	std::vector<uint32_t> position(passCount, 0);  // Counted from the end
+	std::vector<uint32_t> waiting(passCount);
+	std::vector<uint32_t> ready;
+	for (uint32_t pass = 0; pass < passCount; ++pass)
+	{
+		if (!m_passes[pass].live)
+		{
+			m_stats.culledPasses++;
+			continue;
+		}
+		waiting[pass] = static_cast<uint32_t>(dependents[pass].size());
+		if (waiting[pass] == 0)
+			ready.push_back(pass);
+	}
+
+	while (!ready.empty())
+	{
+		auto best = ready.begin();
+		int64_t bestConsumer = -1;
+		for (auto it = ready.begin(); it != ready.end(); ++it)
+		{
+			int64_t consumer = -1;
+			for (uint32_t dependent : dependents[*it])
+				consumer = std::max<int64_t>(consumer, position[dependent]);
+			if (consumer > bestConsumer || (consumer == bestConsumer && *it < *best))
+			{
+				best = it;
+				bestConsumer = consumer;
+			}
+		}
+
+		const uint32_t pass = *best;
+		ready.erase(best);
+		position[pass] = static_cast<uint32_t>(m_order.size());
+		m_order.push_back(pass);
+
+		for (uint32_t dependency : dependencies[pass])
+			if (--waiting[dependency] == 0)
+				ready.push_back(dependency);
+	}
+	std::reverse(m_order.begin(), m_order.end());
+	m_stats.passes = static_cast<uint32_t>(m_order.size());
+}
+
+bool RenderGraph::Allocate()
+{
+	// Lifetimes of the transient textures over the execution order, unused ones get no texture
+	std::vector<Resource> transients;
+	std::vector<bool> seen(m_resources.size(), false);
+	for (uint32_t position = 0; position < m_order.size(); ++position)
+	{
+		for (const Access &access : m_passes[m_order[position]].accesses)
+		{
+			ResourceNode &resource = m_resources[access.resource];
+			if (resource.imported)
+				continue;
+			if (!seen[access.resource])
+			{
+				seen[access.resource] = true;
+				resource.firstUse = position;
+				transients.push_back(access.resource);
+			}
+			resource.lastUse = position;
+		}
+	}
+
+	// Textures idle for a while are no longer part of the frame, eg. after a resize
+	for (auto it = m_physical.begin(); it != m_physical.end();)
+	{
+		if (!it->texture)
+			it = m_physical.erase(it);
+		else if (it->lastFrame + kMaxIdleFrames < m_frame)
+		{
+			m_releaseQueue.Release(std::move(it->view));
+			m_releaseQueue.Release(std::move(it->texture));
+			it = m_physical.erase(it);
+		}
+		else
+		{
+			it->usedThisFrame = false;
+			++it;
+		}
+	}
+
+	// Transients are already in order of their first use
+	for (Resource id : transients)
+	{
+		ResourceNode &resource = m_resources[id];
+		auto physical = std::find_if(m_physical.begin(), m_physical.end(), [&resource](const PhysicalTexture& texture) {
+			return texture.texture && texture.desc == resource.desc && (!texture.usedThisFrame || texture.busyUntil < resource.firstUse);
+		});
+
+		if (physical == m_physical.end())
+		{
+			TRACE_SCOPE("RenderGraphCreateTexture");
+
+			// Evicting other graph textures only empties them, m_physical keeps its layout until the next frame
+			const uint64_t id = m_nextPhysicalId++;
+			WgpuTexturePtr created = GpuMemory::Global().CreateTexture(m_device, Describe(resource.desc), [this, id]() { Evict(id); });
+			PhysicalTexture texture{resource.desc, std::move(created), WgpuTextureViewPtr(nullptr, wgpuTextureViewRelease), 0, false, 0, id};
+			if (!texture.texture)
+			{
+				std::cerr << "Could not create the render graph texture " << resource.name << std::endl;
+				return false;
+			}
+			texture.view = WgpuTextureViewPtr(wgpuTextureCreateView(texture.texture.get(), nullptr), wgpuTextureViewRelease);
+			m_physical.push_back(std::move(texture));
+			physical = m_physical.end() - 1;
+		}
+
+		if (!physical->usedThisFrame)
+		{
+			m_stats.physicalTextures++;
+			m_stats.physicalBytes += GpuMemory::TextureSize(Describe(physical->desc));
+		}
+		GpuMemory::Global().Touch(physical->texture.get());
+		physical->usedThisFrame = true;
+		physical->busyUntil = resource.lastUse;
+		physical->lastFrame = m_frame;
+		resource.physical = static_cast<uint32_t>(physical - m_physical.begin());
+		resource.texture = physical->texture.get();
+		resource.view = physical->view.get();
+
+		m_stats.transientTextures++;
+		m_stats.transientBytes += GpuMemory::TextureSize(Describe(resource.desc));
+	}
+	return true;
+}
+
+void RenderGraph::Evict(uint64_t id)
+{
+	auto physical = std::find_if(m_physical.begin(), m_physical.end(), [id](const PhysicalTexture& texture) { return texture.id == id; });
+	if (physical == m_physical.end())
+		return;
+
+	// Resources of the frame being recorded keep the raw handles, which stay valid until it completes
+	m_releaseQueue.Release(std::move(physical->view));
+	m_releaseQueue.Release(std::move(physical->texture));
+}
+
+WgpuCommandBufferPtr RenderGraph::Execute(const char* label)
+{
+	TRACE_SCOPE("RenderGraphExecute");
+
+	WGPUCommandEncoderDescriptor encoderDesc{};
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	encoderDesc.label = {label, WGPU_STRLEN};
+#else
+	encoderDesc.label = label;
+#endif
+	WgpuCommandEncoderPtr encoder(wgpuDeviceCreateCommandEncoder(m_device, &encoderDesc), wgpuCommandEncoderRelease);
+
+	// Timestamps bracket the render passes, compute and copy passes record into the encoder directly
+	constexpr uint32_t kNoPass = ~0u;
+	uint32_t firstRender = kNoPass;
+	uint32_t lastRender = kNoPass;
+	for (uint32_t index : m_order)
+	{
+		if (!m_passes[index].render)
+			continue;
+		if (firstRender == kNoPass)
+			firstRender = index;
+		lastRender = index;
+	}
+
+	for (uint32_t index : m_order)
+	{
+		const Pass &pass = m_passes[index];
+		TRACE_SCOPE(pass.name.c_str());
+
+		if (!pass.render)
+		{
+			pass.encodeFn(encoder.get());
+			continue;
+		}
+
+		std::vector<WGPURenderPassColorAttachment> colorAttachments(pass.colors.size());
+		for (size_t i = 0; i < pass.colors.size(); ++i)
+		{
+			const ColorAttachment &color = pass.colors[i];
+			WGPURenderPassColorAttachment &attachment = colorAttachments[i];
+			attachment.view = View(color.texture);
+			attachment.resolveTarget = color.resolveTarget != kNoResource ? View(color.resolveTarget) : nullptr;
+			attachment.loadOp = color.loadOp;
+			attachment.storeOp = FindAccess(pass, color.texture)->store ? WGPUStoreOp_Store : WGPUStoreOp_Discard;
+			attachment.clearValue = color.clearValue;
+#if !defined(WEBGPU_BACKEND_WGPU)
+			attachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif
+		}
+
+		WGPURenderPassDepthStencilAttachment depthAttachment{};
+		if (pass.depth.texture != kNoResource)
+		{
+			depthAttachment.view = View(pass.depth.texture);
+			depthAttachment.depthClearValue = pass.depth.clearValue;
+			depthAttachment.depthLoadOp = pass.depth.loadOp;
+			depthAttachment.depthStoreOp = FindAccess(pass, pass.depth.texture)->store ? WGPUStoreOp_Store : WGPUStoreOp_Discard;
+			depthAttachment.depthReadOnly = false;
+			// No stencil aspect, so these must be left undefined
+			depthAttachment.stencilLoadOp = WGPULoadOp_Undefined;
+			depthAttachment.stencilStoreOp = WGPUStoreOp_Undefined;
+			depthAttachment.stencilReadOnly = false;
+		}
+
+		WGPURenderPassDescriptor passDesc{};
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+		passDesc.label = {pass.name.c_str(), WGPU_STRLEN};
+#else
+		passDesc.label = pass.name.c_str();
+#endif
+		passDesc.colorAttachmentCount = colorAttachments.size();
+		passDesc.colorAttachments = colorAttachments.data();
+		passDesc.depthStencilAttachment = pass.depth.texture != kNoResource ? &depthAttachment : nullptr;
+		passDesc.occlusionQuerySet = pass.occlusionQuerySet;
+
+		WgpuPassTimestampWrites timestampWrites{};
+		if (m_timestampQuerySet && (index == firstRender || index == lastRender))
+		{
+			timestampWrites.querySet = m_timestampQuerySet;
+			timestampWrites.beginningOfPassWriteIndex = index == firstRender ? m_timestampBegin : WGPU_QUERY_SET_INDEX_UNDEFINED;
+			timestampWrites.endOfPassWriteIndex = index == lastRender ? m_timestampEnd : WGPU_QUERY_SET_INDEX_UNDEFINED;
+			passDesc.timestampWrites = &timestampWrites;
+		}
+
+		WgpuRenderPassEncoderPtr renderPass(wgpuCommandEncoderBeginRenderPass(encoder.get(), &passDesc), wgpuRenderPassEncoderRelease);
+		pass.renderFn(renderPass.get());
+		wgpuRenderPassEncoderEnd(renderPass.get());
+	}
+
+	WGPUCommandBufferDescriptor commandDesc{};
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	commandDesc.label = {label, WGPU_STRLEN};
+#else
+	commandDesc.label = label;
+#endif
+	return WgpuCommandBufferPtr(wgpuCommandEncoderFinish(encoder.get(), &commandDesc), wgpuCommandBufferRelease);
+}
+
+WGPUTexture RenderGraph::Texture(Resource resource) const
+{
+	return m_resources[resource].texture;
+}
+
+WGPUTextureView RenderGraph::View(Resource resource) const
+{
+	return m_resources[resource].view;
+}
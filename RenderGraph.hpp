@@ -0,0 +1,199 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "ReleaseQueue.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Records a frame as passes that declare the textures they read and write, then culls, orders and
+ * encodes them into a single command buffer.
+ *
+ * Each frame starts with Begin(). Textures are either imported (such as the surface texture) or
+ * transient, described by size and format and only valid during the frame. Compile() walks back
+ * from the imported textures marked as outputs and drops every pass whose writes nothing live reads,
+ * unless it is marked with KeepAlive(). The remaining passes run after the passes they depend on,
+ * producers as late as possible before their consumers so transient lifetimes stay short.
+ *
+ * Transient textures whose lifetimes do not overlap share one physical texture when their
+ * descriptors match, and physical textures are kept across frames until they go unused for a few
+ * frames, when they are handed to the release queue. They are streamable in GpuMemory's budget: an
+ * evicted texture is handed to the release queue too, and recreated the next time a frame needs it.
+ * Attachments only store their contents when a later pass reads them or they are imported.
+ *
+ * A read sees what the passes added before the reader wrote, whatever order they end up running in.
+ */
+class RenderGraph
+{
+public:
+	using Resource = uint32_t;
+	static constexpr Resource kNoResource = ~0u;
+
+	struct TextureDesc
+	{
+		uint32_t width;
+		uint32_t height;
+		WGPUTextureFormat format;
+		uint32_t sampleCount = 1;
+		WGPUTextureUsage usage = WGPUTextureUsage_RenderAttachment;
+
+		bool operator==(const TextureDesc& other) const;
+	};
+
+	// A Load reads the texture's previous contents, a Clear does not
+	struct ColorAttachment
+	{
+		Resource texture = kNoResource;
+		Resource resolveTarget = kNoResource;
+		WGPULoadOp loadOp = WGPULoadOp_Clear;
+		WGPUColor clearValue = {0, 0, 0, 1};
+	};
+
+	// Depth only formats, the stencil aspect is left untouched
+	struct DepthAttachment
+	{
+		Resource texture = kNoResource;
+		WGPULoadOp loadOp = WGPULoadOp_Clear;
+		float clearValue = 1.0f;
+	};
+
+	using RenderFn = std::function<void(WGPURenderPassEncoder pass)>;
+	using EncodeFn = std::function<void(WGPUCommandEncoder encoder)>;
+
+	// Declares the accesses of the pass it was returned for
+	class PassBuilder
+	{
+	public:
+		PassBuilder(RenderGraph& graph, uint32_t pass) : m_graph(graph), m_pass(pass) {}
+
+		PassBuilder& Read(Resource resource);
+		PassBuilder& Write(Resource resource);
+		// Run even when nothing reads what it writes, eg. for readbacks or queries
+		PassBuilder& KeepAlive();
+		// The set the render pass's occlusion queries write into
+		PassBuilder& OcclusionQuerySet(WGPUQuerySet querySet);
+
+	private:
+		RenderGraph& m_graph;
+		uint32_t m_pass;
+	};
+
+	struct Stats
+	{
+		uint32_t passes = 0;
+		uint32_t culledPasses = 0;
+		uint32_t transientTextures = 0;
+		uint32_t physicalTextures = 0;  // Backing the transient textures this frame
+		uint64_t transientBytes = 0;    // Without aliasing
+		uint64_t physicalBytes = 0;
+	};
+
+	// Textures released by the graph are parked in releaseQueue until the GPU is done with them
+	explicit RenderGraph(ReleaseQueue& releaseQueue);
+
+	// Drop the passes and resources of the previous frame, keeping the physical textures
+	void Begin(WGPUDevice device);
+	// Release every physical texture, eg. before the device
+	void Reset();
+
+	Resource Import(const char* name, WGPUTexture texture, WGPUTextureView view);
+	Resource CreateTexture(const char* name, const TextureDesc& desc);
+	// Passes contributing to an output are never culled
+	void MarkOutput(Resource resource);
+	// Write GPU timestamps at the start of the first render pass and the end of the last, this frame only
+	void SetTimestampWrites(WGPUQuerySet querySet, uint32_t beginIndex, uint32_t endIndex);
+
+	// The attachments are declared as the pass's accesses
+	PassBuilder AddRenderPass(const char* name, const std::vector<ColorAttachment>& colors, const DepthAttachment& depth, RenderFn fn);
+	// A compute or copy pass recording directly into the frame's encoder
+	PassBuilder AddPass(const char* name, EncodeFn fn);
+
+	// Cull, order and allocate. Returns false when a texture could not be created
+	bool Compile();
+	// Encode the compiled passes into one command buffer, to be submitted by the caller
+	WgpuCommandBufferPtr Execute(const char* label);
+
+	// Valid from Compile() until the next Begin(), for binding graph textures inside a pass
+	WGPUTexture Texture(Resource resource) const;
+	WGPUTextureView View(Resource resource) const;
+
+	const Stats& GetStats() const { return m_stats; }
+
+private:
+	static constexpr uint32_t kNoPhysical = ~0u;
+	// Frames a physical texture may go unused before it is released
+	static constexpr uint64_t kMaxIdleFrames = 3;
+
+	struct ResourceNode
+	{
+		std::string name;
+		TextureDesc desc;
+		bool imported;
+		bool output;
+		WGPUTexture texture;
+		WGPUTextureView view;
+		uint32_t physical;
+		uint32_t firstUse;  // Positions in the execution order
+		uint32_t lastUse;
+	};
+
+	struct Access
+	{
+		Resource resource;
+		bool read;
+		bool write;
+		bool store;  // Set by Compile(), whether the contents written are needed afterwards
+	};
+
+	struct Pass
+	{
+		std::string name;
+		bool render;
+		bool keepAlive;
+		bool live;
+		WGPUQuerySet occlusionQuerySet;
+		std::vector<ColorAttachment> colors;
+		DepthAttachment depth;
+		RenderFn renderFn;
+		EncodeFn encodeFn;
+		std::vector<Access> accesses;
+	};
+
+	struct PhysicalTexture
+	{
+		TextureDesc desc;
+		WgpuTexturePtr texture;
+		WgpuTextureViewPtr view;
+		uint32_t busyUntil;  // Last use in this frame's execution order
+		bool usedThisFrame;
+		uint64_t lastFrame;  // Last frame it backed a transient texture
+		uint64_t id;         // Identifies it to its eviction callback, null texture once evicted
+	};
+
+	void AddAccess(uint32_t pass, Resource resource, bool read, bool write);
+	const Access* FindAccess(const Pass& pass, Resource resource) const;
+	void Cull();
+	void Order();
+	bool Allocate();
+	// GpuMemory's eviction callback, the texture stays valid for the frame being recorded
+	void Evict(uint64_t id);
+
+	ReleaseQueue& m_releaseQueue;
+	WGPUDevice m_device;
+	uint64_t m_frame;
+	uint64_t m_nextPhysicalId;
+
+	std::vector<ResourceNode> m_resources;
+	std::vector<Pass> m_passes;
+	std::vector<uint32_t> m_order;  // Live passes in execution order
+	std::vector<PhysicalTexture> m_physical;
+	Stats m_stats;
+
+	WGPUQuerySet m_timestampQuerySet;  // Null when the frame writes no timestamps
+	uint32_t m_timestampBegin;
+	uint32_t m_timestampEnd;
+};
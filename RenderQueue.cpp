@@ -0,0 +1,139 @@
+#include "RenderQueue.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstring>
+
+namespace {
+
+// Map a float to an unsigned integer with the same ordering
+uint32_t OrderedFloatBits(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+} // anonymous namespace
+
+uint64_t RenderQueue::MakeKey(Pass pass, uint32_t pipelineId, uint32_t materialId, float depth)
+{
+	assert(pipelineId <= kMaxPipelineId && materialId <= kMaxMaterialId);
+
+	const uint64_t passBits = static_cast<uint64_t>(pass) << 60;
+	const uint64_t pipelineBits = pipelineId & kMaxPipelineId;
+	const uint64_t materialBits = materialId & kMaxMaterialId;
+	const uint64_t depthBits = OrderedFloatBits(depth);
+
+	if (pass == Pass::Transparent)
+		return passBits | ((~depthBits & 0xFFFFFFFFull) << 28) | (pipelineBits << 16) | materialBits;
+
+	return passBits | (pipelineBits << 48) | (materialBits << 32) | depthBits;
+}
+
+void RenderQueue::Submit(const DrawPacket& packet)
+{
+	m_packets.push_back(packet);
+}
+
+void RenderQueue::Sort()
+{
+	const size_t count = m_packets.size();
+	m_order.resize(count);
+	m_scratch.resize(count);
+	for (size_t i = 0; i < count; ++i)
+		m_order[i] = static_cast<uint32_t>(i);
+
+	// LSD radix sort, one byte per pass. Each pass is stable, so the final order is by full key
+	// with ties kept in submission order.
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		std::array<uint32_t, 256> histogram{};
+		for (uint32_t index : m_order)
+			++histogram[(m_packets[index].key >> shift) & 0xFF];
+
+		// Every key shares this byte, the pass would not move anything
+		if (histogram[(m_packets.empty() ? 0 : (m_packets[0].key >> shift) & 0xFF)] == count)
+			continue;
+
+		uint32_t offset = 0;
+		for (uint32_t &bucket : histogram)
+		{
+			const uint32_t bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+
+		for (uint32_t index : m_order)
+			m_scratch[histogram[(m_packets[index].key >> shift) & 0xFF]++] = index;
+
+		m_order.swap(m_scratch);
+	}
+}
+
+void RenderQueue::Execute(WGPURenderPassEncoder renderPass)
+{
+	WGPURenderPipeline pipeline = nullptr;
+	WGPUBindGroup bindGroup = nullptr;
+	WGPUBuffer vertexBuffer = nullptr;
+	WGPUBuffer indexBuffer = nullptr;
+
+	// Sort() may not have been called since the last Submit()
+	if (m_order.size() != m_packets.size())
+		Sort();
+
+	for (uint32_t index : m_order)
+	{
+		const DrawPacket &packet = m_packets[index];
+
+		if (packet.pipeline != pipeline)
+		{
+			wgpuRenderPassEncoderSetPipeline(renderPass, packet.pipeline);
+			pipeline = packet.pipeline;
+			++m_stats.pipelineChanges;
+		}
+		else
+			++m_stats.stateChangesAvoided;
+
+		if (packet.bindGroup != bindGroup)
+		{
+			wgpuRenderPassEncoderSetBindGroup(renderPass, 0, packet.bindGroup, 0, nullptr);
+			bindGroup = packet.bindGroup;
+			++m_stats.bindGroupChanges;
+		}
+		else
+			++m_stats.stateChangesAvoided;
+
+		if (packet.vertexBuffer != vertexBuffer)
+		{
+			wgpuRenderPassEncoderSetVertexBuffer(renderPass, 0, packet.vertexBuffer, 0, packet.vertexBufferSize);
+			vertexBuffer = packet.vertexBuffer;
+			++m_stats.vertexBufferChanges;
+		}
+		else
+			++m_stats.stateChangesAvoided;
+
+		if (packet.indexBuffer != indexBuffer)
+		{
+			wgpuRenderPassEncoderSetIndexBuffer(renderPass, packet.indexBuffer, WGPUIndexFormat_Uint32, 0, packet.indexBufferSize);
+			indexBuffer = packet.indexBuffer;
+			++m_stats.indexBufferChanges;
+		}
+		else
+			++m_stats.stateChangesAvoided;
+
+		wgpuRenderPassEncoderDrawIndexed(renderPass, packet.indexCount, 1, packet.firstIndex, 0, packet.firstInstance);
+		++m_stats.draws;
+	}
+}
+
+void RenderQueue::Clear()
+{
+	m_packets.clear();
+	m_order.clear();
+}
+
+void RenderQueue::ResetStats()
+{
+	m_stats = Stats{};
+}
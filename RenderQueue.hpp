@@ -0,0 +1,72 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Collects the draws of a frame as packets tagged with a 64 bit sort key, radix sorts them and
+ * records them into a render pass while skipping state that is already bound.
+ *
+ * Key layout, from the most significant bits:
+ *   opaque:       pass (4) | pipeline (12) | material (16) | depth (32, front-to-back)
+ *   transparent:  pass (4) | depth (32, back-to-front) | pipeline (12) | material (16)
+ * Opaque draws are grouped by state and sorted front-to-back within a group so the hardware
+ * early-Z test still rejects most hidden fragments. Transparent draws must blend in depth order,
+ * so depth takes precedence over state for them.
+ */
+class RenderQueue
+{
+public:
+	enum class Pass : uint8_t
+	{
+		Opaque = 0,
+		Transparent = 1,
+	};
+
+	struct DrawPacket
+	{
+		uint64_t key;
+		WGPURenderPipeline pipeline;
+		WGPUBindGroup bindGroup;
+		WGPUBuffer vertexBuffer;
+		uint64_t vertexBufferSize;
+		WGPUBuffer indexBuffer;
+		uint64_t indexBufferSize;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		uint32_t firstInstance;  // Index of the object's data in the instance buffer
+	};
+
+	struct Stats
+	{
+		uint64_t draws;
+		uint64_t pipelineChanges;
+		uint64_t bindGroupChanges;
+		uint64_t vertexBufferChanges;
+		uint64_t indexBufferChanges;
+		uint64_t stateChangesAvoided;  // Redundant Set* calls that were not recorded
+	};
+
+	static constexpr uint32_t kMaxPipelineId = (1u << 12) - 1;
+	static constexpr uint32_t kMaxMaterialId = (1u << 16) - 1;
+
+	// depth is the view space depth, smaller is closer to the camera
+	static uint64_t MakeKey(Pass pass, uint32_t pipelineId, uint32_t materialId, float depth);
+
+	void Submit(const DrawPacket& packet);
+	void Sort();
+	void Execute(WGPURenderPassEncoder renderPass);
+	void Clear();
+
+	size_t Size() const { return m_packets.size(); }
+	const Stats& GetStats() const { return m_stats; }  // Accumulated over every Execute()
+	void ResetStats();
+
+private:
+	std::vector<DrawPacket> m_packets;
+	std::vector<uint32_t> m_order;    // Indices into m_packets, in sorted order
+	std::vector<uint32_t> m_scratch;  // Radix sort ping-pong buffer
+	Stats m_stats{};
+};
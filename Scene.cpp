@@ -0,0 +1,296 @@
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <type_traits>
+
+template <class Fn>
+void Scene::ForEachPool(Fn&& fn)
+{
+	fn(m_positionX); fn(m_positionY); fn(m_positionZ);
+	fn(m_rotationX); fn(m_rotationY); fn(m_rotationZ); fn(m_rotationW);
+	fn(m_scaleX); fn(m_scaleY); fn(m_scaleZ);
+	fn(m_localCenterX); fn(m_localCenterY); fn(m_localCenterZ);
+	fn(m_localExtentX); fn(m_localExtentY); fn(m_localExtentZ);
+	fn(m_worldCenterX); fn(m_worldCenterY); fn(m_worldCenterZ);
+	fn(m_worldExtentX); fn(m_worldExtentY); fn(m_worldExtentZ);
+	fn(m_materialIds);
+	fn(m_instances);
+	fn(m_parents);
+	fn(m_levels);
+	fn(m_handles);
+	fn(m_dirty);
+	fn(m_changed);
+}
+
+Scene::Handle Scene::Create(const ObjectDesc& desc)
+{
+	uint32_t parent = kNoParent;
+	uint32_t level = 0;
+	if (desc.parent != kInvalidHandle)
+	{
+		assert(IsAlive(desc.parent));
+		parent = m_handleToIndex[desc.parent];
+		level = m_levels[parent] + 1;
+	}
+
+	const uint32_t index = static_cast<uint32_t>(Size());
+	Handle handle;
+	if (!m_freeHandles.empty())
+	{
+		handle = m_freeHandles.back();
+		m_freeHandles.pop_back();
+		m_handleToIndex[handle] = index;
+	}
+	else
+	{
+		handle = static_cast<Handle>(m_handleToIndex.size());
+		m_handleToIndex.push_back(index);
+	}
+
+	ForEachPool([index](auto& pool) { pool.Resize(index + 1); });
+
+	m_positionX[index] = desc.position.x;
+	m_positionY[index] = desc.position.y;
+	m_positionZ[index] = desc.position.z;
+	m_rotationX[index] = desc.rotation.x;
+	m_rotationY[index] = desc.rotation.y;
+	m_rotationZ[index] = desc.rotation.z;
+	m_rotationW[index] = desc.rotation.w;
+	m_scaleX[index] = desc.scale.x;
+	m_scaleY[index] = desc.scale.y;
+	m_scaleZ[index] = desc.scale.z;
+	m_localCenterX[index] = desc.boundsCenter.x;
+	m_localCenterY[index] = desc.boundsCenter.y;
+	m_localCenterZ[index] = desc.boundsCenter.z;
+	m_localExtentX[index] = desc.boundsExtents.x;
+	m_localExtentY[index] = desc.boundsExtents.y;
+	m_localExtentZ[index] = desc.boundsExtents.z;
+	m_materialIds[index] = desc.materialId;
+	m_parents[index] = parent;
+	m_levels[index] = level;
+	m_handles[index] = handle;
+	MarkDirty(index, kTransformDirty | kMaterialDirty);
+
+	// Appending keeps the level order as long as the object is not on an earlier level than the
+	// last one, which holds when building a hierarchy top down
+	if (m_needsRebuild || (index > 0 && level < m_levels[index - 1]))
+	{
+		m_needsRebuild = true;
+		return handle;
+	}
+
+	if (m_levelStarts.empty())
+		m_levelStarts.push_back(0);
+	if (level + 1 == m_levelStarts.size())
+		m_levelStarts.push_back(index + 1);
+	else
+		m_levelStarts.back() = index + 1;
+
+	return handle;
+}
+
+void Scene::Destroy(Handle handle)
+{
+	if (!IsAlive(handle))
+		return;
+
+	MarkDirty(m_handleToIndex[handle], kDestroyed);
+	m_needsRebuild = true;
+}
+
+bool Scene::IsAlive(Handle handle) const
+{
+	return handle < m_handleToIndex.size() && m_handleToIndex[handle] != kNoParent
+		&& !(m_dirty[m_handleToIndex[handle]] & kDestroyed);
+}
+
+void Scene::MarkDirty(uint32_t index, uint8_t bits)
+{
+	if (!m_dirty[index])
+		++m_dirtyCount;
+	m_dirty[index] |= bits;
+}
+
+void Scene::SetTransform(Handle handle, const math::Vec3& position, const math::Quat& rotation, const math::Vec3& scale)
+{
+	const uint32_t index = m_handleToIndex[handle];
+	m_positionX[index] = position.x;
+	m_positionY[index] = position.y;
+	m_positionZ[index] = position.z;
+	m_rotationX[index] = rotation.x;
+	m_rotationY[index] = rotation.y;
+	m_rotationZ[index] = rotation.z;
+	m_rotationW[index] = rotation.w;
+	m_scaleX[index] = scale.x;
+	m_scaleY[index] = scale.y;
+	m_scaleZ[index] = scale.z;
+	MarkDirty(index, kTransformDirty);
+}
+
+void Scene::SetPosition(Handle handle, const math::Vec3& position)
+{
+	const uint32_t index = m_handleToIndex[handle];
+	m_positionX[index] = position.x;
+	m_positionY[index] = position.y;
+	m_positionZ[index] = position.z;
+	MarkDirty(index, kTransformDirty);
+}
+
+void Scene::SetMaterial(Handle handle, uint32_t materialId)
+{
+	const uint32_t index = m_handleToIndex[handle];
+	m_materialIds[index] = materialId;
+	MarkDirty(index, kMaterialDirty);
+}
+
+void Scene::Rebuild()
+{
+	const size_t count = Size();
+
+	// Stable counting sort by level
+	uint32_t levelCount = 0;
+	for (size_t i = 0; i < count; ++i)
+		levelCount = std::max(levelCount, m_levels[i] + 1);
+
+	std::vector<uint32_t> levelStarts(levelCount + 1, 0);
+	for (size_t i = 0; i < count; ++i)
+		++levelStarts[m_levels[i] + 1];
+	for (uint32_t level = 0; level < levelCount; ++level)
+		levelStarts[level + 1] += levelStarts[level];
+
+	std::vector<uint32_t> order(count);
+	std::vector<uint32_t> cursor(levelStarts.begin(), levelStarts.end() - 1);
+	for (size_t i = 0; i < count; ++i)
+		order[cursor[m_levels[i]]++] = static_cast<uint32_t>(i);
+
+	// Parents come first in level order, so a dead parent is known before its children
+	std::vector<uint32_t> oldToNew(count, kNoParent);
+	std::vector<uint32_t> kept;
+	kept.reserve(count);
+	for (uint32_t old : order)
+	{
+		const uint32_t parent = m_parents[old];
+		const bool dead = (m_dirty[old] & kDestroyed) || (parent != kNoParent && oldToNew[parent] == kNoParent);
+		if (dead)
+		{
+			m_handleToIndex[m_handles[old]] = kNoParent;
+			m_freeHandles.push_back(m_handles[old]);
+			continue;
+		}
+
+		oldToNew[old] = static_cast<uint32_t>(kept.size());
+		kept.push_back(old);
+	}
+
+	ForEachPool([&kept](auto& pool) {
+		std::remove_reference_t<decltype(pool)> gathered(kept.size());
+		for (size_t i = 0; i < kept.size(); ++i)
+			gathered[i] = pool[kept[i]];
+		pool = std::move(gathered);
+	});
+
+	m_levelStarts.assign(1, 0);
+	m_dirtyCount = 0;
+	for (size_t i = 0; i < kept.size(); ++i)
+	{
+		if (m_parents[i] != kNoParent)
+			m_parents[i] = oldToNew[m_parents[i]];
+		m_handleToIndex[m_handles[i]] = static_cast<uint32_t>(i);
+
+		if (m_levels[i] + 1 == m_levelStarts.size())
+			m_levelStarts.push_back(static_cast<uint32_t>(i + 1));
+		else
+			m_levelStarts.back() = static_cast<uint32_t>(i + 1);
+
+		if (m_dirty[i])
+			++m_dirtyCount;
+	}
+}
+
+bool Scene::Update(JobSystem& jobs)
+{
+	const bool rebuilt = m_needsRebuild;
+	if (m_needsRebuild)
+	{
+		Rebuild();
+		m_needsRebuild = false;
+	}
+
+	m_changedRanges.clear();
+	if (m_dirtyCount == 0)
+		return rebuilt;
+
+	// Each level only reads results of the previous ones, so it can be split freely between threads
+	for (size_t level = 0; level + 1 < m_levelStarts.size(); ++level)
+	{
+		const size_t begin = m_levelStarts[level];
+		const size_t end = m_levelStarts[level + 1];
+		jobs.ParallelFor(end - begin, kUpdateGrain, [this, begin](size_t first, size_t last) {
+			UpdateRange(begin + first, begin + last);
+		});
+	}
+
+	m_dirtyCount = 0;
+	CollectChangedRanges();
+	return rebuilt;
+}
+
+void Scene::UpdateRange(size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		const uint8_t dirty = m_dirty[i];
+		const uint32_t parent = m_parents[i];
+		const bool parentChanged = parent != kNoParent && (m_changed[parent] & kWorldChanged);
+
+		uint8_t changed = 0;
+		InstanceData &instance = m_instances[i];
+		if ((dirty & kTransformDirty) || parentChanged)
+		{
+			const math::Mat4 local = math::Trs(
+				{m_positionX[i], m_positionY[i], m_positionZ[i]},
+				{m_rotationX[i], m_rotationY[i], m_rotationZ[i], m_rotationW[i]},
+				{m_scaleX[i], m_scaleY[i], m_scaleZ[i]});
+			instance.world = parent == kNoParent ? local : m_instances[parent].world * local;
+
+			// Box enclosing the transformed local box: the extents go through the absolute matrix
+			const math::Vec4 *c = instance.world.cols;
+			const math::Vec3 center = math::TransformPoint(instance.world, {m_localCenterX[i], m_localCenterY[i], m_localCenterZ[i]});
+			const float ex = m_localExtentX[i], ey = m_localExtentY[i], ez = m_localExtentZ[i];
+			m_worldCenterX[i] = center.x;
+			m_worldCenterY[i] = center.y;
+			m_worldCenterZ[i] = center.z;
+			m_worldExtentX[i] = std::fabs(c[0].x) * ex + std::fabs(c[1].x) * ey + std::fabs(c[2].x) * ez;
+			m_worldExtentY[i] = std::fabs(c[0].y) * ex + std::fabs(c[1].y) * ey + std::fabs(c[2].y) * ez;
+			m_worldExtentZ[i] = std::fabs(c[0].z) * ex + std::fabs(c[1].z) * ey + std::fabs(c[2].z) * ez;
+
+			changed = kWorldChanged | kInstanceWritten;
+		}
+
+		if (dirty & kMaterialDirty)
+		{
+			instance.materialId = m_materialIds[i];
+			changed |= kInstanceWritten;
+		}
+
+		m_changed[i] = changed;
+		m_dirty[i] = 0;
+	}
+}
+
+void Scene::CollectChangedRanges()
+{
+	const size_t count = Size();
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!(m_changed[i] & kInstanceWritten))
+			continue;
+
+		if (!m_changedRanges.empty() && i - (m_changedRanges.back().first + m_changedRanges.back().count) < kRangeMergeGap)
+			m_changedRanges.back().count = static_cast<uint32_t>(i + 1 - m_changedRanges.back().first);
+		else
+			m_changedRanges.push_back({static_cast<uint32_t>(i), 1});
+	}
+}
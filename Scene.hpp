@@ -0,0 +1,146 @@
+#pragma once
+
+#include "AlignedArray.hpp"
+#include "Math.hpp"
+#include "Parallel.hpp"
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Object transforms, bounds and material IDs stored as structure of arrays.
+ *
+ * Every attribute lives in its own cache line aligned pool indexed by the object's dense index.
+ * Objects are kept sorted by hierarchy level (roots first), so a level is a contiguous range whose
+ * parents all live in earlier levels and each level can be updated in parallel.
+ *
+ * World transforms are written straight into an array of InstanceData, which is uploaded to the
+ * GPU as is. Only objects whose local state changed, and their descendants, are recomputed.
+ *
+ * Handles stay valid for the lifetime of an object. Dense indices (and so instance indices) only
+ * change when Update() has to restore the level order, which it reports.
+ */
+class Scene
+{
+public:
+	using Handle = uint32_t;
+	static constexpr Handle kInvalidHandle = ~0u;
+
+	// Matches the WGSL Instance struct, 80 byte stride in a storage buffer
+	struct alignas(16) InstanceData
+	{
+		math::Mat4 world;
+		uint32_t materialId;
+		uint32_t padding[3];
+	};
+	static_assert(sizeof(InstanceData) == 80);
+
+	struct ObjectDesc
+	{
+		Handle parent = kInvalidHandle;
+		math::Vec3 position{0, 0, 0};
+		math::Quat rotation{0, 0, 0, 1};
+		math::Vec3 scale{1, 1, 1};
+		// Local space axis aligned bounds
+		math::Vec3 boundsCenter{0, 0, 0};
+		math::Vec3 boundsExtents{0, 0, 0};
+		uint32_t materialId = 0;
+	};
+
+	// A run of consecutive instances
+	struct Range
+	{
+		uint32_t first;
+		uint32_t count;
+	};
+
+	// The parent must be alive
+	Handle Create(const ObjectDesc& desc);
+
+	// The object and all of its descendants are removed on the next Update()
+	void Destroy(Handle handle);
+
+	void SetTransform(Handle handle, const math::Vec3& position, const math::Quat& rotation, const math::Vec3& scale);
+	void SetPosition(Handle handle, const math::Vec3& position);
+	void SetMaterial(Handle handle, uint32_t materialId);
+
+	bool IsAlive(Handle handle) const;
+	size_t Size() const { return m_handles.Size(); }
+
+	/*
+	 * Apply pending destroys and hierarchy changes, then recompute the world transforms and bounds of
+	 * every changed subtree. Returns true if dense indices changed, in which case every instance must
+	 * be uploaded again rather than just ChangedRanges().
+	 */
+	bool Update(JobSystem& jobs);
+
+	// Valid until the next Update()
+	uint32_t InstanceIndex(Handle handle) const { return m_handleToIndex[handle]; }
+	const InstanceData* Instances() const { return m_instances.Data(); }
+	const math::Mat4& World(Handle handle) const { return m_instances[m_handleToIndex[handle]].world; }
+
+	// Instances written by the last Update(), in ascending order. Ranges also span runs of fewer than
+	// kRangeMergeGap unchanged instances between written ones, so uploads are fewer and larger.
+	const std::vector<Range>& ChangedRanges() const { return m_changedRanges; }
+
+	math::ConstFloat3Soa WorldBoundsCenters() const { return {m_worldCenterX.Data(), m_worldCenterY.Data(), m_worldCenterZ.Data()}; }
+	math::ConstFloat3Soa WorldBoundsExtents() const { return {m_worldExtentX.Data(), m_worldExtentY.Data(), m_worldExtentZ.Data()}; }
+	const uint32_t* MaterialIds() const { return m_materialIds.Data(); }
+
+private:
+	static constexpr uint32_t kNoParent = ~0u;
+
+	// m_dirty bits
+	static constexpr uint8_t kTransformDirty = 1 << 0;
+	static constexpr uint8_t kMaterialDirty = 1 << 1;
+	static constexpr uint8_t kDestroyed = 1 << 2;
+
+	// m_changed bits, describing what the last Update() did to an object
+	static constexpr uint8_t kWorldChanged = 1 << 0;
+	static constexpr uint8_t kInstanceWritten = 1 << 1;
+
+	// Objects processed per parallel chunk. Large enough to amortize scheduling, small enough to balance.
+	static constexpr size_t kUpdateGrain = 4096;
+
+	// Rewriting a few unchanged instances is cheaper than another upload call
+	static constexpr size_t kRangeMergeGap = 16;
+
+	void MarkDirty(uint32_t index, uint8_t bits);
+
+	// Drop destroyed subtrees and restore the level order
+	void Rebuild();
+	void UpdateRange(size_t begin, size_t end);
+	void CollectChangedRanges();
+
+	// Apply fn to every per object pool, for operations that must keep them in step
+	template <class Fn>
+	void ForEachPool(Fn&& fn);
+
+	// Local transform
+	AlignedArray<float> m_positionX, m_positionY, m_positionZ;
+	AlignedArray<float> m_rotationX, m_rotationY, m_rotationZ, m_rotationW;
+	AlignedArray<float> m_scaleX, m_scaleY, m_scaleZ;
+
+	// Bounds, as center and half extents
+	AlignedArray<float> m_localCenterX, m_localCenterY, m_localCenterZ;
+	AlignedArray<float> m_localExtentX, m_localExtentY, m_localExtentZ;
+	AlignedArray<float> m_worldCenterX, m_worldCenterY, m_worldCenterZ;
+	AlignedArray<float> m_worldExtentX, m_worldExtentY, m_worldExtentZ;
+
+	AlignedArray<uint32_t> m_materialIds;
+	AlignedArray<InstanceData> m_instances;
+
+	// Hierarchy
+	AlignedArray<uint32_t> m_parents;  // Dense index of the parent, or kNoParent
+	AlignedArray<uint32_t> m_levels;
+	AlignedArray<Handle> m_handles;    // Dense index to handle
+	AlignedArray<uint8_t> m_dirty;
+	AlignedArray<uint8_t> m_changed;
+
+	std::vector<uint32_t> m_handleToIndex;  // kNoParent for free handles
+	std::vector<Handle> m_freeHandles;
+	std::vector<uint32_t> m_levelStarts;    // First dense index of each level, plus the total count
+	std::vector<Range> m_changedRanges;
+	size_t m_dirtyCount = 0;
+	bool m_needsRebuild = false;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "Math.hpp"
+
+#if defined(MATH_HAS_AVX2)
+#include <immintrin.h>
+#endif
+
+/*
+ * Thin wrappers over one register's worth of floats, so loops over SoA data can be written once
+ * and instantiated for every instruction set. Backend selection follows Math.hpp.
+ *
+ * V is a register of kWidth floats and M the result of a comparison. Madd(a, b, c) is a * b + c.
+ * MoveMask packs the comparison lanes into the low kWidth bits of an int.
+ */
+namespace simd {
+
+struct Scalar
+{
+	using V = float;
+	using M = bool;
+	static constexpr size_t kWidth = 1;
+	static V Load(const float* p) { return *p; }
+	static void Store(float* p, V v) { *p = v; }
+	static V Set1(float s) { return s; }
+	static V Add(V a, V b) { return a + b; }
+	static V Sub(V a, V b) { return a - b; }
+	static V Mul(V a, V b) { return a * b; }
+	static V Madd(V a, V b, V c) { return a * b + c; }
+	static M Less(V a, V b) { return a < b; }
+	static M Or(M a, M b) { return a || b; }
+	static M And(M a, M b) { return a && b; }
+	static int MoveMask(M m) { return m ? 1 : 0; }
+};
+
+#if defined(MATH_HAS_SSE)
+struct Sse
+{
+	using V = __m128;
+	using M = __m128;
+	static constexpr size_t kWidth = 4;
+	static V Load(const float* p) { return _mm_loadu_ps(p); }
+	static void Store(float* p, V v) { _mm_storeu_ps(p, v); }
+	static V Set1(float s) { return _mm_set1_ps(s); }
+	static V Add(V a, V b) { return _mm_add_ps(a, b); }
+	static V Sub(V a, V b) { return _mm_sub_ps(a, b); }
+	static V Mul(V a, V b) { return _mm_mul_ps(a, b); }
+	static V Madd(V a, V b, V c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+	static M Less(V a, V b) { return _mm_cmplt_ps(a, b); }
+	static M Or(M a, M b) { return _mm_or_ps(a, b); }
+	static M And(M a, M b) { return _mm_and_ps(a, b); }
+	static int MoveMask(M m) { return _mm_movemask_ps(m); }
+};
+#endif
+
+#if defined(MATH_HAS_AVX2)
+struct Avx2
+{
+	using V = __m256;
+	using M = __m256;
+	static constexpr size_t kWidth = 8;
+	static V Load(const float* p) { return _mm256_loadu_ps(p); }
+	static void Store(float* p, V v) { _mm256_storeu_ps(p, v); }
+	static V Set1(float s) { return _mm256_set1_ps(s); }
+	static V Add(V a, V b) { return _mm256_add_ps(a, b); }
+	static V Sub(V a, V b) { return _mm256_sub_ps(a, b); }
+	static V Mul(V a, V b) { return _mm256_mul_ps(a, b); }
+#if defined(__FMA__)
+	static V Madd(V a, V b, V c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+	static V Madd(V a, V b, V c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+	static M Less(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static M Or(M a, M b) { return _mm256_or_ps(a, b); }
+	static M And(M a, M b) { return _mm256_and_ps(a, b); }
+	static int MoveMask(M m) { return _mm256_movemask_ps(m); }
+};
+#endif
+
+#if defined(MATH_HAS_NEON)
+struct Neon
+{
+	using V = float32x4_t;
+	using M = uint32x4_t;
+	static constexpr size_t kWidth = 4;
+	static V Load(const float* p) { return vld1q_f32(p); }
+	static void Store(float* p, V v) { vst1q_f32(p, v); }
+	static V Set1(float s) { return vdupq_n_f32(s); }
+	static V Add(V a, V b) { return vaddq_f32(a, b); }
+	static V Sub(V a, V b) { return vsubq_f32(a, b); }
+	static V Mul(V a, V b) { return vmulq_f32(a, b); }
+	static V Madd(V a, V b, V c) { return vmlaq_f32(c, a, b); }
+	static M Less(V a, V b) { return vcltq_f32(a, b); }
+	static M Or(M a, M b) { return vorrq_u32(a, b); }
+	static M And(M a, M b) { return vandq_u32(a, b); }
+	static int MoveMask(M m)
+	{
+		const uint32x4_t bits = vshrq_n_u32(m, 31);
+		return static_cast<int>(vgetq_lane_u32(bits, 0) | (vgetq_lane_u32(bits, 1) << 1)
+			| (vgetq_lane_u32(bits, 2) << 2) | (vgetq_lane_u32(bits, 3) << 3));
+	}
+};
+#endif
+
+#if defined(MATH_HAS_AVX2)
+using Native = Avx2;
+#elif defined(MATH_HAS_SSE)
+using Native = Sse;
+#elif defined(MATH_HAS_NEON)
+using Native = Neon;
+#else
+using Native = Scalar;
+#endif
+
+} // namespace simd
@@ -0,0 +1,615 @@
+#include "SpriteBatcher.hpp"
+#include "Compute.hpp"
+#include "GpuMemory.hpp"
+#include "Image.hpp"
+#include "Trace.hpp"
+#include "webgpu-utils.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <utility>
+
+namespace {
+
+// Smallest ring segment, so the first few frames do not regrow it
+constexpr uint64_t kMinSegmentQuads = 4096;
+
+const char* kSpriteShader = R"(
+struct Quad
+{
+	@location(0) rect: vec4f,   // Pixels, Cpp SpriteBatcher::Quad must match
+	@location(1) uv: vec4f,
+	@location(2) color: vec4f,
+	@location(3) material: u32,
+};
+
+struct VertexOutput
+{
+	@builtin(position) position: vec4f,
+	@location(0) uv: vec2f,
+	@location(1) color: vec4f,
+	@location(2) @interpolate(flat) material: u32,
+};
+
+struct Material
+{
+	uvRect: vec4f,  // Cpp TexturePool::Material must match
+	layer: u32,
+};
+
+@group(0) @binding(0) var<uniform> viewport: vec4f;  // Size in pixels in xy
+@group(0) @binding(1) var texture: texture_2d_array<f32>;
+@group(0) @binding(2) var<storage, read> materials: array<Material>;
+
+override encodeSrgb: bool = false;
+
+fn linearToSrgb(color: vec3f) -> vec3f  // Like the mesh shader's
+{
+	return select(1.055 * pow(color, vec3f(1.0 / 2.4)) - 0.055, color * 12.92, color <= vec3f(0.0031308));
+}
+
+@vertex
+fn vs_main(@builtin(vertex_index) vertex: u32, quad: Quad) -> VertexOutput
+{
+	// A triangle strip over the corners, top left first
+	let corner = vec2f(f32(vertex & 1u), f32(vertex >> 1u));
+	let pixel = quad.rect.xy + corner * quad.rect.zw;
+
+	var out: VertexOutput;
+	out.position = vec4f(pixel / viewport.xy * vec2f(2.0, -2.0) + vec2f(-1.0, 1.0), 0.0, 1.0);
+	out.uv = quad.uv.xy + corner * quad.uv.zw;
+	out.color = quad.color;
+	out.material = quad.material;
+	return out;
+}
+
+@fragment
+fn fs_main(in: VertexOutput) -> @location(0) vec4f
+{
+	// Clamped to the material's region of the pool layer, like the mesh shader
+	let material = materials[in.material];
+	let region = material.uvRect * vec2f(textureDimensions(texture)).xyxy;
+	let texelCoords = vec2i( min(region.xy + in.uv * region.zw, region.xy + region.zw - 1.0) );
+	let color = textureLoad(texture, texelCoords, material.layer, 0) * in.color;
+	if (encodeSrgb)
+	{
+		return vec4f(linearToSrgb(color.rgb), color.a);
+	}
+	return color;
+})";
+
+} // anonymous namespace
+
+SpriteBatcher::SpriteBatcher() :
+	m_device(nullptr),
+	m_queue(nullptr),
+	m_maxBufferSize(0),
+	m_colorFormat(WGPUTextureFormat_Undefined),
+	m_depthFormat(WGPUTextureFormat_Undefined),
+	m_encodeSrgb(false),
+	m_shaderModule(nullptr, wgpuShaderModuleRelease),
+	m_bindGroupLayout(nullptr, wgpuBindGroupLayoutRelease),
+	m_pipelineLayout(nullptr, wgpuPipelineLayoutRelease),
+	m_bindGroup(nullptr, wgpuBindGroupRelease),
+	m_viewportBuffer(nullptr, wgpuBufferRelease),
+	m_ring(nullptr, wgpuBufferRelease),
+	m_segmentQuads(0),
+	m_segment(0),
+	m_viewport{0, 0},
+	m_blend(Blend::Alpha),
+	m_bytesUploaded(UploadBytesCounter())
+{
+}
+
+bool SpriteBatcher::Initialize(WGPUDevice device, WGPUQueue queue, const DeviceLimits& limits, const TexturePool& pool,
+	WGPUTextureFormat colorFormat, WGPUTextureFormat depthFormat, bool encodeSrgb)
+{
+	TRACE_SCOPE("SpriteBatcherInitialize");
+
+	Reset();
+	m_device = device;
+	m_queue = queue;
+	m_maxBufferSize = limits.Limits().maxBufferSize;
+	m_colorFormat = colorFormat;
+	m_depthFormat = depthFormat;
+	m_encodeSrgb = encodeSrgb;
+
+	m_shaderModule = WgpuShaderModulePtr(wgpuUtils::createShaderModule(device, kSpriteShader), wgpuShaderModuleRelease);
+
+	std::array<WGPUBindGroupLayoutEntry, 3> layoutEntries;
+
+	WGPUBindGroupLayoutEntry &viewportLayout = layoutEntries[0];
+	viewportLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	viewportLayout.binding = 0;
+	viewportLayout.visibility = WGPUShaderStage_Vertex;
+	viewportLayout.buffer.type = WGPUBufferBindingType_Uniform;
+	viewportLayout.buffer.minBindingSize = 4 * sizeof(float);
+
+	WGPUBindGroupLayoutEntry &textureLayout = layoutEntries[1];
+	textureLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	textureLayout.binding = 1;
+	textureLayout.visibility = WGPUShaderStage_Fragment;
+	textureLayout.texture.sampleType = WGPUTextureSampleType_Float;
+	textureLayout.texture.viewDimension = WGPUTextureViewDimension_2DArray;
+
+	WGPUBindGroupLayoutEntry &materialLayout = layoutEntries[2];
+	materialLayout = wgpuUtils::getDefault<WGPUBindGroupLayoutEntry>();
+	materialLayout.binding = 2;
+	materialLayout.visibility = WGPUShaderStage_Fragment;
+	materialLayout.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+	materialLayout.buffer.minBindingSize = sizeof(TexturePool::Material);
+
+	WGPUBindGroupLayoutDescriptor bindGroupLayoutDesc{};
+	bindGroupLayoutDesc.entryCount = layoutEntries.size();
+	bindGroupLayoutDesc.entries = layoutEntries.data();
+	WGPUBindGroupLayout bindGroupLayout = wgpuDeviceCreateBindGroupLayout(device, &bindGroupLayoutDesc);
+	m_bindGroupLayout = WgpuBindGroupLayoutPtr(bindGroupLayout, wgpuBindGroupLayoutRelease);
+
+	WGPUPipelineLayoutDescriptor pipelineLayoutDesc{};
+	pipelineLayoutDesc.bindGroupLayoutCount = 1;
+	pipelineLayoutDesc.bindGroupLayouts = &bindGroupLayout;
+	m_pipelineLayout = WgpuPipelineLayoutPtr(wgpuDeviceCreatePipelineLayout(device, &pipelineLayoutDesc), wgpuPipelineLayoutRelease);
+
+	WGPUBufferDescriptor bufferDesc{};
+	bufferDesc.size = 4 * sizeof(float);
+	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Uniform;
+	bufferDesc.mappedAtCreation = false;
+	m_viewportBuffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+	if (!m_viewportBuffer)
+		return false;
+
+	std::array<WGPUBindGroupEntry, 3> entries{};
+	entries[0].binding = 0;
+	entries[0].buffer = m_viewportBuffer.get();
+	entries[0].size = bufferDesc.size;
+	entries[1].binding = 1;
+	entries[1].textureView = pool.View();
+	entries[2].binding = 2;
+	entries[2].buffer = pool.MaterialBuffer();
+	entries[2].size = pool.MaterialBufferSize();
+
+	WGPUBindGroupDescriptor bindGroupDesc{};
+	bindGroupDesc.layout = bindGroupLayout;
+	bindGroupDesc.entryCount = entries.size();
+	bindGroupDesc.entries = entries.data();
+	m_bindGroup = WgpuBindGroupPtr(wgpuDeviceCreateBindGroup(device, &bindGroupDesc), wgpuBindGroupRelease);
+
+	return m_shaderModule && m_pipelineLayout && m_bindGroup;
+}
+
+void SpriteBatcher::Reset()
+{
+	m_pipelines.clear();
+	m_ring.reset();
+	m_segmentQuads = 0;
+	m_segment = 0;
+	m_viewport[0] = m_viewport[1] = 0;
+	m_bindGroup.reset();
+	m_viewportBuffer.reset();
+	m_pipelineLayout.reset();
+	m_bindGroupLayout.reset();
+	m_shaderModule.reset();
+	m_quads.clear();
+	m_batches.clear();
+}
+
+WGPURenderPipeline SpriteBatcher::GetPipeline(Blend blend, uint32_t sampleCount)
+{
+	const uint32_t key = (sampleCount << 1) | (blend == Blend::Alpha ? 1 : 0);
+	auto it = m_pipelines.find(key);
+	if (it != m_pipelines.end())
+		return it->second.get();
+
+	TRACE_SCOPE("SpritePipelineInitialize");
+
+	std::array<WGPUVertexAttribute, 4> attributes{};
+	const std::array<std::pair<WGPUVertexFormat, uint64_t>, 4> formats = {{
+		{WGPUVertexFormat_Float32x4, offsetof(Quad, x)},
+		{WGPUVertexFormat_Unorm16x4, offsetof(Quad, u)},
+		{WGPUVertexFormat_Unorm8x4, offsetof(Quad, color)},
+		{WGPUVertexFormat_Uint32, offsetof(Quad, material)},
+	}};
+	for (uint32_t i = 0; i < attributes.size(); ++i)
+	{
+		attributes[i].format = formats[i].first;
+		attributes[i].offset = formats[i].second;
+		attributes[i].shaderLocation = i;
+	}
+
+	WGPUVertexBufferLayout quadLayout{};
+	quadLayout.attributeCount = attributes.size();
+	quadLayout.attributes = attributes.data();
+	quadLayout.arrayStride = sizeof(Quad);
+	quadLayout.stepMode = WGPUVertexStepMode_Instance;
+
+	WGPURenderPipelineDescriptor pipelineDesc{};
+	pipelineDesc.layout = m_pipelineLayout.get();
+	pipelineDesc.vertex.module = m_shaderModule.get();
+	pipelineDesc.vertex.entryPoint = wgpuUtils::label("vs_main");
+	pipelineDesc.vertex.bufferCount = 1;
+	pipelineDesc.vertex.buffers = &quadLayout;
+	pipelineDesc.primitive.topology = WGPUPrimitiveTopology_TriangleStrip;
+	pipelineDesc.primitive.stripIndexFormat = WGPUIndexFormat_Undefined;
+	pipelineDesc.primitive.frontFace = WGPUFrontFace_CCW;
+	pipelineDesc.primitive.cullMode = WGPUCullMode_None;
+
+	// Drawn over the scene, so only the attachment has to match
+	WGPUDepthStencilState depthStencil{};
+	depthStencil.format = m_depthFormat;
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+	depthStencil.depthWriteEnabled = WGPUOptionalBool_False;
+#else
+	depthStencil.depthWriteEnabled = false;
+#endif
+	depthStencil.depthCompare = WGPUCompareFunction_Always;
+	depthStencil.stencilFront.compare = WGPUCompareFunction_Always;
+	depthStencil.stencilFront.failOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.depthFailOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilFront.passOp = WGPUStencilOperation_Keep;
+	depthStencil.stencilBack = depthStencil.stencilFront;
+	depthStencil.stencilReadMask = 0;
+	depthStencil.stencilWriteMask = 0;
+	if (m_depthFormat != WGPUTextureFormat_Undefined)
+		pipelineDesc.depthStencil = &depthStencil;
+
+	// Straight alpha, the destination alpha is kept like the mesh pipelines do
+	WGPUBlendState blendState{};
+	blendState.color = {WGPUBlendOperation_Add, WGPUBlendFactor_SrcAlpha, WGPUBlendFactor_OneMinusSrcAlpha};
+	blendState.alpha = {WGPUBlendOperation_Add, WGPUBlendFactor_Zero, WGPUBlendFactor_One};
+
+	WGPUColorTargetState colorTarget{};
+	colorTarget.format = m_colorFormat;
+	colorTarget.blend = blend == Blend::Alpha ? &blendState : nullptr;
+	colorTarget.writeMask = WGPUColorWriteMask_All;
+
+	WGPUConstantEntry encodeSrgb{};
+	encodeSrgb.key = wgpuUtils::label("encodeSrgb");
+	encodeSrgb.value = m_encodeSrgb ? 1.0 : 0.0;
+
+	WGPUFragmentState fragment{};
+	fragment.module = m_shaderModule.get();
+	fragment.entryPoint = wgpuUtils::label("fs_main");
+	fragment.constantCount = 1;
+	fragment.constants = &encodeSrgb;
+	fragment.targetCount = 1;
+	fragment.targets = &colorTarget;
+	pipelineDesc.fragment = &fragment;
+
+	pipelineDesc.multisample.count = sampleCount;
+	pipelineDesc.multisample.mask = ~0u;
+	pipelineDesc.multisample.alphaToCoverageEnabled = false;
+
+	WgpuRenderPipelinePtr pipeline(wgpuDeviceCreateRenderPipeline(m_device, &pipelineDesc), wgpuRenderPipelineRelease);
+	if (!pipeline)
+		return nullptr;
+	return m_pipelines.emplace(key, std::move(pipeline)).first->second.get();
+}
+
+bool SpriteBatcher::ReserveRing(uint64_t quadCount)
+{
+	if (quadCount <= m_segmentQuads)
+		return true;
+
+	// Doubling keeps regrowth rare while the load ramps up
+	const uint64_t maxSegmentQuads = m_maxBufferSize / (kRingSegments * sizeof(Quad));
+	const uint64_t segmentQuads = std::min(std::max({quadCount, 2 * m_segmentQuads, kMinSegmentQuads}), maxSegmentQuads);
+	if (segmentQuads <= m_segmentQuads)
+		return false;
+
+	TRACE_SCOPE("SpriteRingGrow");
+
+	// Draws already recorded keep the old buffer alive until they have run
+	WGPUBufferDescriptor bufferDesc{};
+	bufferDesc.size = segmentQuads * kRingSegments * sizeof(Quad);
+	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Vertex;
+	bufferDesc.mappedAtCreation = false;
+	WgpuBufferPtr ring = GpuMemory::Global().CreateBuffer(m_device, bufferDesc);
+	if (!ring)
+		return false;
+
+	m_ring = std::move(ring);
+	m_segmentQuads = segmentQuads;
+	m_segment = 0;
+	return quadCount <= m_segmentQuads;
+}
+
+void SpriteBatcher::Flush(WGPURenderPassEncoder pass, uint32_t sampleCount, uint32_t viewportWidth, uint32_t viewportHeight)
+{
+	TRACE_SCOPE("SpriteFlush");
+
+	m_stats = {};
+	if (m_quads.empty())
+		return;
+
+	// Whatever does not fit the largest ring is dropped from the end
+	uint64_t count = m_quads.size();
+	if (!ReserveRing(count))
+	{
+		count = m_segmentQuads;
+		while (!m_batches.empty() && m_batches.back().first >= count)
+			m_batches.pop_back();
+		if (!m_batches.empty())
+			m_batches.back().count = static_cast<uint32_t>(count - m_batches.back().first);
+		m_stats.dropped = static_cast<uint32_t>(m_quads.size() - count);
+	}
+
+	if (count > 0)
+	{
+		const uint64_t offset = m_segment * m_segmentQuads * sizeof(Quad);
+		const uint64_t size = count * sizeof(Quad);
+		wgpuQueueWriteBuffer(m_queue, m_ring.get(), offset, m_quads.data(), size);
+		m_bytesUploaded.Add(size);
+
+		if (m_viewport[0] != viewportWidth || m_viewport[1] != viewportHeight)
+		{
+			const float viewport[4] = {static_cast<float>(viewportWidth), static_cast<float>(viewportHeight), 0, 0};
+			wgpuQueueWriteBuffer(m_queue, m_viewportBuffer.get(), 0, viewport, sizeof(viewport));
+			m_bytesUploaded.Add(sizeof(viewport));
+			m_viewport[0] = viewportWidth;
+			m_viewport[1] = viewportHeight;
+		}
+
+		wgpuRenderPassEncoderSetBindGroup(pass, 0, m_bindGroup.get(), 0, nullptr);
+		wgpuRenderPassEncoderSetVertexBuffer(pass, 0, m_ring.get(), offset, size);
+
+		// Consecutive batches always differ in blend mode, so each one changes the pipeline
+		for (const Batch &batch : m_batches)
+		{
+			WGPURenderPipeline pipeline = GetPipeline(batch.blend, sampleCount);
+			if (!pipeline)
+				continue;
+			wgpuRenderPassEncoderSetPipeline(pass, pipeline);
+			wgpuRenderPassEncoderDraw(pass, 4, batch.count, 0, batch.first);
+			m_stats.batches++;
+		}
+		m_stats.quads = static_cast<uint32_t>(count);
+		m_segment = (m_segment + 1) % kRingSegments;
+	}
+
+	m_quads.clear();
+	m_batches.clear();
+}
+
+#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
+
+bool RunSpriteBenchmark(uint32_t)
+{
+	std::cerr << "The sprite benchmark needs a headless device, which the web does not have" << std::endl;
+	return false;
+}
+
+#else
+
+namespace {
+
+// One pass clearing the target to opaque black and flushing the batcher into it, then optionally a copy out
+void RenderFrame(ComputeContext& context, SpriteBatcher& batcher, WGPUTextureView view, uint32_t width, uint32_t height,
+	const WgpuTexelCopyTextureInfo* copySource = nullptr, const WgpuTexelCopyBufferInfo* copyDestination = nullptr, const WGPUExtent3D* copySize = nullptr)
+{
+	WgpuCommandEncoderPtr encoder(wgpuDeviceCreateCommandEncoder(context.Device(), nullptr), wgpuCommandEncoderRelease);
+
+	WGPURenderPassColorAttachment colorAttachment{};
+	colorAttachment.view = view;
+	colorAttachment.loadOp = WGPULoadOp_Clear;
+	colorAttachment.storeOp = WGPUStoreOp_Store;
+	colorAttachment.clearValue = WGPUColor{0, 0, 0, 1};
+#if !defined(WEBGPU_BACKEND_WGPU)
+	colorAttachment.depthSlice = WGPU_DEPTH_SLICE_UNDEFINED;
+#endif
+	WGPURenderPassDescriptor passDesc{};
+	passDesc.colorAttachmentCount = 1;
+	passDesc.colorAttachments = &colorAttachment;
+
+	WgpuRenderPassEncoderPtr pass(wgpuCommandEncoderBeginRenderPass(encoder.get(), &passDesc), wgpuRenderPassEncoderRelease);
+	batcher.Flush(pass.get(), 1, width, height);
+	wgpuRenderPassEncoderEnd(pass.get());
+
+	if (copySource)
+		wgpuCommandEncoderCopyTextureToBuffer(encoder.get(), copySource, copyDestination, copySize);
+
+	WgpuCommandBufferPtr commands(wgpuCommandEncoderFinish(encoder.get(), nullptr), wgpuCommandBufferRelease);
+	WGPUCommandBuffer buffer = commands.get();
+	wgpuQueueSubmit(context.Queue(), 1, &buffer);
+}
+
+// Pixel of a readback of rows of width texels, RGBA in the low to high bytes
+uint32_t PixelAt(const std::vector<uint32_t>& pixels, uint32_t width, uint32_t x, uint32_t y)
+{
+	return pixels.empty() ? 0 : pixels[size_t{y} * width + x];
+}
+
+bool ChannelsNear(uint32_t a, uint32_t b, uint32_t tolerance)
+{
+	for (uint32_t shift = 0; shift < 32; shift += 8)
+	{
+		const int difference = static_cast<int>((a >> shift) & 0xff) - static_cast<int>((b >> shift) & 0xff);
+		if (static_cast<uint32_t>(std::abs(difference)) > tolerance)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Fill a pool of two single texture layers and check that adding to it evicts the least recently
+ * used layer of streamable textures and reuses it, never a layer holding a texture that is not
+ * streamable, and that a pool with nothing left to evict refuses the texture.
+ */
+bool CheckPoolEviction(ComputeContext& context, const DeviceLimits& limits)
+{
+	constexpr uint32_t kSize = 64;
+	TexturePool pool;
+	if (!pool.Initialize(context.Device(), context.Queue(), limits, kSize, 2, 8))
+		return false;
+
+	const Image image(kSize, kSize);
+	uint32_t evictedA = 0, evictedB = 0, evictedC = 0;
+	const TexturePool::Handle a = pool.Add(image, [&evictedA]() { ++evictedA; });
+	const TexturePool::Handle b = pool.Add(image, [&evictedB]() { ++evictedB; });
+	if (a == TexturePool::kInvalidHandle || b == TexturePool::kInvalidHandle)
+		return false;
+	const uint32_t layerB = pool.GetMaterial(b).layer;
+
+	// a was drawn last, so b's layer goes
+	pool.Touch(a);
+	const TexturePool::Handle c = pool.Add(image, [&evictedC]() { ++evictedC; });
+	bool ok = c != TexturePool::kInvalidHandle && evictedB == 1 && evictedA == 0 && pool.GetMaterial(c).layer == layerB;
+
+	// Then a's, the least recently used, and c's once a's layer holds a texture that stays
+	const TexturePool::Handle pinned = pool.Add(image);
+	ok = ok && pinned != TexturePool::kInvalidHandle && evictedA == 1 && evictedC == 0;
+	const TexturePool::Handle d = pool.Add(image);
+	ok = ok && d != TexturePool::kInvalidHandle && evictedC == 1 && pool.GetMaterial(d).layer == layerB;
+	ok = ok && pool.Add(image) == TexturePool::kInvalidHandle;
+	return ok;
+}
+
+} // anonymous namespace
+
+bool RunSpriteBenchmark(uint32_t quadCount)
+{
+	using Clock = std::chrono::steady_clock;
+	constexpr uint32_t kWidth = 1920;
+	constexpr uint32_t kHeight = 1080;
+	constexpr uint32_t kWarmupFrames = 3;
+	constexpr uint32_t kFrames = 20;
+	constexpr uint32_t kQuadsPerBlend = 4096;
+	constexpr uint32_t kTextureCount = 8;
+
+	ComputeContext context;
+	if (!context.IsInitialized())
+		return false;
+
+	// Every device supports the baseline tier, the pool and ring stay well within it
+	const DeviceLimits limits;
+	TexturePool pool;
+	SpriteBatcher batcher;
+	if (!pool.Initialize(context.Device(), context.Queue(), limits, 512, 1, kTextureCount + 1)
+		|| !batcher.Initialize(context.Device(), context.Queue(), limits, pool, WGPUTextureFormat_RGBA8Unorm, WGPUTextureFormat_Undefined))
+	{
+		std::cerr << "Could not create the sprite batcher" << std::endl;
+		return false;
+	}
+
+	Image white(4, 4);
+	std::fill(white.pixels.begin(), white.pixels.end(), Image::Pack(255, 255, 255, 255));
+	const TexturePool::Handle whiteTexture = pool.Add(white);
+	std::vector<TexturePool::Handle> textures;
+	for (uint32_t i = 0; i < kTextureCount; ++i)
+		textures.push_back(pool.Add(image::TestPattern(64 + 16 * i, 64)));
+
+	ComputeContext::OffscreenTarget target = context.CreateOffscreenTarget(kWidth, kHeight, WGPUTextureFormat_RGBA8Unorm,
+		WGPUTextureUsage_RenderAttachment | WGPUTextureUsage_CopySrc);
+	if (!target.view)
+		return false;
+
+	// An opaque red quad then a half transparent green one over the black clear, read back
+	constexpr uint32_t kCheckWidth = 64;  // Texels, 256 bytes per row as copies require
+	constexpr uint32_t kCheckHeight = 32;
+	batcher.SetBlend(SpriteBatcher::Blend::Opaque);
+	batcher.DrawQuad({4, 4, 16, 16}, {0, 0, 1, 1}, Image::Pack(255, 0, 0, 255), whiteTexture);
+	batcher.SetBlend(SpriteBatcher::Blend::Alpha);
+	batcher.DrawQuad({32, 4, 16, 16}, {0, 0, 1, 1}, Image::Pack(0, 255, 0, 128), whiteTexture);
+
+	WgpuBufferPtr checkBuffer = context.CreateBuffer(kCheckWidth * kCheckHeight * sizeof(uint32_t), WGPUBufferUsage_CopyDst | WGPUBufferUsage_CopySrc, "Sprite check");
+	WgpuTexelCopyTextureInfo copySource{};
+	copySource.texture = target.texture.get();
+	copySource.aspect = WGPUTextureAspect_All;
+	WgpuTexelCopyBufferInfo copyDestination{};
+	copyDestination.buffer = checkBuffer.get();
+	copyDestination.layout.bytesPerRow = kCheckWidth * sizeof(uint32_t);
+	copyDestination.layout.rowsPerImage = kCheckHeight;
+	const WGPUExtent3D copySize = {kCheckWidth, kCheckHeight, 1};
+	RenderFrame(context, batcher, target.view.get(), kWidth, kHeight, &copySource, &copyDestination, &copySize);
+	const SpriteBatcher::Stats checkStats = batcher.LastStats();
+
+	std::vector<uint32_t> pixels;
+	ComputeContext::Batch readback = context.Begin();
+	readback.Readback(checkBuffer.get(), 0, wgpuBufferGetSize(checkBuffer.get()), [&pixels](const void* data, uint64_t size) {
+		if (data)
+			pixels.assign(static_cast<const uint32_t*>(data), static_cast<const uint32_t*>(data) + size / sizeof(uint32_t));
+	});
+	context.Submit(std::move(readback));
+	context.Wait();
+
+	const bool opaqueMatches = ChannelsNear(PixelAt(pixels, kCheckWidth, 12, 12), Image::Pack(255, 0, 0, 255), 0);
+	const bool blendMatches = ChannelsNear(PixelAt(pixels, kCheckWidth, 40, 12), Image::Pack(0, 128, 0, 255), 1);
+	const bool clearMatches = ChannelsNear(PixelAt(pixels, kCheckWidth, 24, 24), Image::Pack(0, 0, 0, 255), 0);
+	const bool evictionMatches = CheckPoolEviction(context, limits);
+	bool ok = opaqueMatches && blendMatches && clearMatches && evictionMatches && checkStats.quads == 2 && checkStats.batches == 2;
+
+	// Random quads are generated up front so only the batcher is timed
+	struct QuadParams
+	{
+		SpriteBatcher::Rect rect;
+		SpriteBatcher::Rect uv;
+		uint32_t color;
+		TexturePool::Handle texture;
+	};
+	std::mt19937 rng(7);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<QuadParams> quads(quadCount);
+	for (QuadParams &quad : quads)
+	{
+		const float size = 2.0f + 30.0f * unit(rng);
+		quad.rect = {unit(rng) * (kWidth - size), unit(rng) * (kHeight - size), size, size};
+		quad.uv = {0.5f * unit(rng), 0.5f * unit(rng), 0.5f, 0.5f};
+		quad.color = static_cast<uint32_t>(rng()) | 0x80000000u;
+		quad.texture = textures[rng() % textures.size()];
+	}
+
+	auto milliseconds = [](Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+	double buildMs = 0, flushMs = 0, frameMs = 0;
+	SpriteBatcher::Stats stats;
+	for (uint32_t frame = 0; frame < kWarmupFrames + kFrames; ++frame)
+	{
+		const Clock::time_point start = Clock::now();
+		for (uint32_t i = 0; i < quadCount; ++i)
+		{
+			if (i % kQuadsPerBlend == 0)
+				batcher.SetBlend((i / kQuadsPerBlend) % 2 ? SpriteBatcher::Blend::Opaque : SpriteBatcher::Blend::Alpha);
+			const QuadParams &quad = quads[i];
+			batcher.DrawQuad(quad.rect, quad.uv, quad.color, quad.texture);
+		}
+		const Clock::time_point built = Clock::now();
+		RenderFrame(context, batcher, target.view.get(), kWidth, kHeight);
+		const Clock::time_point flushed = Clock::now();
+		context.WaitForQueue();
+		const Clock::time_point done = Clock::now();
+
+		stats = batcher.LastStats();
+		if (frame < kWarmupFrames)
+			continue;
+		buildMs += milliseconds(built - start);
+		flushMs += milliseconds(flushed - built);
+		frameMs += milliseconds(done - start);
+	}
+	buildMs /= kFrames;
+	flushMs /= kFrames;
+	frameMs /= kFrames;
+
+	std::cout << "Sprite benchmark: " << kWidth << "x" << kHeight << ", average of " << kFrames << " frames" << std::endl;
+	std::cout << "  check: " << (ok ? "passed" : "FAILED") << " (opaque " << opaqueMatches << ", blend " << blendMatches
+		<< ", clear " << clearMatches << ", pool eviction " << evictionMatches << ", " << checkStats.batches << " batches)" << std::endl;
+	std::cout << std::fixed << std::setprecision(3);
+	std::cout << "  " << stats.quads << " quads in " << stats.batches << " batches per frame";
+	if (stats.dropped > 0)
+		std::cout << ", " << stats.dropped << " dropped";
+	std::cout << std::endl;
+	std::cout << "  build " << buildMs << " ms, flush " << flushMs << " ms, frame " << frameMs << " ms including the GPU" << std::endl;
+	std::cout << std::setprecision(1) << "  " << stats.quads / frameMs / 1000.0 << " million quads per second, "
+		<< (frameMs <= 1000.0 / 60.0 ? "within" : "over") << " a 60 Hz frame" << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+
+	if (context.ErrorCount() > 0)
+	{
+		std::cout << "  GPU errors were reported" << std::endl;
+		ok = false;
+	}
+	return ok;
+}
+
+#endif  // WEBGPU_BACKEND_EMSCRIPTEN
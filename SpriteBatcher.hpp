@@ -0,0 +1,143 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "DeviceLimits.hpp"
+#include "Metrics.hpp"
+#include "TexturePool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Draws 2D quads in as few instanced draws as possible.
+ *
+ * DrawQuad() appends a 32 byte instance to the frame's quads. Flush() uploads them all with one
+ * queue write into the next segment of a ring buffer and issues one draw per run of quads with the
+ * same blend mode, which is all that breaks a batch: textures come from a TexturePool, so changing
+ * them only changes the material ID in the instance.
+ *
+ * The ring has kRingSegments segments, so a flush never overwrites quads the GPU may still be
+ * reading for an earlier frame. It grows when a flush has more quads than a segment holds, up to
+ * the device's largest buffer; quads past that are dropped. Flush once per submission.
+ */
+class SpriteBatcher
+{
+public:
+	enum class Blend
+	{
+		Opaque,
+		Alpha,
+		Count,
+	};
+
+	struct Rect
+	{
+		float x, y, width, height;
+	};
+
+	struct Stats
+	{
+		uint32_t quads = 0;
+		uint32_t batches = 0;
+		uint32_t dropped = 0;
+	};
+
+	static constexpr uint32_t kRingSegments = 3;
+
+	SpriteBatcher();
+
+	/*
+	 * The pipelines render to colorFormat, with a depth attachment of depthFormat unless it is
+	 * undefined, encoding their output to sRGB with encodeSrgb for targets without an sRGB view.
+	 * Sprites are drawn over everything and never write depth. pool must outlive the batcher.
+	 */
+	bool Initialize(WGPUDevice device, WGPUQueue queue, const DeviceLimits& limits, const TexturePool& pool,
+		WGPUTextureFormat colorFormat, WGPUTextureFormat depthFormat, bool encodeSrgb = false);
+	void Reset();
+
+	// Applies to the quads drawn after it
+	void SetBlend(Blend blend) { m_blend = blend; }
+
+	/*
+	 * rect is in pixels from the top left of the viewport, uv in [0, 1] of the texture, color
+	 * RGBA8 (see Image::Pack()) multiplied with the texture.
+	 */
+	void DrawQuad(const Rect& rect, const Rect& uv, uint32_t color, TexturePool::Handle texture)
+	{
+		if (m_batches.empty() || m_batches.back().blend != m_blend)
+			m_batches.push_back({m_blend, static_cast<uint32_t>(m_quads.size()), 0});
+		m_batches.back().count++;
+
+		m_quads.push_back({rect.x, rect.y, rect.width, rect.height,
+			Unorm16(uv.x), Unorm16(uv.y), Unorm16(uv.width), Unorm16(uv.height), color, texture});
+	}
+
+	// Upload the quads drawn since the last flush and record their draws into pass
+	void Flush(WGPURenderPassEncoder pass, uint32_t sampleCount, uint32_t viewportWidth, uint32_t viewportHeight);
+
+	// Of the last flush
+	const Stats& LastStats() const { return m_stats; }
+
+private:
+	// Cpp side of the shader's instance attributes
+	struct Quad
+	{
+		float x, y, width, height;
+		uint16_t u, v, uvWidth, uvHeight;
+		uint32_t color;
+		uint32_t material;
+	};
+	static_assert(sizeof(Quad) == 32);
+
+	struct Batch
+	{
+		Blend blend;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	static uint16_t Unorm16(float value)
+	{
+		return static_cast<uint16_t>(std::clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+	}
+
+	WGPURenderPipeline GetPipeline(Blend blend, uint32_t sampleCount);
+	bool ReserveRing(uint64_t quadCount);
+
+	WGPUDevice m_device;
+	WGPUQueue m_queue;
+	uint64_t m_maxBufferSize;
+	WGPUTextureFormat m_colorFormat;
+	WGPUTextureFormat m_depthFormat;
+	bool m_encodeSrgb;
+
+	WgpuShaderModulePtr m_shaderModule;
+	WgpuBindGroupLayoutPtr m_bindGroupLayout;
+	WgpuPipelineLayoutPtr m_pipelineLayout;
+	WgpuBindGroupPtr m_bindGroup;
+	WgpuBufferPtr m_viewportBuffer;
+	std::unordered_map<uint32_t, WgpuRenderPipelinePtr> m_pipelines;  // By blend and sample count
+
+	WgpuBufferPtr m_ring;
+	uint64_t m_segmentQuads;  // Capacity of each ring segment
+	uint32_t m_segment;       // Written by the next flush
+	uint32_t m_viewport[2];
+
+	Blend m_blend;
+	std::vector<Quad> m_quads;
+	std::vector<Batch> m_batches;
+	Stats m_stats;
+
+	Counter& m_bytesUploaded;
+};
+
+/*
+ * Draw quadCount random quads per frame on a headless device, with a blend change every few
+ * thousand quads, and report the CPU time to build and flush them and the frame time including the
+ * GPU. First checks that a few quads land on the expected pixels. Returns false on a mismatch or
+ * device error.
+ */
+bool RunSpriteBenchmark(uint32_t quadCount);
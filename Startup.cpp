@@ -0,0 +1,137 @@
+#include "Startup.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+
+StartupGraph::PhaseId StartupGraph::Add(const char* name, Affinity affinity, std::vector<PhaseId> dependencies, PhaseFn fn)
+{
+	const PhaseId id = static_cast<PhaseId>(m_phases.size());
+	for ([[maybe_unused]]PhaseId dependency : dependencies)
+		assert(dependency < id);
+
+	auto phase = std::make_unique<Phase>();
+	phase->name = name;
+	phase->affinity = affinity;
+	phase->dependencies = std::move(dependencies);
+	phase->fn = std::move(fn);
+	m_phases.push_back(std::move(phase));
+	return id;
+}
+
+bool StartupGraph::Run(JobSystem& jobs)
+{
+	TRACE_SCOPE("Startup");
+
+	m_runStart = std::chrono::steady_clock::now();
+	m_mainThread = std::this_thread::get_id();
+
+	for (std::unique_ptr<Phase> &phasePtr : m_phases)
+	{
+		Phase *phase = phasePtr.get();
+
+		// An empty job per dependency holds up ready until that dependency is done
+		for (PhaseId dependency : phase->dependencies)
+			jobs.RunAfter(m_phases[dependency]->done, []() {}, &phase->ready);
+
+		if (phase->affinity == Affinity::MainThread)
+		{
+			// Queued for the main thread before the forwarding job finishes, so done stays held up
+			jobs.RunAfter(phase->ready, [this, &jobs, phase]() {
+				jobs.RunOnMainThread([this, phase]() { RunPhase(*phase); }, &phase->done);
+			}, &phase->done);
+		}
+		else
+		{
+			jobs.RunAfter(phase->ready, [this, phase]() { RunPhase(*phase); }, &phase->done);
+		}
+	}
+
+	// Waiting on the main thread runs its phases, and any others while it has nothing to do
+	bool succeeded = true;
+	for (std::unique_ptr<Phase> &phase : m_phases)
+	{
+		jobs.Wait(phase->done);
+		succeeded = succeeded && phase->status == Status::Succeeded;
+	}
+
+	m_total = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_runStart);
+	return succeeded;
+}
+
+void StartupGraph::RunPhase(Phase& phase)
+{
+	// Dependencies are done, so their status is final
+	for (PhaseId dependency : phase.dependencies)
+	{
+		if (m_phases[dependency]->status != Status::Succeeded)
+		{
+			phase.status = Status::Skipped;
+			return;
+		}
+	}
+
+	TRACE_SCOPE(phase.name);
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	const bool succeeded = phase.fn();
+	const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+	phase.status = succeeded ? Status::Succeeded : Status::Failed;
+	phase.start = std::chrono::duration_cast<std::chrono::microseconds>(start - m_runStart);
+	phase.duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+	phase.thread = std::this_thread::get_id();
+}
+
+std::vector<bool> StartupGraph::CriticalPath() const
+{
+	std::vector<bool> critical(m_phases.size(), false);
+	auto end = [this](PhaseId id) { return m_phases[id]->start + m_phases[id]->duration; };
+
+	if (m_phases.empty())
+		return critical;
+
+	// From the phase that finished last back through the dependency each waited on longest
+	auto endsBefore = [&end](PhaseId a, PhaseId b) { return end(a) < end(b); };
+	PhaseId id = 0;
+	for (PhaseId other = 1; other < m_phases.size(); ++other)
+		id = std::max(id, other, endsBefore);
+
+	while (true)
+	{
+		critical[id] = true;
+		const std::vector<PhaseId> &dependencies = m_phases[id]->dependencies;
+		if (dependencies.empty())
+			break;
+		id = *std::max_element(dependencies.begin(), dependencies.end(), endsBefore);
+	}
+	return critical;
+}
+
+void StartupGraph::PrintReport(std::ostream& out) const
+{
+	auto ms = [](std::chrono::microseconds time) { return time.count() / 1000.0; };
+	const std::vector<bool> critical = CriticalPath();
+
+	out << "Startup took " << std::fixed << std::setprecision(1) << ms(m_total) << " ms, * marks the critical path:" << std::endl;
+	out << "    " << std::left << std::setw(16) << "phase" << std::setw(8) << "thread" << std::right
+		<< std::setw(10) << "start ms" << std::setw(13) << "duration ms" << std::endl;
+	for (size_t i = 0; i < m_phases.size(); ++i)
+	{
+		const Phase &phase = *m_phases[i];
+		out << "  " << (critical[i] ? '*' : ' ') << ' ' << std::left << std::setw(16) << phase.name;
+		if (phase.status == Status::Skipped)
+		{
+			out << "skipped" << std::right << std::endl;
+			continue;
+		}
+
+		out << std::setw(8) << (phase.thread == m_mainThread ? "main" : "worker") << std::right
+			<< std::setw(10) << ms(phase.start) << std::setw(13) << ms(phase.duration);
+		if (phase.status == Status::Failed)
+			out << "  failed";
+		out << std::endl;
+	}
+	out.unsetf(std::ios::floatfield);
+}
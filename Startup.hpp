@@ -0,0 +1,77 @@
+#pragma once
+
+#include "Parallel.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+/**
+ * Startup as a graph of named phases, each started on the job system as soon as the phases it
+ * depends on have finished. Phases touching the window or the device run on the main thread and
+ * the CPU only ones on any thread, so they overlap the blocking adapter and device requests.
+ *
+ * A phase returns false to fail startup, the phases depending on it are then skipped. The time of
+ * every phase is recorded for the report, which marks the critical path: the chain of phases, each
+ * the last of its dependencies to finish, that decided the total.
+ */
+class StartupGraph
+{
+public:
+	using PhaseId = uint32_t;
+	using PhaseFn = std::function<bool()>;
+
+	enum class Affinity
+	{
+		MainThread,
+		AnyThread,
+	};
+
+	// Names must be string literals, they also name the phase's trace scope. Dependencies must
+	// have been added before.
+	PhaseId Add(const char* name, Affinity affinity, std::vector<PhaseId> dependencies, PhaseFn fn);
+
+	// Run every phase and return once all have finished or been skipped, true if none failed.
+	// Only on the thread that created jobs.
+	bool Run(JobSystem& jobs);
+
+	std::chrono::microseconds Total() const { return m_total; }
+
+	void PrintReport(std::ostream& out) const;
+
+private:
+	enum class Status
+	{
+		Pending,
+		Succeeded,
+		Failed,
+		Skipped,
+	};
+
+	struct Phase
+	{
+		const char* name;
+		Affinity affinity;
+		std::vector<PhaseId> dependencies;
+		PhaseFn fn;
+
+		JobSystem::Counter ready;  // Held up by the dependencies
+		JobSystem::Counter done;
+		Status status = Status::Pending;
+		std::chrono::microseconds start{};  // Since Run() was called
+		std::chrono::microseconds duration{};
+		std::thread::id thread;
+	};
+
+	void RunPhase(Phase& phase);
+	std::vector<bool> CriticalPath() const;
+
+	std::vector<std::unique_ptr<Phase>> m_phases;
+	std::chrono::steady_clock::time_point m_runStart;
+	std::chrono::microseconds m_total{};
+	std::thread::id m_mainThread;
+};
@@ -0,0 +1,221 @@
+#include "TexturePool.hpp"
+#include "GpuMemory.hpp"
+#include "Trace.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+TexturePool::TexturePool() :
+	m_queue(nullptr),
+	m_layerSize(0),
+	m_texture(nullptr, wgpuTextureRelease),
+	m_view(nullptr, wgpuTextureViewRelease),
+	m_materialBuffer(nullptr, wgpuBufferRelease),
+	m_useClock(0),
+	m_bytesUploaded(UploadBytesCounter())
+{
+}
+
+bool TexturePool::Initialize(WGPUDevice device, WGPUQueue queue, const DeviceLimits& limits, uint32_t layerSize, uint32_t layerCount, uint32_t maxMaterials)
+{
+	TRACE_SCOPE("TexturePoolInitialize");
+
+	Reset();
+	m_queue = queue;
+	m_layerSize = std::min(layerSize, limits.Limits().maxTextureDimension2D);
+	layerCount = std::min(layerCount, limits.Limits().maxTextureArrayLayers);
+
+	WGPUTextureDescriptor textureDesc{};
+	textureDesc.dimension = WGPUTextureDimension_2D;
+	textureDesc.size = {m_layerSize, m_layerSize, layerCount};
+	textureDesc.mipLevelCount = 1;
+	textureDesc.sampleCount = 1;
+	// Images are sRGB encoded, loads decode them to linear
+	textureDesc.format = WGPUTextureFormat_RGBA8UnormSrgb;
+	textureDesc.usage = WGPUTextureUsage_CopyDst | WGPUTextureUsage_TextureBinding;
+	m_texture = GpuMemory::Global().CreateTexture(device, textureDesc);
+	if (!m_texture)
+	{
+		std::cerr << "Could not create the texture pool" << std::endl;
+		return false;
+	}
+
+	// An array view even with a single layer, the shaders always index one
+	WGPUTextureViewDescriptor viewDesc{};
+	viewDesc.aspect = WGPUTextureAspect_All;
+	viewDesc.baseArrayLayer = 0;
+	viewDesc.arrayLayerCount = layerCount;
+	viewDesc.baseMipLevel = 0;
+	viewDesc.mipLevelCount = 1;
+	viewDesc.dimension = WGPUTextureViewDimension_2DArray;
+	viewDesc.format = textureDesc.format;
+	m_view = WgpuTextureViewPtr(wgpuTextureCreateView(m_texture.get(), &viewDesc), wgpuTextureViewRelease);
+
+	WGPUBufferDescriptor bufferDesc{};
+	bufferDesc.size = uint64_t{maxMaterials} * sizeof(Material);
+	bufferDesc.usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage;
+	bufferDesc.mappedAtCreation = false;
+	m_materialBuffer = GpuMemory::Global().CreateBuffer(device, bufferDesc);
+
+	m_layers.resize(layerCount);
+	m_slots.resize(maxMaterials);
+	m_materials.resize(maxMaterials, Material{{0, 0, 0, 0}, 0, {}});
+	return m_view && m_materialBuffer;
+}
+
+void TexturePool::Reset()
+{
+	m_materialBuffer.reset();
+	m_view.reset();
+	m_texture.reset();
+	m_layers.clear();
+	m_slots.clear();
+	m_materials.clear();
+}
+
+TexturePool::Handle TexturePool::Add(const Image& image, EvictCallback onEvict)
+{
+	TRACE_SCOPE("TexturePoolAdd");
+
+	if (image.width == 0 || image.height == 0 || image.width > m_layerSize || image.height > m_layerSize)
+	{
+		std::cerr << "A " << image.width << "x" << image.height << " texture does not fit the texture pool's "
+			<< m_layerSize << "x" << m_layerSize << " layers" << std::endl;
+		return kInvalidHandle;
+	}
+
+	auto free = std::find_if(m_slots.begin(), m_slots.end(), [](const Slot& slot) { return !slot.used; });
+	if (free == m_slots.end())
+	{
+		std::cerr << "The texture pool is out of materials" << std::endl;
+		return kInvalidHandle;
+	}
+	const Handle handle = static_cast<Handle>(free - m_slots.begin());
+
+	// Earlier layers first, so textures stay packed into as few layers as possible
+	uint32_t layer = 0, x = 0, y = 0;
+	while (layer < m_layers.size() && !Pack(m_layers[layer], image.width, image.height, x, y))
+		++layer;
+	while (layer == m_layers.size() && EvictLayer())
+	{
+		layer = 0;
+		while (layer < m_layers.size() && !Pack(m_layers[layer], image.width, image.height, x, y))
+			++layer;
+	}
+	if (layer == m_layers.size())
+	{
+		std::cerr << "The texture pool is full" << std::endl;
+		return kInvalidHandle;
+	}
+
+	Layer &poolLayer = m_layers[layer];
+	poolLayer.liveCount++;
+	poolLayer.streamableCount += onEvict ? 1 : 0;
+	poolLayer.lastUse = ++m_useClock;
+
+	Slot &slot = m_slots[handle];
+	slot.used = true;
+	slot.layer = layer;
+	slot.onEvict = std::move(onEvict);
+
+	WgpuTexelCopyTextureInfo destination{};
+	destination.texture = m_texture.get();
+	destination.mipLevel = 0;
+	destination.origin = {x, y, layer};
+	destination.aspect = WGPUTextureAspect_All;
+
+	WgpuTexelCopyBufferLayout source{};
+	source.offset = 0;
+	source.bytesPerRow = sizeof(image.pixels[0]) * image.width;
+	source.rowsPerImage = image.height;
+
+	const WGPUExtent3D extent = {image.width, image.height, 1};
+	wgpuQueueWriteTexture(m_queue, &destination, image.Data(), image.ByteSize(), &source, &extent);
+
+	const float scale = 1.0f / m_layerSize;
+	Material &material = m_materials[handle];
+	material.uvRect = {x * scale, y * scale, image.width * scale, image.height * scale};
+	material.layer = layer;
+	wgpuQueueWriteBuffer(m_queue, m_materialBuffer.get(), handle * sizeof(Material), &material, sizeof(Material));
+	m_bytesUploaded.Add(image.ByteSize() + sizeof(Material));
+
+	return handle;
+}
+
+void TexturePool::Remove(Handle handle)
+{
+	if (handle < m_slots.size() && m_slots[handle].used)
+		Release(handle);
+}
+
+void TexturePool::Touch(Handle handle)
+{
+	if (handle < m_slots.size() && m_slots[handle].used)
+		m_layers[m_slots[handle].layer].lastUse = ++m_useClock;
+}
+
+bool TexturePool::Pack(Layer& layer, uint32_t width, uint32_t height, uint32_t& x, uint32_t& y) const
+{
+	// The shortest shelf the texture fits on wastes the least height
+	Shelf *best = nullptr;
+	for (Shelf &shelf : layer.shelves)
+		if (shelf.height >= height && m_layerSize - shelf.x >= width && (!best || shelf.height < best->height))
+			best = &shelf;
+
+	if (!best)
+	{
+		if (m_layerSize - layer.top < height)
+			return false;
+		layer.shelves.push_back({layer.top, height, 0});
+		layer.top += height;
+		best = &layer.shelves.back();
+	}
+
+	x = best->x;
+	y = best->y;
+	best->x += width;
+	return true;
+}
+
+bool TexturePool::EvictLayer()
+{
+	auto victim = m_layers.end();
+	for (auto it = m_layers.begin(); it != m_layers.end(); ++it)
+		if (it->liveCount > 0 && it->streamableCount == it->liveCount && (victim == m_layers.end() || it->lastUse < victim->lastUse))
+			victim = it;
+	if (victim == m_layers.end())
+		return false;
+
+	TRACE_SCOPE("TexturePoolEvict");
+
+	// Callbacks run once the whole layer is free
+	const uint32_t layer = static_cast<uint32_t>(victim - m_layers.begin());
+	std::vector<EvictCallback> callbacks;
+	for (Handle handle = 0; handle < m_slots.size(); ++handle)
+	{
+		if (m_slots[handle].used && m_slots[handle].layer == layer)
+		{
+			callbacks.push_back(m_slots[handle].onEvict);
+			Release(handle);
+		}
+	}
+
+	for (EvictCallback &callback : callbacks)
+		callback();
+	return true;
+}
+
+void TexturePool::Release(Handle handle)
+{
+	Slot &slot = m_slots[handle];
+	Layer &layer = m_layers[slot.layer];
+	layer.liveCount--;
+	layer.streamableCount -= slot.onEvict ? 1 : 0;
+
+	// Shelves are never compacted, a layer is only reused once it is empty
+	if (layer.liveCount == 0)
+		layer = Layer{};
+
+	slot.used = false;
+	slot.onEvict = nullptr;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <webgpu/webgpu.h>
+#include "webgputypes.hpp"
+#include "DeviceLimits.hpp"
+#include "Image.hpp"
+#include "Math.hpp"
+#include "Metrics.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/**
+ * sRGB encoded RGBA8 textures packed into the layers of one texture_2d_array, so objects with
+ * different textures share a bind group and can be drawn together.
+ *
+ * Each layer is an atlas: textures are placed on shelves, rows as tall as their first texture,
+ * filled left to right. Each texture gets a handle, which is also its index in the material
+ * buffer, a storage buffer of Material the shaders look up by an instance's material ID.
+ *
+ * A layer is reused once all of its textures are removed. When no layer has room, the least
+ * recently used layer holding only streamable textures (added with an eviction callback) is
+ * evicted as a whole.
+ *
+ * Used from the main thread, like the rest of the device work.
+ */
+class TexturePool
+{
+public:
+	using Handle = uint32_t;
+	static constexpr Handle kInvalidHandle = ~0u;
+
+	// Called after the texture has been evicted, its handle is invalid from then on. Must not call back into the pool.
+	using EvictCallback = std::function<void()>;
+
+	struct Material
+	{
+		math::Vec4 uvRect;  // Offset and size of the texture in its layer, in layer UVs
+		uint32_t layer;
+		uint32_t padding[3];
+	};
+	static_assert(sizeof(Material) == 32);
+
+	TexturePool();
+
+	// The layer size and count are clamped to the device limits
+	bool Initialize(WGPUDevice device, WGPUQueue queue, const DeviceLimits& limits, uint32_t layerSize, uint32_t layerCount, uint32_t maxMaterials);
+	void Reset();
+
+	// Upload image into a free region, kInvalidHandle when it is larger than a layer or nothing fits
+	Handle Add(const Image& image, EvictCallback onEvict = nullptr);
+	void Remove(Handle handle);
+
+	// Mark the layer of a streamable texture as used, moving it to the back of the eviction order
+	void Touch(Handle handle);
+
+	const Material& GetMaterial(Handle handle) const { return m_materials[handle]; }
+
+	WGPUTextureView View() const { return m_view.get(); }
+	WGPUBuffer MaterialBuffer() const { return m_materialBuffer.get(); }
+	uint64_t MaterialBufferSize() const { return m_materials.size() * sizeof(Material); }
+	uint32_t LayerCount() const { return static_cast<uint32_t>(m_layers.size()); }
+	uint32_t LayerSize() const { return m_layerSize; }
+
+private:
+	struct Shelf
+	{
+		uint32_t y;
+		uint32_t height;
+		uint32_t x;  // Where the next texture goes
+	};
+
+	struct Layer
+	{
+		std::vector<Shelf> shelves;
+		uint32_t top = 0;  // Where the next shelf goes
+		uint32_t liveCount = 0;
+		uint32_t streamableCount = 0;
+		uint64_t lastUse = 0;
+	};
+
+	struct Slot
+	{
+		bool used = false;
+		uint32_t layer = 0;
+		EvictCallback onEvict;
+	};
+
+	bool Pack(Layer& layer, uint32_t width, uint32_t height, uint32_t& x, uint32_t& y) const;
+	bool EvictLayer();
+	void Release(Handle handle);
+
+	WGPUQueue m_queue;
+	uint32_t m_layerSize;
+	WgpuTexturePtr m_texture;
+	WgpuTextureViewPtr m_view;
+	WgpuBufferPtr m_materialBuffer;
+
+	std::vector<Layer> m_layers;
+	std::vector<Slot> m_slots;
+	std::vector<Material> m_materials;  // CPU copy of the material buffer
+	uint64_t m_useClock;
+
+	Counter& m_bytesUploaded;
+};
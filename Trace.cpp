@@ -0,0 +1,184 @@
+#include "Trace.hpp"
+
+#if defined(APP_TRACING_ENABLED)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_USE_RDTSC
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TRACE_USE_RDTSC
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Event
+{
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+};
+
+struct ThreadBuffer
+{
+	uint32_t tid;
+	const char* name = nullptr;
+	// Only contended while the trace is being written
+	std::mutex mutex;
+	std::vector<Event> events;
+};
+
+struct Registry
+{
+	std::mutex mutex;
+	std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+	uint32_t nextTid = 1;
+
+	// Reference points used to convert raw timestamps into microseconds
+	uint64_t startTicks = 0;
+	Clock::time_point startTime;
+};
+
+std::atomic<bool> g_enabled{false};
+
+Registry& GetRegistry()
+{
+	static Registry registry;
+	return registry;
+}
+
+ThreadBuffer& GetThreadBuffer()
+{
+	thread_local std::shared_ptr<ThreadBuffer> buffer;
+	if (!buffer)
+	{
+		buffer = std::make_shared<ThreadBuffer>();
+		Registry &registry = GetRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		buffer->tid = registry.nextTid++;
+		buffer->events.reserve(4096);
+		registry.buffers.push_back(buffer);
+	}
+	return *buffer;
+}
+
+void WriteEscaped(std::ostream& os, const char* str)
+{
+	for (; *str; ++str)
+	{
+		if (*str == '"' || *str == '\\')
+			os << '\\';
+		os << *str;
+	}
+}
+
+} // anonymous namespace
+
+namespace trace {
+
+uint64_t Now()
+{
+#if defined(TRACE_USE_RDTSC)
+	return __rdtsc();
+#else
+	return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+#endif
+}
+
+void Enable(bool enable)
+{
+	if (enable && !g_enabled)
+	{
+		Registry &registry = GetRegistry();
+		registry.startTicks = Now();
+		registry.startTime = Clock::now();
+	}
+	g_enabled = enable;
+}
+
+bool IsEnabled()
+{
+	return g_enabled.load(std::memory_order_relaxed);
+}
+
+void SetThreadName(const char* name)
+{
+	GetThreadBuffer().name = name;
+}
+
+void Record(const char* name, uint64_t start, uint64_t end)
+{
+	ThreadBuffer &buffer = GetThreadBuffer();
+	std::lock_guard<std::mutex> lock(buffer.mutex);
+	buffer.events.push_back({name, start, end});
+}
+
+bool WriteJson(const std::string& path)
+{
+	Registry &registry = GetRegistry();
+
+	// Calibrate the timestamp counter against the steady clock over the whole capture
+	const double elapsedUs = std::chrono::duration<double, std::micro>(Clock::now() - registry.startTime).count();
+	const uint64_t elapsedTicks = Now() - registry.startTicks;
+	const double ticksPerUs = (elapsedUs > 0 && elapsedTicks > 0) ? elapsedTicks / elapsedUs : 1000.0;
+
+	std::ofstream file(path);
+	if (!file)
+	{
+		std::cerr << "Could not open trace file " << path << std::endl;
+		return false;
+	}
+
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+
+	std::lock_guard<std::mutex> registryLock(registry.mutex);
+	for (const std::shared_ptr<ThreadBuffer> &buffer : registry.buffers)
+	{
+		std::lock_guard<std::mutex> lock(buffer->mutex);
+
+		if (buffer->name)
+		{
+			file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+				<< ",\"args\":{\"name\":\"";
+			WriteEscaped(file, buffer->name);
+			file << "\"}}";
+			first = false;
+		}
+
+		for (const Event &event : buffer->events)
+		{
+			// Events recorded before Enable() reset the reference point are dropped
+			if (event.start < registry.startTicks)
+				continue;
+
+			const double ts = (event.start - registry.startTicks) / ticksPerUs;
+			const double dur = (event.end - event.start) / ticksPerUs;
+			file << (first ? "" : ",") << "\n{\"name\":\"";
+			WriteEscaped(file, event.name);
+			file << "\",\"cat\":\"app\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+				<< ",\"ts\":" << ts << ",\"dur\":" << dur << "}";
+			first = false;
+		}
+	}
+	file << "\n]}\n";
+
+	std::cout << "Trace written to " << path << std::endl;
+	return true;
+}
+
+} // namespace trace
+
+#endif // APP_TRACING_ENABLED
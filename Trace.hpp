@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Scoped CPU trace events written as Chrome trace-event JSON (load in Perfetto or chrome://tracing).
+ *
+ * TRACE_SCOPE("name") records the duration of the enclosing scope on the calling thread. Events go
+ * to a thread local buffer so recording never contends with other threads. Names must be string
+ * literals (or otherwise outlive the trace) since only the pointer is stored.
+ *
+ * Scopes only exist when APP_TRACING_ENABLED is defined (debug builds, or the APP_TRACING CMake
+ * option), and even then only record once trace::Enable() has been called.
+ */
+#if defined(APP_TRACING_ENABLED)
+	#define TRACE_CONCAT_IMPL(a, b) a ## b
+	#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+	#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+	#define TRACE_THREAD_NAME(name) trace::SetThreadName(name)
+#else
+	#define TRACE_SCOPE(name) ((void)0)
+	#define TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+namespace trace {
+
+// Whether trace scopes were compiled in at all
+constexpr bool kCompiledIn =
+#if defined(APP_TRACING_ENABLED)
+	true;
+#else
+	false;
+#endif
+
+#if defined(APP_TRACING_ENABLED)
+
+void Enable(bool enable);
+bool IsEnabled();
+void SetThreadName(const char* name);
+
+// Write every recorded event. Threads must not be recording while this runs.
+bool WriteJson(const std::string& path);
+
+uint64_t Now();
+void Record(const char* name, uint64_t start, uint64_t end);
+
+class Scope
+{
+public:
+	explicit Scope(const char* name) :
+		m_name(name),
+		m_start(IsEnabled() ? Now() : 0)
+	{}
+
+	~Scope()
+	{
+		if (m_start)
+			Record(m_name, m_start, Now());
+	}
+
+	Scope(const Scope&) = delete;
+	Scope& operator=(const Scope&) = delete;
+
+private:
+	const char* m_name;
+	uint64_t m_start;
+};
+
+#else
+
+inline void Enable(bool) {}
+inline bool IsEnabled() { return false; }
+inline void SetThreadName(const char*) {}
+inline bool WriteJson(const std::string&) { return false; }
+
+#endif
+
+} // namespace trace
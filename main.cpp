@@ -1,20 +1,298 @@
 #include "App.hpp"
+#include "Benchmarks.hpp"
+#include "Compute.hpp"
+#include "ImageCompute.hpp"
+#include "MeshLod.hpp"
+#include "Metrics.hpp"
+#include "Parallel.hpp"
+#include "SpriteBatcher.hpp"
+#include "Trace.hpp"
 
 #if defined(WEBGPU_BACKEND_EMSCRIPTEN)
 #include <emscripten.h>
 #endif
 
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <string>
+#include <string_view>
 
-int main (int , char**)
+namespace {
+
+struct CommandLine
+{
+	App::Options app;
+	// CPU benchmarks run instead of the app when non zero
+	uint32_t mathBenchIterations = 0;
+	uint32_t sceneBenchObjects = 0;
+	uint32_t cullBenchObjects = 0;
+	uint32_t imageBenchSize = 0;
+	uint32_t jobBenchThreads = 0;
+	uint32_t spriteBenchQuads = 0;
+	uint32_t lodBenchObjects = 0;
+	uint32_t metricsBenchScrapes = 0;
+	// Headless compute jobs run instead of the app when set
+	std::string computeBatch;
+};
+
+void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [options]" << std::endl
+		<< "  --msaa <1|4>               Number of samples per pixel (default 1)" << std::endl
+		<< "  --bench [frames]           Render offscreen frames for each MSAA mode and report the cost" << std::endl
+		<< "  --trace <file>             Write a Chrome trace-event JSON of CPU scopes on exit" << std::endl
+		<< "  --metrics-file <file>      Periodically dump metrics in the Prometheus text format" << std::endl
+		<< "  --metrics-socket <path>    Serve metrics over HTTP on a local Unix socket" << std::endl
+		<< "  --metrics-interval <ms>    Period of the metrics file dump (default 5000)" << std::endl
+		<< "  --gpu-budget <MiB>         GPU memory budget, streamable resources are evicted to stay within it" << std::endl
+		<< "  --adapter <name>           Adapter to use: a power preference, candidate index or part of its name" << std::endl
+		<< "  --hdr                      Render to a half float target, tone mapped and graded through a 3D LUT" << std::endl
+		<< "  --dynamic-resolution [fps] Scale the scene's resolution to hold a frame rate (default 60)" << std::endl
+		<< "  --min-scale <percent>      Lowest dynamic resolution scale (default 50)" << std::endl
+		<< "  --max-scale <percent>      Highest dynamic resolution scale (default 100)" << std::endl
+		<< "  --scale-band <percent>     Frame time deviation from the target the scale ignores (default 10)" << std::endl
+		<< "  --occlusion-culling        Skip objects occlusion queries found hidden behind others" << std::endl
+		<< "  --lod-error <pixels>       Screen error a mesh's level of detail may show, 0 for full detail (default 1)" << std::endl
+		<< "  --bench-math [runs]        Check and time the math backends against the scalar reference" << std::endl
+		<< "  --bench-scene [objects]    Time hierarchy updates of a random scene (default 1000000 objects)" << std::endl
+		<< "  --bench-cull [objects]     Check and time BVH frustum culling of a random scene (default 1000000 objects)" << std::endl
+		<< "  --bench-image [size]       Check and time the image filters on the CPU and GPU up to size^2 pixels (default 2048)" << std::endl
+		<< "  --bench-jobs [threads]     Time the job system with 1 up to the given threads (default one per core)" << std::endl
+		<< "  --bench-sprites [quads]    Check and time the sprite batcher drawing quads per frame (default 1000000)" << std::endl
+		<< "  --bench-lod [objects]      Check mesh levels of detail and time scenes of up to objects with and without them (default 16384)" << std::endl
+		<< "  --bench-metrics [scrapes]  Check the metrics file and socket exports and time scrapes socket requests (default 1000)" << std::endl
+		<< "  --compute-batch <jobs>     Run the compute shader jobs listed in a file on a headless device" << std::endl;
+}
+
+bool ParseUnsigned(const char* str, uint32_t& value)
 {
-	App app;
+	// strtoull would skip whitespace and take a sign, wrapping "-1" around to the largest value
+	if (!std::isdigit(static_cast<unsigned char>(str[0])))
+		return false;
+
+	char* end = nullptr;
+	errno = 0;
+	const unsigned long long parsed = std::strtoull(str, &end, 10);
+	if (*end != '\0' || errno == ERANGE || parsed > UINT32_MAX)
+		return false;
+
+	value = static_cast<uint32_t>(parsed);
+	return true;
+}
+
+bool ParseOptions(int argc, char** argv, CommandLine& commandLine)
+{
+	App::Options &options = commandLine.app;
+	for (int i = 1; i < argc; ++i)
+	{
+		const std::string_view arg = argv[i];
+		if (arg == "--msaa" && i + 1 < argc)
+		{
+			if (!ParseUnsigned(argv[++i], options.sampleCount) || (options.sampleCount != 1 && options.sampleCount != 4))
+			{
+				std::cerr << "MSAA sample count must be 1 or 4" << std::endl;
+				return false;
+			}
+		}
+		else if (arg == "--bench")
+		{
+			options.benchFrames = 500;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], options.benchFrames))
+				++i;
+		}
+		else if (arg == "--trace" && i + 1 < argc)
+		{
+			options.tracePath = argv[++i];
+			if (!trace::kCompiledIn)
+				std::cerr << "Tracing is not compiled into this build. Configure with -DAPP_TRACING=ON" << std::endl;
+		}
+		else if (arg == "--metrics-file" && i + 1 < argc)
+			options.metricsFile = argv[++i];
+		else if (arg == "--metrics-socket" && i + 1 < argc)
+			options.metricsSocket = argv[++i];
+		else if (arg == "--metrics-interval" && i + 1 < argc)
+		{
+			uint32_t interval = 0;
+			if (!ParseUnsigned(argv[++i], interval) || interval == 0)
+			{
+				std::cerr << "Metrics interval must be a positive number of milliseconds" << std::endl;
+				return false;
+			}
+			options.metricsInterval = std::chrono::milliseconds(interval);
+		}
+		else if (arg == "--gpu-budget" && i + 1 < argc)
+		{
+			uint32_t budgetMiB = 0;
+			if (!ParseUnsigned(argv[++i], budgetMiB))
+			{
+				std::cerr << "GPU budget must be a number of MiB" << std::endl;
+				return false;
+			}
+			options.gpuBudget = uint64_t{budgetMiB} * 1024 * 1024;
+		}
+		else if (arg == "--adapter" && i + 1 < argc)
+		{
+			options.adapter = argv[++i];
+		}
+		else if (arg == "--hdr")
+			options.hdr = true;
+		else if (arg == "--occlusion-culling")
+			options.occlusionCulling = true;
+		else if (arg == "--lod-error" && i + 1 < argc)
+		{
+			uint32_t pixels = 0;
+			if (!ParseUnsigned(argv[++i], pixels))
+			{
+				std::cerr << "The level of detail error must be a whole number of pixels" << std::endl;
+				return false;
+			}
+			options.lodErrorPixels = static_cast<float>(pixels);
+		}
+		else if (arg == "--dynamic-resolution")
+		{
+			options.dynamicResolution = true;
+			uint32_t fps = 0;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], fps))
+			{
+				++i;
+				if (fps == 0)
+				{
+					std::cerr << "Target frame rate must be positive" << std::endl;
+					return false;
+				}
+				options.resolution.targetMs = 1000.0 / fps;
+			}
+		}
+		else if ((arg == "--min-scale" || arg == "--max-scale" || arg == "--scale-band") && i + 1 < argc)
+		{
+			uint32_t percent = 0;
+			if (!ParseUnsigned(argv[++i], percent) || percent > 100 || (percent == 0 && arg != "--scale-band"))
+			{
+				std::cerr << "Scale percentages must be between 1 and 100" << std::endl;
+				return false;
+			}
+			if (arg == "--min-scale")
+				options.resolution.minScale = percent / 100.0f;
+			else if (arg == "--max-scale")
+				options.resolution.maxScale = percent / 100.0f;
+			else
+				options.resolution.hysteresis = percent / 100.0;
+		}
+		else if (arg == "--bench-math")
+		{
+			commandLine.mathBenchIterations = 20;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.mathBenchIterations))
+				++i;
+		}
+		else if (arg == "--bench-scene")
+		{
+			commandLine.sceneBenchObjects = 1000000;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.sceneBenchObjects))
+				++i;
+		}
+		else if (arg == "--bench-cull")
+		{
+			commandLine.cullBenchObjects = 1000000;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.cullBenchObjects))
+				++i;
+		}
+		else if (arg == "--bench-image")
+		{
+			commandLine.imageBenchSize = 2048;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.imageBenchSize))
+				++i;
+		}
+		else if (arg == "--bench-jobs")
+		{
+			commandLine.jobBenchThreads = JobSystem::DefaultWorkerCount() + 1;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.jobBenchThreads))
+				++i;
+		}
+		else if (arg == "--bench-sprites")
+		{
+			commandLine.spriteBenchQuads = 1000000;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.spriteBenchQuads))
+				++i;
+		}
+		else if (arg == "--bench-lod")
+		{
+			commandLine.lodBenchObjects = 16384;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.lodBenchObjects))
+				++i;
+		}
+		else if (arg == "--bench-metrics")
+		{
+			commandLine.metricsBenchScrapes = 1000;
+			if (i + 1 < argc && ParseUnsigned(argv[i + 1], commandLine.metricsBenchScrapes))
+				++i;
+		}
+		else if (arg == "--compute-batch" && i + 1 < argc)
+			commandLine.computeBatch = argv[++i];
+		else
+		{
+			std::cerr << "Unknown argument: " << arg << std::endl;
+			return false;
+		}
+	}
+
+	// Checked once both are known, either may come first
+	if (options.resolution.minScale > options.resolution.maxScale)
+	{
+		std::cerr << "--min-scale must not be above --max-scale" << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+} // anonymous namespace
+
+int main (int argc, char** argv)
+{
+	CommandLine commandLine;
+	if (!ParseOptions(argc, argv, commandLine))
+	{
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	if (commandLine.mathBenchIterations > 0)
+		return RunMathBenchmark(commandLine.mathBenchIterations) ? 0 : 1;
+	if (commandLine.sceneBenchObjects > 0)
+		return RunSceneBenchmark(commandLine.sceneBenchObjects) ? 0 : 1;
+	if (commandLine.cullBenchObjects > 0)
+		return RunCullBenchmark(commandLine.cullBenchObjects) ? 0 : 1;
+	if (commandLine.jobBenchThreads > 0)
+		return RunJobBenchmark(commandLine.jobBenchThreads) ? 0 : 1;
+	if (commandLine.imageBenchSize > 0)
+		return RunImageBenchmark(commandLine.imageBenchSize) ? 0 : 1;
+	if (commandLine.spriteBenchQuads > 0)
+		return RunSpriteBenchmark(commandLine.spriteBenchQuads) ? 0 : 1;
+	if (commandLine.lodBenchObjects > 0)
+		return RunLodBenchmark(commandLine.lodBenchObjects) ? 0 : 1;
+	if (commandLine.metricsBenchScrapes > 0)
+		return RunMetricsBenchmark(commandLine.metricsBenchScrapes) ? 0 : 1;
+	if (!commandLine.computeBatch.empty())
+		return RunComputeBatch(commandLine.computeBatch) ? 0 : 1;
+
+	const App::Options &options = commandLine.app;
+	App app(options);
 	if (!app.IsInitialized())
 	{
 		std::cerr << "App could not be Initialized. Exiting..." << std::endl;
 		return 1;
 	}
 
+	if (options.benchFrames > 0)
+	{
+		app.RunBenchmark();
+		app.Terminate();
+		return 0;
+	}
+
 #if defined(WEBGPU_BACKEND_EMSCRIPTEN)
 	emscripten_set_main_loop_arg([](void* arg) {
 			App* app = static_cast<App*>(arg);
@@ -1,10 +1,6 @@
 #include "webgpu-utils.hpp"
 #include <webgpu/webgpu.h>
 
-#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
-#include <emscripten.h>
-#endif
-
 #include <cassert>
 #include <iostream>
 
@@ -22,138 +18,51 @@ std::ostream& operator<<(std::ostream& os, WGPUStringView strView)
 
 namespace{
 
-void printLimits(WGPULimits limits)
+void printLimits(WGPULimits limits, std::ostream& out)
 {
-	std::cout << "Max vertex attributes: " << limits.maxVertexAttributes << std::endl;
-	std::cout << "Max compute invocations per workgroup: " << limits.maxComputeInvocationsPerWorkgroup << std::endl;
+	out << "Max vertex attributes: " << limits.maxVertexAttributes << std::endl;
+	out << "Max compute invocations per workgroup: " << limits.maxComputeInvocationsPerWorkgroup << std::endl;
 #if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	std::cout << "Max inter stage shader components: " << limits.maxInterStageShaderComponents  << std::endl;
+	out << "Max inter stage shader components: " << limits.maxInterStageShaderComponents  << std::endl;
 #endif
-	std::cout << std::endl;
+	out << std::endl;
 }
 
 } // anonymous namespace
 
 namespace wgpuUtils{
 
-WGPUAdapter requestAdapter(WGPUInstance instance, const WGPURequestAdapterOptions* options)
-{
-	/**
-	 * Holds local information shared with the onAdapterRequestEnded callback
-	 */
-	struct UserData
-	{
-		WGPUAdapter adapter = nullptr;
-		bool requestEnded = false;	// TODO: Don't need this if using new WGPUFutureWaitInfo
-	} userData;
-
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	auto onAdapterRequestEnded = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, WGPUStringView message, void* pUserData1, [[maybe_unused]]void* pUserData2)
+WGPUStringView label(const char* text)
+{
+	return {text, WGPU_STRLEN};
+}
 #else
-	auto onAdapterRequestEnded = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, const char* message, void* pUserData1)
-#endif
-	{
-		UserData& userData = *reinterpret_cast<UserData*>(pUserData1);
-		if (status == WGPURequestAdapterStatus_Success)
-			userData.adapter = adapter;
-		else
-			std::cerr << "Could not retrieve WebGPU adapter: " << message << std::endl;
-		userData.requestEnded = true;
-	};
-
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPURequestAdapterCallbackInfo callbackInfo;
-	callbackInfo.callback = onAdapterRequestEnded;
-	callbackInfo.mode = WGPUCallbackMode_WaitAnyOnly;
-	callbackInfo.nextInChain = nullptr;
-	callbackInfo.userdata1 = static_cast<void*>(&userData);
-	callbackInfo.userdata2 = nullptr;
-
-	[[maybe_unused]]WGPUFuture future = wgpuInstanceRequestAdapter(instance, options, callbackInfo);
-
-	#if !defined(WEBGPU_FUTURE_UNIMPLEMENTED)
-		WGPUFutureWaitInfo futureWait;
-		futureWait.future = future;
-		futureWait.completed = false;
-		while(wgpuInstanceWaitAny(instance, 1, &futureWait, 0) != WGPUWaitStatus_Success)
-		{
-		#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
-			emscripten_sleep(100);
-		#endif  // WEBGPU_BACKEND_EMSCRIPTEN
-		}
-	#endif  // WEBGPU_FUTURE_UNIMPLEMENTED
-#else  // EMSCRIPTEN_WEBGPU_DEPRECATED
-	wgpuInstanceRequestAdapter(instance, options, onAdapterRequestEnded, static_cast<void*>(&userData));
-	while (!userData.requestEnded)
-		emscripten_sleep(100);
-#endif  // EMSCRIPTEN_WEBGPU_DEPRECATED
-
-	// The callback is called synchronously so the following assert should never fire.
-	assert(userData.requestEnded);
-
-	return userData.adapter;
+const char* label(const char* text)
+{
+	return text;
 }
+#endif
 
-WGPUDevice requestDevice([[maybe_unused]]WGPUInstance instance, WGPUAdapter adapter, const WGPUDeviceDescriptor* descriptor)
+WGPUShaderModule createShaderModule(WGPUDevice device, const char* wgsl)
 {
-	/**
-	 * Holds local information shared with the onDeviceRequest callback
-	 */
-	struct UserData
-	{
-		WGPUDevice device = nullptr;
-		bool requestEnded = false; // TODO: Is this still required with WGPUFuture?
-	} userData;
-
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	auto onDeviceRequestEnded = [](WGPURequestDeviceStatus status, WGPUDevice device, WGPUStringView message, void* pUserData1, [[maybe_unused]]void* pUserData2)
+	WGPUShaderSourceWGSL shaderSourceDesc{};
+	shaderSourceDesc.chain.sType = WGPUSType_ShaderSourceWGSL;
+	shaderSourceDesc.code = WGPUStringView{wgsl, WGPU_STRLEN};
 #else
-	auto onDeviceRequestEnded = [](WGPURequestDeviceStatus status, WGPUDevice device, const char* message, void* pUserData1)
+	WGPUShaderModuleWGSLDescriptor shaderSourceDesc{};
+	shaderSourceDesc.chain.sType = WGPUSType_ShaderModuleWGSLDescriptor;
+	shaderSourceDesc.code = wgsl;
 #endif
-	{
-		UserData& userData = *reinterpret_cast<UserData*>(pUserData1);
-		if (status == WGPURequestDeviceStatus_Success)
-			userData.device = device;
-		else
-			std::cerr << "Could not retrieve WebGPU device: " << message << std::endl;
-		userData.requestEnded = true;
-	};
+	shaderSourceDesc.chain.next = nullptr;
 
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
-	WGPURequestDeviceCallbackInfo callbackInfo;
-	callbackInfo.callback = onDeviceRequestEnded;
-	callbackInfo.mode = WGPUCallbackMode_WaitAnyOnly;
-	callbackInfo.nextInChain = nullptr;
-	callbackInfo.userdata1 = static_cast<void*>(&userData);
-	callbackInfo.userdata2 = nullptr;
-
-	[[maybe_unused]]WGPUFuture future = wgpuAdapterRequestDevice(adapter, descriptor, callbackInfo);
-
-	#if !defined(WEBGPU_FUTURE_UNIMPLEMENTED)
-		WGPUFutureWaitInfo futureWait;
-		futureWait.future = future;
-		futureWait.completed = false;
-
-		while(wgpuInstanceWaitAny(instance, 1, &futureWait, 0) != WGPUWaitStatus_Success)
-		{
-		#if defined(WEBGPU_BACKEND_EMSCRIPTEN)
-			// TODO: Does emscripten still need this. Will timeout work on all platforms?
-			emscripten_sleep(100);
-		#endif  // WEBGPU_BACKEND_EMSCRIPTEN
-		}
-	#endif // WEBGPU_FUTURE_UNIMPLEMENTED
-#else  // EMSCRIPTEN_WEBGPU_DEPRECATED
-	wgpuAdapterRequestDevice(adapter, descriptor, onDeviceRequestEnded, static_cast<void*>(&userData));
-	while (!userData.requestEnded)
-		emscripten_sleep(100);
-#endif // EMSCRIPTEN_WEBGPU_DEPRECATED
-	// The callback is called synchronously so the following assert should never fire.
-	assert(userData.requestEnded);
-
-	return userData.device;
+	WGPUShaderModuleDescriptor shaderDesc{};
+	shaderDesc.nextInChain = &shaderSourceDesc.chain;
+	return wgpuDeviceCreateShaderModule(device, &shaderDesc);
 }
 
-void printAdapterFeatures(WGPUAdapter adapter)
+void printAdapterFeatures(WGPUAdapter adapter, std::ostream& out)
 {
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
 	WGPUSupportedFeatures features{};
@@ -165,37 +74,37 @@ void printAdapterFeatures(WGPUAdapter adapter)
 	wgpuAdapterEnumerateFeatures(adapter, features.data());
 #endif
 
-	std::cout << "Adapter features:" << std::endl;
-	std::cout << std::hex;
+	out << "Adapter features:" << std::endl;
+	out << std::hex;
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
 	for (size_t i = 0; i < features.featureCount; ++i)
-		std::cout << "0x" << features.features[i] << std::endl;
+		out << "0x" << features.features[i] << std::endl;
 #else
 	for (auto f : features)
-		std::cout << "0x" << f << std::endl;
+		out << "0x" << f << std::endl;
 #endif
-	std::cout << std::dec << std::endl;
+	out << std::dec << std::endl;
 }
 
-void printAdapterProperties(WGPUAdapter adapter)
+void printAdapterProperties(WGPUAdapter adapter, std::ostream& out)
 {
 	WGPUAdapterInfo info{};
 	wgpuAdapterGetInfo(adapter, &info);
 
-	std::cout << "Adapter info: " << std::endl;
-	std::cout << "vendorID: "     << info.vendorID << std::endl;
-	std::cout << "vendor: "       << info.vendor << std::endl;
-	std::cout << "architecture: " << info.architecture << std::endl;
-	std::cout << "deviceID: "     << info.deviceID << std::endl;
-	std::cout << "device: "       << info.device << std::endl;
-	std::cout << "description: "  << info.description << std::endl;
-	std::cout << std::hex;
-	std::cout << "adapterType: 0x" << info.adapterType << std::endl;
-	std::cout << "backendType: 0x" << info.backendType << std::endl;
-	std::cout << std::dec << std::endl;;
+	out << "Adapter info: " << std::endl;
+	out << "vendorID: "     << info.vendorID << std::endl;
+	out << "vendor: "       << info.vendor << std::endl;
+	out << "architecture: " << info.architecture << std::endl;
+	out << "deviceID: "     << info.deviceID << std::endl;
+	out << "device: "       << info.device << std::endl;
+	out << "description: "  << info.description << std::endl;
+	out << std::hex;
+	out << "adapterType: 0x" << info.adapterType << std::endl;
+	out << "backendType: 0x" << info.backendType << std::endl;
+	out << std::dec << std::endl;
 }
 
-void printAdapterLimits(WGPUAdapter adapter)
+void printAdapterLimits(WGPUAdapter adapter, std::ostream& out)
 {
 #if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
 	WGPUSupportedLimits supportedLimits{};
@@ -206,11 +115,11 @@ void printAdapterLimits(WGPUAdapter adapter)
 	wgpuAdapterGetLimits(adapter, &limits);
 #endif
 
-	std::cout << "Adapter limits: " << std::endl;
-	printLimits(limits);
+	out << "Adapter limits: " << std::endl;
+	printLimits(limits, out);
 }
 
-void printDeviceLimits(WGPUDevice device)
+void printDeviceLimits(WGPUDevice device, std::ostream& out)
 {
 #if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
 	WGPUSupportedLimits supportedLimits{};
@@ -221,8 +130,26 @@ void printDeviceLimits(WGPUDevice device)
 	wgpuDeviceGetLimits(device, &limits);
 #endif
 
-	std::cout << "Device limits: " << std::endl;
-	printLimits(limits);
+	out << "Device limits: " << std::endl;
+	printLimits(limits, out);
+}
+
+WGPUTextureFormat srgbFormat(WGPUTextureFormat format)
+{
+	switch (format)
+	{
+		case WGPUTextureFormat_RGBA8Unorm:
+			return WGPUTextureFormat_RGBA8UnormSrgb;
+		case WGPUTextureFormat_BGRA8Unorm:
+			return WGPUTextureFormat_BGRA8UnormSrgb;
+		default:
+			return format;
+	}
+}
+
+bool isSrgbFormat(WGPUTextureFormat format)
+{
+	return format == WGPUTextureFormat_RGBA8UnormSrgb || format == WGPUTextureFormat_BGRA8UnormSrgb;
 }
 
 void configureSurface(WGPUSurface surface, WGPUDevice device, WGPUAdapter adapter, int width, int height)
@@ -235,8 +162,10 @@ void configureSurface(WGPUSurface surface, WGPUDevice device, WGPUAdapter adapte
 #else
 	surfaceConfig.format = wgpuSurfaceGetPreferredFormat(surface, adapter);
 #endif // EMSCRIPTEN_WEBGPU_DEPRECATED
-	surfaceConfig.viewFormatCount = 0;
-	surfaceConfig.viewFormats = nullptr;
+	// Rendering through an sRGB view lets the hardware encode the linear output
+	const WGPUTextureFormat viewFormat = srgbFormat(surfaceConfig.format);
+	surfaceConfig.viewFormatCount = viewFormat != surfaceConfig.format ? 1 : 0;
+	surfaceConfig.viewFormats = &viewFormat;
 	surfaceConfig.usage = WGPUTextureUsage_RenderAttachment;
 	surfaceConfig.device = device;
 	surfaceConfig.presentMode = WGPUPresentMode_Fifo;
@@ -2,9 +2,7 @@
 
 #include <webgpu/webgpu.h>
 
-#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
 #include <iostream>
-#endif
 
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
 std::ostream& operator<<(std::ostream& os, WGPUStringView strView);
@@ -17,19 +15,32 @@ std::ostream& operator<<(std::ostream& os, WGPUStringView strView);
 
 namespace wgpuUtils{
 
-WGPUAdapter requestAdapter(WGPUInstance instance, const WGPURequestAdapterOptions* options);
-WGPUDevice requestDevice(WGPUInstance instance, WGPUAdapter adapter, const WGPUDeviceDescriptor* descriptor);
+// A descriptor label or entry point name from a null terminated string
+#if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+WGPUStringView label(const char* text);
+#else
+const char* label(const char* text);
+#endif
+
+// Compile null terminated WGSL source, the caller owns the returned module
+WGPUShaderModule createShaderModule(WGPUDevice device, const char* wgsl);
+
+// The sRGB counterpart of an 8 bit format, other formats are returned as they are
+WGPUTextureFormat srgbFormat(WGPUTextureFormat format);
+// Whether the format encodes to sRGB on writes and decodes on reads
+bool isSrgbFormat(WGPUTextureFormat format);
 
+// Also allows views in the sRGB counterpart of the preferred format
 void configureSurface(WGPUSurface surface, WGPUDevice device, WGPUAdapter adapter, int width, int height);
 
 #if !defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
 	WGPUTextureFormat getPreferredFormat(WGPUAdapter adapter, WGPUSurface surface);
 #endif
 
-void printAdapterFeatures(WGPUAdapter adapter);
-void printAdapterProperties(WGPUAdapter adapter);
-void printAdapterLimits(WGPUAdapter adapter);
-void printDeviceLimits(WGPUDevice device);
+void printAdapterFeatures(WGPUAdapter adapter, std::ostream& out = std::cout);
+void printAdapterProperties(WGPUAdapter adapter, std::ostream& out = std::cout);
+void printAdapterLimits(WGPUAdapter adapter, std::ostream& out = std::cout);
+void printDeviceLimits(WGPUDevice device, std::ostream& out = std::cout);
 
 template <class T>
 T getDefault();
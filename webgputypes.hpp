@@ -16,9 +16,11 @@ WGPU_PTR_ALIAS(Adapter)
 WGPU_PTR_ALIAS(Device)
 WGPU_PTR_ALIAS(Surface)
 WGPU_PTR_ALIAS(RenderPipeline)
+WGPU_PTR_ALIAS(ComputePipeline)
 WGPU_PTR_ALIAS(Queue)
 WGPU_PTR_ALIAS(ShaderModule)
 WGPU_PTR_ALIAS(RenderPassEncoder)
+WGPU_PTR_ALIAS(ComputePassEncoder)
 WGPU_PTR_ALIAS(CommandEncoder)
 WGPU_PTR_ALIAS(CommandBuffer)
 WGPU_PTR_ALIAS(Texture)
@@ -27,5 +29,25 @@ WGPU_PTR_ALIAS(Buffer)
 WGPU_PTR_ALIAS(PipelineLayout)
 WGPU_PTR_ALIAS(BindGroupLayout)
 WGPU_PTR_ALIAS(BindGroup)
+WGPU_PTR_ALIAS(QuerySet)
+WGPU_PTR_ALIAS(Sampler)
 
 #undef WGPU_PTR_ALIAS
+
+// Texel copy descriptors were renamed in the latest webgpu.h
+#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+using WgpuTexelCopyTextureInfo = WGPUImageCopyTexture;
+using WgpuTexelCopyBufferInfo = WGPUImageCopyBuffer;
+using WgpuTexelCopyBufferLayout = WGPUTextureDataLayout;
+#else
+using WgpuTexelCopyTextureInfo = WGPUTexelCopyTextureInfo;
+using WgpuTexelCopyBufferInfo = WGPUTexelCopyBufferInfo;
+using WgpuTexelCopyBufferLayout = WGPUTexelCopyBufferLayout;
+#endif
+
+// Pass timestamp writes were split per pass type before the latest webgpu.h
+#if defined(EMSCRIPTEN_WEBGPU_DEPRECATED)
+using WgpuPassTimestampWrites = WGPURenderPassTimestampWrites;
+#else
+using WgpuPassTimestampWrites = WGPUPassTimestampWrites;
+#endif